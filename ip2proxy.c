@@ -1,5 +1,12 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
 #include <IP2Proxy.h>
 
 static void print_usage(const char *argv0)
@@ -9,9 +16,39 @@ static void print_usage(const char *argv0)
 "	-b, --bin-version\n"
 "		Print the IP2Proxy BIN database version.\n"
 "\n"
+"	-c, --export\n"
+"	Write the fewest CIDR prefixes covering the proxies of the BIN data file and exit.\n"
+"	Supported format:\n"
+"		- nftables (sets to include in a table)\n"
+"		- ipset (ipset restore input)\n"
+"		- binary (prefix list for BPF LPM tries)\n"
+"	Filters:\n"
+"		--proxy-type VPN,TOR,...\n"
+"		--usage-type DCH,CDN,...\n"
+"		--threat SPAM,BOTNET,...\n"
+"		--fraud-score [MINIMUM SCORE]\n"
+"		--set-name [SET NAME] (default ip2proxy)\n"
+"\n"
 "	-d, --data-file\n"
 "		Specify the path of IP2Proxy BIN data file.\n"
 "\n"
+"	--diff [NEW IP2PROXY BIN DATA PATH]\n"
+"	Print the address ranges whose fields differ between the BIN data file and a newer one\n"
+"	and exit, one row per changed field with the old and new values. Use --field to select\n"
+"	the fields to compare.\n"
+"\n"
+"	--make-patch [NEW IP2PROXY BIN DATA PATH]\n"
+"	Write the ranges changed between the BIN data file and a newer one with their new strings\n"
+"	to the output file and exit. The patch is much smaller than the newer BIN data file.\n"
+"\n"
+"	--apply-patch [PATCH PATH]\n"
+"	Write the BIN data file updated by a patch from --make-patch to the output file and exit.\n"
+"	The output file is replaced at once, a process opening it meanwhile reads either version.\n"
+"\n"
+"	--compress\n"
+"	Write the BIN data file compressed in 64 KB frames to the output file and exit. The\n"
+"	compressed file opens like the BIN data file with -d, in any lookup mode.\n"
+"\n"
 "	-e, --field\n"
 "		Output the field data.\n"
 "		Field name includes:\n"
@@ -84,12 +121,42 @@ static void print_usage(const char *argv0)
 "		- csv (default)\n"
 "		- tab\n"
 "		- xml\n"
+"		- ndjson (one JSON object per row)\n"
+"		- columns (columnar binary, a dictionary per field, see the manual page)\n"
+"\n"
+"	--dedup [MB]\n"
+"	Look up every distinct address of the input file once and repeat its row for the other lines,\n"
+"	keeping the rows in at most the given memory. The share of lines answered this way is reported.\n"
+"\n"
+"	--enrich\n"
+"	Write every line of the input file with the fields appended, the address is taken from the line.\n"
+"		--ip-column [N] (field of the address, from 1, default 1)\n"
+"		--delimiter [CHARACTER] (between the fields of a line and the appended ones, default \\t)\n"
+"		--ip-key [NAME] (the lines are JSON objects, the fields are added as members)\n"
+"\n"
+"	-g, --negative-filter\n"
+"	Answer the addresses of networks without any proxy without a search, faster when most\n"
+"	addresses are not proxies. The share of lookups answered this way is reported at the end.\n"
+"\n"
+"	--group-by [FIELD,FIELD,...]\n"
+"	Count the lookups of the input file by the values of the given fields and print only the\n"
+"	count of every group, largest first. Same field names as --field, without ip.\n"
+"\n"
+"	--count\n"
+"	Print the count of every group, the default with --group-by. Alone, count the input lines.\n"
+"\n"
+"	--top [K]\n"
+"	Print only the K largest groups, counted with a sketch of bounded memory. The error column\n"
+"	is the most their count can exceed the true count by.\n"
 "\n"
 "	-h, -?, --help\n"
 "	Display the help.\n"
 "\n"
 "	-i, --input-file\n"
-"	Specify an input file of IP address list, one IP per row.\n"
+"	Specify an input file of IP address list, one IP per row, - reads the standard input.\n"
+"\n"
+"	-m, --memory\n"
+"	Load the BIN data file into memory and report the load time, throughput and CRC32C.\n"
 "\n"
 "	-n, --no-heading\n"
 "	Suppress the heading display.\n"
@@ -97,6 +164,24 @@ static void print_usage(const char *argv0)
 "	-o, --output-file\n"
 "	Specify an output file to store the lookup results.\n"
 "\n"
+"	-t, --threads\n"
+"	Number of threads looking up the input file (default 1), the rows keep the input order.\n"
+"	The BIN data file is loaded into memory when more than one thread is used.\n"
+"\n"
+"	-s, --save-index\n"
+"	Write the sidecar index file of the BIN data file to the given path and exit.\n"
+"\n"
+"	-x, --index\n"
+"	Speed up the queries with a sidecar index file written by --save-index.\n"
+"\n"
+"	--sorted\n"
+"	The addresses of the input file are in ascending order, the lookups walk the database forward\n"
+"	from the previous row instead of searching it. Unsorted lines still get the right row, slower.\n"
+"\n"
+"	--sort [MB]\n"
+"	Sort the input file by address in runs of at most the given memory before the lookups, as with\n"
+"	--sorted. The rows come out in address order, invalid addresses first.\n"
+"\n"
 "	-p, --ip\n"
 "	Specify an IP address query (Supported IPv4 and IPv6 address).\n"
 "\n"
@@ -128,6 +213,11 @@ static void print_header(FILE *fout, const char *field, const char *format)
 		return;
 	}
 
+	// Every NDJSON row names its fields
+	if (strcmp(format, "NDJSON") == 0) {
+		return;
+	}
+
 #define WRITE_HEADER(field_name)  \
 		if (strncmp(start, field_name, end - start) == 0) { \
 			if (strcmp(format, "CSV") == 0) { \
@@ -176,218 +266,2679 @@ static void print_header(FILE *fout, const char *field, const char *format)
 }
 
 
-static void print_record(FILE *fout, const char *field, IP2ProxyRecord *record, const char *format, const char *ip)
+/* Fields of a view by their --field name, in the order of the output */
+static const struct {
+	const char *name;
+	uint32_t mask;
+} view_fields[] = {
+	{ "is_proxy", ISPROXY },
+	{ "proxy_type", PROXYTYPE },
+	{ "country_code", COUNTRYSHORT },
+	{ "country_name", COUNTRYLONG },
+	{ "region_name", REGION },
+	{ "city_name", CITY },
+	{ "isp", ISP },
+	{ "domain", DOMAINNAME },
+	{ "usage_type", USAGETYPE },
+	{ "as_number", ASN },
+	{ "as_name", AS },
+	{ "last_seen", LASTSEEN },
+	{ "threat", THREAT },
+	{ "provider", PROVIDER },
+	{ "fraud_score", FRAUDSCORE }
+};
+
+#define VIEW_FIELDS (sizeof(view_fields) / sizeof(view_fields[0]))
+
+typedef struct {
+	FILE *fout;
+	const char *format;
+	uint32_t mode;
+} diff_output;
+
+/* Mode of the fields listed in --field */
+static uint32_t field_mode(const char *field)
 {
 	const char *start = field;
-	const char *end = strchr(start, ',');
-	int first = 1;
+	uint32_t mode = 0;
+	size_t length;
+	size_t i;
 
-	if (strcmp(format, "XML") == 0) {
-		fprintf(fout, "<row>");
+	while (*start != '\0') {
+		length = strcspn(start, ",");
+
+		for (i = 0; i < VIEW_FIELDS; i++) {
+			if (strlen(view_fields[i].name) == length && strncmp(start, view_fields[i].name, length) == 0) {
+				mode |= view_fields[i].mask;
+			}
+		}
+
+		start += length;
+		start += (*start == ',') ? 1 : 0;
 	}
 
-#define WRITE_FIELD(field_name, field)  \
-		if (strncmp(start, field_name, end - start) == 0) { \
-			const char *value = field; \
-			if (strcmp(value, NOT_SUPPORTED) == 0) { \
-				value = "NOT SUPPORTED"; \
-			} \
-			if (strcmp(format, "XML") == 0) { \
-				fprintf(fout, "<%s>%s</%s>", field_name, value, field_name); \
-			} else if (strcmp(format, "CSV") == 0) { \
-				if (!first) { \
-					fprintf(fout, ","); \
-				} \
-				fprintf(fout, "\"%s\"", value); \
-			} else if (strcmp(format, "TAB") == 0) { \
-				if (!first) { \
-					fprintf(fout, "\t"); \
-				} \
-				fprintf(fout, "%s", value); \
-			} \
-			first = 0; \
+	return mode;
+}
+
+static const IP2ProxyField *view_value(const IP2ProxyView *view, uint32_t mask, IP2ProxyField *is_proxy, char *buffer)
+{
+	switch (mask) {
+		case ISPROXY:
+			is_proxy->length = (uint32_t) sprintf(buffer, "%d", view->is_proxy);
+			is_proxy->data = buffer;
+			return is_proxy;
+		case PROXYTYPE: return &view->proxy_type;
+		case COUNTRYSHORT: return &view->country_short;
+		case COUNTRYLONG: return &view->country_long;
+		case REGION: return &view->region;
+		case CITY: return &view->city;
+		case ISP: return &view->isp;
+		case DOMAINNAME: return &view->domain;
+		case USAGETYPE: return &view->usage_type;
+		case ASN: return &view->asn;
+		case AS: return &view->as_;
+		case LASTSEEN: return &view->last_seen;
+		case THREAT: return &view->threat;
+		case PROVIDER: return &view->provider;
+		default: return &view->fraud_score;
+	}
+}
+
+/* A value in the syntax of the format, CSV doubles its quotes and XML and NDJSON escape their markup */
+static void print_value(FILE *fout, const char *format, const IP2ProxyField *value)
+{
+	int json = (strcmp(format, "NDJSON") == 0);
+	const char *special = (strcmp(format, "CSV") == 0) ? "\"" : (strcmp(format, "XML") == 0) ? "&<>" : json ? "\"\\" : "";
+	size_t start = 0;
+	size_t i;
+	unsigned char c;
+
+	for (i = 0; i < value->length; i++) {
+		c = (unsigned char) value->data[i];
+
+		// Most values have none of these
+		if (c >= 0x20 && c != '"' && c != '&' && c != '<' && c != '>' && c != '\\') {
+			continue;
 		}
-#define WRITE_FIELDF(field_name, field)  \
-		if (strncmp(start, field_name, end - start) == 0) { \
-			if (strcmp(format, "XML") == 0) { \
-				fprintf(fout, "<%s>%f</%s>", field_name, field, field_name); \
-			} else if (strcmp(format, "CSV") == 0) { \
-				if (!first) { \
-					fprintf(fout, ","); \
-				} \
-				fprintf(fout, "\"%f\"", field); \
-			} else if (strcmp(format, "TAB") == 0) { \
-				if (!first) { \
-					fprintf(fout, "\t"); \
-				} \
-				fprintf(fout, "%f", field); \
-			} \
-			first = 0; \
+
+		if (!(json && c < 0x20) && (c == '\0' || strchr(special, c) == NULL)) {
+			continue;
 		}
 
+		fwrite(value->data + start, 1, i - start, fout);
+		start = i + 1;
 
-	for (;;) {
-		if (end == NULL) {
-			end = start + strlen(start);
+		if (json) {
+			fprintf(fout, (c < 0x20) ? "\\u%04x" : "\\%c", c);
+		} else if (c == '"') {
+			fputs("\"\"", fout);
+		} else {
+			fputs((c == '&') ? "&amp;" : (c == '<') ? "&lt;" : "&gt;", fout);
 		}
+	}
 
-		WRITE_FIELD("ip", ip);
-		WRITE_FIELD("is_proxy", record->is_proxy);
-		WRITE_FIELD("proxy_type", record->proxy_type);
-		WRITE_FIELD("country_code", record->country_short);
-		WRITE_FIELD("country_name", record->country_long);
-		WRITE_FIELD("region_name", record->region);
-		WRITE_FIELD("city_name", record->city);
-		WRITE_FIELD("isp", record->isp);
-		WRITE_FIELD("domain", record->domain);
-		WRITE_FIELD("usage_type", record->usage_type);
-		WRITE_FIELD("as_number", record->asn);
-		WRITE_FIELD("as_name", record->as_);
-		WRITE_FIELD("last_seen", record->last_seen);
-		WRITE_FIELD("threat", record->threat);
-		WRITE_FIELD("provider", record->provider);
-		WRITE_FIELD("fraud_score", record->fraud_score);
+	fwrite(value->data + start, 1, value->length - start, fout);
+}
 
-		if (*end == ',') {
-			start = end + 1;
-			end = strchr(start, ',');
+/* One row for every field which changed in the range */
+static int32_t print_change(const char *from, const char *to, const IP2ProxyView *old_view, const IP2ProxyView *new_view, void *user_data)
+{
+	diff_output *output = (diff_output *) user_data;
+	IP2ProxyField old_is_proxy;
+	IP2ProxyField new_is_proxy;
+	char old_buffer[16];
+	char new_buffer[16];
+	const IP2ProxyField *old_value;
+	const IP2ProxyField *new_value;
+	size_t i;
+
+	for (i = 0; i < VIEW_FIELDS; i++) {
+		if ((output->mode & view_fields[i].mask) == 0) {
+			continue;
+		}
+
+		old_value = view_value(old_view, view_fields[i].mask, &old_is_proxy, old_buffer);
+		new_value = view_value(new_view, view_fields[i].mask, &new_is_proxy, new_buffer);
+
+		if (old_value->length == new_value->length && memcmp(old_value->data, new_value->data, old_value->length) == 0) {
+			continue;
+		}
+
+		if (strcmp(output->format, "XML") == 0) {
+			fprintf(output->fout, "<row><from>%s</from><to>%s</to><field>%s</field><old>", from, to, view_fields[i].name);
+			print_value(output->fout, output->format, old_value);
+			fprintf(output->fout, "</old><new>");
+			print_value(output->fout, output->format, new_value);
+			fprintf(output->fout, "</new></row>\n");
+		} else if (strcmp(output->format, "CSV") == 0) {
+			fprintf(output->fout, "\"%s\",\"%s\",\"%s\",\"", from, to, view_fields[i].name);
+			print_value(output->fout, output->format, old_value);
+			fprintf(output->fout, "\",\"");
+			print_value(output->fout, output->format, new_value);
+			fprintf(output->fout, "\"\n");
 		} else {
-			break;
+			fprintf(output->fout, "%s\t%s\t%s\t", from, to, view_fields[i].name);
+			print_value(output->fout, output->format, old_value);
+			fprintf(output->fout, "\t");
+			print_value(output->fout, output->format, new_value);
+			fprintf(output->fout, "\n");
 		}
 	}
-	if (strcmp(format, "XML") == 0) {
-		fprintf(fout, "</row>");
+
+	return 0;
+}
+
+/* Fields which IP2Proxy_is_proxy returns as IP2Proxy_get_all does */
+static int is_proxy_fields(const char *field)
+{
+	const char *start = field;
+	size_t length;
+
+	while (*start != '\0') {
+		length = strcspn(start, ",");
+
+		if (!(length == 2 && strncmp(start, "ip", 2) == 0) && !(length == 8 && strncmp(start, "is_proxy", 8) == 0) && !(length == 12 && strncmp(start, "country_code", 12) == 0)) {
+			return 0;
+		}
+
+		start += length;
+		start += (*start == ',') ? 1 : 0;
 	}
-	fprintf(fout, "\n");
+
+	return 1;
 }
 
-int main(int argc, char *argv[])
+#define INPUT_CHUNK (4 * 1024 * 1024)
+
+/*
+ * Input file of -i, handed out in chunks which end at a line break. A regular
+ * file is mapped and the chunks point into the mapping. Anything else, such
+ * as a pipe, is read into a new buffer for every chunk and the partial last
+ * line is carried over to the next one.
+ */
+typedef struct {
+	int fd;
+	char *map;
+	size_t size;
+	size_t position;
+	char *carry;
+	size_t carry_length;
+	int eof;
+	uint64_t sequence;
+	pthread_mutex_t lock;
+} input_reader;
+
+/* Lines of the input, buffer is only set for a chunk which was read */
+typedef struct {
+	const char *data;
+	size_t length;
+	char *buffer;
+	uint64_t sequence;
+} input_chunk;
+
+/* Read the input from an open file, input_close closes it */
+static void input_attach(input_reader *reader, int fd)
 {
-	int i;
-	char *data_file = NULL;
+	struct stat status;
 
-	const char *input_file = NULL;
-	const char *output_file = NULL;
-	const char *ip = NULL;
-	const char *format = "CSV";
-	const char *field = NULL;
-	int no_heading = 0;
-	bool print_bin_version = false;
-	IP2Proxy *obj = NULL;
-	IP2ProxyRecord *record = NULL;
-	FILE *fout = stdout;
+	memset(reader, 0, sizeof(input_reader));
+	reader->fd = fd;
+	pthread_mutex_init(&reader->lock, NULL);
 
-	field = "ip,is_proxy,proxy_type,country_code,country_name,region_name,city_name,isp,domain,as_number,as_name,last_seen,threat,provider,fraud_score";
+	if (fstat(reader->fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+		reader->map = (char *) mmap(NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
 
-	for (i = 1; i < argc; i++) {
-		const char *argvi = argv[i];
+		if (reader->map == MAP_FAILED) {
+			reader->map = NULL;
+		} else {
+			reader->size = (size_t) status.st_size;
+			madvise(reader->map, reader->size, MADV_SEQUENTIAL);
+		}
+	}
+}
 
-		if (strcmp(argvi, "-d") == 0 || strcmp(argvi, "--data-file") == 0) {
-			if (i + 1 < argc) {
-				data_file = argv[++i];
-			}
-		} else if (strcmp(argvi, "-i") == 0 || strcmp(argvi, "--input-file") == 0) {
-			if (i + 1 < argc) {
-				input_file = argv[++i];
-			}
-		} else if (strcmp(argvi, "-b") == 0 || strcmp(argvi, "--bin-version") == 0) {
-			print_bin_version = true;
-		} else if (strcmp(argvi, "-p") == 0 || strcmp(argvi, "--ip") == 0) {
-			if (i + 1 < argc) {
-				ip = argv[++i];
+/* Open the input file, - for the standard input */
+static int input_open(input_reader *reader, const char *path)
+{
+	int fd;
+
+	if ((fd = (strcmp(path, "-") == 0) ? STDIN_FILENO : open(path, O_RDONLY)) < 0) {
+		return -1;
+	}
+
+	input_attach(reader, fd);
+
+	return 0;
+}
+
+static void input_close(input_reader *reader)
+{
+	if (reader->map != NULL) {
+		munmap(reader->map, reader->size);
+	}
+
+	if (reader->fd != STDIN_FILENO) {
+		close(reader->fd);
+	}
+
+	free(reader->carry);
+	pthread_mutex_destroy(&reader->lock);
+}
+
+/* Read the next chunk into a buffer, a line longer than a chunk makes the buffer grow */
+static int input_read(input_reader *reader, input_chunk *chunk)
+{
+	size_t capacity = INPUT_CHUNK + reader->carry_length;
+	size_t length = reader->carry_length;
+	size_t end = 0;
+	ssize_t got;
+	char *buffer;
+	char *grown;
+
+	if ((buffer = (char *) malloc(capacity)) == NULL) {
+		return -1;
+	}
+
+	if (reader->carry_length > 0) {
+		memcpy(buffer, reader->carry, reader->carry_length);
+	}
+
+	while (!reader->eof) {
+		if (length == capacity) {
+			for (end = length; end > reader->carry_length && buffer[end - 1] != '\n'; end--) {
 			}
-		} else if (strcmp(argvi, "-o") == 0 || strcmp(argvi, "--output-file") == 0) {
-			if (i + 1 < argc) {
-				output_file = argv[++i];
+
+			if (end > reader->carry_length) {
+				break;
 			}
-		} else if (strcmp(argvi, "-f") == 0 || strcmp(argvi, "--format") == 0) {
-			if (i + 1 < argc) {
-				format = argv[++i];
+
+			if ((grown = (char *) realloc(buffer, capacity * 2)) == NULL) {
+				free(buffer);
+				return -1;
 			}
-		} else if (strcmp(argvi, "-h") == 0 || strcmp(argvi, "-?") == 0 || strcmp(argvi, "--help") == 0) {
-			print_usage(argv[0]);
-			return 0;
-		} else if (strcmp(argvi, "-v") == 0 || strcmp(argvi, "--version") == 0) {
-			print_version();
-			return 0;
-		} else if (strcmp(argvi, "-e") == 0 || strcmp(argvi, "--field") == 0) {
-			if (i + 1 < argc) {
-				field = argv[++i];
+
+			buffer = grown;
+			capacity *= 2;
+		}
+
+		if ((got = read(reader->fd, buffer + length, capacity - length)) < 0) {
+			if (errno == EINTR) {
+				continue;
 			}
-		} else if (strcmp(argvi, "-n") == 0 || strcmp(argvi, "--no-heading") == 0) {
-			no_heading = 1;
+
+			free(buffer);
+			return -1;
 		}
+
+		length += (size_t) got;
+		reader->eof = (got == 0);
 	}
 
-	if (strcmp(format, "CSV") != 0 && strcmp(format, "XML") != 0 && strcmp(format, "TAB") != 0) {
-		fprintf(stderr, "Invalid format %s, supported formats: CSV, XML, TAB\n", format);
-		exit(-1);
+	// All of the last chunk, the lines of a full one
+	end = reader->eof ? length : end;
+	reader->carry_length = length - end;
+
+	if (reader->carry_length > 0) {
+		if ((grown = (char *) realloc(reader->carry, reader->carry_length)) == NULL) {
+			free(buffer);
+			return -1;
+		}
+
+		reader->carry = grown;
+		memcpy(reader->carry, buffer + end, reader->carry_length);
 	}
 
-	if (data_file == NULL) {
-		fprintf(stderr, "Datafile is absent\n");
-		exit(-1);
+	if (end == 0) {
+		free(buffer);
+		return 0;
 	}
 
-	obj = IP2Proxy_open((char *)data_file);
-	if (obj == NULL) {
-		fprintf(stderr, "Failed to open BIN database %s\n", data_file);
-		exit(-1);
+	chunk->buffer = buffer;
+	chunk->data = buffer;
+	chunk->length = end;
+
+	return 1;
+}
+
+/* Take the next chunk, 0 at the end of the input and -1 if it cannot be read */
+static int input_next(input_reader *reader, input_chunk *chunk)
+{
+	const char *line_end;
+	size_t end;
+	int result = 1;
+
+	chunk->buffer = NULL;
+	chunk->length = 0;
+
+	pthread_mutex_lock(&reader->lock);
+
+	if (reader->map != NULL) {
+		if (reader->position == reader->size) {
+			result = 0;
+		} else {
+			end = (reader->size - reader->position > INPUT_CHUNK) ? reader->position + INPUT_CHUNK : reader->size;
+			line_end = (const char *) memchr(reader->map + end, '\n', reader->size - end);
+			end = (line_end != NULL) ? (size_t) (line_end - reader->map) + 1 : reader->size;
+
+			chunk->data = reader->map + reader->position;
+			chunk->length = end - reader->position;
+			reader->position = end;
+		}
+	} else if (reader->eof && reader->carry_length == 0) {
+		result = 0;
+	} else {
+		result = input_read(reader, chunk);
 	}
 
-	if (print_bin_version) {
-		printf("BIN version %s\n", IP2Proxy_get_package_version(obj));
-		exit(0);
+	chunk->sequence = reader->sequence;
+	reader->sequence += (result == 1) ? 1 : 0;
+
+	pthread_mutex_unlock(&reader->lock);
+
+	return result;
+}
+
+static int is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+/* Next line of a chunk without the surrounding whitespace, or only without its line break, NULL at the end */
+static const char *input_line(const char **cursor, const char *end, size_t *length, int trim)
+{
+	const char *start;
+	const char *line_end;
+
+	if (*cursor >= end) {
+		return NULL;
 	}
 
-	if (output_file != NULL) {
-		fout = fopen(output_file, "w");
-		if (fout == NULL) {
-			fprintf(stderr, "Failed to open output file %s\n", output_file);
-			exit(-1);
-		}
+	start = *cursor;
+	line_end = (const char *) memchr(start, '\n', (size_t) (end - start));
+	line_end = (line_end != NULL) ? line_end : end;
+	*cursor = (line_end < end) ? line_end + 1 : end;
+
+	while (trim && start < line_end && is_blank(*start)) {
+		start++;
 	}
 
-	if (!no_heading) {
-		print_header(fout, field, format);
+	while (line_end > start && (trim ? is_blank(line_end[-1]) : (line_end[-1] == '\r'))) {
+		line_end--;
 	}
 
-	if (ip != NULL) {
-		record = IP2Proxy_get_all(obj, (char *)ip);
-		print_record(fout, field, record, format, ip);
-		IP2Proxy_free_record(record);
+	*length = (size_t) (line_end - start);
+
+	return start;
+}
+
+/* Lookups sharing the values of the --group-by fields */
+typedef struct {
+	char *key; /* values separated by tabs */
+	size_t length;
+	uint64_t hash;
+	uint64_t count;
+	uint64_t error; /* most the count can exceed the true count by */
+	size_t slot;
+} group;
+
+/*
+ * Groups by key. Without a limit every group is counted exactly. With one the
+ * table is a Space-Saving sketch of the limit largest groups: a new group
+ * takes the place of the smallest one and inherits its count as error, so
+ * the groups are kept as a min-heap on their counts.
+ */
+typedef struct {
+	group *groups;
+	size_t count;
+	size_t capacity;
+	size_t *slots; /* index of a group plus one, 0 for an empty slot */
+	size_t slot_count;
+	size_t limit;
+} group_table;
+
+static uint64_t group_hash(const char *key, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t) key[i]) * 1099511628211ULL;
 	}
 
-	if (input_file != NULL) {
-		char *line = NULL;
-		size_t n;
-		ssize_t len;
-		FILE *fin = fopen(input_file, "r");
+	return hash;
+}
 
-		if (fin == NULL) {
-			fprintf(stderr, "Failed to open input file %s\n", input_file);
-			exit(-1);
+/* Slot of a key, empty when the key has no group */
+static size_t group_slot(const group_table *table, const char *key, size_t length, uint64_t hash)
+{
+	size_t mask = table->slot_count - 1;
+	size_t slot = (size_t) hash & mask;
+	const group *g;
+
+	while (table->slots[slot] != 0) {
+		g = &table->groups[table->slots[slot] - 1];
+
+		if (g->hash == hash && g->length == length && memcmp(g->key, key, length) == 0) {
+			break;
 		}
 
-		while ((len = getline(&line, &n, fin)) != -1) {
-			if (line[len - 1] == '\n') {
-				line[--len] = '\0';
-			}
-			if (line[len - 1] == '\r') {
-				line[--len] = '\0';
-			}
-			record = IP2Proxy_get_all(obj, line);
-			print_record(fout, field, record, format, line);
-			IP2Proxy_free_record(record);
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+static group *group_find(const group_table *table, const char *key, size_t length)
+{
+	size_t slot;
+
+	if (table->slot_count == 0) {
+		return NULL;
+	}
+
+	slot = group_slot(table, key, length, group_hash(key, length));
+
+	return (table->slots[slot] != 0) ? &table->groups[table->slots[slot] - 1] : NULL;
+}
+
+/* Empty the slot of a group, the following slots move back so no search stops early */
+static void group_unlink(group_table *table, size_t slot)
+{
+	size_t mask = table->slot_count - 1;
+	size_t next = slot;
+	size_t home;
+
+	table->slots[slot] = 0;
+
+	for (;;) {
+		next = (next + 1) & mask;
+
+		if (table->slots[next] == 0) {
+			return;
 		}
 
-		fclose(fin);
+		home = (size_t) table->groups[table->slots[next] - 1].hash & mask;
+
+		if (((next - home) & mask) >= ((next - slot) & mask)) {
+			table->slots[slot] = table->slots[next];
+			table->groups[table->slots[slot] - 1].slot = slot;
+			table->slots[next] = 0;
+			slot = next;
+		}
 	}
+}
+
+static void group_swap(group_table *table, size_t i, size_t j)
+{
+	group g = table->groups[i];
+
+	table->groups[i] = table->groups[j];
+	table->groups[j] = g;
+	table->slots[table->groups[i].slot] = i + 1;
+	table->slots[table->groups[j].slot] = j + 1;
+}
+
+static void group_sift_up(group_table *table, size_t i)
+{
+	while (i > 0 && table->groups[(i - 1) / 2].count > table->groups[i].count) {
+		group_swap(table, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void group_sift_down(group_table *table, size_t i)
+{
+	size_t smallest;
+
+	for (;;) {
+		smallest = i;
+
+		if (2 * i + 1 < table->count && table->groups[2 * i + 1].count < table->groups[smallest].count) {
+			smallest = 2 * i + 1;
+		}
+
+		if (2 * i + 2 < table->count && table->groups[2 * i + 2].count < table->groups[smallest].count) {
+			smallest = 2 * i + 2;
+		}
+
+		if (smallest == i) {
+			return;
+		}
+
+		group_swap(table, i, smallest);
+		i = smallest;
+	}
+}
+
+/* Double the groups and slots, the slots are kept at most half full */
+static int group_grow(group_table *table)
+{
+	size_t capacity = (table->capacity == 0) ? 64 : table->capacity * 2;
+	group *groups = (group *) realloc(table->groups, capacity * sizeof(group));
+	size_t *slots;
+	size_t i;
+
+	if (groups == NULL) {
+		return -1;
+	}
+
+	table->groups = groups;
+	table->capacity = capacity;
+
+	if ((slots = (size_t *) calloc(capacity * 2, sizeof(size_t))) == NULL) {
+		return -1;
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->slot_count = capacity * 2;
+
+	for (i = 0; i < table->count; i++) {
+		groups[i].slot = group_slot(table, groups[i].key, groups[i].length, groups[i].hash);
+		slots[groups[i].slot] = i + 1;
+	}
+
+	return 0;
+}
+
+/* Add count lookups to the group of key */
+static int group_add(group_table *table, const char *key, size_t length, uint64_t count, uint64_t error)
+{
+	uint64_t hash = group_hash(key, length);
+	size_t slot;
+	group *g;
+
+	if (table->slot_count > 0 && table->slots[slot = group_slot(table, key, length, hash)] != 0) {
+		g = &table->groups[table->slots[slot] - 1];
+		g->count += count;
+		g->error += error;
+
+		if (table->limit > 0) {
+			group_sift_down(table, (size_t) (g - table->groups));
+		}
+
+		return 0;
+	}
+
+	// The smallest group gives its place to the new one
+	if (table->limit > 0 && table->count == table->limit) {
+		char *evicted;
+
+		g = &table->groups[0];
+
+		if ((evicted = (char *) realloc(g->key, length + 1)) == NULL) {
+			return -1;
+		}
+
+		group_unlink(table, g->slot);
+		memcpy(evicted, key, length);
+		evicted[length] = '\0';
+		g->key = evicted;
+		g->length = length;
+		g->hash = hash;
+		g->error = g->count + error;
+		g->count += count;
+		g->slot = group_slot(table, key, length, hash);
+		table->slots[g->slot] = 1;
+		group_sift_down(table, 0);
+		return 0;
+	}
+
+	if (table->count == table->capacity && group_grow(table) != 0) {
+		return -1;
+	}
+
+	g = &table->groups[table->count];
+
+	if ((g->key = (char *) malloc(length + 1)) == NULL) {
+		return -1;
+	}
+
+	memcpy(g->key, key, length);
+	g->key[length] = '\0';
+	g->length = length;
+	g->hash = hash;
+	g->count = count;
+	g->error = error;
+	g->slot = group_slot(table, key, length, hash);
+	table->slots[g->slot] = ++table->count;
+
+	if (table->limit > 0) {
+		group_sift_up(table, table->count - 1);
+	}
+
+	return 0;
+}
+
+static void group_free(group_table *table)
+{
+	size_t i;
+
+	for (i = 0; i < table->count; i++) {
+		free(table->groups[i].key);
+	}
+
+	free(table->groups);
+	free(table->slots);
+}
+
+/* Larger counts first, then by key so the output does not depend on the threads */
+static int group_compare(const void *a, const void *b)
+{
+	const group *x = (const group *) a;
+	const group *y = (const group *) b;
+
+	if (x->count != y->count) {
+		return (x->count > y->count) ? -1 : 1;
+	}
+
+	return strcmp(x->key, y->key);
+}
+
+/*
+ * Sum the tables of the threads into merged. A group missing from a full
+ * sketch may have been counted up to the smallest count of that sketch, which
+ * is added to its count and error so counts stay upper bounds.
+ */
+static int group_merge(group_table *merged, group_table **tables, int table_count)
+{
+	group *g;
+	size_t i;
+	int t;
+
+	for (t = 0; t < table_count; t++) {
+		for (i = 0; i < tables[t]->count; i++) {
+			g = &tables[t]->groups[i];
+
+			if (group_add(merged, g->key, g->length, g->count, g->error) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	for (t = 0; t < table_count; t++) {
+		if (tables[t]->limit == 0 || tables[t]->count < tables[t]->limit) {
+			continue;
+		}
+
+		for (i = 0; i < merged->count; i++) {
+			g = &merged->groups[i];
+
+			if (group_find(tables[t], g->key, g->length) == NULL) {
+				g->count += tables[t]->groups[0].count;
+				g->error += tables[t]->groups[0].count;
+			}
+		}
+	}
+
+	qsort(merged->groups, merged->count, sizeof(group), group_compare);
+
+	return 0;
+}
+
+/* Lines of the input file looked up and counted by one thread */
+typedef struct {
+	pthread_t thread;
+	IP2Proxy *obj;
+	input_reader *reader;
+	const size_t *fields; /* indexes in view_fields */
+	size_t field_count;
+	uint32_t mode;
+	group_table table;
+	int failed;
+} group_worker;
+
+/* Values of the --group-by fields separated by tabs */
+static size_t group_key(const IP2ProxyView *view, const size_t *fields, size_t field_count, char *key)
+{
+	IP2ProxyField is_proxy;
+	const IP2ProxyField *value;
+	char buffer[16];
+	size_t length = 0;
+	size_t i;
+
+	for (i = 0; i < field_count; i++) {
+		value = view_value(view, view_fields[fields[i]].mask, &is_proxy, buffer);
+
+		if (i > 0) {
+			key[length++] = '\t';
+		}
+
+		memcpy(key + length, value->data, value->length);
+		length += value->length;
+	}
+
+	return length;
+}
+
+static void *group_lines(void *argument)
+{
+	group_worker *worker = (group_worker *) argument;
+	char key[VIEW_FIELDS * 256];
+	IP2ProxyView view;
+	input_chunk chunk;
+	const char *cursor;
+	const char *ip;
+	size_t length;
+	int result;
+
+	while (!worker->failed && (result = input_next(worker->reader, &chunk)) == 1) {
+		cursor = chunk.data;
+
+		while (!worker->failed && (ip = input_line(&cursor, chunk.data + chunk.length, &length, 1)) != NULL) {
+			if (worker->field_count > 0) {
+				IP2Proxy_get_view_n(worker->obj, ip, length, worker->mode, &view);
+			}
+
+			if (group_add(&worker->table, key, group_key(&view, worker->fields, worker->field_count, key), 1, 0) != 0) {
+				worker->failed = 1;
+			}
+		}
+
+		free(chunk.buffer);
+	}
+
+	worker->failed |= (result < 0);
+
+	return NULL;
+}
+
+/* Indexes in view_fields of the fields listed in --group-by, -1 for an unknown field */
+static int group_fields(const char *list, size_t *fields)
+{
+	const char *start = list;
+	size_t length;
+	size_t i;
+	int count = 0;
+
+	while (*start != '\0') {
+		length = strcspn(start, ",");
+
+		for (i = 0; i < VIEW_FIELDS; i++) {
+			if (strlen(view_fields[i].name) == length && strncmp(start, view_fields[i].name, length) == 0) {
+				break;
+			}
+		}
+
+		if (i == VIEW_FIELDS || count == (int) VIEW_FIELDS) {
+			return -1;
+		}
+
+		fields[count++] = i;
+		start += length;
+		start += (*start == ',') ? 1 : 0;
+	}
+
+	return count;
+}
+
+/* One row per group with its field values and count, the error of the count as well for --top */
+static void print_groups(FILE *fout, const char *format, int no_heading, const size_t *fields, size_t field_count, const group_table *table, size_t rows, int top)
+{
+	const char *names[VIEW_FIELDS + 2];
+	char count[2][24];
+	IP2ProxyField values[VIEW_FIELDS + 2];
+	size_t columns = field_count + (top ? 2 : 1);
+	int csv = (strcmp(format, "CSV") == 0);
+	const char *start;
+	size_t length;
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < field_count; i++) {
+		names[i] = view_fields[fields[i]].name;
+	}
+
+	names[field_count] = "count";
+	names[field_count + 1] = "error";
 
 	if (!no_heading) {
+		if (strcmp(format, "XML") == 0) {
+			fprintf(fout, "<xml>\n");
+		} else {
+			for (i = 0; i < columns; i++) {
+				fprintf(fout, csv ? "%s\"%s\"" : "%s%s", (i > 0) ? (csv ? "," : "\t") : "", names[i]);
+			}
+
+			fprintf(fout, "\n");
+		}
+	}
+
+	for (j = 0; j < rows && j < table->count; j++) {
+		start = table->groups[j].key;
+
+		for (i = 0; i < field_count; i++) {
+			length = strcspn(start, "\t");
+			values[i].data = start;
+			values[i].length = (uint32_t) length;
+			start += length + ((start[length] == '\t') ? 1 : 0);
+		}
+
+		values[field_count].data = count[0];
+		values[field_count].length = (uint32_t) sprintf(count[0], "%llu", (unsigned long long) table->groups[j].count);
+		values[field_count + 1].data = count[1];
+		values[field_count + 1].length = (uint32_t) sprintf(count[1], "%llu", (unsigned long long) table->groups[j].error);
+
+		if (strcmp(format, "XML") == 0) {
+			fprintf(fout, "<row>");
+
+			for (i = 0; i < columns; i++) {
+				fprintf(fout, "<%s>", names[i]);
+				print_value(fout, format, &values[i]);
+				fprintf(fout, "</%s>", names[i]);
+			}
+
+			fprintf(fout, "</row>\n");
+		} else {
+			for (i = 0; i < columns; i++) {
+				fprintf(fout, "%s%s", (i > 0) ? (csv ? "," : "\t") : "", csv ? "\"" : "");
+				print_value(fout, format, &values[i]);
+				fprintf(fout, "%s", csv ? "\"" : "");
+			}
+
+			fprintf(fout, "\n");
+		}
+	}
+
+	if (!no_heading && strcmp(format, "XML") == 0) {
+		fprintf(fout, "</xml>\n");
+	}
+}
+
+/* Count the lookups of the input file by group with threads workers, then print the groups */
+static int group_input(IP2Proxy *obj, input_reader *reader, FILE *fout, const char *format, int no_heading, const char *group_by, long top, int threads)
+{
+	size_t fields[VIEW_FIELDS];
+	group_worker *workers;
+	group_table **tables;
+	group_table merged;
+	uint32_t mode = 0;
+	int field_count;
+	int failed = 0;
+	int i;
+
+	if ((field_count = group_fields(group_by, fields)) < 0) {
+		fprintf(stderr, "Invalid field in --group-by %s\n", group_by);
+		return -1;
+	}
+
+	for (i = 0; i < field_count; i++) {
+		mode |= view_fields[fields[i]].mask;
+	}
+
+	workers = (group_worker *) calloc((size_t) threads, sizeof(group_worker));
+	tables = (group_table **) calloc((size_t) threads, sizeof(group_table *));
+
+	if (workers == NULL || tables == NULL) {
+		free(workers);
+		free(tables);
+		return -1;
+	}
+
+	for (i = 0; i < threads; i++) {
+		workers[i].obj = obj;
+		workers[i].reader = reader;
+		workers[i].fields = fields;
+		workers[i].field_count = (size_t) field_count;
+		workers[i].mode = mode;
+		tables[i] = &workers[i].table;
+
+		// A sketch several times larger than the groups printed keeps their counts close
+		workers[i].table.limit = (top > 0) ? (size_t) top * 16 : 0;
+	}
+
+	if (threads == 1) {
+		group_lines(&workers[0]);
+	} else {
+		for (i = 0; i < threads; i++) {
+			if (pthread_create(&workers[i].thread, NULL, group_lines, &workers[i]) != 0) {
+				threads = i;
+				failed = 1;
+				break;
+			}
+		}
+
+		for (i = 0; i < threads; i++) {
+			pthread_join(workers[i].thread, NULL);
+		}
+	}
+
+	memset(&merged, 0, sizeof(merged));
+
+	for (i = 0; i < threads; i++) {
+		failed |= workers[i].failed;
+	}
+
+	if (!failed && group_merge(&merged, tables, threads) == 0) {
+		print_groups(fout, format, no_heading, fields, (size_t) field_count, &merged, (top > 0) ? (size_t) top : merged.count, top > 0);
+	} else {
+		failed = 1;
+	}
+
+	group_free(&merged);
+
+	for (i = 0; i < threads; i++) {
+		group_free(&workers[i].table);
+	}
+
+	free(workers);
+	free(tables);
+
+	return failed ? -1 : 0;
+}
+
+static void print_view(FILE *fout, const char *field, const IP2ProxyView *view, const char *format, const char *ip, size_t ip_length)
+{
+	const char *start = field;
+	const char *end = strchr(start, ',');
+	IP2ProxyField ip_value;
+	IP2ProxyField is_proxy;
+	char buffer[16];
+	int first = 1;
+
+	ip_value.data = ip;
+	ip_value.length = (uint32_t) ip_length;
+
+	if (strcmp(format, "XML") == 0) {
+		fprintf(fout, "<row>");
+	}
+
+#define WRITE_FIELD(field_name, field)  \
+		if (strncmp(start, field_name, end - start) == 0) { \
+			const IP2ProxyField *value = field; \
+			if (strcmp(format, "XML") == 0) { \
+				fprintf(fout, "<%s>", field_name); \
+				print_value(fout, format, value); \
+				fprintf(fout, "</%s>", field_name); \
+			} else if (strcmp(format, "CSV") == 0) { \
+				if (!first) { \
+					fprintf(fout, ","); \
+				} \
+				fputc('"', fout); \
+				print_value(fout, format, value); \
+				fputc('"', fout); \
+			} else if (strcmp(format, "TAB") == 0) { \
+				if (!first) { \
+					fprintf(fout, "\t"); \
+				} \
+				print_value(fout, format, value); \
+			} else if (strcmp(format, "NDJSON") == 0) { \
+				fprintf(fout, "%s\"%s\":", first ? "{" : ",", field_name); \
+				if (strcmp(field_name, "is_proxy") == 0) { \
+					fprintf(fout, "%d", view->is_proxy); \
+				} else { \
+					fputc('"', fout); \
+					print_value(fout, format, value); \
+					fputc('"', fout); \
+				} \
+			} \
+			first = 0; \
+		}
+
+	for (;;) {
+		if (end == NULL) {
+			end = start + strlen(start);
+		}
+
+		WRITE_FIELD("ip", &ip_value);
+		WRITE_FIELD("is_proxy", view_value(view, ISPROXY, &is_proxy, buffer));
+		WRITE_FIELD("proxy_type", &view->proxy_type);
+		WRITE_FIELD("country_code", &view->country_short);
+		WRITE_FIELD("country_name", &view->country_long);
+		WRITE_FIELD("region_name", &view->region);
+		WRITE_FIELD("city_name", &view->city);
+		WRITE_FIELD("isp", &view->isp);
+		WRITE_FIELD("domain", &view->domain);
+		WRITE_FIELD("usage_type", &view->usage_type);
+		WRITE_FIELD("as_number", &view->asn);
+		WRITE_FIELD("as_name", &view->as_);
+		WRITE_FIELD("last_seen", &view->last_seen);
+		WRITE_FIELD("threat", &view->threat);
+		WRITE_FIELD("provider", &view->provider);
+		WRITE_FIELD("fraud_score", &view->fraud_score);
+
+		if (*end == ',') {
+			start = end + 1;
+			end = strchr(start, ',');
+		} else {
+			break;
+		}
+	}
+	if (strcmp(format, "XML") == 0) {
+		fprintf(fout, "</row>");
+	} else if (strcmp(format, "NDJSON") == 0) {
+		fprintf(fout, first ? "{}" : "}");
+	}
+	fprintf(fout, "\n");
+}
+
+/*
+ * Columnar output of -f COLUMNS. Every value of a column other than ip is the
+ * code of an entry in the dictionary of the column, numbered from 0 in the
+ * order the entries first appear. All integers are little endian.
+ *
+ * Header: "IP2PXCOL", uint8 version, uint8 column count, then for every
+ *         column uint8 length and the --field name
+ * Block:  uint32 row count, 0 after the last block, then for every column
+ *         ip:    for every row uint16 length and the address as read
+ *         other: uint32 count of the entries new in this block, each uint16
+ *                length and the value, then uint8 code width (1, 2 or 4)
+ *                and the code of every row
+ *
+ * A block holds the rows of one chunk of the input file.
+ */
+#define COLUMNS_VERSION 1
+#define COLUMN_IP VIEW_FIELDS
+
+typedef struct {
+	size_t fields[VIEW_FIELDS + 1]; /* indexes in view_fields, COLUMN_IP for ip */
+	size_t count;
+	group_table dictionaries[VIEW_FIELDS + 1]; /* group index is the code */
+} column_writer;
+
+/* Rows waiting for the dictionaries of the writer, codes are those of the block dictionaries */
+typedef struct {
+	const column_writer *writer;
+	group_table dictionaries[VIEW_FIELDS + 1];
+	uint32_t *codes; /* row after row */
+	size_t rows;
+	size_t capacity;
+	uint8_t *addresses;
+	size_t address_length;
+	size_t address_capacity;
+	int failed;
+} column_block;
+
+static void put_le(uint8_t *buffer, uint32_t value, int width)
+{
+	int i;
+
+	for (i = 0; i < width; i++) {
+		buffer[i] = (uint8_t) (value >> (8 * i));
+	}
+}
+
+/* Indexes in view_fields of the exact --field names, COLUMN_IP for ip, unknown names are left out */
+static size_t field_columns(const char *field, size_t *fields)
+{
+	const char *start = field;
+	size_t count = 0;
+	size_t length;
+	size_t i;
+
+	while (*start != '\0' && count <= VIEW_FIELDS) {
+		length = strcspn(start, ",");
+
+		for (i = 0; i < VIEW_FIELDS; i++) {
+			if (strlen(view_fields[i].name) == length && strncmp(start, view_fields[i].name, length) == 0) {
+				break;
+			}
+		}
+
+		if (i < VIEW_FIELDS || (length == 2 && strncmp(start, "ip", 2) == 0)) {
+			fields[count++] = i;
+		}
+
+		start += length;
+		start += (*start == ',') ? 1 : 0;
+	}
+
+	return count;
+}
+
+/* Columns of the --field names and the header of the output */
+static void column_open(column_writer *writer, const char *field, FILE *fout)
+{
+	uint8_t header[10];
+	const char *name;
+	size_t i;
+
+	memset(writer, 0, sizeof(column_writer));
+	writer->count = field_columns(field, writer->fields);
+
+	memcpy(header, "IP2PXCOL", 8);
+	header[8] = COLUMNS_VERSION;
+	header[9] = (uint8_t) writer->count;
+	fwrite(header, 1, sizeof(header), fout);
+
+	for (i = 0; i < writer->count; i++) {
+		name = (writer->fields[i] == COLUMN_IP) ? "ip" : view_fields[writer->fields[i]].name;
+		fputc((int) strlen(name), fout);
+		fputs(name, fout);
+	}
+}
+
+/* End of the blocks */
+static void column_close(column_writer *writer, FILE *fout)
+{
+	uint8_t end[4] = { 0, 0, 0, 0 };
+	size_t i;
+
+	fwrite(end, 1, sizeof(end), fout);
+
+	for (i = 0; i < writer->count; i++) {
+		group_free(&writer->dictionaries[i]);
+	}
+}
+
+static void column_block_init(column_block *block, const column_writer *writer)
+{
+	memset(block, 0, sizeof(column_block));
+	block->writer = writer;
+}
+
+static void column_block_free(column_block *block)
+{
+	size_t i;
+
+	for (i = 0; i < block->writer->count; i++) {
+		group_free(&block->dictionaries[i]);
+	}
+
+	free(block->codes);
+	free(block->addresses);
+}
+
+static void column_block_add(column_block *block, const IP2ProxyView *view, const char *ip, size_t ip_length)
+{
+	const column_writer *writer = block->writer;
+	IP2ProxyField is_proxy;
+	const IP2ProxyField *value;
+	char buffer[16];
+	uint32_t *codes;
+	uint8_t *addresses;
+	group *entry;
+	size_t i;
+
+	if (block->failed) {
+		return;
+	}
+
+	if (block->rows == block->capacity) {
+		block->capacity = (block->capacity == 0) ? 4096 : block->capacity * 2;
+
+		if ((codes = (uint32_t *) realloc(block->codes, block->capacity * writer->count * sizeof(uint32_t) + 1)) == NULL) {
+			block->failed = 1;
+			return;
+		}
+
+		block->codes = codes;
+	}
+
+	for (i = 0; i < writer->count; i++) {
+		if (writer->fields[i] == COLUMN_IP) {
+			ip_length = (ip_length > 65535) ? 65535 : ip_length;
+
+			if (block->address_length + 2 + ip_length > block->address_capacity) {
+				block->address_capacity = (block->address_length + 2 + ip_length) * 2;
+
+				if ((addresses = (uint8_t *) realloc(block->addresses, block->address_capacity)) == NULL) {
+					block->failed = 1;
+					return;
+				}
+
+				block->addresses = addresses;
+			}
+
+			put_le(block->addresses + block->address_length, (uint32_t) ip_length, 2);
+			memcpy(block->addresses + block->address_length + 2, ip, ip_length);
+			block->address_length += 2 + ip_length;
+			continue;
+		}
+
+		value = view_value(view, view_fields[writer->fields[i]].mask, &is_proxy, buffer);
+
+		if ((entry = group_find(&block->dictionaries[i], value->data, value->length)) == NULL) {
+			if (group_add(&block->dictionaries[i], value->data, value->length, 1, 0) != 0) {
+				block->failed = 1;
+				return;
+			}
+
+			entry = &block->dictionaries[i].groups[block->dictionaries[i].count - 1];
+		}
+
+		block->codes[block->rows * writer->count + i] = (uint32_t) (entry - block->dictionaries[i].groups);
+	}
+
+	block->rows++;
+}
+
+/* Move the new entries of the block into the dictionaries of the writer, write the block and empty it */
+static int column_block_write(column_writer *writer, column_block *block, FILE *fout)
+{
+	uint32_t *codes = NULL;
+	uint8_t *bytes = NULL;
+	uint8_t prefix[4];
+	size_t known;
+	size_t row;
+	size_t i;
+	size_t j;
+	group *entry;
+	uint32_t largest;
+	int width;
+	int failed = block->failed;
+
+	if (!failed && block->rows > 0) {
+		put_le(prefix, (uint32_t) block->rows, 4);
+		fwrite(prefix, 1, 4, fout);
+	}
+
+	for (i = 0; i < writer->count && !failed && block->rows > 0; i++) {
+		if (writer->fields[i] == COLUMN_IP) {
+			fwrite(block->addresses, 1, block->address_length, fout);
+			continue;
+		}
+
+		known = writer->dictionaries[i].count;
+		codes = (uint32_t *) malloc(block->dictionaries[i].count * sizeof(uint32_t));
+		bytes = (uint8_t *) malloc(block->rows * 4);
+
+		if (codes == NULL || bytes == NULL) {
+			failed = 1;
+			break;
+		}
+
+		largest = 0;
+
+		for (j = 0; j < block->dictionaries[i].count; j++) {
+			entry = &block->dictionaries[i].groups[j];
+
+			if (group_find(&writer->dictionaries[i], entry->key, entry->length) == NULL && group_add(&writer->dictionaries[i], entry->key, entry->length, 1, 0) != 0) {
+				failed = 1;
+				break;
+			}
+
+			codes[j] = (uint32_t) (group_find(&writer->dictionaries[i], entry->key, entry->length) - writer->dictionaries[i].groups);
+			largest = (codes[j] > largest) ? codes[j] : largest;
+		}
+
+		if (failed) {
+			break;
+		}
+
+		// The entries added above are the new ones, in the order of their codes
+		put_le(prefix, (uint32_t) (writer->dictionaries[i].count - known), 4);
+		fwrite(prefix, 1, 4, fout);
+
+		for (j = known; j < writer->dictionaries[i].count; j++) {
+			entry = &writer->dictionaries[i].groups[j];
+			put_le(prefix, (uint32_t) entry->length, 2);
+			fwrite(prefix, 1, 2, fout);
+			fwrite(entry->key, 1, entry->length, fout);
+		}
+
+		width = (largest < 256) ? 1 : (largest < 65536) ? 2 : 4;
+		fputc(width, fout);
+
+		for (row = 0; row < block->rows; row++) {
+			put_le(bytes + row * width, codes[block->codes[row * writer->count + i]], width);
+		}
+
+		fwrite(bytes, (size_t) width, block->rows, fout);
+		free(codes);
+		free(bytes);
+		codes = NULL;
+		bytes = NULL;
+	}
+
+	free(codes);
+	free(bytes);
+	column_block_free(block);
+	column_block_init(block, writer);
+
+	return failed ? -1 : 0;
+}
+
+/*
+ * Lines of --enrich, the address is the ip_column field of the line split at
+ * delimiter or, with ip_key, the member of that name of a JSON object.
+ */
+typedef struct {
+	char delimiter;
+	long ip_column; /* from 1 */
+	const char *ip_key;
+	size_t fields[VIEW_FIELDS + 1];
+	size_t count;
+} enrich_spec;
+
+/* First delimiter of a field, a space delimiter matches a tab too, NULL if there is none */
+static const char *find_delimiter(const char *start, const char *end, char delimiter)
+{
+	if (delimiter != ' ') {
+		return (const char *) memchr(start, delimiter, (size_t) (end - start));
+	}
+
+	for (; start < end; start++) {
+		if (*start == ' ' || *start == '\t') {
+			return start;
+		}
+	}
+
+	return NULL;
+}
+
+/* Address of a line, quotes and whitespace around it left out */
+static const char *enrich_address(const enrich_spec *spec, const char *line, size_t line_length, size_t *length)
+{
+	const char *end = line + line_length;
+	const char *start = line;
+	const char *stop;
+	size_t key_length;
+	long column;
+
+	if (spec->ip_key != NULL) {
+		key_length = strlen(spec->ip_key);
+
+		// First member of the name, a name is quoted so a match inside a value must be followed by a colon
+		for (start = line; (start = (const char *) memchr(start, '"', (size_t) (end - start))) != NULL; start++) {
+			if ((size_t) (end - start) < key_length + 2 || start[key_length + 1] != '"' || memcmp(start + 1, spec->ip_key, key_length) != 0) {
+				continue;
+			}
+
+			for (stop = start + key_length + 2; stop < end && is_blank(*stop); stop++) {
+			}
+
+			if (stop < end && *stop == ':') {
+				break;
+			}
+		}
+
+		if (start == NULL) {
+			*length = 0;
+			return line;
+		}
+
+		// A string ends at its closing quote, any other value at a comma, brace or blank
+		for (start = stop + 1; start < end && is_blank(*start); start++) {
+		}
+
+		if (start < end && *start == '"') {
+			start++;
+			stop = (const char *) memchr(start, '"', (size_t) (end - start));
+		} else {
+			for (stop = start; stop < end && *stop != ',' && *stop != '}' && !is_blank(*stop); stop++) {
+			}
+		}
+
+		*length = (stop != NULL) ? (size_t) (stop - start) : 0;
+
+		return start;
+	}
+
+	// As in awk, a space delimiter means runs of spaces and tabs and the leading ones do not count
+	for (column = 1; column <= spec->ip_column && start < end; column++) {
+		while (spec->delimiter == ' ' && start < end && is_blank(*start)) {
+			start++;
+		}
+
+		if (column == spec->ip_column) {
+			break;
+		}
+
+		stop = find_delimiter(start, end, spec->delimiter);
+		start = (stop != NULL) ? stop + 1 : end;
+	}
+
+	stop = find_delimiter(start, end, spec->delimiter);
+	stop = (stop != NULL) ? stop : end;
+
+	while (start < stop && (is_blank(*start) || *start == '"')) {
+		start++;
+	}
+
+	while (stop > start && (is_blank(stop[-1]) || stop[-1] == '"')) {
+		stop--;
+	}
+
+	*length = (size_t) (stop - start);
+
+	return start;
+}
+
+/* A value between the delimiters, quoted when it holds a delimiter or a quote */
+static void print_delimited(FILE *fout, char delimiter, const IP2ProxyField *value)
+{
+	size_t i;
+
+	if (memchr(value->data, delimiter, value->length) == NULL && memchr(value->data, '"', value->length) == NULL) {
+		fwrite(value->data, 1, value->length, fout);
+		return;
+	}
+
+	fputc('"', fout);
+
+	for (i = 0; i < value->length; i++) {
+		if (value->data[i] == '"') {
+			fputc('"', fout);
+		}
+
+		fputc(value->data[i], fout);
+	}
+
+	fputc('"', fout);
+}
+
+/* The fields appended to a line, after a delimiter each, or the members added to a JSON object with ip_key */
+static void print_fields(FILE *fout, const enrich_spec *spec, const IP2ProxyView *view, const char *ip, size_t ip_length)
+{
+	IP2ProxyField ip_value;
+	IP2ProxyField is_proxy;
+	const IP2ProxyField *value;
+	char buffer[16];
+	size_t i;
+
+	ip_value.data = ip;
+	ip_value.length = (uint32_t) ip_length;
+
+	for (i = 0; i < spec->count; i++) {
+		value = (spec->fields[i] == COLUMN_IP) ? &ip_value : view_value(view, view_fields[spec->fields[i]].mask, &is_proxy, buffer);
+
+		if (spec->ip_key == NULL) {
+			fputc(spec->delimiter, fout);
+			print_delimited(fout, spec->delimiter, value);
+			continue;
+		}
+
+		fprintf(fout, "%s\"%s\":", (i > 0) ? "," : "", (spec->fields[i] == COLUMN_IP) ? "ip" : view_fields[spec->fields[i]].name);
+
+		if (spec->fields[i] != COLUMN_IP && view_fields[spec->fields[i]].mask == ISPROXY) {
+			fprintf(fout, "%d", view->is_proxy);
+		} else {
+			fputc('"', fout);
+			print_value(fout, "NDJSON", value);
+			fputc('"', fout);
+		}
+	}
+}
+
+/* The line with the fields of print_fields, which go before the closing brace of a JSON object */
+static void print_enriched(FILE *fout, const enrich_spec *spec, const char *line, size_t line_length, const char *fields, size_t fields_length)
+{
+	size_t end = line_length;
+	size_t open;
+
+	while (end > 0 && is_blank(line[end - 1])) {
+		end--;
+	}
+
+	if (spec->ip_key == NULL) {
+		fwrite(line, 1, line_length, fout);
+		fwrite(fields, 1, fields_length, fout);
+		fputc('\n', fout);
+		return;
+	}
+
+	if (end == 0 || line[end - 1] != '}') {
+		fwrite(line, 1, line_length, fout);
+		fputc('\n', fout);
+		return;
+	}
+
+	// After a comma unless the object is empty
+	for (open = end - 1; open > 0 && is_blank(line[open - 1]); open--) {
+	}
+
+	fwrite(line, 1, end - 1, fout);
+
+	if (fields_length > 0 && !(open > 0 && line[open - 1] == '{')) {
+		fputc(',', fout);
+	}
+
+	fwrite(fields, 1, fields_length, fout);
+	fwrite(line + end - 1, 1, line_length - end + 1, fout);
+	fputc('\n', fout);
+}
+
+/*
+ * Rows of --dedup by address, so every distinct address of the input is
+ * looked up and formatted once. Each thread keeps its own. The entries come
+ * in sets of DEDUP_WAYS, the most recent first, and a new address takes the
+ * place of the least recent one of its set. A row which would take the cache
+ * over its budget is not kept, its address is looked up again next time.
+ */
+#define DEDUP_WAYS 4
+
+typedef struct {
+	char *data; /* address, then the row */
+	uint32_t address_length;
+	uint32_t row_length;
+	uint64_t hash;
+} dedup_entry;
+
+typedef struct {
+	dedup_entry *entries;
+	size_t set_mask;
+	size_t bytes;
+	size_t budget;
+	uint64_t lines;
+	uint64_t hits;
+} dedup_cache;
+
+static int dedup_open(dedup_cache *cache, size_t budget)
+{
+	size_t sets = 1;
+
+	memset(cache, 0, sizeof(dedup_cache));
+
+	// Room for rows of about 256 bytes
+	while (sets * 2 * DEDUP_WAYS * 256 <= budget) {
+		sets *= 2;
+	}
+
+	if ((cache->entries = (dedup_entry *) calloc(sets * DEDUP_WAYS, sizeof(dedup_entry))) == NULL) {
+		return -1;
+	}
+
+	cache->set_mask = sets - 1;
+	cache->budget = budget;
+	cache->bytes = sets * DEDUP_WAYS * sizeof(dedup_entry);
+
+	return 0;
+}
+
+static void dedup_close(dedup_cache *cache)
+{
+	size_t i;
+
+	for (i = 0; cache->entries != NULL && i < (cache->set_mask + 1) * DEDUP_WAYS; i++) {
+		free(cache->entries[i].data);
+	}
+
+	free(cache->entries);
+}
+
+/* Row of an address seen before, NULL for a new one */
+static const char *dedup_find(dedup_cache *cache, const char *address, size_t length, uint64_t hash, size_t *row_length)
+{
+	dedup_entry *set = &cache->entries[(size_t) (hash & cache->set_mask) * DEDUP_WAYS];
+	dedup_entry found;
+	int i;
+
+	cache->lines++;
+
+	for (i = 0; i < DEDUP_WAYS && set[i].data != NULL; i++) {
+		if (set[i].hash == hash && set[i].address_length == length && memcmp(set[i].data, address, length) == 0) {
+			found = set[i];
+			memmove(set + 1, set, (size_t) i * sizeof(dedup_entry));
+			set[0] = found;
+			cache->hits++;
+			*row_length = found.row_length;
+			return found.data + found.address_length;
+		}
+	}
+
+	return NULL;
+}
+
+static void dedup_add(dedup_cache *cache, const char *address, size_t length, uint64_t hash, const char *row, size_t row_length)
+{
+	dedup_entry *set = &cache->entries[(size_t) (hash & cache->set_mask) * DEDUP_WAYS];
+	dedup_entry *last = &set[DEDUP_WAYS - 1];
+	char *data;
+
+	if (last->data != NULL) {
+		cache->bytes -= last->address_length + last->row_length;
+		free(last->data);
+		last->data = NULL;
+	}
+
+	if (cache->bytes + length + row_length > cache->budget || (data = (char *) malloc(length + row_length)) == NULL) {
+		return;
+	}
+
+	memcpy(data, address, length);
+	memcpy(data + length, row, row_length);
+	memmove(set + 1, set, (DEDUP_WAYS - 1) * sizeof(dedup_entry));
+	set[0].data = data;
+	set[0].address_length = (uint32_t) length;
+	set[0].row_length = (uint32_t) row_length;
+	set[0].hash = hash;
+	cache->bytes += length + row_length;
+}
+
+/*
+ * External sort of --sort. Runs of lines that fit the budget are sorted by
+ * the key of their address and written to temporary files, which are then
+ * merged through a heap into the sorted input.
+ */
+#define SORT_KEY 17
+
+/* Line of a run, the key is the family (0 for an invalid address, 4 or 6) and the address */
+typedef struct {
+	uint8_t key[SORT_KEY];
+	uint32_t length;
+	size_t offset;
+} sort_line;
+
+/* Next line of a run being merged */
+typedef struct {
+	FILE *file;
+	uint8_t key[SORT_KEY];
+	char *line;
+	size_t capacity;
+	ssize_t length;
+} sort_run;
+
+/* Key in the order of the rows of the database, an IPv4 address inside IPv6 counts as IPv4 as in a lookup */
+static void sort_key(const char *ip, size_t length, uint8_t *key)
+{
+	char text[INET6_ADDRSTRLEN + 1];
+	uint8_t address[16];
+	int i;
+
+	memset(key, 0, SORT_KEY);
+
+	if (length == 0 || length >= sizeof(text)) {
+		return;
+	}
+
+	memcpy(text, ip, length);
+	text[length] = '\0';
+
+	if (inet_pton(AF_INET, text, key + 13) == 1) {
+		key[0] = 4;
+		return;
+	}
+
+	if (inet_pton(AF_INET6, text, address) != 1) {
+		return;
+	}
+
+	key[0] = 4;
+
+	if (memcmp(address, "\0\0\0\0\0\0\0\0\0\0\377\377", 12) == 0) {
+		memcpy(key + 13, address + 12, 4);
+	} else if (address[0] == 0x20 && address[1] == 0x02) {
+		memcpy(key + 13, address + 2, 4);
+	} else if (address[0] == 0x20 && address[1] == 0x01 && address[2] == 0 && address[3] == 0) {
+		for (i = 0; i < 4; i++) {
+			key[13 + i] = (uint8_t) ~address[12 + i];
+		}
+	} else {
+		key[0] = 6;
+		memcpy(key + 1, address, 16);
+	}
+}
+
+static int sort_compare(const void *a, const void *b)
+{
+	return memcmp(((const sort_line *) a)->key, ((const sort_line *) b)->key, SORT_KEY);
+}
+
+/* Key of a line as the lookups take its address */
+static void sort_line_key(const enrich_spec *enrich, const char *line, size_t length, uint8_t *key)
+{
+	size_t ip_length = length;
+	const char *ip = (enrich != NULL) ? enrich_address(enrich, line, length, &ip_length) : line;
+
+	sort_key(ip, ip_length, key);
+}
+
+/* Sort the lines of text and write them as a run */
+static FILE *sort_write_run(const char *text, sort_line *lines, size_t count)
+{
+	FILE *run = tmpfile();
+	size_t i;
+
+	if (run == NULL) {
+		return NULL;
+	}
+
+	if (count > 1) {
+		qsort(lines, count, sizeof(sort_line), sort_compare);
+	}
+
+	for (i = 0; i < count; i++) {
+		fwrite(text + lines[i].offset, 1, lines[i].length, run);
+		fputc('\n', run);
+	}
+
+	if (fflush(run) != 0 || ferror(run)) {
+		fclose(run);
+		return NULL;
+	}
+
+	rewind(run);
+
+	return run;
+}
+
+/* Read the next line of a run, 0 at its end */
+static int sort_next(sort_run *run, const enrich_spec *enrich)
+{
+	if ((run->length = getline(&run->line, &run->capacity, run->file)) <= 0) {
+		return 0;
+	}
+
+	run->length--;
+	sort_line_key(enrich, run->line, (size_t) run->length, run->key);
+
+	return 1;
+}
+
+static void sort_sift_down(sort_run **heap, size_t count, size_t i)
+{
+	size_t smallest;
+	sort_run *run;
+
+	for (;;) {
+		smallest = i;
+
+		if (2 * i + 1 < count && memcmp(heap[2 * i + 1]->key, heap[smallest]->key, SORT_KEY) < 0) {
+			smallest = 2 * i + 1;
+		}
+
+		if (2 * i + 2 < count && memcmp(heap[2 * i + 2]->key, heap[smallest]->key, SORT_KEY) < 0) {
+			smallest = 2 * i + 2;
+		}
+
+		if (smallest == i) {
+			return;
+		}
+
+		run = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = run;
+		i = smallest;
+	}
+}
+
+/* Merge the runs into one file */
+static FILE *sort_merge(FILE **files, size_t count, const enrich_spec *enrich)
+{
+	sort_run *runs = (sort_run *) calloc(count, sizeof(sort_run));
+	sort_run **heap = (sort_run **) calloc(count, sizeof(sort_run *));
+	FILE *merged = tmpfile();
+	size_t live = 0;
+	size_t i;
+
+	for (i = 0; runs != NULL && heap != NULL && merged != NULL && i < count; i++) {
+		runs[i].file = files[i];
+
+		if (sort_next(&runs[i], enrich)) {
+			heap[live++] = &runs[i];
+		}
+	}
+
+	for (i = live; i-- > 0;) {
+		sort_sift_down(heap, live, i);
+	}
+
+	while (live > 0) {
+		fwrite(heap[0]->line, 1, (size_t) heap[0]->length, merged);
+		fputc('\n', merged);
+
+		if (!sort_next(heap[0], enrich)) {
+			heap[0] = heap[--live];
+		}
+
+		sort_sift_down(heap, live, 0);
+	}
+
+	for (i = 0; runs != NULL && i < count; i++) {
+		free(runs[i].line);
+	}
+
+	free(runs);
+	free(heap);
+
+	if (merged != NULL && (runs == NULL || heap == NULL || fflush(merged) != 0 || ferror(merged))) {
+		fclose(merged);
+		return NULL;
+	}
+
+	return merged;
+}
+
+/* Sort the lines of the input in at most budget bytes, returns a temporary file or NULL */
+static FILE *sort_input(input_reader *reader, size_t budget, const enrich_spec *enrich)
+{
+	input_chunk chunk;
+	const char *cursor;
+	const char *line;
+	size_t length;
+	char *text = (char *) malloc(budget);
+	size_t used = 0;
+	sort_line *lines = NULL;
+	sort_line *grown_lines;
+	size_t count = 0;
+	size_t capacity = 0;
+	FILE **runs = NULL;
+	FILE **grown_runs;
+	FILE *sorted = NULL;
+	size_t run_count = 0;
+	size_t i;
+	int failed = (text == NULL);
+	int result;
+
+	while (!failed && (result = input_next(reader, &chunk)) != 0) {
+		failed = (result < 0);
+		cursor = chunk.data;
+
+		while (!failed && (line = input_line(&cursor, chunk.data + chunk.length, &length, enrich == NULL)) != NULL) {
+			// A full run is written aside, a line longer than the budget makes a run of its own
+			if (count > 0 && used + length > budget) {
+				if ((grown_runs = (FILE **) realloc(runs, (run_count + 1) * sizeof(FILE *))) == NULL || (grown_runs[run_count] = sort_write_run(text, lines, count)) == NULL) {
+					runs = (grown_runs != NULL) ? grown_runs : runs;
+					failed = 1;
+					break;
+				}
+
+				runs = grown_runs;
+				run_count++;
+				used = 0;
+				count = 0;
+			}
+
+			if (count == capacity) {
+				capacity = (capacity == 0) ? 65536 : capacity * 2;
+
+				if ((grown_lines = (sort_line *) realloc(lines, capacity * sizeof(sort_line))) == NULL) {
+					failed = 1;
+					break;
+				}
+
+				lines = grown_lines;
+			}
+
+			if (length > budget) {
+				char *grown_text = (char *) realloc(text, length);
+
+				if (grown_text == NULL) {
+					failed = 1;
+					break;
+				}
+
+				text = grown_text;
+				budget = length;
+			}
+
+			memcpy(text + used, line, length);
+			sort_line_key(enrich, text + used, length, lines[count].key);
+			lines[count].length = (uint32_t) length;
+			lines[count].offset = used;
+			used += length;
+			count++;
+		}
+
+		free(chunk.buffer);
+	}
+
+	if (!failed && (count > 0 || run_count == 0)) {
+		if ((grown_runs = (FILE **) realloc(runs, (run_count + 1) * sizeof(FILE *))) == NULL || (grown_runs[run_count] = sort_write_run(text, lines, count)) == NULL) {
+			runs = (grown_runs != NULL) ? grown_runs : runs;
+			failed = 1;
+		} else {
+			runs = grown_runs;
+			run_count++;
+		}
+	}
+
+	free(text);
+	free(lines);
+
+	if (!failed) {
+		sorted = (run_count == 1) ? runs[0] : sort_merge(runs, run_count, enrich);
+	}
+
+	for (i = 0; i < run_count; i++) {
+		if (runs[i] != sorted) {
+			fclose(runs[i]);
+		}
+	}
+
+	free(runs);
+
+	return sorted;
+}
+
+/* Lookups of the input file shared by the threads */
+typedef struct {
+	IP2Proxy *obj;
+	input_reader *reader;
+	FILE *fout;
+	const char *field;
+	const char *format;
+	column_writer *columns; /* set for -f COLUMNS */
+	const enrich_spec *enrich; /* set for --enrich */
+	size_t dedup; /* bytes of the cache of every thread, 0 without --dedup */
+	uint32_t mode;
+	int threads;
+	int sorted; /* set for --sorted and --sort */
+	pthread_mutex_t lock;
+	pthread_cond_t turn;
+	uint64_t next; /* sequence of the chunk whose rows are written next */
+	uint64_t lines;
+	uint64_t hits;
+	int failed;
+} lookup_job;
+
+static void *lookup_lines(void *argument)
+{
+	lookup_job *job = (lookup_job *) argument;
+	IP2ProxyView view;
+	const IP2ProxyView *found = &view;
+	IP2ProxyJoin *join = NULL;
+	input_chunk chunk;
+	column_block block;
+	dedup_cache cache;
+	const char *cursor;
+	const char *line;
+	const char *ip;
+	const char *row;
+	size_t line_length;
+	size_t length;
+	size_t row_length = 0;
+	uint64_t hash = 0;
+	char *text = NULL;
+	size_t text_length = 0;
+	char *scratch_text = NULL;
+	size_t scratch_length = 0;
+	FILE *scratch = NULL;
+	FILE *out;
+	int dedup = (job->dedup > 0);
+	int failed = 0;
+	int result;
+
+	if (job->columns != NULL) {
+		column_block_init(&block, job->columns);
+	}
+
+	// Rows kept for --dedup and fields put into the lines of --enrich are printed here first
+	if ((dedup || job->enrich != NULL) && (scratch = open_memstream(&scratch_text, &scratch_length)) == NULL) {
+		failed = 1;
+	}
+
+	if (dedup && dedup_open(&cache, job->dedup) != 0) {
+		failed = 1;
+		dedup = 0;
+	}
+
+	// Every thread walks its own chunks of the sorted input forward
+	if (job->sorted && (join = IP2Proxy_join_open(job->obj, job->mode)) == NULL) {
+		failed = 1;
+	}
+
+	while ((result = input_next(job->reader, &chunk)) == 1) {
+		// With several threads the rows of a chunk are printed aside, then written in input order
+		out = (job->threads > 1 && job->columns == NULL) ? open_memstream(&text, &text_length) : job->fout;
+		cursor = chunk.data;
+
+		while (out != NULL && !failed && (line = input_line(&cursor, chunk.data + chunk.length, &line_length, job->enrich == NULL)) != NULL) {
+			ip = (job->enrich != NULL) ? enrich_address(job->enrich, line, line_length, &length) : line;
+			length = (job->enrich != NULL) ? length : line_length;
+			row = NULL;
+
+			if (dedup) {
+				hash = group_hash(ip, length);
+				row = dedup_find(&cache, ip, length, hash, &row_length);
+			}
+
+			if (row == NULL) {
+				if (join != NULL) {
+					IP2Proxy_join_lookup(join, ip, length, &found);
+				} else {
+					IP2Proxy_get_view_n(job->obj, ip, length, job->mode, &view);
+				}
+
+				if (job->columns != NULL) {
+					column_block_add(&block, found, ip, length);
+					continue;
+				}
+
+				if (scratch == NULL) {
+					print_view(out, job->field, found, job->format, ip, length);
+					continue;
+				}
+
+				fseek(scratch, 0, SEEK_SET);
+
+				if (job->enrich != NULL) {
+					print_fields(scratch, job->enrich, found, ip, length);
+				} else {
+					print_view(scratch, job->field, found, job->format, ip, length);
+				}
+
+				fflush(scratch);
+				row = scratch_text;
+				row_length = scratch_length;
+
+				if (dedup) {
+					dedup_add(&cache, ip, length, hash, row, row_length);
+				}
+			}
+
+			if (job->enrich != NULL) {
+				print_enriched(out, job->enrich, line, line_length, row, row_length);
+			} else {
+				fwrite(row, 1, row_length, out);
+			}
+		}
+
+		free(chunk.buffer);
+
+		// The rows of a chunk make a block, the blocks take their codes in input order
+		if (job->threads == 1 && job->columns == NULL) {
+			continue;
+		}
+
+		if (out == NULL) {
+			failed = 1;
+		} else if (out != job->fout) {
+			fclose(out);
+		}
+
+		pthread_mutex_lock(&job->lock);
+
+		while (job->next != chunk.sequence) {
+			pthread_cond_wait(&job->turn, &job->lock);
+		}
+
+		if (job->columns != NULL) {
+			failed |= (column_block_write(job->columns, &block, job->fout) != 0);
+		} else if (out != NULL) {
+			fwrite(text, 1, text_length, job->fout);
+			free(text);
+		}
+
+		job->next++;
+		pthread_cond_broadcast(&job->turn);
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	if (job->columns != NULL) {
+		column_block_free(&block);
+	}
+
+	if (scratch != NULL) {
+		fclose(scratch);
+		free(scratch_text);
+	}
+
+	IP2Proxy_join_close(join);
+	pthread_mutex_lock(&job->lock);
+
+	if (dedup) {
+		job->lines += cache.lines;
+		job->hits += cache.hits;
+		dedup_close(&cache);
+	}
+
+	job->failed |= failed || (result < 0);
+	pthread_mutex_unlock(&job->lock);
+
+	return NULL;
+}
+
+static int lookup_input(IP2Proxy *obj, input_reader *reader, FILE *fout, const char *field, const char *format, column_writer *columns, const enrich_spec *enrich, size_t dedup, uint32_t mode, int threads, int sorted)
+{
+	pthread_t *workers;
+	lookup_job job;
+	int i;
+
+	memset(&job, 0, sizeof(job));
+	job.obj = obj;
+	job.reader = reader;
+	job.fout = fout;
+	job.field = field;
+	job.format = format;
+	job.columns = columns;
+	job.enrich = enrich;
+	job.dedup = dedup / (size_t) threads;
+	job.mode = mode;
+	job.threads = threads;
+	job.sorted = sorted;
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.turn, NULL);
+
+	if (threads == 1) {
+		lookup_lines(&job);
+	} else if ((workers = (pthread_t *) calloc((size_t) threads, sizeof(pthread_t))) == NULL) {
+		job.failed = 1;
+	} else {
+		for (i = 0; i < threads; i++) {
+			if (pthread_create(&workers[i], NULL, lookup_lines, &job) != 0) {
+				pthread_mutex_lock(&job.lock);
+				job.failed = 1;
+				pthread_mutex_unlock(&job.lock);
+				threads = i;
+				break;
+			}
+		}
+
+		for (i = 0; i < threads; i++) {
+			pthread_join(workers[i], NULL);
+		}
+
+		free(workers);
+	}
+
+	pthread_mutex_destroy(&job.lock);
+	pthread_cond_destroy(&job.turn);
+
+	if (dedup > 0 && job.lines > 0) {
+		fprintf(stderr, "Dedup answered %llu of %llu lines (%.1f%%) with an earlier row, %.1f lines per lookup\n", (unsigned long long) job.hits, (unsigned long long) job.lines, 100.0 * (double) job.hits / (double) job.lines, (double) job.lines / (double) (job.lines - job.hits));
+	}
+
+	return job.failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	char *data_file = NULL;
+
+	const char *input_file = NULL;
+	const char *output_file = NULL;
+	const char *ip = NULL;
+	const char *format = "CSV";
+	const char *field = NULL;
+	int no_heading = 0;
+	int memory = 0;
+	int negative_filter = 0;
+	uint32_t mode = ALL;
+	const char *index_file = NULL;
+	const char *save_index_file = NULL;
+	const char *export_format = NULL;
+	const char *diff_file = NULL;
+	const char *make_patch_file = NULL;
+	const char *apply_patch_file = NULL;
+	int compress = 0;
+	const char *set_name = "ip2proxy";
+	const char *group_by = NULL;
+	int count = 0;
+	long top = 0;
+	int threads = 1;
+	IP2ProxyExportFilter filter = { NULL, NULL, NULL, 0 };
+	bool print_bin_version = false;
+	IP2Proxy *obj = NULL;
+	IP2ProxyView view;
+	input_reader reader;
+	column_writer columns;
+	int columnar = 0;
+	enrich_spec enrich_line = { '\t', 1, NULL, { 0 }, 0 };
+	int enrich = 0;
+	long dedup = 0;
+	int sorted = 0;
+	long sort = 0;
+	FILE *fout = stdout;
+
+	for (i = 1; i < argc; i++) {
+		const char *argvi = argv[i];
+
+		if (strcmp(argvi, "-d") == 0 || strcmp(argvi, "--data-file") == 0) {
+			if (i + 1 < argc) {
+				data_file = argv[++i];
+			}
+		} else if (strcmp(argvi, "-i") == 0 || strcmp(argvi, "--input-file") == 0) {
+			if (i + 1 < argc) {
+				input_file = argv[++i];
+			}
+		} else if (strcmp(argvi, "-b") == 0 || strcmp(argvi, "--bin-version") == 0) {
+			print_bin_version = true;
+		} else if (strcmp(argvi, "-p") == 0 || strcmp(argvi, "--ip") == 0) {
+			if (i + 1 < argc) {
+				ip = argv[++i];
+			}
+		} else if (strcmp(argvi, "-o") == 0 || strcmp(argvi, "--output-file") == 0) {
+			if (i + 1 < argc) {
+				output_file = argv[++i];
+			}
+		} else if (strcmp(argvi, "-f") == 0 || strcmp(argvi, "--format") == 0) {
+			if (i + 1 < argc) {
+				format = argv[++i];
+			}
+		} else if (strcmp(argvi, "-h") == 0 || strcmp(argvi, "-?") == 0 || strcmp(argvi, "--help") == 0) {
+			print_usage(argv[0]);
+			return 0;
+		} else if (strcmp(argvi, "-v") == 0 || strcmp(argvi, "--version") == 0) {
+			print_version();
+			return 0;
+		} else if (strcmp(argvi, "-e") == 0 || strcmp(argvi, "--field") == 0) {
+			if (i + 1 < argc) {
+				field = argv[++i];
+			}
+		} else if (strcmp(argvi, "-n") == 0 || strcmp(argvi, "--no-heading") == 0) {
+			no_heading = 1;
+		} else if (strcmp(argvi, "-m") == 0 || strcmp(argvi, "--memory") == 0) {
+			memory = 1;
+		} else if (strcmp(argvi, "-g") == 0 || strcmp(argvi, "--negative-filter") == 0) {
+			negative_filter = 1;
+		} else if (strcmp(argvi, "-x") == 0 || strcmp(argvi, "--index") == 0) {
+			if (i + 1 < argc) {
+				index_file = argv[++i];
+			}
+		} else if (strcmp(argvi, "-s") == 0 || strcmp(argvi, "--save-index") == 0) {
+			if (i + 1 < argc) {
+				save_index_file = argv[++i];
+			}
+		} else if (strcmp(argvi, "-c") == 0 || strcmp(argvi, "--export") == 0) {
+			if (i + 1 < argc) {
+				export_format = argv[++i];
+			}
+		} else if (strcmp(argvi, "--proxy-type") == 0) {
+			if (i + 1 < argc) {
+				filter.proxy_type = argv[++i];
+			}
+		} else if (strcmp(argvi, "--usage-type") == 0) {
+			if (i + 1 < argc) {
+				filter.usage_type = argv[++i];
+			}
+		} else if (strcmp(argvi, "--threat") == 0) {
+			if (i + 1 < argc) {
+				filter.threat = argv[++i];
+			}
+		} else if (strcmp(argvi, "--fraud-score") == 0) {
+			if (i + 1 < argc) {
+				filter.fraud_score = atoi(argv[++i]);
+			}
+		} else if (strcmp(argvi, "--diff") == 0) {
+			if (i + 1 < argc) {
+				diff_file = argv[++i];
+			}
+		} else if (strcmp(argvi, "--make-patch") == 0) {
+			if (i + 1 < argc) {
+				make_patch_file = argv[++i];
+			}
+		} else if (strcmp(argvi, "--apply-patch") == 0) {
+			if (i + 1 < argc) {
+				apply_patch_file = argv[++i];
+			}
+		} else if (strcmp(argvi, "--compress") == 0) {
+			compress = 1;
+		} else if (strcmp(argvi, "--group-by") == 0) {
+			if (i + 1 < argc) {
+				group_by = argv[++i];
+			}
+		} else if (strcmp(argvi, "--count") == 0) {
+			count = 1;
+		} else if (strcmp(argvi, "--top") == 0) {
+			if (i + 1 < argc) {
+				top = atol(argv[++i]);
+			}
+		} else if (strcmp(argvi, "-t") == 0 || strcmp(argvi, "--threads") == 0) {
+			if (i + 1 < argc) {
+				threads = atoi(argv[++i]);
+			}
+		} else if (strcmp(argvi, "--dedup") == 0) {
+			if (i + 1 < argc) {
+				dedup = atol(argv[++i]);
+			}
+		} else if (strcmp(argvi, "--sorted") == 0) {
+			sorted = 1;
+		} else if (strcmp(argvi, "--sort") == 0) {
+			if (i + 1 < argc) {
+				sort = atol(argv[++i]);
+			}
+		} else if (strcmp(argvi, "--enrich") == 0) {
+			enrich = 1;
+		} else if (strcmp(argvi, "--delimiter") == 0) {
+			if (i + 1 < argc) {
+				const char *delimiter = argv[++i];
+
+				enrich_line.delimiter = (strcmp(delimiter, "\\t") == 0) ? '\t' : delimiter[0];
+			}
+		} else if (strcmp(argvi, "--ip-column") == 0) {
+			if (i + 1 < argc) {
+				enrich_line.ip_column = atol(argv[++i]);
+			}
+		} else if (strcmp(argvi, "--ip-key") == 0) {
+			if (i + 1 < argc) {
+				enrich_line.ip_key = argv[++i];
+			}
+		} else if (strcmp(argvi, "--set-name") == 0) {
+			if (i + 1 < argc) {
+				set_name = argv[++i];
+			}
+		}
+	}
+
+	if (strcmp(format, "CSV") != 0 && strcmp(format, "XML") != 0 && strcmp(format, "TAB") != 0 && strcmp(format, "NDJSON") != 0 && strcmp(format, "COLUMNS") != 0) {
+		fprintf(stderr, "Invalid format %s, supported formats: CSV, XML, TAB, NDJSON, COLUMNS\n", format);
+		exit(-1);
+	}
+
+	columnar = (strcmp(format, "COLUMNS") == 0);
+
+	// The enriched lines already hold the address
+	if (field == NULL) {
+		field = enrich ? "is_proxy,proxy_type,country_code,country_name,region_name,city_name,isp,domain,as_number,as_name,last_seen,threat,provider,fraud_score" : "ip,is_proxy,proxy_type,country_code,country_name,region_name,city_name,isp,domain,as_number,as_name,last_seen,threat,provider,fraud_score";
+	}
+
+	if (enrich && (input_file == NULL || ip != NULL || enrich_line.ip_column < 1 || enrich_line.delimiter == '\0' || columnar)) {
+		fprintf(stderr, "--enrich needs an input file, an --ip-column from 1 and a delimiter, without --ip or -f COLUMNS\n");
+		exit(-1);
+	}
+
+	enrich_line.count = field_columns(field, enrich_line.fields);
+
+	if (dedup < 0 || (dedup > 0 && columnar)) {
+		fprintf(stderr, "--dedup needs a size in MB and is not supported with -f COLUMNS\n");
+		exit(-1);
+	}
+
+	if (sort < 0 || ((sorted || sort > 0) && (input_file == NULL || group_by != NULL || count || top > 0))) {
+		fprintf(stderr, "--sorted and --sort need an input file and are not supported with --group-by, --count or --top\n");
+		exit(-1);
+	}
+
+	if ((strcmp(format, "NDJSON") == 0 || columnar) && (diff_file != NULL || group_by != NULL || count || top > 0)) {
+		fprintf(stderr, "Format %s is only supported for lookups, use CSV, XML or TAB\n", format);
+		exit(-1);
+	}
+
+	if (data_file == NULL) {
+		fprintf(stderr, "Datafile is absent\n");
+		exit(-1);
+	}
+
+	obj = IP2Proxy_open((char *)data_file);
+	if (obj == NULL) {
+		fprintf(stderr, "Failed to open BIN database %s\n", data_file);
+		exit(-1);
+	}
+
+	if (save_index_file != NULL) {
+		if (IP2Proxy_save_index(obj, save_index_file, IP2PROXY_PINNED_INDEX_INTERVAL) != 0) {
+			fprintf(stderr, "Failed to write index file %s\n", save_index_file);
+			exit(-1);
+		}
+
+		IP2Proxy_close(obj);
+		return 0;
+	}
+
+	if (index_file != NULL && IP2Proxy_load_index(obj, index_file) != 0) {
+		fprintf(stderr, "Index file %s is missing or stale, using the plain search\n", index_file);
+	}
+
+	if ((make_patch_file != NULL || apply_patch_file != NULL || compress) && output_file == NULL) {
+		fprintf(stderr, "Output file is absent\n");
+		exit(-1);
+	}
+
+	// Both files are read with File I/O, only one BIN file can be loaded into memory
+	if (make_patch_file != NULL) {
+		IP2Proxy *new_obj = IP2Proxy_open((char *)make_patch_file);
+		int32_t changes;
+
+		if (new_obj == NULL) {
+			fprintf(stderr, "Failed to open BIN database %s\n", make_patch_file);
+			exit(-1);
+		}
+
+		if ((changes = IP2Proxy_make_patch(obj, new_obj, output_file)) < 0) {
+			fprintf(stderr, "Failed to write patch %s from %s to %s\n", output_file, data_file, make_patch_file);
+			exit(-1);
+		}
+
+		fprintf(stderr, "%d address ranges changed\n", changes);
+
+		IP2Proxy_close(new_obj);
+		IP2Proxy_close(obj);
+		return 0;
+	}
+
+	if (apply_patch_file != NULL) {
+		int32_t changes;
+
+		if ((changes = IP2Proxy_apply_patch(obj, apply_patch_file, output_file)) < 0) {
+			fprintf(stderr, "Failed to apply patch %s, it must be made from %s\n", apply_patch_file, data_file);
+			exit(-1);
+		}
+
+		fprintf(stderr, "%d address ranges changed\n", changes);
+
+		IP2Proxy_close(obj);
+		return 0;
+	}
+
+	if (compress) {
+		struct stat status;
+
+		if (IP2Proxy_compress(obj, output_file) != 0 || stat(output_file, &status) != 0) {
+			fprintf(stderr, "Failed to write compressed BIN database %s\n", output_file);
+			exit(-1);
+		}
+
+		fprintf(stderr, "%llu bytes compressed to %lld bytes\n", (unsigned long long) obj->database_size, (long long) status.st_size);
+
+		IP2Proxy_close(obj);
+		return 0;
+	}
+
+	if (diff_file != NULL) {
+		IP2Proxy *new_obj = IP2Proxy_open((char *)diff_file);
+		diff_output output;
+		int32_t changes;
+
+		if (new_obj == NULL) {
+			fprintf(stderr, "Failed to open BIN database %s\n", diff_file);
+			exit(-1);
+		}
+
+		if (output_file != NULL && (fout = fopen(output_file, "w")) == NULL) {
+			fprintf(stderr, "Failed to open output file %s\n", output_file);
+			exit(-1);
+		}
+
+		output.fout = fout;
+		output.format = format;
+		output.mode = field_mode(field);
+
+		if (!no_heading) {
+			if (strcmp(format, "XML") == 0) {
+				fprintf(fout, "<xml>\n");
+			} else if (strcmp(format, "CSV") == 0) {
+				fprintf(fout, "\"from\",\"to\",\"field\",\"old\",\"new\"\n");
+			} else {
+				fprintf(fout, "from\tto\tfield\told\tnew\n");
+			}
+		}
+
+		if ((changes = IP2Proxy_diff(obj, new_obj, output.mode, print_change, &output)) < 0) {
+			fprintf(stderr, "Failed to compare %s with %s\n", data_file, diff_file);
+			exit(-1);
+		}
+
+		if (!no_heading) {
+			print_footer(fout, field, format);
+		}
+
+		fprintf(stderr, "%d address ranges changed\n", changes);
+
+		if (fout != stdout) {
+			fclose(fout);
+		}
+
+		IP2Proxy_close(new_obj);
+		IP2Proxy_close(obj);
+		return 0;
+	}
+
+	if (memory) {
+		IP2ProxyLoadStats stats;
+
+		if (IP2Proxy_set_lookup_mode(obj, IP2PROXY_CACHE_MEMORY) != 0 || IP2Proxy_get_load_stats(obj, &stats) != 0) {
+			fprintf(stderr, "Failed to load BIN database %s into memory\n", data_file);
+			exit(-1);
+		}
+
+		fprintf(stderr, "Loaded %llu bytes in %.3f s (%.1f MB/s, %u threads), CRC32C %08x\n", (unsigned long long) stats.size, stats.seconds, stats.throughput, stats.threads, stats.crc32c);
+	}
+
+	if (export_format != NULL) {
+		enum IP2Proxy_export_format export = IP2PROXY_EXPORT_NFTABLES;
+		int32_t prefixes;
+
+		if (strcmp(export_format, "ipset") == 0) {
+			export = IP2PROXY_EXPORT_IPSET;
+		} else if (strcmp(export_format, "binary") == 0) {
+			export = IP2PROXY_EXPORT_BINARY;
+		} else if (strcmp(export_format, "nftables") != 0) {
+			fprintf(stderr, "Invalid export format %s, supported formats: nftables, ipset, binary\n", export_format);
+			exit(-1);
+		}
+
+		// The export reads every row, faster from memory
+		if (!memory && IP2Proxy_set_lookup_mode(obj, IP2PROXY_CACHE_MEMORY) != 0) {
+			fprintf(stderr, "Failed to load BIN database %s into memory\n", data_file);
+			exit(-1);
+		}
+
+		if (output_file != NULL && (fout = fopen(output_file, "w")) == NULL) {
+			fprintf(stderr, "Failed to open output file %s\n", output_file);
+			exit(-1);
+		}
+
+		if ((prefixes = IP2Proxy_export_cidr(obj, &filter, export, set_name, fout)) < 0) {
+			fprintf(stderr, "Failed to export BIN database %s, check that it has the filtered fields\n", data_file);
+			exit(-1);
+		}
+
+		fprintf(stderr, "Exported %d prefixes\n", prefixes);
+
+		if (fout != stdout) {
+			fclose(fout);
+		}
+
+		IP2Proxy_close(obj);
+		return 0;
+	}
+
+	if (print_bin_version) {
+		printf("BIN version %s\n", IP2Proxy_get_package_version(obj));
+		exit(0);
+	}
+
+	if (negative_filter && IP2Proxy_set_negative_filter(obj, 1) != 0) {
+		fprintf(stderr, "Failed to build the negative lookup filter of %s\n", data_file);
+		exit(-1);
+	}
+
+	// Only is_proxy and the country code, the filter can answer without a search
+	if (is_proxy_fields(field)) {
+		mode = ISPROXY;
+	}
+
+	if (output_file != NULL) {
+		fout = fopen(output_file, "w");
+		if (fout == NULL) {
+			fprintf(stderr, "Failed to open output file %s\n", output_file);
+			exit(-1);
+		}
+	}
+
+	if (threads < 1 || threads > 256) {
+		fprintf(stderr, "Invalid number of threads %d\n", threads);
+		exit(-1);
+	}
+
+	if (input_file != NULL && input_open(&reader, input_file) != 0) {
+		fprintf(stderr, "Failed to open input file %s\n", input_file);
+		exit(-1);
+	}
+
+	// File I/O lookups share the file position, threads read the database from memory
+	if (input_file != NULL && threads > 1 && !memory && IP2Proxy_set_lookup_mode(obj, IP2PROXY_CACHE_MEMORY) != 0) {
+		fprintf(stderr, "Failed to load BIN database %s into memory\n", data_file);
+		exit(-1);
+	}
+
+	// Only the groups are printed, straight from the lookups
+	if (group_by != NULL || count || top > 0) {
+		if (input_file == NULL) {
+			fprintf(stderr, "Input file is absent\n");
+			exit(-1);
+		}
+
+		if (group_input(obj, &reader, fout, format, no_heading, (group_by != NULL) ? group_by : "", top, threads) != 0) {
+			exit(-1);
+		}
+
+		input_close(&reader);
+
+		if (fout != stdout) {
+			fclose(fout);
+		}
+
+		IP2Proxy_close(obj);
+		return 0;
+	}
+	// The lookups read the sorted copy of the input, so the rows come out in address order
+	if (sort > 0) {
+		FILE *sorted_file = sort_input(&reader, (size_t) sort << 20, enrich ? &enrich_line : NULL);
+
+		if (sorted_file == NULL) {
+			fprintf(stderr, "Failed to sort input file %s\n", input_file);
+			exit(-1);
+		}
+
+		input_close(&reader);
+		rewind(sorted_file);
+		input_attach(&reader, dup(fileno(sorted_file)));
+		fclose(sorted_file);
+		sorted = 1;
+	}
+
+	// The columnar header and end are part of the format, not a heading
+	if (columnar) {
+		column_open(&columns, field, fout);
+	} else if (!no_heading && !enrich) {
+		print_header(fout, field, format);
+	}
+
+	if (ip != NULL) {
+		IP2Proxy_get_view(obj, ip, mode, &view);
+
+		if (columnar) {
+			column_block block;
+
+			column_block_init(&block, &columns);
+			column_block_add(&block, &view, ip, strlen(ip));
+
+			if (column_block_write(&columns, &block, fout) != 0) {
+				fprintf(stderr, "Out of memory\n");
+				exit(-1);
+			}
+		} else {
+			print_view(fout, field, &view, format, ip, strlen(ip));
+		}
+	}
+
+	if (input_file != NULL) {
+		if (lookup_input(obj, &reader, fout, field, format, columnar ? &columns : NULL, enrich ? &enrich_line : NULL, (size_t) dedup << 20, mode, threads, sorted) != 0) {
+			fprintf(stderr, "Failed to read input file %s\n", input_file);
+			exit(-1);
+		}
+
+		input_close(&reader);
+	}
+
+	if (columnar) {
+		column_close(&columns, fout);
+	} else if (!no_heading && !enrich) {
 		print_footer(fout, field, format);
 	}
 
+	if (negative_filter) {
+		IP2ProxyFilterStats stats;
+
+		if (IP2Proxy_get_filter_stats(obj, &stats) != 0) {
+			stats.lookups = 0;
+			stats.ipv6_lookups = 0;
+		}
+
+		// The IPv6 networks are much larger than the IPv4 ones, a share of both would hide how either fares
+		if (stats.lookups > stats.ipv6_lookups) {
+			fprintf(stderr, "Negative filter answered %llu of %llu IPv4 lookups (%.1f%%) without a search\n", (unsigned long long) (stats.skipped - stats.ipv6_skipped), (unsigned long long) (stats.lookups - stats.ipv6_lookups), 100.0 * (double) (stats.skipped - stats.ipv6_skipped) / (double) (stats.lookups - stats.ipv6_lookups));
+		}
+
+		if (stats.ipv6_lookups > 0) {
+			fprintf(stderr, "Negative filter answered %llu of %llu IPv6 lookups (%.1f%%) without a search\n", (unsigned long long) stats.ipv6_skipped, (unsigned long long) stats.ipv6_lookups, 100.0 * (double) stats.ipv6_skipped / (double) stats.ipv6_lookups);
+		}
+	}
+
 	IP2Proxy_close(obj);
 
 	return 0;
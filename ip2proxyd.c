@@ -0,0 +1,631 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <IP2Proxy.h>
+#include "ip2proxyd.h"
+
+static void print_usage(const char *argv0)
+{
+	printf(
+"ip2proxyd -d [IP2PROXY BIN DATA PATH] [OPTIONS]\n"
+"	-d, --data-file\n"
+"	Specify the path of IP2Proxy BIN data file.\n"
+"\n"
+"	-s, --socket\n"
+"	Path of the Unix domain socket to listen on (default " IP2PROXYD_SOCKET ").\n"
+"\n"
+"	-t, --threads\n"
+"	Number of event loops, each on its own thread (default 1).\n"
+"\n"
+"	-m, --shared-memory\n"
+"	Load the BIN data file into shared memory instead of private memory.\n"
+"\n"
+"	-g, --negative-filter\n"
+"	Answer the addresses of networks without any proxy without a search.\n"
+"\n"
+"	-r, --ring\n"
+"	Also answer lookups through a shared memory ring of this name, such as /IP2Proxy_Ring.\n"
+"\n"
+"	-h, -?, --help\n"
+"	Display the help.\n");
+}
+
+/* Fields of a response after is_proxy, in ascending bit order */
+static const struct {
+	uint32_t mask;
+	size_t offset;
+} response_fields[] = {
+	{ COUNTRYSHORT, offsetof(IP2ProxyView, country_short) },
+	{ COUNTRYLONG, offsetof(IP2ProxyView, country_long) },
+	{ REGION, offsetof(IP2ProxyView, region) },
+	{ CITY, offsetof(IP2ProxyView, city) },
+	{ ISP, offsetof(IP2ProxyView, isp) },
+	{ PROXYTYPE, offsetof(IP2ProxyView, proxy_type) },
+	{ DOMAINNAME, offsetof(IP2ProxyView, domain) },
+	{ USAGETYPE, offsetof(IP2ProxyView, usage_type) },
+	{ ASN, offsetof(IP2ProxyView, asn) },
+	{ AS, offsetof(IP2ProxyView, as_) },
+	{ LASTSEEN, offsetof(IP2ProxyView, last_seen) },
+	{ THREAT, offsetof(IP2ProxyView, threat) },
+	{ PROVIDER, offsetof(IP2ProxyView, provider) },
+	{ FRAUDSCORE, offsetof(IP2ProxyView, fraud_score) }
+};
+
+#define RESPONSE_FIELDS (sizeof(response_fields) / sizeof(response_fields[0]))
+
+/* Most bytes a result can take in a response */
+#define RESULT_SIZE (1 + RESPONSE_FIELDS * 256)
+
+/* Responses waiting to be written above which requests are not read any more */
+#define OUTPUT_LIMIT (4 * 1024 * 1024)
+
+typedef struct {
+	int fd;
+	uint8_t *input;
+	size_t input_size;
+	size_t input_capacity;
+	uint8_t *output;
+	size_t output_start;
+	size_t output_size;
+	size_t output_capacity;
+	uint32_t events;
+	int eof; /* the client shut down its side, answer what it sent then close */
+} connection;
+
+/* One event loop with its own epoll instance, every loop accepts on the same socket */
+typedef struct {
+	pthread_t thread;
+	IP2Proxy *obj;
+	int listener;
+	int epoll;
+	IP2ProxyView view;
+	uint64_t frames;
+	uint64_t addresses;
+	uint64_t connections;
+} event_loop;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int signal_number)
+{
+	(void) signal_number;
+	stopping = 1;
+}
+
+static uint32_t get32(const uint8_t *buffer)
+{
+	return ((uint32_t) buffer[3] << 24) | ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[1] << 8) | (uint32_t) buffer[0];
+}
+
+static uint16_t get16(const uint8_t *buffer)
+{
+	return (uint16_t) (((uint32_t) buffer[1] << 8) | (uint32_t) buffer[0]);
+}
+
+static void put32(uint8_t *buffer, uint32_t value)
+{
+	buffer[0] = (uint8_t) value;
+	buffer[1] = (uint8_t) (value >> 8);
+	buffer[2] = (uint8_t) (value >> 16);
+	buffer[3] = (uint8_t) (value >> 24);
+}
+
+static void put16(uint8_t *buffer, uint16_t value)
+{
+	buffer[0] = (uint8_t) value;
+	buffer[1] = (uint8_t) (value >> 8);
+}
+
+/* Make room for size more bytes of responses */
+static int reserve_output(connection *conn, size_t size)
+{
+	uint8_t *output;
+	size_t capacity;
+
+	if (conn->output_start > 0 && conn->output_start == conn->output_size) {
+		conn->output_start = 0;
+		conn->output_size = 0;
+	}
+
+	if (conn->output_size + size <= conn->output_capacity) {
+		return 0;
+	}
+
+	// Written bytes are dropped before growing
+	if (conn->output_start > 0) {
+		memmove(conn->output, conn->output + conn->output_start, conn->output_size - conn->output_start);
+		conn->output_size -= conn->output_start;
+		conn->output_start = 0;
+
+		if (conn->output_size + size <= conn->output_capacity) {
+			return 0;
+		}
+	}
+
+	for (capacity = (conn->output_capacity == 0) ? 65536 : conn->output_capacity * 2; capacity < conn->output_size + size; capacity *= 2) {
+	}
+
+	if ((output = (uint8_t *) realloc(conn->output, capacity)) == NULL) {
+		return -1;
+	}
+
+	conn->output = output;
+	conn->output_capacity = capacity;
+
+	return 0;
+}
+
+/* Look up the addresses of a request and append the response, -1 for a malformed frame */
+static int answer(event_loop *loop, connection *conn, const uint8_t *frame, uint32_t length)
+{
+	uint32_t id = get32(frame);
+	uint32_t mode = get32(frame + 4) & ALL;
+	uint16_t count = get16(frame + 8);
+	uint16_t version = get16(frame + 10);
+	uint16_t status = IP2PROXYD_OK;
+	const uint8_t *ip = frame + 12;
+	const uint8_t *end = frame + length;
+	const IP2ProxyField *field;
+	uint8_t *response;
+	size_t start;
+	size_t size;
+	uint32_t i;
+	size_t j;
+
+	if (version != IP2PROXYD_VERSION) {
+		status = IP2PROXYD_BAD_VERSION;
+	} else if (count > IP2PROXYD_MAX_BATCH) {
+		status = IP2PROXYD_BAD_REQUEST;
+	}
+
+	if (reserve_output(conn, IP2PROXYD_HEADER_SIZE + ((status == IP2PROXYD_OK) ? (size_t) count * RESULT_SIZE : 0)) != 0) {
+		return -1;
+	}
+
+	start = conn->output_size;
+	size = IP2PROXYD_HEADER_SIZE;
+
+	for (i = 0; status == IP2PROXYD_OK && i < count; i++) {
+		if (ip >= end || ip + 1 + ip[0] > end) {
+			return -1;
+		}
+
+		IP2Proxy_get_view_n(loop->obj, (const char *) ip + 1, ip[0], mode, &loop->view);
+		ip += 1 + ip[0];
+
+		response = conn->output + start + size;
+		response[0] = (uint8_t) (int8_t) loop->view.is_proxy;
+		size++;
+
+		for (j = 0; j < RESPONSE_FIELDS; j++) {
+			if ((mode & response_fields[j].mask) == 0) {
+				continue;
+			}
+
+			field = (const IP2ProxyField *) ((const char *) &loop->view + response_fields[j].offset);
+			response = conn->output + start + size;
+			response[0] = (uint8_t) ((field->length > 255) ? 255 : field->length);
+			memcpy(response + 1, field->data, response[0]);
+			size += 1 + response[0];
+		}
+	}
+
+	response = conn->output + start;
+	put32(response, (uint32_t) size - 4);
+	put32(response + 4, id);
+	put32(response + 8, mode);
+	put16(response + 12, (status == IP2PROXYD_OK) ? count : 0);
+	put16(response + 14, status);
+	conn->output_size += size;
+
+	loop->frames++;
+	loop->addresses += (status == IP2PROXYD_OK) ? count : 0;
+
+	return 0;
+}
+
+/* Answer every complete request in the input, a partial one is kept for the next read */
+static int answer_all(event_loop *loop, connection *conn)
+{
+	size_t position = 0;
+	uint32_t length;
+
+	while (conn->input_size - position >= 4 && conn->output_size - conn->output_start < OUTPUT_LIMIT) {
+		length = get32(conn->input + position);
+
+		if (length < IP2PROXYD_HEADER_SIZE - 4 || length > IP2PROXYD_MAX_FRAME - 4) {
+			return -1;
+		}
+
+		if (conn->input_size - position < 4 + (size_t) length) {
+			break;
+		}
+
+		if (answer(loop, conn, conn->input + position + 4, length) != 0) {
+			return -1;
+		}
+
+		position += 4 + length;
+	}
+
+	memmove(conn->input, conn->input + position, conn->input_size - position);
+	conn->input_size -= position;
+
+	return 0;
+}
+
+static int flush_output(connection *conn)
+{
+	ssize_t written;
+
+	while (conn->output_start < conn->output_size) {
+		written = send(conn->fd, conn->output + conn->output_start, conn->output_size - conn->output_start, MSG_NOSIGNAL);
+
+		if (written < 0) {
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : (errno == EINTR) ? flush_output(conn) : -1;
+		}
+
+		conn->output_start += (size_t) written;
+	}
+
+	return 0;
+}
+
+static void close_connection(event_loop *loop, connection *conn)
+{
+	epoll_ctl(loop->epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	free(conn->input);
+	free(conn->output);
+	free(conn);
+}
+
+/* Read while responses can be queued, then wait for the socket to drain */
+static void serve(event_loop *loop, connection *conn, uint32_t events)
+{
+	struct epoll_event event;
+	ssize_t received;
+	uint32_t wanted;
+
+	if (events & EPOLLERR) {
+		close_connection(loop, conn);
+		return;
+	}
+
+	if ((events & EPOLLOUT) && flush_output(conn) != 0) {
+		close_connection(loop, conn);
+		return;
+	}
+
+	while (!conn->eof && conn->output_size - conn->output_start < OUTPUT_LIMIT) {
+		if (conn->input_size == conn->input_capacity) {
+			size_t capacity = (conn->input_capacity == 0) ? 65536 : conn->input_capacity * 2;
+			uint8_t *input;
+
+			if (capacity > 2 * IP2PROXYD_MAX_FRAME || (input = (uint8_t *) realloc(conn->input, capacity)) == NULL) {
+				close_connection(loop, conn);
+				return;
+			}
+
+			conn->input = input;
+			conn->input_capacity = capacity;
+		}
+
+		received = recv(conn->fd, conn->input + conn->input_size, conn->input_capacity - conn->input_size, 0);
+
+		if (received == 0) {
+			conn->eof = 1;
+			break;
+		}
+
+		if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			close_connection(loop, conn);
+			return;
+		}
+
+		if (received < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			break;
+		}
+
+		conn->input_size += (size_t) received;
+
+		if (answer_all(loop, conn) != 0 || flush_output(conn) != 0) {
+			close_connection(loop, conn);
+			return;
+		}
+	}
+
+	// Requests left in the input are answered once the output drains
+	if (conn->input_size > 0 && conn->output_size - conn->output_start < OUTPUT_LIMIT && (answer_all(loop, conn) != 0 || flush_output(conn) != 0)) {
+		close_connection(loop, conn);
+		return;
+	}
+
+	// After the end of the input every complete request is answered, then the connection closes once the output drains
+	while (conn->eof && conn->output_start == conn->output_size && conn->input_size >= 4) {
+		size_t left = conn->input_size;
+
+		if (answer_all(loop, conn) != 0 || flush_output(conn) != 0) {
+			close_connection(loop, conn);
+			return;
+		}
+
+		if (conn->input_size == left) {
+			break;
+		}
+	}
+
+	if (conn->eof && conn->output_start == conn->output_size) {
+		close_connection(loop, conn);
+		return;
+	}
+
+	wanted = (!conn->eof && conn->output_size - conn->output_start < OUTPUT_LIMIT) ? EPOLLIN : 0;
+	wanted |= (conn->output_start < conn->output_size) ? EPOLLOUT : 0;
+
+	if (wanted != conn->events) {
+		event.events = wanted;
+		event.data.ptr = conn;
+		conn->events = wanted;
+		epoll_ctl(loop->epoll, EPOLL_CTL_MOD, conn->fd, &event);
+	}
+}
+
+static void accept_all(event_loop *loop)
+{
+	struct epoll_event event;
+	connection *conn;
+	int fd;
+
+	while ((fd = accept4(loop->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		if ((conn = (connection *) calloc(1, sizeof(connection))) == NULL) {
+			close(fd);
+			continue;
+		}
+
+		conn->fd = fd;
+		conn->events = EPOLLIN;
+		event.events = EPOLLIN;
+		event.data.ptr = conn;
+
+		if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+			close(fd);
+			free(conn);
+			continue;
+		}
+
+		loop->connections++;
+	}
+}
+
+static void *run(void *argument)
+{
+	event_loop *loop = (event_loop *) argument;
+	struct epoll_event events[256];
+	int ready;
+	int i;
+
+	while (!stopping) {
+		// Woken at least twice a second to notice a stop request
+		ready = epoll_wait(loop->epoll, events, 256, 500);
+
+		for (i = 0; i < ready; i++) {
+			if (events[i].data.ptr == NULL) {
+				accept_all(loop);
+			} else {
+				serve(loop, (connection *) events[i].data.ptr, events[i].events);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* True when the path is a socket nobody listens on any more */
+static bool stale_socket(const struct sockaddr_un *address)
+{
+	struct stat buffer;
+	bool stale;
+	int fd;
+
+	if (lstat(address->sun_path, &buffer) != 0 || !S_ISSOCK(buffer.st_mode) || (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		return false;
+	}
+
+	stale = (connect(fd, (const struct sockaddr *) address, sizeof(*address)) != 0 && errno == ECONNREFUSED);
+	close(fd);
+
+	return stale;
+}
+
+/* Listening socket at path, -1 on failure and -2 when something else is there */
+static int listen_on(const char *path)
+{
+	struct sockaddr_un address;
+	struct stat buffer;
+	int fd;
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		return -1;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	// Only a socket left by a previous run is replaced, never a file or the socket of a running daemon
+	if (lstat(path, &buffer) == 0) {
+		if (!stale_socket(&address)) {
+			return -2;
+		}
+
+		unlink(path);
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *data_file = NULL;
+	const char *socket_path = IP2PROXYD_SOCKET;
+	const char *ring_name = NULL;
+	IP2ProxyRing *ring = NULL;
+	int threads = 1;
+	bool shared_memory = false;
+	bool negative_filter = false;
+	struct epoll_event event;
+	struct sigaction action;
+	event_loop *loops;
+	IP2Proxy *obj;
+	uint64_t frames = 0;
+	uint64_t addresses = 0;
+	int listener;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		const char *argvi = argv[i];
+
+		if (strcmp(argvi, "-d") == 0 || strcmp(argvi, "--data-file") == 0) {
+			if (i + 1 < argc) {
+				data_file = argv[++i];
+			}
+		} else if (strcmp(argvi, "-s") == 0 || strcmp(argvi, "--socket") == 0) {
+			if (i + 1 < argc) {
+				socket_path = argv[++i];
+			}
+		} else if (strcmp(argvi, "-t") == 0 || strcmp(argvi, "--threads") == 0) {
+			if (i + 1 < argc) {
+				threads = atoi(argv[++i]);
+			}
+		} else if (strcmp(argvi, "-m") == 0 || strcmp(argvi, "--shared-memory") == 0) {
+			shared_memory = true;
+		} else if (strcmp(argvi, "-g") == 0 || strcmp(argvi, "--negative-filter") == 0) {
+			negative_filter = true;
+		} else if (strcmp(argvi, "-r") == 0 || strcmp(argvi, "--ring") == 0) {
+			if (i + 1 < argc) {
+				ring_name = argv[++i];
+			}
+		} else if (strcmp(argvi, "-h") == 0 || strcmp(argvi, "-?") == 0 || strcmp(argvi, "--help") == 0) {
+			print_usage(argv[0]);
+			return 0;
+		}
+	}
+
+	if (data_file == NULL) {
+		fprintf(stderr, "Datafile is absent\n");
+		exit(-1);
+	}
+
+	if (threads < 1 || threads > 256) {
+		fprintf(stderr, "Invalid number of threads %d\n", threads);
+		exit(-1);
+	}
+
+	if ((obj = IP2Proxy_open((char *) data_file)) == NULL) {
+		fprintf(stderr, "Failed to open BIN database %s\n", data_file);
+		exit(-1);
+	}
+
+	// Lookups from memory do not share a file position, the loops run them side by side
+	if (IP2Proxy_set_lookup_mode(obj, shared_memory ? IP2PROXY_SHARED_MEMORY : IP2PROXY_CACHE_MEMORY) != 0) {
+		fprintf(stderr, "Failed to load BIN database %s into memory\n", data_file);
+		exit(-1);
+	}
+
+	if (negative_filter && IP2Proxy_set_negative_filter(obj, 1) != 0) {
+		fprintf(stderr, "Failed to build the negative lookup filter of %s\n", data_file);
+		exit(-1);
+	}
+
+	if (ring_name != NULL && (ring = IP2Proxy_ring_create(obj, ring_name, 1024)) == NULL) {
+		fprintf(stderr, "Failed to create the shared memory ring %s\n", ring_name);
+		exit(-1);
+	}
+
+	if ((listener = listen_on(socket_path)) < 0) {
+		fprintf(stderr, (listener == -2) ? "Failed to listen on %s: address in use\n" : "Failed to listen on %s\n", socket_path);
+		exit(-1);
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	if ((loops = (event_loop *) calloc((size_t) threads, sizeof(event_loop))) == NULL) {
+		exit(-1);
+	}
+
+	for (i = 0; i < threads; i++) {
+		loops[i].obj = obj;
+		loops[i].listener = listener;
+
+		// Only one loop is woken for each new connection
+		event.events = EPOLLIN | EPOLLEXCLUSIVE;
+		event.data.ptr = NULL;
+
+		if ((loops[i].epoll = epoll_create1(EPOLL_CLOEXEC)) < 0 || epoll_ctl(loops[i].epoll, EPOLL_CTL_ADD, listener, &event) != 0) {
+			fprintf(stderr, "Failed to create the event loops\n");
+			exit(-1);
+		}
+	}
+
+	fprintf(stderr, "Serving %s on %s with %d threads\n", data_file, socket_path, threads);
+
+	for (i = 1; i < threads; i++) {
+		if (pthread_create(&loops[i].thread, NULL, run, &loops[i]) != 0) {
+			fprintf(stderr, "Failed to start the event loops\n");
+			exit(-1);
+		}
+	}
+
+	run(&loops[0]);
+
+	for (i = 0; i < threads; i++) {
+		if (i > 0) {
+			pthread_join(loops[i].thread, NULL);
+		}
+
+		frames += loops[i].frames;
+		addresses += loops[i].addresses;
+		close(loops[i].epoll);
+	}
+
+	fprintf(stderr, "Answered %llu requests for %llu addresses\n", (unsigned long long) frames, (unsigned long long) addresses);
+
+	close(listener);
+	unlink(socket_path);
+	IP2Proxy_ring_close(ring);
+	free(loops);
+
+	if (shared_memory) {
+		IP2Proxy_delete_shm();
+	}
+
+	IP2Proxy_close(obj);
+
+	return 0;
+}
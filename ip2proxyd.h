@@ -0,0 +1,46 @@
+/*
+ * IP2Proxy C library is distributed under MIT license
+ * Copyright (c) 2013-2026 IP2Location.com. support at ip2location dot com
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT license
+ */
+
+#ifndef HAVE_IP2PROXYD_H
+#define HAVE_IP2PROXYD_H
+
+/*
+ * Protocol of ip2proxyd over a Unix domain stream socket. All integers are
+ * little endian. A client may send any number of requests without waiting,
+ * the responses come back in the same order.
+ *
+ * Request:  uint32 length of the rest of the frame
+ *           uint32 id, echoed in the response
+ *           uint32 mode, the fields to return (COUNTRYSHORT | ISPROXY | ...)
+ *           uint16 count of IP addresses, at most IP2PROXYD_MAX_BATCH
+ *           uint16 version, IP2PROXYD_VERSION
+ *           count times: uint8 length, then the IP address as text
+ *
+ * Response: uint32 length of the rest of the frame
+ *           uint32 id
+ *           uint32 mode
+ *           uint16 count of results, 0 when status is not IP2PROXYD_OK
+ *           uint16 status
+ *           count times: int8 is_proxy (-1 for an invalid address), then for
+ *           every other field of mode in ascending bit order: uint8 length
+ *           and the value
+ *
+ * A frame longer than IP2PROXYD_MAX_FRAME closes the connection.
+ */
+
+#define IP2PROXYD_VERSION 1
+#define IP2PROXYD_HEADER_SIZE 16
+#define IP2PROXYD_MAX_BATCH 1024
+#define IP2PROXYD_MAX_FRAME (IP2PROXYD_HEADER_SIZE + IP2PROXYD_MAX_BATCH * 256)
+#define IP2PROXYD_SOCKET "/tmp/ip2proxyd.sock"
+
+#define IP2PROXYD_OK 0
+#define IP2PROXYD_BAD_VERSION 1
+#define IP2PROXYD_BAD_REQUEST 2
+
+#endif
@@ -20,6 +20,7 @@
 #endif
 
 #include <string.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -35,6 +36,20 @@
 	#define PACKAGE_VERSION _STR(API_VERSION)
 #else
 	#include "../config.h"
+	#include <pthread.h>
+	#include <poll.h>
+	#include <time.h>
+	#include <sys/uio.h>
+	#include <sys/syscall.h>
+	#ifdef HAVE_SYS_EVENTFD_H
+		#include <sys/eventfd.h>
+	#endif
+	#ifdef HAVE_LINUX_IO_URING_H
+		#include <linux/io_uring.h>
+	#endif
+	#ifdef HAVE_LINUX_FUTEX_H
+		#include <linux/futex.h>
+	#endif
 #endif
 
 typedef struct ip_container {
@@ -43,6 +58,169 @@ typedef struct ip_container {
 	struct in6_addr ipv6;
 } ip_container;
 
+// One cached block of the BIN file
+typedef struct ip2proxy_page {
+	uint32_t number;
+	uint32_t length;
+	int32_t prev;
+	int32_t next;
+	int32_t chain;
+	uint8_t *data;
+} ip2proxy_page;
+
+// BIN file stored as LZ4 blocks of frame_size bytes, read through the file offsets of the frames
+typedef struct ip2proxy_frames {
+	FILE *file;
+	uint32_t frame_size;
+	uint32_t frame_count;
+	uint32_t raw_size;
+	uint32_t raw_crc32c;
+	uint32_t *offsets; // frame_count + 1 offsets, a frame as long as its raw bytes is stored raw
+} ip2proxy_frames;
+
+// Per handler LRU cache of BIN file pages used in File I/O mode, the pages are frames of a compressed BIN file
+typedef struct ip2proxy_page_cache {
+	FILE *file;
+	ip2proxy_frames *frames;
+	uint32_t page_size;
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t bucket_mask;
+	int32_t head;
+	int32_t tail;
+	int32_t *buckets;
+	ip2proxy_page *pages;
+	uint8_t *storage;
+} ip2proxy_page_cache;
+
+// Index tables and every n-th row key kept in memory for File I/O mode
+typedef struct ip2proxy_pinned_index {
+	uint32_t interval;
+	uint32_t *ipv4_index;
+	uint32_t *ipv6_index;
+	uint32_t ipv4_sample_count;
+	uint32_t ipv6_sample_count;
+	uint32_t *ipv4_samples;
+	struct in6_addr *ipv6_samples;
+	void *mapping;
+	size_t mapping_size;
+} ip2proxy_pinned_index;
+
+// Header of a sidecar index file, followed by the index tables and the samples in host byte order
+typedef struct ip2proxy_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t interval;
+	uint32_t database_size;
+	uint8_t database_type;
+	uint8_t database_column;
+	uint8_t database_year;
+	uint8_t database_month;
+	uint8_t database_day;
+	uint8_t reserved[3];
+	uint32_t database_crc32c;
+	uint32_t ipv4_database_count;
+	uint32_t ipv6_database_count;
+	uint32_t ipv4_sample_count;
+	uint32_t ipv6_sample_count;
+	uint32_t flags;
+	uint32_t payload_crc32c;
+	uint32_t padding;
+} ip2proxy_index_header;
+
+#define IP2PROXY_INDEX_MAGIC "IP2PXIDX"
+#define IP2PROXY_INDEX_VERSION 1
+#define IP2PROXY_INDEX_IPV4 0x0001
+#define IP2PROXY_INDEX_IPV6 0x0002
+#define IP2PROXY_INDEX_TABLE_SIZE (65536 * 2 * sizeof(uint32_t))
+
+// Header of a delta patch, followed by the changed ranges of each address family and their new strings in host byte order
+typedef struct ip2proxy_patch_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t database_crc32c; // of the database the patch applies to
+	uint32_t payload_crc32c;
+	uint32_t output_crc32c; // of the whole database the patch produces
+	uint32_t ipv4_changes;
+	uint32_t ipv6_changes;
+	uint32_t strings_size;
+	uint8_t database_type;
+	uint8_t database_column;
+	uint8_t database_year; // of the database the patch produces
+	uint8_t database_month;
+	uint8_t database_day;
+	uint8_t reserved[19];
+} ip2proxy_patch_header;
+
+#define IP2PROXY_PATCH_MAGIC "IP2PXPAT"
+#define IP2PROXY_PATCH_VERSION 2
+
+// Header of a compressed BIN file, followed by the frame offsets and the frames in host byte order
+typedef struct ip2proxy_frames_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t frame_size;
+	uint32_t frame_count;
+	uint32_t raw_size; // of the BIN file
+	uint32_t raw_crc32c;
+	uint8_t reserved[32];
+} ip2proxy_frames_header;
+
+#define IP2PROXY_FRAMES_MAGIC "IP2PXLZ4"
+#define IP2PROXY_FRAMES_VERSION 1
+#define IP2PROXY_LZ4_HASH_BITS 12
+
+// Byte 35 of the header of a BIN file with 64-bit offsets, its string pointers are 32-bit offsets from a 64-bit base
+#define IP2PROXY_FORMAT_LARGE 1
+
+// A range is both bounds as 16 bytes big endian keys, a bit per column taking its string from the patch, then the column values
+#define IP2PROXY_PATCH_ENTRY_SIZE(column) (36 + ((column) - 1) * 4)
+
+// String fields read ahead of decoding a record
+typedef struct ip2proxy_prefetch {
+	uint32_t count;
+	uint32_t position[16];
+	uint8_t data[16][256];
+} ip2proxy_prefetch;
+
+// Decode and search functions for one database layout
+typedef struct ip2proxy_kernel {
+	uint8_t database_column;
+	void (*read_view)(IP2Proxy *handler, const uint8_t *buffer, uint32_t mode, const ip2proxy_prefetch *prefetch, IP2ProxyView *view);
+	const uint8_t *(*find_ipv4_row)(IP2Proxy *handler, uint32_t ip_number, uint8_t *buffer);
+	const uint8_t *(*find_ipv6_row)(IP2Proxy *handler, struct in6_addr *ip, uint8_t *buffer);
+} ip2proxy_kernel;
+
+// Index of the fields in a layout
+enum {
+	IP2PROXY_FIELD_COUNTRY,
+	IP2PROXY_FIELD_REGION,
+	IP2PROXY_FIELD_CITY,
+	IP2PROXY_FIELD_ISP,
+	IP2PROXY_FIELD_PROXY_TYPE,
+	IP2PROXY_FIELD_DOMAIN,
+	IP2PROXY_FIELD_USAGE_TYPE,
+	IP2PROXY_FIELD_ASN,
+	IP2PROXY_FIELD_AS,
+	IP2PROXY_FIELD_LAST_SEEN,
+	IP2PROXY_FIELD_THREAT,
+	IP2PROXY_FIELD_PROVIDER,
+	IP2PROXY_FIELD_FRAUD_SCORE,
+	IP2PROXY_FIELD_COUNT
+};
+
+// Inlined into every kernel so the layout becomes constants
+#if defined(__GNUC__)
+#define IP2PROXY_INLINE __inline__ __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define IP2PROXY_INLINE __forceinline
+#else
+#define IP2PROXY_INLINE
+#endif
+
 uint8_t IP2PROXY_COUNTRY_POSITION[13]		= {0,   2,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3};
 uint8_t IP2PROXY_REGION_POSITION[13]		= {0,   0,   0,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4};
 uint8_t IP2PROXY_CITY_POSITION[13]			= {0,   0,   0,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5};
@@ -57,20 +235,66 @@ uint8_t IP2PROXY_THREAT_POSITION[13]		= {0,   0,   0,   0,   0,   0,   0,   0,
 uint8_t IP2PROXY_PROVIDER_POSITION[13]		= {0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  0 ,  13,  13};
 uint8_t IP2PROXY_FRAUD_SCORE_POSITION[13]	= {0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  0 ,  14};
 
+// Number of columns and position of every field of the PX1 to PX12 layouts, same as the tables above
+//     type columns country region city isp proxy_type domain usage_type asn as last_seen threat provider fraud_score
+#define IP2PROXY_LAYOUTS(KERNEL) \
+	KERNEL(1,   2,  2,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0) \
+	KERNEL(2,   3,  3,  0,  0,  0,  2,  0,  0,  0,  0,  0,  0,  0,  0) \
+	KERNEL(3,   5,  3,  4,  5,  0,  2,  0,  0,  0,  0,  0,  0,  0,  0) \
+	KERNEL(4,   6,  3,  4,  5,  6,  2,  0,  0,  0,  0,  0,  0,  0,  0) \
+	KERNEL(5,   7,  3,  4,  5,  6,  2,  7,  0,  0,  0,  0,  0,  0,  0) \
+	KERNEL(6,   8,  3,  4,  5,  6,  2,  7,  8,  0,  0,  0,  0,  0,  0) \
+	KERNEL(7,  10,  3,  4,  5,  6,  2,  7,  8,  9, 10,  0,  0,  0,  0) \
+	KERNEL(8,  11,  3,  4,  5,  6,  2,  7,  8,  9, 10, 11,  0,  0,  0) \
+	KERNEL(9,  12,  3,  4,  5,  6,  2,  7,  8,  9, 10, 11, 12,  0,  0) \
+	KERNEL(10, 12,  3,  4,  5,  6,  2,  7,  8,  9, 10, 11, 12,  0,  0) \
+	KERNEL(11, 13,  3,  4,  5,  6,  2,  7,  8,  9, 10, 11, 12, 13,  0) \
+	KERNEL(12, 14,  3,  4,  5,  6,  2,  7,  8,  9, 10, 11, 12, 13, 14)
+
 // Static variables
 static int32_t is_in_memory = 0;
+static IP2Proxy *memory_owner = NULL; /* handler which set the lookup mode, the memory is released when it is closed */
 static enum IP2Proxy_lookup_mode lookup_mode = IP2PROXY_FILE_IO; /* Set default lookup mode as File I/O */
 static void *memory_pointer;
+static ip2proxy_frames *memory_frames; /* frames of a compressed BIN file loaded into memory */
+static IP2ProxyLoadStats load_stats;
 
 // Static functions
 static int IP2Proxy_initialize(IP2Proxy *handler);
-static int IP2Proxy_is_ipv4(char* ip);
-static int IP2Proxy_is_ipv6(char* ip);
-static int32_t IP2Proxy_load_database_into_memory(FILE *file, void *memory_pointer, int64_t size);
+static int32_t IP2Proxy_load_database_into_memory(FILE *file, ip2proxy_frames *frames, void *memory_pointer, int64_t size);
+static int32_t IP2Proxy_check_database_size(IP2Proxy *handler);
+static int32_t IP2Proxy_memory_size(FILE *file, int64_t *size);
+static int32_t IP2Proxy_database_file_size(IP2Proxy *handler, uint64_t *size);
 static IP2ProxyRecord *IP2Proxy_new_record();
 static IP2ProxyRecord *IP2Proxy_get_record(IP2Proxy *handler, char *ip, uint32_t mode);
 static IP2ProxyRecord *IP2Proxy_get_ipv4_record(IP2Proxy *handler, uint32_t mode, ip_container parsed_ip);
 static IP2ProxyRecord *IP2Proxy_get_ipv6_record(IP2Proxy *handler, uint32_t mode, ip_container parsed_ip);
+static const ip2proxy_kernel *IP2Proxy_select_kernel(IP2Proxy *handler);
+static const ip2proxy_kernel *IP2Proxy_get_kernel(IP2Proxy *handler);
+static ip2proxy_page_cache *IP2Proxy_page_cache_new(FILE *file, ip2proxy_frames *frames, uint32_t pages);
+static ip2proxy_frames *IP2Proxy_frames_open(FILE *file);
+static void IP2Proxy_frames_free(ip2proxy_frames *frames);
+static uint32_t IP2Proxy_read_at(IP2Proxy *handler, off_t offset, uint8_t *buffer, uint32_t size);
+static uint32_t IP2Proxy_frames_load(ip2proxy_frames *frames, uint32_t number, uint8_t *data);
+static uint32_t IP2Proxy_frames_read(ip2proxy_frames *frames, off_t offset, uint8_t *buffer, uint32_t size);
+static uint32_t IP2Proxy_lz4_compress(const uint8_t *source, uint32_t size, uint8_t *destination, uint32_t capacity);
+static void IP2Proxy_page_cache_free(ip2proxy_page_cache *cache);
+static ip2proxy_pinned_index *IP2Proxy_pinned_index_new(IP2Proxy *handler, uint32_t interval);
+static void IP2Proxy_pinned_index_free(ip2proxy_pinned_index *pinned);
+static int32_t IP2Proxy_index_fingerprint(IP2Proxy *handler, uint32_t *crc);
+static int32_t IP2Proxy_patch_image(IP2Proxy *handler, const char *patch, FILE *file, uint32_t *crc, uint32_t *expected);
+static uint32_t IP2Proxy_crc32c(uint32_t crc, const uint8_t *data, size_t length);
+static void IP2Proxy_crc32c_init(void);
+static void IP2Proxy_pinned_narrow_ipv4(ip2proxy_pinned_index *pinned, uint32_t ip_number, uint32_t *low, uint32_t *high);
+static void IP2Proxy_pinned_narrow_ipv6(ip2proxy_pinned_index *pinned, struct in6_addr *ip_number, uint32_t *low, uint32_t *high);
+static const uint8_t *IP2Proxy_fetch(IP2Proxy *handler, uint64_t position, uint32_t length, uint8_t *buffer);
+static uint32_t IP2Proxy_pread(FILE *file, off_t offset, uint8_t *buffer, uint32_t size);
+static uint32_t IP2Proxy_get32(const uint8_t *buffer);
+static uint32_t IP2Proxy_get32_be(const uint8_t *buffer);
+static struct in6_addr IP2Proxy_get128(const uint8_t *buffer);
+static int IP2Proxy_negative_hit(IP2Proxy *handler, const ip_container *parsed_ip);
+static int32_t IP2Proxy_get_parsed_view(IP2Proxy *handler, ip_container parsed_ip, uint32_t mode, IP2ProxyView *view);
+static void IP2Proxy_negative_filter_free(void *filter);
 
 #ifndef WIN32
 static int32_t shm_fd;
@@ -93,6 +317,7 @@ IP2Proxy *IP2Proxy_open(char *bin)
 
 	handler = (IP2Proxy *) calloc(1, sizeof(IP2Proxy));
 	handler->file = f;
+	handler->frames = IP2Proxy_frames_open(f);
 
 	IP2Proxy_initialize(handler);
 
@@ -101,10 +326,14 @@ IP2Proxy *IP2Proxy_open(char *bin)
 		if (handler->database_year <= 20 && handler->product_code == 0) {
 		} else {
 			printf(INVALID_BIN_DATABASE);
+			IP2Proxy_close(handler);
 			return NULL;
 		}
 	}
 
+	handler->page_cache = IP2Proxy_page_cache_new(f, (ip2proxy_frames *) handler->frames, (handler->frames != NULL) ? IP2PROXY_FRAME_CACHE_DEFAULT : IP2PROXY_PAGE_CACHE_DEFAULT);
+	handler->kernel = IP2Proxy_select_kernel(handler);
+
 	return handler;
 }
 
@@ -181,27 +410,109 @@ int32_t IP2Proxy_set_lookup_mode(IP2Proxy *handler, enum IP2Proxy_lookup_mode mo
 		return -1;
 	}
 
+	// The pinned index belongs to the handler, the database of another one may still be loaded into memory
+	if (mode == IP2PROXY_HYBRID_MEMORY) {
+		return IP2Proxy_set_pinned_index(handler, IP2PROXY_PINNED_INDEX_INTERVAL);
+	}
+
 	// Mark database loaded into memory
 	is_in_memory = 1;
+	memory_owner = handler;
+	memory_frames = (ip2proxy_frames *) handler->frames;
 
 	if (mode == IP2PROXY_FILE_IO) {
 		return 0;
 	} else if (mode == IP2PROXY_CACHE_MEMORY) {
-		return IP2Proxy_set_memory_cache(handler->file);
+		if (IP2Proxy_check_database_size(handler) == -1 || IP2Proxy_set_memory_cache(handler->file) == -1) {
+			return -1;
+		}
 	} else if (mode == IP2PROXY_SHARED_MEMORY) {
-		return IP2Proxy_set_shared_memory(handler->file);
+		if (IP2Proxy_check_database_size(handler) == -1 || IP2Proxy_set_shared_memory(handler->file) == -1) {
+			return -1;
+		}
 	} else {
 		return -1;
 	}
+
+	// Page cache and pinned index are not used once the whole database is in memory
+	IP2Proxy_page_cache_free(handler->page_cache);
+	handler->page_cache = NULL;
+	IP2Proxy_pinned_index_free(handler->pinned_index);
+	handler->pinned_index = NULL;
+
+	return 0;
+}
+
+// Resize the page cache used in File I/O mode, 0 to disable it, a page is a frame of a compressed BIN file
+int32_t IP2Proxy_set_page_cache(IP2Proxy *handler, uint32_t pages)
+{
+	if (handler == NULL || handler->is_csv == 1) {
+		return -1;
+	}
+
+	// Frames of a compressed BIN file are always read through the cache
+	if (pages == 0 && handler->frames != NULL) {
+		return -1;
+	}
+
+	IP2Proxy_page_cache_free(handler->page_cache);
+	handler->page_cache = NULL;
+
+	if (pages == 0) {
+		return 0;
+	}
+
+	if ((handler->page_cache = IP2Proxy_page_cache_new(handler->file, (ip2proxy_frames *) handler->frames, pages)) == NULL) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// Keep the index tables and every n-th row key in memory for File I/O mode, 0 to disable it
+int32_t IP2Proxy_set_pinned_index(IP2Proxy *handler, uint32_t interval)
+{
+	if (handler == NULL || handler->is_csv == 1) {
+		return -1;
+	}
+
+	// Database is already in memory
+	if (lookup_mode != IP2PROXY_FILE_IO) {
+		return -1;
+	}
+
+	IP2Proxy_pinned_index_free(handler->pinned_index);
+	handler->pinned_index = NULL;
+
+	if (interval == 0) {
+		return 0;
+	}
+
+	if ((handler->pinned_index = IP2Proxy_pinned_index_new(handler, interval)) == NULL) {
+		return -1;
+	}
+
+	return 0;
 }
 
 // Close IP2Proxy handler
 uint32_t IP2Proxy_close(IP2Proxy *handler)
 {
-	is_in_memory = 0;
-
 	if (handler != NULL) {
-		IP2Proxy_close_memory(handler->file);
+		IP2Proxy_page_cache_free(handler->page_cache);
+		IP2Proxy_pinned_index_free(handler->pinned_index);
+		IP2Proxy_negative_filter_free(handler->negative_filter);
+
+		// Other handlers may still read the database in memory
+		if (handler == memory_owner) {
+			is_in_memory = 0;
+			memory_owner = NULL;
+			IP2Proxy_close_memory(handler->file);
+		} else if (handler->file != NULL) {
+			fclose(handler->file);
+		}
+
+		IP2Proxy_frames_free((ip2proxy_frames *) handler->frames);
 		free(handler);
 	}
 
@@ -226,7 +537,7 @@ static int IP2Proxy_initialize(IP2Proxy *handler)
 	uint32_t mem_offset = 1;
 
 	if (lookup_mode == IP2PROXY_FILE_IO) {
-		fread(buffer, sizeof(buffer), 1, handler->file);
+		IP2Proxy_read_at(handler, 0, buffer, sizeof(buffer));
 	}
 
 	handler->database_type = IP2Proxy_read8_row((uint8_t*)buffer, 0, mem_offset);
@@ -245,6 +556,17 @@ static int IP2Proxy_initialize(IP2Proxy *handler)
 	handler->license_code = IP2Proxy_read8_row((uint8_t*)buffer, 30, mem_offset);
 	handler->database_size = IP2Proxy_read32_row((uint8_t*)buffer, 31, mem_offset);
 
+	// Header of a BIN file with 64-bit offsets goes on with the high 32 bits of the addresses and size, then the base of the string pointers
+	if (IP2Proxy_read8_row((uint8_t*)buffer, 35, mem_offset) == IP2PROXY_FORMAT_LARGE) {
+		handler->large_format = 1;
+		handler->ipv4_database_address |= (uint64_t) IP2Proxy_read32_row((uint8_t*)buffer, 36, mem_offset) << 32;
+		handler->ipv6_database_address |= (uint64_t) IP2Proxy_read32_row((uint8_t*)buffer, 40, mem_offset) << 32;
+		handler->ipv4_index_base_address |= (uint64_t) IP2Proxy_read32_row((uint8_t*)buffer, 44, mem_offset) << 32;
+		handler->ipv6_index_base_address |= (uint64_t) IP2Proxy_read32_row((uint8_t*)buffer, 48, mem_offset) << 32;
+		handler->database_size |= (uint64_t) IP2Proxy_read32_row((uint8_t*)buffer, 52, mem_offset) << 32;
+		handler->strings_base = IP2Proxy_read32_row((uint8_t*)buffer, 56, mem_offset) | ((uint64_t) IP2Proxy_read32_row((uint8_t*)buffer, 60, mem_offset) << 32);
+	}
+
 	return 0;
 }
 
@@ -265,50 +587,227 @@ int IP2Proxy_ipv6_compare(struct in6_addr *addr1, struct in6_addr *addr2)
 	return ret;
 }
 
-// Parse IP address into binary address for lookup purpose
-static ip_container IP2Proxy_parse_address(const char *ip)
+// Value of a hexadecimal digit, -1 for any other character
+static int IP2Proxy_hex_value(char c)
 {
-	ip_container parsed;
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
 
-	if (IP2Proxy_is_ipv4((char *) ip)) {
-		// Parse IPv4 address
-		parsed.version = 4;
-		inet_pton(AF_INET, ip, &parsed.ipv4);
-		parsed.ipv4 = htonl(parsed.ipv4);
-	} else if (IP2Proxy_is_ipv6((char *) ip)) {
-		// Parse IPv6 address
-		inet_pton(AF_INET6, ip, &parsed.ipv6);
+	return -1;
+}
 
-		// IPv4 Address in IPv6
-		if (parsed.ipv6.s6_addr[0] == 0 && parsed.ipv6.s6_addr[1] == 0 && parsed.ipv6.s6_addr[2] == 0 && parsed.ipv6.s6_addr[3] == 0 && parsed.ipv6.s6_addr[4] == 0 && parsed.ipv6.s6_addr[5] == 0 && parsed.ipv6.s6_addr[6] == 0 && parsed.ipv6.s6_addr[7] == 0 && parsed.ipv6.s6_addr[8] == 0 && parsed.ipv6.s6_addr[9] == 0 && parsed.ipv6.s6_addr[10] == 255 && parsed.ipv6.s6_addr[11] == 255) {
-			parsed.version = 4;
-			parsed.ipv4 = (parsed.ipv6.s6_addr[12] << 24) + (parsed.ipv6.s6_addr[13] << 16) + (parsed.ipv6.s6_addr[14] << 8) + parsed.ipv6.s6_addr[15];
+// Parse a dotted quad, same rules as inet_pton: 4 decimal octets without leading zeros
+static int IP2Proxy_parse_ipv4(const char *ip, size_t length, uint32_t *result)
+{
+	uint32_t value = 0;
+	uint32_t octet = 0;
+	uint32_t octets = 0;
+	uint32_t digits = 0;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		uint32_t digit = (uint32_t) (uint8_t) ip[i] - '0';
+
+		if (digit <= 9) {
+			if (digits > 0 && octet == 0) {
+				return 0;
+			}
+
+			octet = octet * 10 + digit;
+
+			if (octet > 255) {
+				return 0;
+			}
+
+			if (digits++ == 0 && ++octets > 4) {
+				return 0;
+			}
+		} else if (ip[i] == '.' && digits > 0 && octets < 4) {
+			value = (value << 8) | octet;
+			octet = 0;
+			digits = 0;
+		} else {
+			return 0;
+		}
+	}
+
+	if (octets < 4 || digits == 0) {
+		return 0;
+	}
+
+	*result = (value << 8) | octet;
+
+	return 1;
+}
+
+// Parse an IPv6 address with optional :: and trailing dotted quad, same rules as inet_pton
+static int IP2Proxy_parse_ipv6(const char *ip, size_t length, uint8_t *result)
+{
+	uint8_t address[16] = { 0 };
+	const char *end = ip + length;
+	const char *token;
+	uint32_t written = 0;
+	uint32_t value = 0;
+	uint32_t digits = 0;
+	int32_t gap = -1;
+	uint32_t ipv4;
+	int digit;
+
+	if (ip == end) {
+		return 0;
+	}
+
+	// A leading colon must start ::
+	if (*ip == ':') {
+		if (++ip == end || *ip != ':') {
+			return 0;
+		}
+	}
+
+	token = ip;
+
+	while (ip < end) {
+		char c = *ip++;
+
+		if ((digit = IP2Proxy_hex_value(c)) >= 0) {
+			if (digits == 4) {
+				return 0;
+			}
+
+			value = (value << 4) | (uint32_t) digit;
+			digits++;
+			continue;
 		}
 
-		// 6to4 Address - 2002::/16
-		else if (parsed.ipv6.s6_addr[0] == 32 && parsed.ipv6.s6_addr[1] == 2) {
-			parsed.version = 4;
-			parsed.ipv4 = (parsed.ipv6.s6_addr[2] << 24) + (parsed.ipv6.s6_addr[3] << 16) + (parsed.ipv6.s6_addr[4] << 8) + parsed.ipv6.s6_addr[5];
+		if (c == ':') {
+			token = ip;
+
+			if (digits == 0) {
+				if (gap >= 0) {
+					return 0;
+				}
+
+				gap = (int32_t) written;
+				continue;
+			} else if (ip == end || written + 2 > 16) {
+				return 0;
+			}
+
+			address[written++] = (uint8_t) (value >> 8);
+			address[written++] = (uint8_t) value;
+			value = 0;
+			digits = 0;
+			continue;
+		}
+
+		// Embedded IPv4 address ends the string
+		if (c == '.' && written + 4 <= 16 && IP2Proxy_parse_ipv4(token, (size_t) (end - token), &ipv4)) {
+			address[written++] = (uint8_t) (ipv4 >> 24);
+			address[written++] = (uint8_t) (ipv4 >> 16);
+			address[written++] = (uint8_t) (ipv4 >> 8);
+			address[written++] = (uint8_t) ipv4;
+			digits = 0;
+			break;
 		}
 
-		// Teredo Address - 2001:0::/32
-		else if (parsed.ipv6.s6_addr[0] == 32 && parsed.ipv6.s6_addr[1] == 1 && parsed.ipv6.s6_addr[2] == 0 && parsed.ipv6.s6_addr[3] == 0) {
-			parsed.version = 4;
-			parsed.ipv4 = ~((parsed.ipv6.s6_addr[12] << 24) + (parsed.ipv6.s6_addr[13] << 16) + (parsed.ipv6.s6_addr[14] << 8) + parsed.ipv6.s6_addr[15]);
+		return 0;
+	}
+
+	if (digits > 0) {
+		if (written + 2 > 16) {
+			return 0;
 		}
 
-		// Common IPv6 Address
-		else {
-			parsed.version = 6;
+		address[written++] = (uint8_t) (value >> 8);
+		address[written++] = (uint8_t) value;
+	}
+
+	// Move the groups after :: to the end
+	if (gap >= 0) {
+		if (written == 16) {
+			return 0;
 		}
-	} else {
-		// Invalid IP address
-		parsed.version = -1;
+
+		memmove(address + 16 - (written - gap), address + gap, written - gap);
+		memset(address + gap, 0, 16 - written);
+		written = 16;
+	}
+
+	if (written != 16) {
+		return 0;
+	}
+
+	memcpy(result, address, 16);
+
+	return 1;
+}
+
+// Parse IP address of a given length into binary address for lookup purpose
+static ip_container IP2Proxy_parse_address_n(const char *ip, size_t length)
+{
+	ip_container parsed;
+	const uint8_t *address = parsed.ipv6.s6_addr;
+	size_t i;
+
+	parsed.version = -1;
+
+	// An IPv4 octet has at most 3 digits and an IPv6 group at most 4, the first separator tells them apart
+	for (i = 0; i < length && i < 5; i++) {
+		if (ip[i] == '.') {
+			if (IP2Proxy_parse_ipv4(ip, length, &parsed.ipv4)) {
+				parsed.version = 4;
+			}
+			return parsed;
+		}
+
+		if (ip[i] == ':') {
+			break;
+		}
+	}
+
+	if (i == length || i == 5 || !IP2Proxy_parse_ipv6(ip, length, parsed.ipv6.s6_addr)) {
+		return parsed;
+	}
+
+	// IPv4 Address in IPv6
+	if (address[0] == 0 && address[1] == 0 && address[2] == 0 && address[3] == 0 && address[4] == 0 && address[5] == 0 && address[6] == 0 && address[7] == 0 && address[8] == 0 && address[9] == 0 && address[10] == 255 && address[11] == 255) {
+		parsed.version = 4;
+		parsed.ipv4 = IP2Proxy_get32_be(address + 12);
+	}
+
+	// 6to4 Address - 2002::/16
+	else if (address[0] == 32 && address[1] == 2) {
+		parsed.version = 4;
+		parsed.ipv4 = IP2Proxy_get32_be(address + 2);
+	}
+
+	// Teredo Address - 2001:0::/32
+	else if (address[0] == 32 && address[1] == 1 && address[2] == 0 && address[3] == 0) {
+		parsed.version = 4;
+		parsed.ipv4 = ~IP2Proxy_get32_be(address + 12);
+	}
+
+	// Common IPv6 Address
+	else {
+		parsed.version = 6;
 	}
 
 	return parsed;
 }
 
+// Parse IP address into binary address for lookup purpose
+static ip_container IP2Proxy_parse_address(const char *ip)
+{
+	return IP2Proxy_parse_address_n(ip, strlen(ip));
+}
+
 // Get country code
 IP2ProxyRecord *IP2Proxy_get_country_short(IP2Proxy *handler, char *ip)
 {
@@ -432,810 +931,6192 @@ static IP2ProxyRecord *IP2Proxy_bad_record(const char *message)
 	return record;
 }
 
-// read the record data
-static IP2ProxyRecord *IP2Proxy_read_record(IP2Proxy *handler, uint8_t* buffer, uint32_t mode, uint32_t mem_offset)
+// Point a view field at a string of the database
+static void IP2Proxy_read_field(IP2Proxy *handler, const ip2proxy_prefetch *prefetch, uint32_t position, uint8_t *buffer, IP2ProxyField *field)
 {
-	uint8_t dbtype = handler->database_type;
-	FILE *handle = handler->file;
-	IP2ProxyRecord *record = IP2Proxy_new_record();
-	record->is_proxy = "-1";
-
-
-	if ((mode & ISPROXY) && (IP2PROXY_COUNTRY_POSITION[dbtype] != 0)) {
-		if (!record->country_short) {
-			record->country_short = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_COUNTRY_POSITION[dbtype] - 2), mem_offset));
-		}
-
-		if (strcmp(record->country_short, "-") == 0) {
-			record->is_proxy = "0";
-		} else {
-			record->is_proxy = "1";
-
-			if (IP2PROXY_PROXY_TYPE_POSITION[dbtype] == 0) {
-				record->proxy_type = strdup(NOT_SUPPORTED);
-			} else {
-				if (!record->proxy_type) {
-					record->proxy_type = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_PROXY_TYPE_POSITION[dbtype] - 2), mem_offset));
-				}
+	const uint8_t *string = NULL;
+	uint32_t i;
 
-				if (strcmp(record->proxy_type, "DCH") == 0 || strcmp(record->proxy_type, "SES") == 0 || strcmp(record->proxy_type, "AIC") == 0) {
-					record->is_proxy = "2";
-				} else {
-					record->is_proxy = "1";
-				}
+	if (prefetch != NULL) {
+		for (i = 0; i < prefetch->count; i++) {
+			if (prefetch->position[i] == position) {
+				string = prefetch->data[i];
+				break;
 			}
 		}
-	} else {
-		record->is_proxy = "-1";
 	}
 
-	if ((mode & COUNTRYSHORT) && (IP2PROXY_COUNTRY_POSITION[dbtype] != 0)) {
-		if (!record->country_short) {
-			record->country_short = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_COUNTRY_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->country_short) {
-			record->country_short = strdup(NOT_SUPPORTED);
-		}
+	// Copied into the view buffer in File I/O mode
+	if (string == NULL) {
+		string = IP2Proxy_fetch(handler, handler->strings_base + position + 1, 256, buffer);
 	}
 
-	if ((mode & COUNTRYLONG) && (IP2PROXY_COUNTRY_POSITION[dbtype] != 0)) {
-		if (!record->country_long) {
-			record->country_long = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_COUNTRY_POSITION[dbtype] - 2), mem_offset)+3);
-		}
-	} else {
-		if (!record->country_long) {
-			record->country_long = strdup(NOT_SUPPORTED);
-		}
-	}
+	field->data = (const char *) string + 1;
+	field->length = string[0];
+}
 
-	if ((mode & REGION) && (IP2PROXY_REGION_POSITION[dbtype] != 0)) {
-		if (!record->region) {
-			record->region = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_REGION_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->region)
-			record->region = strdup(NOT_SUPPORTED);
-	}
+// Check a view field against a string
+static int IP2Proxy_field_equals(const IP2ProxyField *field, const char *value)
+{
+	return field->length == strlen(value) && memcmp(field->data, value, field->length) == 0;
+}
 
-	if ((mode & CITY) && (IP2PROXY_CITY_POSITION[dbtype] != 0)) {
-		if (!record->city) {
-			record->city = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_CITY_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->city) {
-			record->city = strdup(NOT_SUPPORTED);
-		}
-	}
+// Set every string field of a view
+static void IP2Proxy_fill_view(IP2ProxyView *view, const IP2ProxyField *field)
+{
+	view->country_short = *field;
+	view->country_long = *field;
+	view->region = *field;
+	view->city = *field;
+	view->isp = *field;
+	view->proxy_type = *field;
+	view->domain = *field;
+	view->usage_type = *field;
+	view->asn = *field;
+	view->as_ = *field;
+	view->last_seen = *field;
+	view->threat = *field;
+	view->provider = *field;
+	view->fraud_score = *field;
+}
 
-	if ((mode & ISP) && (IP2PROXY_ISP_POSITION[dbtype] != 0)) {
-		if (!record->isp) {
-			record->isp = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_ISP_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->isp) {
-			record->isp = strdup(NOT_SUPPORTED);
-		}
-	}
+// Fill every field of a view with a message
+static void IP2Proxy_bad_view(IP2ProxyView *view, const char *message)
+{
+	IP2ProxyField field;
 
-	if ((mode & PROXYTYPE) && (IP2PROXY_PROXY_TYPE_POSITION[dbtype] != 0)) {
-		if (!record->proxy_type)
-			record->proxy_type = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_PROXY_TYPE_POSITION[dbtype] - 2), mem_offset));
-	} else {
-		if (!record->proxy_type) {
-			record->proxy_type = strdup(NOT_SUPPORTED);
-		}
-	}
+	field.data = message;
+	field.length = (uint32_t) strlen(message);
 
-	if ((mode & DOMAINNAME) && (IP2PROXY_DOMAIN_POSITION[dbtype] != 0)) {
-		if (!record->domain) {
-			record->domain = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_DOMAIN_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->domain) {
-			record->domain = strdup(NOT_SUPPORTED);
-		}
-	}
+	IP2Proxy_fill_view(view, &field);
+	view->is_proxy = (strcmp(message, NOT_SUPPORTED) == 0) ? 0 : -1;
+}
 
-	if ((mode & USAGETYPE) && (IP2PROXY_USAGE_TYPE_POSITION[dbtype] != 0)) {
-		if (!record->usage_type) {
-			record->usage_type = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_USAGE_TYPE_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->usage_type) {
-			record->usage_type = strdup(NOT_SUPPORTED);
-		}
+#define IP2PROXY_READ_FIELD(flag, index, field, slot) \
+	if ((mode & (flag)) && (position[index] != 0) && (decoded & (flag)) == 0) { \
+		IP2Proxy_read_field(handler, prefetch, IP2Proxy_get32(buffer + 4 * (position[index] - 2)), view->buffer[slot], &view->field); \
 	}
 
-	if ((mode & ASN) && (IP2PROXY_ASN_POSITION[dbtype] != 0)) {
-		if (!record->asn) {
-			record->asn = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_ASN_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->asn) {
-			record->asn = strdup(NOT_SUPPORTED);
-		}
-	}
+// Decode the record data of a layout into a view
+static IP2PROXY_INLINE void IP2Proxy_decode_view(IP2Proxy *handler, const uint8_t *buffer, uint32_t mode, const ip2proxy_prefetch *prefetch, IP2ProxyView *view, const uint8_t *position)
+{
+	static const IP2ProxyField not_supported = { NOT_SUPPORTED, sizeof(NOT_SUPPORTED) - 1 };
+	uint32_t decoded = 0;
 
-	if ((mode & AS) && (IP2PROXY_AS_POSITION[dbtype] != 0)) {
-		if (!record->as_) {
-			record->as_ = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_AS_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->as_) {
-			record->as_ = strdup(NOT_SUPPORTED);
-		}
-	}
+	IP2Proxy_fill_view(view, &not_supported);
+	view->is_proxy = -1;
 
-	if ((mode & LASTSEEN) && (IP2PROXY_LAST_SEEN_POSITION[dbtype] != 0)) {
-		if (!record->last_seen) {
-			record->last_seen = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_LAST_SEEN_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->last_seen) {
-			record->last_seen = strdup(NOT_SUPPORTED);
-		}
-	}
+	if ((mode & ISPROXY) && (position[IP2PROXY_FIELD_COUNTRY] != 0)) {
+		IP2Proxy_read_field(handler, prefetch, IP2Proxy_get32(buffer + 4 * (position[IP2PROXY_FIELD_COUNTRY] - 2)), view->buffer[0], &view->country_short);
+		decoded |= COUNTRYSHORT;
 
-	if ((mode & THREAT) && (IP2PROXY_THREAT_POSITION[dbtype] != 0)) {
-		if (!record->threat) {
-			record->threat = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_THREAT_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->threat) {
-			record->threat = strdup(NOT_SUPPORTED);
-		}
-	}
+		if (view->country_short.length == 1 && view->country_short.data[0] == '-') {
+			view->is_proxy = 0;
+		} else {
+			view->is_proxy = 1;
 
-	if ((mode & PROVIDER) && (IP2PROXY_PROVIDER_POSITION[dbtype] != 0)) {
-		if (!record->provider) {
-			record->provider = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_PROVIDER_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->provider) {
-			record->provider = strdup(NOT_SUPPORTED);
+			if (position[IP2PROXY_FIELD_PROXY_TYPE] != 0) {
+				IP2Proxy_read_field(handler, prefetch, IP2Proxy_get32(buffer + 4 * (position[IP2PROXY_FIELD_PROXY_TYPE] - 2)), view->buffer[5], &view->proxy_type);
+				decoded |= PROXYTYPE;
+
+				if (IP2Proxy_field_equals(&view->proxy_type, "DCH") || IP2Proxy_field_equals(&view->proxy_type, "SES") || IP2Proxy_field_equals(&view->proxy_type, "AIC")) {
+					view->is_proxy = 2;
+				}
+			}
 		}
 	}
 
-	if ((mode & FRAUDSCORE) && (IP2PROXY_FRAUD_SCORE_POSITION[dbtype] != 0)) {
-		if (!record->fraud_score) {
-			record->fraud_score = IP2Proxy_read_string(handle, IP2Proxy_read32_row(buffer, 4 * (IP2PROXY_FRAUD_SCORE_POSITION[dbtype] - 2), mem_offset));
-		}
-	} else {
-		if (!record->fraud_score) {
-			record->fraud_score = strdup(NOT_SUPPORTED);
-		}
+	IP2PROXY_READ_FIELD(COUNTRYSHORT, IP2PROXY_FIELD_COUNTRY, country_short, 0);
+
+	// Country name follows the 2 characters country code
+	if ((mode & COUNTRYLONG) && (position[IP2PROXY_FIELD_COUNTRY] != 0)) {
+		IP2Proxy_read_field(handler, prefetch, IP2Proxy_get32(buffer + 4 * (position[IP2PROXY_FIELD_COUNTRY] - 2)) + 3, view->buffer[1], &view->country_long);
 	}
 
-	return record;
+	IP2PROXY_READ_FIELD(REGION, IP2PROXY_FIELD_REGION, region, 2);
+	IP2PROXY_READ_FIELD(CITY, IP2PROXY_FIELD_CITY, city, 3);
+	IP2PROXY_READ_FIELD(ISP, IP2PROXY_FIELD_ISP, isp, 4);
+	IP2PROXY_READ_FIELD(PROXYTYPE, IP2PROXY_FIELD_PROXY_TYPE, proxy_type, 5);
+	IP2PROXY_READ_FIELD(DOMAINNAME, IP2PROXY_FIELD_DOMAIN, domain, 6);
+	IP2PROXY_READ_FIELD(USAGETYPE, IP2PROXY_FIELD_USAGE_TYPE, usage_type, 7);
+	IP2PROXY_READ_FIELD(ASN, IP2PROXY_FIELD_ASN, asn, 8);
+	IP2PROXY_READ_FIELD(AS, IP2PROXY_FIELD_AS, as_, 9);
+	IP2PROXY_READ_FIELD(LASTSEEN, IP2PROXY_FIELD_LAST_SEEN, last_seen, 10);
+	IP2PROXY_READ_FIELD(THREAT, IP2PROXY_FIELD_THREAT, threat, 11);
+	IP2PROXY_READ_FIELD(PROVIDER, IP2PROXY_FIELD_PROVIDER, provider, 12);
+	IP2PROXY_READ_FIELD(FRAUDSCORE, IP2PROXY_FIELD_FRAUD_SCORE, fraud_score, 13);
 }
 
-// Get the location data
-static IP2ProxyRecord *IP2Proxy_get_record(IP2Proxy *handler, char *ip, uint32_t mode)
+// Decode the record data with the position tables of any database type
+static void IP2Proxy_read_view_generic(IP2Proxy *handler, const uint8_t *buffer, uint32_t mode, const ip2proxy_prefetch *prefetch, IP2ProxyView *view)
 {
-	ip_container parsed_ip = IP2Proxy_parse_address(ip);
-	IP2ProxyRecord *record;
+	uint8_t dbtype = handler->database_type;
+	uint8_t position[IP2PROXY_FIELD_COUNT];
+
+	position[IP2PROXY_FIELD_COUNTRY] = IP2PROXY_COUNTRY_POSITION[dbtype];
+	position[IP2PROXY_FIELD_REGION] = IP2PROXY_REGION_POSITION[dbtype];
+	position[IP2PROXY_FIELD_CITY] = IP2PROXY_CITY_POSITION[dbtype];
+	position[IP2PROXY_FIELD_ISP] = IP2PROXY_ISP_POSITION[dbtype];
+	position[IP2PROXY_FIELD_PROXY_TYPE] = IP2PROXY_PROXY_TYPE_POSITION[dbtype];
+	position[IP2PROXY_FIELD_DOMAIN] = IP2PROXY_DOMAIN_POSITION[dbtype];
+	position[IP2PROXY_FIELD_USAGE_TYPE] = IP2PROXY_USAGE_TYPE_POSITION[dbtype];
+	position[IP2PROXY_FIELD_ASN] = IP2PROXY_ASN_POSITION[dbtype];
+	position[IP2PROXY_FIELD_AS] = IP2PROXY_AS_POSITION[dbtype];
+	position[IP2PROXY_FIELD_LAST_SEEN] = IP2PROXY_LAST_SEEN_POSITION[dbtype];
+	position[IP2PROXY_FIELD_THREAT] = IP2PROXY_THREAT_POSITION[dbtype];
+	position[IP2PROXY_FIELD_PROVIDER] = IP2PROXY_PROVIDER_POSITION[dbtype];
+	position[IP2PROXY_FIELD_FRAUD_SCORE] = IP2PROXY_FRAUD_SCORE_POSITION[dbtype];
+
+	IP2Proxy_decode_view(handler, buffer, mode, prefetch, view, position);
+}
 
-	if (parsed_ip.version == 4) {
-		record = IP2Proxy_get_ipv4_record(handler, mode, parsed_ip);
+// Copy a view field into a null terminated string
+static char *IP2Proxy_field_dup(const IP2ProxyField *field)
+{
+	char *str = (char *) malloc(field->length + 1);
 
-		if (record == NULL) {
-			return IP2Proxy_bad_record(NOT_SUPPORTED);
-		}
+	memcpy(str, field->data, field->length);
+	str[field->length] = '\0';
 
-		return record;
-	}
-	if (parsed_ip.version == 6) {
-		if (handler->ipv6_database_count == 0) {
-			return IP2Proxy_bad_record(IPV6_ADDRESS_MISSING_IN_IPV4_BIN);
-		}
+	return str;
+}
 
-		record = IP2Proxy_get_ipv6_record(handler, mode, parsed_ip);
+// read the record data
+// Copy a view into a new record
+static IP2ProxyRecord *IP2Proxy_view_to_record(const IP2ProxyView *view)
+{
+	IP2ProxyRecord *record = IP2Proxy_new_record();
+	const char *is_proxy[] = { "-1", "0", "1", "2" };
+
+	record->is_proxy = (char *) is_proxy[view->is_proxy + 1];
+	record->country_short = IP2Proxy_field_dup(&view->country_short);
+	record->country_long = IP2Proxy_field_dup(&view->country_long);
+	record->region = IP2Proxy_field_dup(&view->region);
+	record->city = IP2Proxy_field_dup(&view->city);
+	record->isp = IP2Proxy_field_dup(&view->isp);
+	record->proxy_type = IP2Proxy_field_dup(&view->proxy_type);
+	record->domain = IP2Proxy_field_dup(&view->domain);
+	record->usage_type = IP2Proxy_field_dup(&view->usage_type);
+	record->asn = IP2Proxy_field_dup(&view->asn);
+	record->as_ = IP2Proxy_field_dup(&view->as_);
+	record->last_seen = IP2Proxy_field_dup(&view->last_seen);
+	record->threat = IP2Proxy_field_dup(&view->threat);
+	record->provider = IP2Proxy_field_dup(&view->provider);
+	record->fraud_score = IP2Proxy_field_dup(&view->fraud_score);
 
-		if (record == NULL) {
-			return IP2Proxy_bad_record(NOT_SUPPORTED);
-		}
-
-		return record;
-	} else {
-		return IP2Proxy_bad_record(INVALID_IP_ADDRESS);
-	}
+	return record;
 }
 
-// Get IPv4 records from database
-static IP2ProxyRecord *IP2Proxy_get_ipv4_record(IP2Proxy *handler, uint32_t mode, ip_container parsed_ip)
+static IP2ProxyRecord *IP2Proxy_read_record(IP2Proxy *handler, const uint8_t *buffer, uint32_t mode, const ip2proxy_prefetch *prefetch)
 {
-	FILE *handle = handler->file;
-	uint32_t ip_number;
-	uint32_t ip_from;
-	uint32_t ip_to;
+	IP2ProxyView view;
 
-	ip_number = parsed_ip.ipv4;
+	IP2Proxy_get_kernel(handler)->read_view(handler, buffer, mode, prefetch, &view);
 
-	if (ip_number == (uint32_t) MAX_IPV4_RANGE) {
-		ip_number = ip_number - 1;
+	return IP2Proxy_view_to_record(&view);
+}
+
+// Answer a lookup of is_proxy and the country code as not a proxy when the negative filter allows it
+static int IP2Proxy_negative_view(IP2Proxy *handler, const ip_container *parsed_ip, uint32_t mode, IP2ProxyView *view)
+{
+	static const IP2ProxyField not_supported = { NOT_SUPPORTED, sizeof(NOT_SUPPORTED) - 1 };
+	static const IP2ProxyField not_proxy = { "-", 1 };
+
+	if (handler->negative_filter == NULL || (mode & ~(ISPROXY | COUNTRYSHORT)) != 0 || !IP2Proxy_negative_hit(handler, parsed_ip)) {
+		return 0;
 	}
 
-	if (handler->is_csv == 1) {
-		char line[2048];
-		char *delimiter = ";";
-		char *token;
-		int is_found = 0;
+	// Same view as the search, the country code of every row which is not a proxy is "-"
+	IP2Proxy_fill_view(view, &not_supported);
+	view->is_proxy = 0;
+	view->country_short = not_proxy;
 
-		IP2ProxyRecord *record = IP2Proxy_new_record();
-		record->is_proxy = "-1";
-		record->proxy_type = NOT_SUPPORTED;
-		record->region = NOT_SUPPORTED;
-		record->city = NOT_SUPPORTED;
-		record->isp = NOT_SUPPORTED;
-		record->domain = NOT_SUPPORTED;
-		record->usage_type = NOT_SUPPORTED;
-		record->asn = NOT_SUPPORTED;
-		record->as_ = NOT_SUPPORTED;
-		record->last_seen = NOT_SUPPORTED;
-		record->threat = NOT_SUPPORTED;
-		record->provider = NOT_SUPPORTED;
-		record->fraud_score = NOT_SUPPORTED;
+	return 1;
+}
 
-		while (fgets(line, 2048, handle) != NULL) {
-			IP2Proxy_replace(line, "\n", "");
-			IP2Proxy_replace(line, "\",\"", ";");
-			IP2Proxy_replace(line, "\"", "");
+// Decode the record of an IP address without allocating memory
+int32_t IP2Proxy_get_view(IP2Proxy *handler, const char *ip, uint32_t mode, IP2ProxyView *view)
+{
+	if (ip == NULL) {
+		return -1;
+	}
 
-			token = strtok(line, delimiter);
+	return IP2Proxy_get_view_n(handler, ip, strlen(ip), mode, view);
+}
 
-			ip_from = atoi(token);
+// Same as IP2Proxy_get_view for an IP address which is not null terminated
+int32_t IP2Proxy_get_view_n(IP2Proxy *handler, const char *ip, size_t length, uint32_t mode, IP2ProxyView *view)
+{
+	ip_container parsed_ip;
 
-			token = strtok(NULL, delimiter);
+	if (handler == NULL || ip == NULL || view == NULL) {
+		return -1;
+	}
 
-			ip_to = atoi(token);
+	parsed_ip = IP2Proxy_parse_address_n(ip, length);
 
-			if (ip_number >= ip_from && ip_number <= ip_to) {
-				is_found = 1;
-				break;
-			}
-		}
+	return IP2Proxy_get_parsed_view(handler, parsed_ip, mode, view);
+}
 
-		if (is_found == 0) {
-			record->country_short = "-";
-			record->country_long = "-";
-			record->region = "-";
-			record->city = "-";
-			record->isp = "-";
-			record->is_proxy = "0";
-			record->proxy_type = "-";
-			record->domain = "-";
-			record->usage_type = "-";
-			record->asn = "-";
-			record->as_ = "-";
-			record->last_seen = "-";
-			record->threat = "-";
-			record->provider = "-";
-			record->fraud_score = "0";
+// Decode the record of an IP address which is already parsed
+static int32_t IP2Proxy_get_parsed_view(IP2Proxy *handler, ip_container parsed_ip, uint32_t mode, IP2ProxyView *view)
+{
+	uint8_t full_row_buffer[200];
+	const uint8_t *row = NULL;
+	const ip2proxy_kernel *kernel = IP2Proxy_get_kernel(handler);
 
-			return record;
+	if (IP2Proxy_negative_view(handler, &parsed_ip, mode, view)) {
+		return 0;
+	}
+
+	if (parsed_ip.version == 4) {
+		if (parsed_ip.ipv4 == (uint32_t) MAX_IPV4_RANGE) {
+			parsed_ip.ipv4--;
 		}
 
-		switch (handler->database_type) {
-			case 1:
-				token = strtok(NULL, delimiter);
-				record->country_short = strdup(token);
+		if (handler->is_csv == 0 && (row = kernel->find_ipv4_row(handler, parsed_ip.ipv4, full_row_buffer)) != NULL) {
+			kernel->read_view(handler, row + 4, mode, NULL, view);
+			return 0;
+		}
+	} else if (parsed_ip.version == 6) {
+		if (handler->ipv6_database_count == 0) {
+			IP2Proxy_bad_view(view, IPV6_ADDRESS_MISSING_IN_IPV4_BIN);
+			return -1;
+		}
 
-				token = strtok(NULL, delimiter);
-				record->country_long = strdup(token);
+		if (handler->is_csv == 0 && (row = kernel->find_ipv6_row(handler, &parsed_ip.ipv6, full_row_buffer)) != NULL) {
+			kernel->read_view(handler, row + 16, mode, NULL, view);
+			return 0;
+		}
+	} else {
+		IP2Proxy_bad_view(view, INVALID_IP_ADDRESS);
+		return -1;
+	}
 
-				if (strcmp(record->country_short, "-") == 0) {
-					record->is_proxy = "0";
-				} else {
-					record->is_proxy = "1";
-				}
+	IP2Proxy_bad_view(view, NOT_SUPPORTED);
+	return -1;
+}
 
-				return record;
+// Read the first IP number of a row as a 16 bytes big endian key, IPv4 in the last 4 bytes
+static void IP2Proxy_row_key(IP2Proxy *handler, int ipv6, uint32_t row, uint8_t *key)
+{
+	uint64_t base_address = ipv6 ? handler->ipv6_database_address : handler->ipv4_database_address;
+	uint32_t column_offset = handler->database_column * 4 + (ipv6 ? 12 : 0);
+	uint8_t buffer[16];
+	const uint8_t *data = IP2Proxy_fetch(handler, base_address + (uint64_t) row * column_offset, ipv6 ? 16 : 4, buffer);
+	uint32_t i;
 
-			case 2:
-				token = strtok(NULL, delimiter);
-				record->proxy_type = strdup(token);
+	memset(key, 0, 16);
 
-				token = strtok(NULL, delimiter);
-				record->country_short = strdup(token);
+	if (ipv6) {
+		for (i = 0; i < 16; i++) {
+			key[i] = data[15 - i];
+		}
+	} else {
+		key[12] = data[3];
+		key[13] = data[2];
+		key[14] = data[1];
+		key[15] = data[0];
+	}
+}
 
-				token = strtok(NULL, delimiter);
-				record->country_long = strdup(token);
+// Format a 16 bytes key as an IP address
+static void IP2Proxy_key_to_text(int ipv6, const uint8_t *key, char *text)
+{
+	if (ipv6) {
+		inet_ntop(AF_INET6, key, text, INET6_ADDRSTRLEN);
+	} else {
+		sprintf(text, "%u.%u.%u.%u", key[12], key[13], key[14], key[15]);
+	}
+}
 
-				if (strcmp(record->country_short, "-") == 0) {
-					record->is_proxy = "0";
-				} else if (strcmp(record->proxy_type, "DCH") == 0 || strcmp(record->proxy_type, "SES") == 0) {
-					record->is_proxy = "0";
-				} else {
-					record->is_proxy = "1";
-				}
+// Called for every row of a walk with the first and last address as 16 bytes big endian keys
+typedef int32_t (*ip2proxy_row_callback)(int ipv6, const uint8_t *from, const uint8_t *to, const IP2ProxyView *view, void *user_data);
 
-				return record;
+typedef struct ip2proxy_range_context {
+	IP2Proxy_range_callback callback;
+	void *user_data;
+} ip2proxy_range_context;
 
-			case 3:
-				token = strtok(NULL, delimiter);
-				record->proxy_type = strdup(token);
+// Sequential reader of the rows of one address family
+typedef struct ip2proxy_row_cursor {
+	IP2Proxy *handler;
+	const ip2proxy_kernel *kernel;
+	int ipv6;
+	uint32_t row;
+	uint32_t count;
+	uint32_t mode;
+	const uint8_t *data;
+	uint8_t from[16];
+	uint8_t to[16];
+	uint8_t row_buffer[200];
+	uint8_t *window; // rows read ahead in File I/O mode, NULL to read row by row
+	uint32_t window_rows;
+	uint32_t window_start;
+	uint32_t window_count;
+	IP2ProxyView view;
+} ip2proxy_row_cursor;
+
+// Rows read at once by a sequential cursor in File I/O mode, growing from the first to the largest window
+#define IP2PROXY_CURSOR_FIRST_WINDOW 16
+#define IP2PROXY_CURSOR_WINDOW 256
+
+static void IP2Proxy_cursor_init(ip2proxy_row_cursor *cursor, IP2Proxy *handler, int ipv6, uint32_t mode, uint32_t row)
+{
+	cursor->handler = handler;
+	cursor->kernel = IP2Proxy_get_kernel(handler);
+	cursor->ipv6 = ipv6;
+	cursor->row = row;
+	cursor->count = ipv6 ? handler->ipv6_database_count : handler->ipv4_database_count;
+
+	// The last row only marks the end of the address family, range queries and row walks stop before it
+	cursor->count -= (cursor->count > 0) ? 1 : 0;
+	cursor->mode = mode;
+	cursor->data = NULL;
+	cursor->window = NULL;
+	cursor->window_rows = 0;
+	cursor->window_start = 0;
+	cursor->window_count = 0;
+}
 
-				token = strtok(NULL, delimiter);
-				record->country_short = strdup(token);
+// Read the rows of a walk in windows, returns -1 without memory
+static int IP2Proxy_cursor_readahead(ip2proxy_row_cursor *cursor)
+{
+	cursor->window_rows = IP2PROXY_CURSOR_FIRST_WINDOW;
 
-				token = strtok(NULL, delimiter);
-				record->country_long = strdup(token);
+	// Rows are read in place from memory
+	if (lookup_mode != IP2PROXY_FILE_IO) {
+		return 0;
+	}
 
-				token = strtok(NULL, delimiter);
-				record->region = strdup(token);
+	cursor->window = (uint8_t *) malloc(IP2PROXY_CURSOR_WINDOW * (cursor->handler->database_column * 4 + 12) + 16);
 
-				token = strtok(NULL, delimiter);
-				record->city = strdup(token);
+	return (cursor->window == NULL) ? -1 : 0;
+}
 
+// Point the data of the current row into the window, reading the next window when the row is past it.
+// A short walk reads little past its end, a long one reads the largest windows.
+static const uint8_t *IP2Proxy_cursor_window(ip2proxy_row_cursor *cursor, uint64_t base_address, uint32_t column_offset, uint32_t key_size)
+{
+	if (cursor->row < cursor->window_start || cursor->row >= cursor->window_start + cursor->window_count) {
+		cursor->window_start = cursor->row;
+		cursor->window_count = cursor->count - cursor->row;
+		cursor->window_count = (cursor->window_count > cursor->window_rows) ? cursor->window_rows : cursor->window_count;
+		IP2Proxy_fetch(cursor->handler, base_address + (uint64_t) cursor->row * column_offset, cursor->window_count * column_offset + key_size, cursor->window);
+		cursor->window_rows = (cursor->window_rows < IP2PROXY_CURSOR_WINDOW) ? cursor->window_rows * 2 : cursor->window_rows;
+	}
 
-				if (strcmp(record->country_short, "-") == 0) {
-					record->is_proxy = "0";
-				} else if (strcmp(record->proxy_type, "DCH") == 0 || strcmp(record->proxy_type, "SES") == 0) {
-					record->is_proxy = "0";
-				} else {
-					record->is_proxy = "1";
-				}
+	return cursor->window + (cursor->row - cursor->window_start) * column_offset;
+}
 
-				return record;
+// Read the first and last address of the current row, returns 0 past the last row
+static int IP2Proxy_cursor_read(ip2proxy_row_cursor *cursor)
+{
+	IP2Proxy *handler = cursor->handler;
+	uint64_t base_address = cursor->ipv6 ? handler->ipv6_database_address : handler->ipv4_database_address;
+	uint32_t column_offset = handler->database_column * 4 + (cursor->ipv6 ? 12 : 0);
+	uint32_t key_size = cursor->ipv6 ? 16 : 4;
+	int i;
 
-			case 4:
-				token = strtok(NULL, delimiter);
-				record->proxy_type = strdup(token);
+	if (cursor->row >= cursor->count) {
+		return 0;
+	}
 
-				token = strtok(NULL, delimiter);
-				record->country_short = strdup(token);
+	if (cursor->window != NULL) {
+		cursor->data = IP2Proxy_cursor_window(cursor, base_address, column_offset, key_size);
+	} else {
+		cursor->data = IP2Proxy_fetch(handler, base_address + (uint64_t) cursor->row * column_offset, column_offset + key_size, cursor->row_buffer);
+	}
 
-				token = strtok(NULL, delimiter);
-				record->country_long = strdup(token);
+	memset(cursor->from, 0, 16);
+	memset(cursor->to, 0, 16);
 
-				token = strtok(NULL, delimiter);
-				record->region = strdup(token);
+	for (i = 0; i < (int) key_size; i++) {
+		cursor->from[16 - key_size + i] = cursor->data[key_size - 1 - i];
+		cursor->to[16 - key_size + i] = cursor->data[column_offset + key_size - 1 - i];
+	}
 
-				token = strtok(NULL, delimiter);
-				record->city = strdup(token);
+	// The next row starts right after this one ends
+	for (i = 15; i >= 0 && cursor->to[i]-- == 0; i--) {
+	}
 
-				token = strtok(NULL, delimiter);
-				record->isp = strdup(token);
+	return 1;
+}
 
-				if (strcmp(record->country_short, "-") == 0) {
-					record->is_proxy = "0";
-				} else if (strcmp(record->proxy_type, "DCH") == 0 || strcmp(record->proxy_type, "SES") == 0) {
-					record->is_proxy = "0";
-				} else {
-					record->is_proxy = "1";
-				}
+// Decode the fields of the row read last
+static void IP2Proxy_cursor_decode(ip2proxy_row_cursor *cursor)
+{
+	cursor->kernel->read_view(cursor->handler, cursor->data + (cursor->ipv6 ? 16 : 4), cursor->mode, NULL, &cursor->view);
+}
 
-				return record;
-		}
+// Call back every row overlapping [start, end] given as 16 bytes big endian keys, returns the number of rows
+static int32_t IP2Proxy_walk_range(IP2Proxy *handler, int ipv6, const uint8_t *start, const uint8_t *end, uint32_t mode, ip2proxy_row_callback callback, void *user_data)
+{
+	uint32_t count = ipv6 ? handler->ipv6_database_count : handler->ipv4_database_count;
+	uint64_t index_base_address = ipv6 ? handler->ipv6_index_base_address : handler->ipv4_index_base_address;
+	uint32_t low = 0;
+	uint32_t high;
+	uint32_t mid;
+	int32_t rows = 0;
+	uint8_t from[16];
+	ip2proxy_row_cursor *cursor;
 
-		return NULL;
+	if (count == 0 || memcmp(start, end, 16) > 0) {
+		return 0;
 	}
 
-	uint32_t base_address = handler->ipv4_database_address;
-	uint32_t database_column = handler->database_column;
-	uint32_t ipv4_index_base_address = handler->ipv4_index_base_address;
-
-	uint32_t low = 0;
-	uint32_t high = handler->ipv4_database_count;
-	uint32_t mid = 0;
+	high = count - 1;
 
-	uint32_t column_offset = database_column * 4;
-	uint32_t row_offset = 0;
-	uint8_t full_row_buffer[200];
-	uint8_t row_buffer[200];
-	uint32_t full_row_size;
-	uint32_t row_size;
-	uint32_t mem_offset;
+	// Narrow with the index table as the point search does
+	if (index_base_address > 0) {
+		uint32_t number = ipv6 ? ((uint32_t) start[0] << 8) | start[1] : ((uint32_t) start[12] << 8) | start[13];
+		uint8_t index_buffer[8];
+		const uint8_t *index = IP2Proxy_fetch(handler, index_base_address + (number << 3), sizeof(index_buffer), index_buffer);
 
+		low = IP2Proxy_get32(index);
+		high = IP2Proxy_get32(index + 4);
+		high = (high >= count) ? count - 1 : high;
+		low = (low > high) ? high : low;
+	}
 
-	if (ipv4_index_base_address > 0) {
-		uint32_t number = (uint32_t) ip_number >> 16;
-		uint32_t indexpos = ipv4_index_base_address + (number << 3);
+	// Last row starting at or below start
+	while (low < high) {
+		mid = low + ((high - low + 1) >> 1);
+		IP2Proxy_row_key(handler, ipv6, mid, from);
 
-		uint8_t indexbuffer[8];
-		if (lookup_mode == IP2PROXY_FILE_IO) {
-			fseek(handle, indexpos - 1, 0);
-			fread(indexbuffer, sizeof(indexbuffer), 1, handle);
+		if (memcmp(from, start, 16) <= 0) {
+			low = mid;
+		} else {
+			high = mid - 1;
 		}
-		mem_offset = indexpos;
-		low = IP2Proxy_read32_row((uint8_t*)indexbuffer, 0, mem_offset);
-		high = IP2Proxy_read32_row((uint8_t*)indexbuffer, 4, mem_offset);
 	}
 
-	full_row_size = column_offset + 4;
-	row_size = column_offset - 4;
+	if ((cursor = (ip2proxy_row_cursor *) malloc(sizeof(ip2proxy_row_cursor))) == NULL) {
+		return -1;
+	}
 
-	while (low <= high) {
-		mid = (uint32_t)((low + high) >> 1);
-		row_offset = base_address + (mid * column_offset);
+	IP2Proxy_cursor_init(cursor, handler, ipv6, mode, low);
 
-		if (lookup_mode == IP2PROXY_FILE_IO) {
-			fseek(handle, row_offset - 1, 0);
-			fread(&full_row_buffer, full_row_size, 1, handle);
-		}
-		mem_offset = row_offset;
+	if (IP2Proxy_cursor_readahead(cursor) != 0) {
+		free(cursor);
+		return -1;
+	}
 
-		ip_from = IP2Proxy_read32_row((uint8_t*)full_row_buffer, 0, mem_offset);
-		ip_to = IP2Proxy_read32_row((uint8_t*)full_row_buffer, column_offset, mem_offset);
+	// Rows are sorted and contiguous, walk them until one starts after end
+	for (; IP2Proxy_cursor_read(cursor); cursor->row++) {
+		if (memcmp(cursor->from, end, 16) > 0) {
+			break;
+		}
 
-		if ((ip_number >= ip_from) && (ip_number < ip_to)) {
-			if (lookup_mode == IP2PROXY_FILE_IO) {
-				memcpy(&row_buffer, ((uint8_t*)full_row_buffer) + 4, row_size); // extract actual row data
-			}
+		IP2Proxy_cursor_decode(cursor);
+		rows++;
 
-			return IP2Proxy_read_record(handler, (uint8_t *)row_buffer, mode, mem_offset + 4);
-		} else {
-			if (ip_number < ip_from) {
-				high = mid - 1;
-			} else {
-				low = mid + 1;
-			}
+		if (callback(ipv6, cursor->from, cursor->to, &cursor->view, user_data) != 0) {
+			break;
 		}
 	}
 
-	return NULL;
+	free(cursor->window);
+	free(cursor);
+
+	return rows;
 }
 
-// Get IPv6 records from database
-static IP2ProxyRecord * IP2Proxy_get_ipv6_record(IP2Proxy *handler, uint32_t mode, ip_container parsed_ip)
+// Pass a row to the callback of a range query with its bounds as text
+static int32_t IP2Proxy_range_row(int ipv6, const uint8_t *from, const uint8_t *to, const IP2ProxyView *view, void *user_data)
 {
-	FILE *handle = handler->file;
-	uint32_t base_address = handler->ipv6_database_address;
-	uint32_t database_column = handler->database_column;
-	uint32_t ipv6_index_base_address = handler->ipv6_index_base_address;
+	ip2proxy_range_context *context = (ip2proxy_range_context *) user_data;
+	char from_text[INET6_ADDRSTRLEN];
+	char to_text[INET6_ADDRSTRLEN];
 
-	uint32_t low = 0;
-	uint32_t high = handler->ipv6_database_count;
-	uint32_t mid = 0;
+	IP2Proxy_key_to_text(ipv6, from, from_text);
+	IP2Proxy_key_to_text(ipv6, to, to_text);
 
-	struct in6_addr ip_from;
-	struct in6_addr ip_to;
-	struct in6_addr ip_number;
+	return context->callback(from_text, to_text, view, context->user_data);
+}
 
-	uint32_t column_offset = database_column * 4 + 12;
-	uint32_t row_offset = 0;
-	uint8_t full_row_buffer[200];
-	uint8_t row_buffer[200];
-	uint32_t full_row_size;
-	uint32_t row_size;
-	uint32_t mem_offset;
+// Parse an IPv4 or IPv6 address into a 16 bytes big endian key, returns 4, 6 or -1
+static int IP2Proxy_parse_key(const char *ip, size_t length, uint8_t *key)
+{
+	uint32_t ipv4;
 
-	ip_number = parsed_ip.ipv6;
+	memset(key, 0, 16);
 
-	if (!high) {
-		return NULL;
+	if (IP2Proxy_parse_ipv4(ip, length, &ipv4)) {
+		key[12] = (uint8_t) (ipv4 >> 24);
+		key[13] = (uint8_t) (ipv4 >> 16);
+		key[14] = (uint8_t) (ipv4 >> 8);
+		key[15] = (uint8_t) ipv4;
+		return 4;
 	}
 
-	if (ipv6_index_base_address > 0) {
-		uint32_t number = (ip_number.s6_addr[0] * 256) + ip_number.s6_addr[1];
-		uint32_t indexpos = ipv6_index_base_address + (number << 3);
+	if (IP2Proxy_parse_ipv6(ip, length, key)) {
+		return 6;
+	}
+
+	return -1;
+}
+
+// Call back every database segment overlapping the range from start to end
+int32_t IP2Proxy_query_range(IP2Proxy *handler, const char *start, const char *end, uint32_t mode, IP2Proxy_range_callback callback, void *user_data)
+{
+	uint8_t start_key[16];
+	uint8_t end_key[16];
+	ip2proxy_range_context context;
+	int version;
+
+	if (handler == NULL || start == NULL || end == NULL || callback == NULL || handler->is_csv == 1) {
+		return -1;
+	}
+
+	version = IP2Proxy_parse_key(start, strlen(start), start_key);
+
+	if (version == -1 || IP2Proxy_parse_key(end, strlen(end), end_key) != version) {
+		return -1;
+	}
+
+	context.callback = callback;
+	context.user_data = user_data;
+
+	return IP2Proxy_walk_range(handler, version == 6, start_key, end_key, mode, IP2Proxy_range_row, &context);
+}
+
+// Call back every database segment overlapping a network such as 1.2.3.0/24 or 2001:db8::/48
+int32_t IP2Proxy_query_cidr(IP2Proxy *handler, const char *cidr, uint32_t mode, IP2Proxy_range_callback callback, void *user_data)
+{
+	uint8_t start_key[16];
+	uint8_t end_key[16];
+	const char *slash;
+	uint32_t prefix = 0;
+	uint32_t bits;
+	uint32_t i;
+	ip2proxy_range_context context;
+	int version;
+
+	if (handler == NULL || cidr == NULL || callback == NULL || handler->is_csv == 1) {
+		return -1;
+	}
+
+	if ((slash = strchr(cidr, '/')) == NULL || slash[1] == '\0' || strlen(slash + 1) > 3) {
+		return -1;
+	}
+
+	for (i = 1; slash[i] != '\0'; i++) {
+		if (slash[i] < '0' || slash[i] > '9') {
+			return -1;
+		}
+
+		prefix = prefix * 10 + (uint32_t) (slash[i] - '0');
+	}
+
+	if ((version = IP2Proxy_parse_key(cidr, (size_t) (slash - cidr), start_key)) == -1 || prefix > ((version == 4) ? 32U : 128U)) {
+		return -1;
+	}
+
+	// Host bits cleared for the start and set for the end
+	bits = (version == 4) ? 96 + prefix : prefix;
+
+	for (i = 0; i < 16; i++) {
+		uint8_t mask = (bits >= (i + 1) * 8) ? 0xFF : (bits <= i * 8) ? 0 : (uint8_t) (0xFF << (8 - (bits - i * 8)));
+
+		start_key[i] &= mask;
+		end_key[i] = start_key[i] | (uint8_t) ~mask;
+	}
+
+	context.callback = callback;
+	context.user_data = user_data;
+
+	return IP2Proxy_walk_range(handler, version == 6, start_key, end_key, mode, IP2Proxy_range_row, &context);
+}
+
+// Parse the address of a lookup into a 16 bytes big endian key as the point search reads it, returns 4, 6 or -1
+static int IP2Proxy_lookup_key(const char *ip, size_t length, uint8_t *key)
+{
+	ip_container parsed_ip = IP2Proxy_parse_address_n(ip, length);
+
+	memset(key, 0, 16);
+
+	if (parsed_ip.version == 4) {
+		if (parsed_ip.ipv4 == (uint32_t) MAX_IPV4_RANGE) {
+			parsed_ip.ipv4--;
+		}
+
+		key[12] = (uint8_t) (parsed_ip.ipv4 >> 24);
+		key[13] = (uint8_t) (parsed_ip.ipv4 >> 16);
+		key[14] = (uint8_t) (parsed_ip.ipv4 >> 8);
+		key[15] = (uint8_t) parsed_ip.ipv4;
+		return 4;
+	}
+
+	if (parsed_ip.version == 6) {
+		memcpy(key, parsed_ip.ipv6.s6_addr, 16);
+		return 6;
+	}
+
+	return -1;
+}
+
+// Lookups of addresses in ascending order, each family walks its rows forward
+struct IP2ProxyJoin {
+	IP2Proxy *handler;
+	ip2proxy_row_cursor cursors[2];
+	int positioned[2];
+	int decoded[2];
+	IP2ProxyView bad_view;
+};
+
+// Open a merge join of sorted addresses with the rows of the database
+IP2ProxyJoin *IP2Proxy_join_open(IP2Proxy *handler, uint32_t mode)
+{
+	IP2ProxyJoin *join;
+
+	if (handler == NULL || handler->is_csv == 1) {
+		return NULL;
+	}
+
+	if ((join = (IP2ProxyJoin *) calloc(1, sizeof(IP2ProxyJoin))) == NULL) {
+		return NULL;
+	}
+
+	join->handler = handler;
+	IP2Proxy_cursor_init(&join->cursors[0], handler, 0, mode, 0);
+	IP2Proxy_cursor_init(&join->cursors[1], handler, 1, mode, 0);
+
+	return join;
+}
+
+// Move the cursor of a family to the row holding key, returns 0 if no row holds it
+static int IP2Proxy_join_seek(IP2ProxyJoin *join, int ipv6, const uint8_t *key)
+{
+	ip2proxy_row_cursor *cursor = &join->cursors[ipv6];
+	uint8_t from[16];
+	uint32_t low = 0;
+	uint32_t high;
+	uint32_t step = 1;
+	uint32_t mid;
+
+	if (cursor->count == 0) {
+		return 0;
+	}
+
+	if (join->positioned[ipv6] && memcmp(key, cursor->from, 16) >= 0 && memcmp(key, cursor->to, 16) <= 0) {
+		return 1;
+	}
+
+	// Past the current row, steps double until a row starts after key, so a gap of n rows costs log n reads
+	if (join->positioned[ipv6] && memcmp(key, cursor->from, 16) > 0) {
+		low = cursor->row;
+
+		while (low + step < cursor->count) {
+			IP2Proxy_row_key(join->handler, ipv6, low + step, from);
+
+			if (memcmp(from, key, 16) > 0) {
+				break;
+			}
+
+			low += step;
+			step <<= 1;
+		}
+
+		high = (low + step < cursor->count) ? low + step - 1 : cursor->count - 1;
+	} else {
+		// Out of order, search all the rows
+		high = cursor->count - 1;
+	}
+
+	// Last row starting at or below key
+	while (low < high) {
+		mid = low + ((high - low + 1) >> 1);
+		IP2Proxy_row_key(join->handler, ipv6, mid, from);
+
+		if (memcmp(from, key, 16) <= 0) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	cursor->row = low;
+	join->positioned[ipv6] = IP2Proxy_cursor_read(cursor);
+	join->decoded[ipv6] = 0;
+
+	return join->positioned[ipv6] && memcmp(key, cursor->from, 16) >= 0 && memcmp(key, cursor->to, 16) <= 0;
+}
+
+// Same as IP2Proxy_get_view_n, the view belongs to the join and is decoded once for the addresses of a row
+int32_t IP2Proxy_join_lookup(IP2ProxyJoin *join, const char *ip, size_t length, const IP2ProxyView **view)
+{
+	uint8_t key[16];
+	int version;
+	int ipv6;
+
+	if (join == NULL || ip == NULL || view == NULL) {
+		return -1;
+	}
+
+	*view = &join->bad_view;
+
+	if ((version = IP2Proxy_lookup_key(ip, length, key)) == -1) {
+		IP2Proxy_bad_view(&join->bad_view, INVALID_IP_ADDRESS);
+		return -1;
+	}
+
+	ipv6 = (version == 6);
+
+	if (ipv6 && join->handler->ipv6_database_count == 0) {
+		IP2Proxy_bad_view(&join->bad_view, IPV6_ADDRESS_MISSING_IN_IPV4_BIN);
+		return -1;
+	}
+
+	if (!IP2Proxy_join_seek(join, ipv6, key)) {
+		IP2Proxy_bad_view(&join->bad_view, NOT_SUPPORTED);
+		return -1;
+	}
+
+	if (!join->decoded[ipv6]) {
+		IP2Proxy_cursor_decode(&join->cursors[ipv6]);
+		join->decoded[ipv6] = 1;
+	}
+
+	*view = &join->cursors[ipv6].view;
+
+	return 0;
+}
+
+void IP2Proxy_join_close(IP2ProxyJoin *join)
+{
+	free(join);
+}
+
+struct IP2ProxyCursor {
+	ip2proxy_row_cursor rows;
+	int started;
+};
+
+// Iterate over the rows of one address family, or over part of parts disjoint slices of them
+IP2ProxyCursor *IP2Proxy_cursor_open(IP2Proxy *handler, int32_t ipv6, uint32_t mode, uint32_t part, uint32_t parts)
+{
+	IP2ProxyCursor *cursor;
+	uint32_t count;
+
+	if (handler == NULL || handler->is_csv == 1 || parts == 0 || part >= parts) {
+		return NULL;
+	}
+
+	if ((cursor = (IP2ProxyCursor *) malloc(sizeof(IP2ProxyCursor))) == NULL) {
+		return NULL;
+	}
+
+	IP2Proxy_cursor_init(&cursor->rows, handler, ipv6 != 0, mode, 0);
+	cursor->started = 0;
+
+	// The last row of a slice still ends where the first row of the next one starts
+	count = cursor->rows.count;
+	cursor->rows.row = (uint32_t) ((uint64_t) count * part / parts);
+	cursor->rows.count = (uint32_t) ((uint64_t) count * (part + 1) / parts);
+
+	if (IP2Proxy_cursor_readahead(&cursor->rows) != 0) {
+		free(cursor);
+		return NULL;
+	}
+
+#ifndef WIN32
+#ifdef POSIX_FADV_SEQUENTIAL
+	if (lookup_mode == IP2PROXY_FILE_IO && handler->page_cache == NULL && cursor->rows.row < cursor->rows.count) {
+		uint32_t column_offset = handler->database_column * 4 + (ipv6 ? 12 : 0);
+		uint64_t base_address = ipv6 ? handler->ipv6_database_address : handler->ipv4_database_address;
+
+		posix_fadvise(fileno(handler->file), (off_t) base_address - 1 + (off_t) cursor->rows.row * column_offset, (off_t) (cursor->rows.count - cursor->rows.row + 1) * column_offset, POSIX_FADV_SEQUENTIAL);
+	}
+#endif
+#endif
+
+	return cursor;
+}
+
+// Move to the next row, returns 1 with its bounds as 16 bytes big endian keys and its fields, 0 after the last row
+int32_t IP2Proxy_cursor_next(IP2ProxyCursor *cursor, const uint8_t **from, const uint8_t **to, const IP2ProxyView **view)
+{
+	if (cursor == NULL) {
+		return -1;
+	}
+
+	if (cursor->started && cursor->rows.row < cursor->rows.count) {
+		cursor->rows.row++;
+	}
+
+	cursor->started = 1;
+
+	if (!IP2Proxy_cursor_read(&cursor->rows)) {
+		return 0;
+	}
+
+	IP2Proxy_cursor_decode(&cursor->rows);
+
+	if (from != NULL) {
+		*from = cursor->rows.from;
+	}
+
+	if (to != NULL) {
+		*to = cursor->rows.to;
+	}
+
+	if (view != NULL) {
+		*view = &cursor->rows.view;
+	}
+
+	return 1;
+}
+
+void IP2Proxy_cursor_close(IP2ProxyCursor *cursor)
+{
+	if (cursor != NULL) {
+		free(cursor->rows.window);
+		free(cursor);
+	}
+}
+
+// Prefixes of one address family collected by an export
+typedef struct ip2proxy_export {
+	const IP2ProxyExportFilter *filter;
+	int ipv6;
+	uint8_t *prefixes; // 16 bytes key and prefix length
+	uint32_t count;
+	uint32_t size;
+	int pending; // [start, end] holds a run of matching rows
+	uint8_t start[16];
+	uint8_t end[16];
+	int failed;
+} ip2proxy_export;
+
+// Check if one of the values separated by / in a field is in a comma separated list
+static int IP2Proxy_field_listed(const IP2ProxyField *field, const char *list)
+{
+	const char *value = field->data;
+	const char *last = field->data + field->length;
+
+	for (;;) {
+		const char *next = (const char *) memchr(value, '/', (size_t) (last - value));
+		const char *item = list;
+		size_t length = (size_t) (((next == NULL) ? last : next) - value);
+
+		while (*item != '\0') {
+			size_t item_length = strcspn(item, ",");
+
+			if (item_length == length && memcmp(item, value, length) == 0) {
+				return 1;
+			}
+
+			item += item_length;
+			item += (*item == ',') ? 1 : 0;
+		}
+
+		if (next == NULL) {
+			return 0;
+		}
+
+		value = next + 1;
+	}
+}
+
+static int IP2Proxy_export_match(const IP2ProxyExportFilter *filter, const IP2ProxyView *view)
+{
+	int32_t score = 0;
+	uint32_t i;
+
+	if (view->is_proxy <= 0) {
+		return 0;
+	}
+
+	if ((filter->proxy_type != NULL && !IP2Proxy_field_listed(&view->proxy_type, filter->proxy_type))
+		|| (filter->usage_type != NULL && !IP2Proxy_field_listed(&view->usage_type, filter->usage_type))
+		|| (filter->threat != NULL && !IP2Proxy_field_listed(&view->threat, filter->threat))) {
+		return 0;
+	}
+
+	if (filter->fraud_score > 0) {
+		for (i = 0; i < view->fraud_score.length && view->fraud_score.data[i] >= '0' && view->fraud_score.data[i] <= '9' && score < 1000; i++) {
+			score = score * 10 + (view->fraud_score.data[i] - '0');
+		}
+
+		if (i == 0 || score < filter->fraud_score) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// Split the pending run into the fewest aligned prefixes
+static void IP2Proxy_export_flush(ip2proxy_export *export)
+{
+	uint32_t width = export->ipv6 ? 128 : 32;
+	uint8_t key[16];
+	uint8_t last[16];
+	uint32_t bits;
+	uint32_t n;
+	uint8_t *prefix;
+	int i;
+
+	if (!export->pending) {
+		return;
+	}
+
+	export->pending = 0;
+	memcpy(key, export->start, 16);
+
+	for (;;) {
+		// Widest block aligned on key, shrunk until it ends within the run
+		for (bits = 0, i = 15; i >= 0 && key[i] == 0; i--) {
+			bits += 8;
+		}
+
+		for (n = (i >= 0) ? key[i] : 0; i >= 0 && (n & 1) == 0; n >>= 1) {
+			bits++;
+		}
+
+		bits = (bits > width) ? width : bits;
+
+		for (;;) {
+			memcpy(last, key, 16);
+
+			for (i = 15, n = bits; n > 0; i--) {
+				last[i] |= (uint8_t) ((n >= 8) ? 0xFF : (1U << n) - 1);
+				n = (n >= 8) ? n - 8 : 0;
+			}
+
+			if (memcmp(last, export->end, 16) <= 0) {
+				break;
+			}
+
+			bits--;
+		}
+
+		if (export->count == export->size) {
+			uint32_t size = (export->size == 0) ? 4096 : export->size * 2;
+			uint8_t *prefixes = (uint8_t *) realloc(export->prefixes, (size_t) size * 17);
+
+			if (prefixes == NULL) {
+				export->failed = 1;
+				return;
+			}
+
+			export->prefixes = prefixes;
+			export->size = size;
+		}
+
+		prefix = export->prefixes + (size_t) export->count++ * 17;
+		memcpy(prefix, key, 16);
+		prefix[16] = (uint8_t) (width - bits);
+
+		if (memcmp(last, export->end, 16) == 0) {
+			return;
+		}
+
+		// Next block starts right after this one
+		memcpy(key, last, 16);
+
+		for (i = 15; i >= 0 && ++key[i] == 0; i--) {
+		}
+	}
+}
+
+// Merge consecutive matching rows into runs, rows of a database are contiguous
+static int32_t IP2Proxy_export_row(int ipv6, const uint8_t *from, const uint8_t *to, const IP2ProxyView *view, void *user_data)
+{
+	ip2proxy_export *export = (ip2proxy_export *) user_data;
+
+	(void) ipv6;
+
+	if (!IP2Proxy_export_match(export->filter, view)) {
+		IP2Proxy_export_flush(export);
+	} else if (export->pending) {
+		memcpy(export->end, to, 16);
+	} else {
+		memcpy(export->start, from, 16);
+		memcpy(export->end, to, 16);
+		export->pending = 1;
+	}
+
+	return export->failed;
+}
+
+// Write the prefixes of one address family as text
+static void IP2Proxy_export_text(const ip2proxy_export *export, enum IP2Proxy_export_format format, const char *name, FILE *output)
+{
+	const char *family = export->ipv6 ? "6" : "4";
+	char text[INET6_ADDRSTRLEN];
+	const uint8_t *prefix;
+	uint32_t i;
+
+	if (format == IP2PROXY_EXPORT_NFTABLES) {
+		fprintf(output, "set %s_v%s {\n\ttype ipv%s_addr\n\tflags interval\n", name, family, family);
+	} else {
+		fprintf(output, "create %s_v%s hash:net family inet%s maxelem %u -exist\n", name, family, export->ipv6 ? "6" : "", (export->count > 65536) ? export->count : 65536);
+	}
+
+	for (i = 0; i < export->count; i++) {
+		prefix = export->prefixes + (size_t) i * 17;
+		IP2Proxy_key_to_text(export->ipv6, prefix, text);
+
+		if (format == IP2PROXY_EXPORT_NFTABLES) {
+			fprintf(output, "%s%s/%u", (i == 0) ? "\telements = {\n\t\t" : ",\n\t\t", text, prefix[16]);
+		} else {
+			fprintf(output, "add %s_v%s %s/%u -exist\n", name, family, text, prefix[16]);
+		}
+	}
+
+	if (format == IP2PROXY_EXPORT_NFTABLES) {
+		fprintf(output, "%s}\n", (export->count > 0) ? "\n\t}\n" : "");
+	}
+}
+
+// Write the prefixes of one address family as BPF LPM trie keys
+static void IP2Proxy_export_binary(const ip2proxy_export *export, FILE *output)
+{
+	uint8_t entry[sizeof(uint32_t) + 16];
+	uint32_t key_size = export->ipv6 ? 16 : 4;
+	uint32_t length;
+	const uint8_t *prefix;
+	uint32_t i;
+
+	for (i = 0; i < export->count; i++) {
+		prefix = export->prefixes + (size_t) i * 17;
+		length = prefix[16];
+		memcpy(entry, &length, sizeof(uint32_t));
+		memcpy(entry + sizeof(uint32_t), prefix + 16 - key_size, key_size);
+		fwrite(entry, sizeof(uint32_t) + key_size, 1, output);
+	}
+}
+
+// Write the fewest CIDR prefixes covering the proxies matching a filter, returns the number of prefixes
+int32_t IP2Proxy_export_cidr(IP2Proxy *handler, const IP2ProxyExportFilter *filter, enum IP2Proxy_export_format format, const char *name, FILE *output)
+{
+	static const IP2ProxyExportFilter any = { NULL, NULL, NULL, 0 };
+	ip2proxy_export exports[2];
+	IP2ProxyPrefixHeader header;
+	uint8_t start[16];
+	uint8_t end[16];
+	uint32_t mode = ISPROXY | PROXYTYPE;
+	uint8_t dbtype;
+	int32_t count = -1;
+	int failed = 0;
+	int i;
+
+	if (handler == NULL || name == NULL || output == NULL || handler->is_csv == 1 || handler->database_type > 12) {
+		return -1;
+	}
+
+	filter = (filter == NULL) ? &any : filter;
+	dbtype = handler->database_type;
+
+	// A filter on a column which the database does not have would export nothing
+	if ((filter->proxy_type != NULL && IP2PROXY_PROXY_TYPE_POSITION[dbtype] == 0)
+		|| (filter->usage_type != NULL && IP2PROXY_USAGE_TYPE_POSITION[dbtype] == 0)
+		|| (filter->threat != NULL && IP2PROXY_THREAT_POSITION[dbtype] == 0)
+		|| (filter->fraud_score > 0 && IP2PROXY_FRAUD_SCORE_POSITION[dbtype] == 0)) {
+		return -1;
+	}
+
+	mode |= (filter->usage_type != NULL) ? USAGETYPE : 0;
+	mode |= (filter->threat != NULL) ? THREAT : 0;
+	mode |= (filter->fraud_score > 0) ? FRAUDSCORE : 0;
+
+	// One sequential walk of each row array
+	for (i = 0; i < 2; i++) {
+		memset(&exports[i], 0, sizeof(ip2proxy_export));
+		exports[i].filter = filter;
+		exports[i].ipv6 = i;
+		memset(start, 0, sizeof(start));
+		memset(end, i ? 0xFF : 0, sizeof(end));
+		memset(end + 12, 0xFF, 4);
+
+		if (!failed) {
+			failed = IP2Proxy_walk_range(handler, i, start, end, mode, IP2Proxy_export_row, &exports[i]) < 0;
+			IP2Proxy_export_flush(&exports[i]);
+			failed |= exports[i].failed;
+		}
+	}
+
+	if (!failed) {
+		if (format == IP2PROXY_EXPORT_BINARY) {
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, IP2PROXY_PREFIX_MAGIC, sizeof(header.magic));
+			header.byte_order = 0x01020304;
+			header.ipv4_count = exports[0].count;
+			header.ipv6_count = exports[1].count;
+			fwrite(&header, sizeof(header), 1, output);
+			IP2Proxy_export_binary(&exports[0], output);
+			IP2Proxy_export_binary(&exports[1], output);
+		} else {
+			IP2Proxy_export_text(&exports[0], format, name, output);
+
+			if (handler->ipv6_database_count > 0) {
+				IP2Proxy_export_text(&exports[1], format, name, output);
+			}
+		}
+
+		count = (fflush(output) == 0 && !ferror(output)) ? (int32_t) (exports[0].count + exports[1].count) : -1;
+	}
+
+	free(exports[0].prefixes);
+	free(exports[1].prefixes);
+
+	return count;
+}
+
+// Networks holding at least one proxy, a clear bit answers a lookup without a search.
+// A /24 IPv6 prefix is too large to tell much, the /48 networks of its proxies are hashed into a second bitmap,
+// unless a proxy row spans too many of them to set one bit for each.
+typedef struct ip2proxy_negative_filter {
+	uint8_t *ipv4; // one bit per /24
+	uint8_t *ipv6; // one bit per /24 prefix, NULL without IPv6 rows
+	uint8_t *ipv6_wide; // one bit per /24 prefix searched whatever its /48 networks
+	uint8_t *ipv6_networks; // one bit per hash of a /48 network
+	uint32_t ipv4_buckets;
+	uint32_t ipv6_buckets;
+	uint32_t ipv6_networks_set;
+	uint64_t lookups;
+	uint64_t skipped;
+	uint64_t ipv6_lookups;
+	uint64_t ipv6_skipped;
+} ip2proxy_negative_filter;
+
+#define IP2PROXY_FILTER_BUCKETS (1 << 24)
+#define IP2PROXY_FILTER_NETWORK_SPAN 256 // /48 networks of a row hashed one by one, the /24 prefixes of a longer row are wide
+
+// Bit of a /48 network, the first 6 bytes of an IPv6 address
+static uint32_t IP2Proxy_negative_network(uint64_t network)
+{
+	return (uint32_t) ((network * 0x9E3779B97F4A7C15ULL) >> 40);
+}
+
+static uint64_t IP2Proxy_negative_prefix48(const uint8_t *address)
+{
+	uint64_t network = 0;
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		network = (network << 8) | address[i];
+	}
+
+	return network;
+}
+
+// Lookups may run on several threads in memory modes
+#if defined(__GNUC__)
+#define IP2PROXY_FILTER_COUNT(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)
+#else
+#define IP2PROXY_FILTER_COUNT(counter) ((counter)++)
+#endif
+
+static void IP2Proxy_negative_filter_free(void *filter)
+{
+	ip2proxy_negative_filter *negative = (ip2proxy_negative_filter *) filter;
+
+	if (negative != NULL) {
+		free(negative->ipv4);
+		free(negative->ipv6);
+		free(negative->ipv6_wide);
+		free(negative->ipv6_networks);
+		free(negative);
+	}
+}
+
+// Set the bucket bits of every row which is a proxy
+static int32_t IP2Proxy_negative_filter_row(int ipv6, const uint8_t *from, const uint8_t *to, const IP2ProxyView *view, void *user_data)
+{
+	ip2proxy_negative_filter *negative = (ip2proxy_negative_filter *) user_data;
+	uint8_t *bits = ipv6 ? negative->ipv6 : negative->ipv4;
+	uint32_t *buckets = ipv6 ? &negative->ipv6_buckets : &negative->ipv4_buckets;
+	const uint8_t *first = ipv6 ? from : from + 12;
+	const uint8_t *last = ipv6 ? to : to + 12;
+	uint32_t bucket = ((uint32_t) first[0] << 16) | ((uint32_t) first[1] << 8) | first[2];
+	uint32_t end = ((uint32_t) last[0] << 16) | ((uint32_t) last[1] << 8) | last[2];
+	uint64_t network;
+	uint64_t last_network;
+	uint32_t bit;
+	int wide = 0;
+
+	if (view->is_proxy == 0) {
+		return 0;
+	}
+
+	if (ipv6) {
+		network = IP2Proxy_negative_prefix48(first);
+		last_network = IP2Proxy_negative_prefix48(last);
+		wide = (last_network - network >= IP2PROXY_FILTER_NETWORK_SPAN);
+
+		for (; !wide; network++) {
+			bit = IP2Proxy_negative_network(network);
+
+			if ((negative->ipv6_networks[bit >> 3] & (1 << (bit & 7))) == 0) {
+				negative->ipv6_networks[bit >> 3] |= (uint8_t) (1 << (bit & 7));
+				negative->ipv6_networks_set++;
+			}
+
+			if (network == last_network) {
+				break;
+			}
+		}
+	}
+
+	for (;; bucket++) {
+		if ((bits[bucket >> 3] & (1 << (bucket & 7))) == 0) {
+			bits[bucket >> 3] |= (uint8_t) (1 << (bucket & 7));
+			(*buckets)++;
+		}
+
+		if (wide) {
+			negative->ipv6_wide[bucket >> 3] |= (uint8_t) (1 << (bucket & 7));
+		}
+
+		if (bucket == end) {
+			return 0;
+		}
+	}
+}
+
+// Check the negative filter, returns 1 when the IP address is not in any proxy range
+static int IP2Proxy_negative_hit(IP2Proxy *handler, const ip_container *parsed_ip)
+{
+	ip2proxy_negative_filter *negative = (ip2proxy_negative_filter *) handler->negative_filter;
+	uint32_t bucket;
+	uint32_t bit;
+
+	if (parsed_ip->version == 4) {
+		bucket = parsed_ip->ipv4 >> 8;
+		IP2PROXY_FILTER_COUNT(negative->lookups);
+
+		if (negative->ipv4[bucket >> 3] & (1 << (bucket & 7))) {
+			return 0;
+		}
+	} else if (parsed_ip->version == 6 && negative->ipv6 != NULL) {
+		bucket = ((uint32_t) parsed_ip->ipv6.s6_addr[0] << 16) | ((uint32_t) parsed_ip->ipv6.s6_addr[1] << 8) | parsed_ip->ipv6.s6_addr[2];
+		bit = IP2Proxy_negative_network(IP2Proxy_negative_prefix48(parsed_ip->ipv6.s6_addr));
+		IP2PROXY_FILTER_COUNT(negative->lookups);
+		IP2PROXY_FILTER_COUNT(negative->ipv6_lookups);
+
+		// A prefix holding a proxy is searched when it is wide or the bit of the /48 network is set
+		if ((negative->ipv6[bucket >> 3] & (1 << (bucket & 7))) && ((negative->ipv6_wide[bucket >> 3] & (1 << (bucket & 7))) || (negative->ipv6_networks[bit >> 3] & (1 << (bit & 7))))) {
+			return 0;
+		}
+
+		IP2PROXY_FILTER_COUNT(negative->ipv6_skipped);
+	} else {
+		return 0;
+	}
+
+	IP2PROXY_FILTER_COUNT(negative->skipped);
+
+	return 1;
+}
+
+// Build the negative lookup filter from one walk of the rows, or release it
+int32_t IP2Proxy_set_negative_filter(IP2Proxy *handler, int32_t enable)
+{
+	ip2proxy_negative_filter *negative;
+	uint8_t start[16];
+	uint8_t end[16];
+
+	if (handler == NULL || handler->is_csv == 1 || handler->database_type > 12) {
+		return -1;
+	}
+
+	IP2Proxy_negative_filter_free(handler->negative_filter);
+	handler->negative_filter = NULL;
+
+	if (!enable) {
+		return 0;
+	}
+
+	if ((negative = (ip2proxy_negative_filter *) calloc(1, sizeof(ip2proxy_negative_filter))) == NULL) {
+		return -1;
+	}
+
+	if ((negative->ipv4 = (uint8_t *) calloc(IP2PROXY_FILTER_BUCKETS / 8, 1)) == NULL
+		|| (handler->ipv6_database_count > 0 && ((negative->ipv6 = (uint8_t *) calloc(IP2PROXY_FILTER_BUCKETS / 8, 1)) == NULL
+			|| (negative->ipv6_wide = (uint8_t *) calloc(IP2PROXY_FILTER_BUCKETS / 8, 1)) == NULL || (negative->ipv6_networks = (uint8_t *) calloc(IP2PROXY_FILTER_BUCKETS / 8, 1)) == NULL))) {
+		IP2Proxy_negative_filter_free(negative);
+		return -1;
+	}
+
+	memset(start, 0, sizeof(start));
+	memset(end, 0, sizeof(end));
+	memset(end + 12, 0xFF, 4);
+
+	if (IP2Proxy_walk_range(handler, 0, start, end, ISPROXY, IP2Proxy_negative_filter_row, negative) < 0) {
+		IP2Proxy_negative_filter_free(negative);
+		return -1;
+	}
+
+	memset(end, 0xFF, sizeof(end));
+
+	if (negative->ipv6 != NULL && IP2Proxy_walk_range(handler, 1, start, end, ISPROXY, IP2Proxy_negative_filter_row, negative) < 0) {
+		IP2Proxy_negative_filter_free(negative);
+		return -1;
+	}
+
+	// No row holds the last IPv6 address, its lookups keep the search and its error
+	if (negative->ipv6 != NULL) {
+		negative->ipv6[IP2PROXY_FILTER_BUCKETS / 8 - 1] |= 0x80;
+		negative->ipv6_wide[IP2PROXY_FILTER_BUCKETS / 8 - 1] |= 0x80;
+	}
+
+	handler->negative_filter = negative;
+
+	return 0;
+}
+
+int32_t IP2Proxy_get_filter_stats(IP2Proxy *handler, IP2ProxyFilterStats *stats)
+{
+	ip2proxy_negative_filter *negative;
+
+	if (handler == NULL || stats == NULL || handler->negative_filter == NULL) {
+		return -1;
+	}
+
+	negative = (ip2proxy_negative_filter *) handler->negative_filter;
+	stats->lookups = negative->lookups;
+	stats->skipped = negative->skipped;
+	stats->ipv4_buckets = negative->ipv4_buckets;
+	stats->ipv6_buckets = negative->ipv6_buckets;
+	stats->ipv6_lookups = negative->ipv6_lookups;
+	stats->ipv6_skipped = negative->ipv6_skipped;
+	stats->ipv6_networks = negative->ipv6_networks_set;
+
+	return 0;
+}
+
+// String fields of a view with their mode flag
+static const struct {
+	uint32_t flag;
+	size_t offset;
+} IP2PROXY_VIEW_FIELDS[] = {
+	{ COUNTRYSHORT, offsetof(IP2ProxyView, country_short) },
+	{ COUNTRYLONG, offsetof(IP2ProxyView, country_long) },
+	{ REGION, offsetof(IP2ProxyView, region) },
+	{ CITY, offsetof(IP2ProxyView, city) },
+	{ ISP, offsetof(IP2ProxyView, isp) },
+	{ PROXYTYPE, offsetof(IP2ProxyView, proxy_type) },
+	{ DOMAINNAME, offsetof(IP2ProxyView, domain) },
+	{ USAGETYPE, offsetof(IP2ProxyView, usage_type) },
+	{ ASN, offsetof(IP2ProxyView, asn) },
+	{ AS, offsetof(IP2ProxyView, as_) },
+	{ LASTSEEN, offsetof(IP2ProxyView, last_seen) },
+	{ THREAT, offsetof(IP2ProxyView, threat) },
+	{ PROVIDER, offsetof(IP2ProxyView, provider) },
+	{ FRAUDSCORE, offsetof(IP2ProxyView, fraud_score) }
+};
+
+#define IP2PROXY_VIEW_FIELD(view, i) ((IP2ProxyField *) ((char *) (view) + IP2PROXY_VIEW_FIELDS[i].offset))
+
+// Check if two views hold the same values for the fields of mode
+static int IP2Proxy_view_equals(const IP2ProxyView *a, const IP2ProxyView *b, uint32_t mode)
+{
+	const IP2ProxyField *field_a;
+	const IP2ProxyField *field_b;
+	size_t i;
+
+	if ((mode & ISPROXY) && a->is_proxy != b->is_proxy) {
+		return 0;
+	}
+
+	for (i = 0; i < sizeof(IP2PROXY_VIEW_FIELDS) / sizeof(IP2PROXY_VIEW_FIELDS[0]); i++) {
+		if ((mode & IP2PROXY_VIEW_FIELDS[i].flag) == 0) {
+			continue;
+		}
+
+		field_a = IP2PROXY_VIEW_FIELD(a, i);
+		field_b = IP2PROXY_VIEW_FIELD(b, i);
+
+		if (field_a->length != field_b->length || memcmp(field_a->data, field_b->data, field_a->length) != 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// Copy a view, fields in the buffer of the source are moved to the buffer of the copy
+static void IP2Proxy_copy_view(IP2ProxyView *target, const IP2ProxyView *source)
+{
+	uintptr_t low = (uintptr_t) source->buffer;
+	uintptr_t high = low + sizeof(source->buffer);
+	IP2ProxyField *field;
+	size_t i;
+
+	memcpy(target, source, sizeof(IP2ProxyView));
+
+	for (i = 0; i < sizeof(IP2PROXY_VIEW_FIELDS) / sizeof(IP2PROXY_VIEW_FIELDS[0]); i++) {
+		field = IP2PROXY_VIEW_FIELD(target, i);
+
+		if ((uintptr_t) field->data >= low && (uintptr_t) field->data < high) {
+			field->data = (const char *) target->buffer + ((uintptr_t) field->data - low);
+		}
+	}
+}
+
+// Rows of both databases and the change waiting to be merged with the next one
+typedef struct ip2proxy_diff {
+	ip2proxy_row_cursor cursors[2];
+	IP2ProxyView views[2];
+	uint8_t values[2][1024]; // string pointers of both rows where the change starts
+	uint8_t from[16];
+	uint8_t to[16];
+	int pending;
+	int32_t changes;
+	int32_t (*report)(struct ip2proxy_diff *diff, int ipv6);
+	IP2Proxy_diff_callback callback;
+	void *user_data;
+} ip2proxy_diff;
+
+// Pass the pending change to the report function, returns non zero to stop
+static int32_t IP2Proxy_diff_flush(ip2proxy_diff *diff, int ipv6)
+{
+	if (!diff->pending) {
+		return 0;
+	}
+
+	diff->pending = 0;
+	diff->changes++;
+
+	return diff->report(diff, ipv6);
+}
+
+// Pass a change to the callback of IP2Proxy_diff with its bounds as text
+static int32_t IP2Proxy_diff_report(ip2proxy_diff *diff, int ipv6)
+{
+	char from_text[INET6_ADDRSTRLEN];
+	char to_text[INET6_ADDRSTRLEN];
+
+	IP2Proxy_key_to_text(ipv6, diff->from, from_text);
+	IP2Proxy_key_to_text(ipv6, diff->to, to_text);
+
+	return diff->callback(from_text, to_text, &diff->views[0], &diff->views[1], diff->user_data);
+}
+
+// Merge walk the rows of one address family of both databases, returns non zero when stopped
+static int32_t IP2Proxy_diff_rows(ip2proxy_diff *diff, IP2Proxy *old_handler, IP2Proxy *new_handler, int ipv6, uint32_t mode)
+{
+	ip2proxy_row_cursor *old_rows = &diff->cursors[0];
+	ip2proxy_row_cursor *new_rows = &diff->cursors[1];
+	uint8_t start[16];
+	uint8_t end[16];
+	int old_done;
+	int new_done;
+	int i;
+
+	IP2Proxy_cursor_init(old_rows, old_handler, ipv6, mode, 0);
+	IP2Proxy_cursor_init(new_rows, new_handler, ipv6, mode, 0);
+
+	if (!IP2Proxy_cursor_read(old_rows) || !IP2Proxy_cursor_read(new_rows)) {
+		return 0;
+	}
+
+	IP2Proxy_cursor_decode(old_rows);
+	IP2Proxy_cursor_decode(new_rows);
+	memcpy(start, (memcmp(old_rows->from, new_rows->from, 16) > 0) ? old_rows->from : new_rows->from, 16);
+
+	for (;;) {
+		// Both rows hold the same values up to the first end
+		old_done = memcmp(old_rows->to, new_rows->to, 16) <= 0;
+		new_done = memcmp(new_rows->to, old_rows->to, 16) <= 0;
+		memcpy(end, old_done ? old_rows->to : new_rows->to, 16);
+
+		if (IP2Proxy_view_equals(&old_rows->view, &new_rows->view, mode)) {
+			if (IP2Proxy_diff_flush(diff, ipv6) != 0) {
+				return 1;
+			}
+		} else if (diff->pending && IP2Proxy_view_equals(&old_rows->view, &diff->views[0], mode) && IP2Proxy_view_equals(&new_rows->view, &diff->views[1], mode)) {
+			memcpy(diff->to, end, 16);
+		} else {
+			if (IP2Proxy_diff_flush(diff, ipv6) != 0) {
+				return 1;
+			}
+
+			IP2Proxy_copy_view(&diff->views[0], &old_rows->view);
+			IP2Proxy_copy_view(&diff->views[1], &new_rows->view);
+			memcpy(diff->values[0], old_rows->data + (ipv6 ? 16 : 4), (old_handler->database_column - 1) * 4);
+			memcpy(diff->values[1], new_rows->data + (ipv6 ? 16 : 4), (new_handler->database_column - 1) * 4);
+			memcpy(diff->from, start, 16);
+			memcpy(diff->to, end, 16);
+			diff->pending = 1;
+		}
+
+		if (old_done) {
+			old_rows->row++;
+
+			if (!IP2Proxy_cursor_read(old_rows)) {
+				break;
+			}
+
+			IP2Proxy_cursor_decode(old_rows);
+		}
+
+		if (new_done) {
+			new_rows->row++;
+
+			if (!IP2Proxy_cursor_read(new_rows)) {
+				break;
+			}
+
+			IP2Proxy_cursor_decode(new_rows);
+		}
+
+		memcpy(start, end, 16);
+
+		for (i = 15; i >= 0 && ++start[i] == 0; i--) {
+		}
+	}
+
+	return IP2Proxy_diff_flush(diff, ipv6);
+}
+
+// Call back every address range whose fields of mode differ between two databases, returns the number of ranges
+int32_t IP2Proxy_diff(IP2Proxy *old_handler, IP2Proxy *new_handler, uint32_t mode, IP2Proxy_diff_callback callback, void *user_data)
+{
+	ip2proxy_diff *diff;
+	int32_t changes;
+
+	if (old_handler == NULL || new_handler == NULL || callback == NULL || old_handler->is_csv == 1 || new_handler->is_csv == 1) {
+		return -1;
+	}
+
+	// Rows of a DB in memory would be read for both handlers
+	if (lookup_mode != IP2PROXY_FILE_IO) {
+		printf(DATABASE_IN_MEMORY);
+		return -1;
+	}
+
+	if ((diff = (ip2proxy_diff *) malloc(sizeof(ip2proxy_diff))) == NULL) {
+		return -1;
+	}
+
+	diff->pending = 0;
+	diff->changes = 0;
+	diff->report = IP2Proxy_diff_report;
+	diff->callback = callback;
+	diff->user_data = user_data;
+
+	// IPv6 rows are only compared when both databases have them
+	if (IP2Proxy_diff_rows(diff, old_handler, new_handler, 0, mode) == 0 && old_handler->ipv6_database_count > 0 && new_handler->ipv6_database_count > 0) {
+		IP2Proxy_diff_rows(diff, old_handler, new_handler, 1, mode);
+	}
+
+	changes = diff->changes;
+	free(diff);
+
+	return changes;
+}
+
+// Encode a little endian 32-bit value
+static void IP2Proxy_put32(uint8_t *buffer, uint32_t value)
+{
+	buffer[0] = (uint8_t) value;
+	buffer[1] = (uint8_t) (value >> 8);
+	buffer[2] = (uint8_t) (value >> 16);
+	buffer[3] = (uint8_t) (value >> 24);
+}
+
+// Bytes of the string a column points to, the country column holds the short name before the long one
+static uint32_t IP2Proxy_column_string(IP2Proxy *handler, uint32_t pointer, int country, uint8_t *buffer, const uint8_t **string)
+{
+	uint32_t prefix = country ? 3 : 0;
+
+	*string = IP2Proxy_fetch(handler, handler->strings_base + pointer + 1, prefix + 256, buffer);
+
+	return prefix + 1 + (*string)[prefix];
+}
+
+// String of the new database already in a patch
+typedef struct ip2proxy_patch_slot {
+	uint32_t pointer; // 0 for an empty slot
+	uint32_t offset;
+	int country;
+} ip2proxy_patch_slot;
+
+// Patch being written, each string of the new database is stored once
+typedef struct ip2proxy_patch_writer {
+	IP2Proxy *handlers[2];
+	uint32_t country_column;
+	FILE *file;
+	uint32_t crc;
+	uint32_t changes[2];
+	uint8_t *strings;
+	uint32_t strings_size;
+	uint32_t strings_capacity;
+	ip2proxy_patch_slot *slots;
+	uint32_t slot_count;
+	uint32_t used;
+	int failed;
+} ip2proxy_patch_writer;
+
+static ip2proxy_patch_slot *IP2Proxy_patch_slot(ip2proxy_patch_slot *slots, uint32_t slot_count, uint32_t pointer, int country)
+{
+	uint32_t i = (pointer * 2654435761U) & (slot_count - 1);
+
+	while (slots[i].pointer != 0 && (slots[i].pointer != pointer || slots[i].country != country)) {
+		i = (i + 1) & (slot_count - 1);
+	}
+
+	return &slots[i];
+}
+
+// Offset of a string of the new database in the strings of the patch, the string is added when missing
+static uint32_t IP2Proxy_patch_string(ip2proxy_patch_writer *writer, uint32_t pointer, int country, const uint8_t *string, uint32_t length)
+{
+	ip2proxy_patch_slot *slot;
+	uint32_t i;
+
+	// Kept at most half full
+	if ((writer->used + 1) * 2 > writer->slot_count) {
+		uint32_t slot_count = writer->slot_count * 2;
+		ip2proxy_patch_slot *slots = (ip2proxy_patch_slot *) calloc(slot_count, sizeof(ip2proxy_patch_slot));
+
+		if (slots == NULL) {
+			writer->failed = 1;
+			return 0;
+		}
+
+		for (i = 0; i < writer->slot_count; i++) {
+			if (writer->slots[i].pointer != 0) {
+				*IP2Proxy_patch_slot(slots, slot_count, writer->slots[i].pointer, writer->slots[i].country) = writer->slots[i];
+			}
+		}
+
+		free(writer->slots);
+		writer->slots = slots;
+		writer->slot_count = slot_count;
+	}
+
+	slot = IP2Proxy_patch_slot(writer->slots, writer->slot_count, pointer, country);
+
+	if (slot->pointer != 0) {
+		return slot->offset;
+	}
+
+	if (writer->strings_size + length > writer->strings_capacity) {
+		uint32_t capacity = writer->strings_capacity * 2 + length;
+		uint8_t *strings = (uint8_t *) realloc(writer->strings, capacity);
+
+		if (strings == NULL) {
+			writer->failed = 1;
+			return 0;
+		}
+
+		writer->strings = strings;
+		writer->strings_capacity = capacity;
+	}
+
+	memcpy(writer->strings + writer->strings_size, string, length);
+	slot->pointer = pointer;
+	slot->offset = writer->strings_size;
+	slot->country = country;
+	writer->strings_size += length;
+	writer->used++;
+
+	return slot->offset;
+}
+
+// Write a changed range, columns whose string did not change keep pointing into the old database
+static int32_t IP2Proxy_patch_change(ip2proxy_diff *diff, int ipv6)
+{
+	ip2proxy_patch_writer *writer = (ip2proxy_patch_writer *) diff->user_data;
+	uint32_t columns = writer->handlers[0]->database_column - 1;
+	uint8_t entry[IP2PROXY_PATCH_ENTRY_SIZE(256)];
+	uint8_t buffers[2][3 + 256];
+	const uint8_t *strings[2];
+	uint32_t lengths[2];
+	uint32_t pointers[2];
+	uint32_t new_columns = 0;
+	uint32_t value;
+	uint32_t i;
+	int country;
+
+	memcpy(entry, diff->from, 16);
+	memcpy(entry + 16, diff->to, 16);
+
+	for (i = 0; i < columns; i++) {
+		country = (i == writer->country_column);
+		pointers[0] = IP2Proxy_get32(diff->values[0] + i * 4);
+		pointers[1] = IP2Proxy_get32(diff->values[1] + i * 4);
+		lengths[0] = IP2Proxy_column_string(writer->handlers[0], pointers[0], country, buffers[0], &strings[0]);
+		lengths[1] = IP2Proxy_column_string(writer->handlers[1], pointers[1], country, buffers[1], &strings[1]);
+
+		if (lengths[0] == lengths[1] && memcmp(strings[0], strings[1], lengths[0]) == 0) {
+			value = pointers[0];
+		} else {
+			value = IP2Proxy_patch_string(writer, pointers[1], country, strings[1], lengths[1]);
+			new_columns |= 1U << i;
+		}
+
+		memcpy(entry + 36 + i * 4, &value, 4);
+	}
+
+	memcpy(entry + 32, &new_columns, 4);
+	writer->crc = IP2Proxy_crc32c(writer->crc, entry, IP2PROXY_PATCH_ENTRY_SIZE(columns + 1));
+	writer->changes[ipv6]++;
+
+	if (writer->failed || fwrite(entry, IP2PROXY_PATCH_ENTRY_SIZE(columns + 1), 1, writer->file) != 1) {
+		writer->failed = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+// Write the changes from one database to another as a patch applied by IP2Proxy_apply_patch, returns the number of ranges
+int32_t IP2Proxy_make_patch(IP2Proxy *old_handler, IP2Proxy *new_handler, const char *path)
+{
+	ip2proxy_patch_header header;
+	ip2proxy_patch_writer writer;
+	ip2proxy_diff *diff;
+	char *temporary;
+	FILE *image = NULL;
+	uint32_t expected;
+	int32_t result = -1;
+
+	if (old_handler == NULL || new_handler == NULL || path == NULL || old_handler->is_csv == 1 || new_handler->is_csv == 1) {
+		return -1;
+	}
+
+	if (lookup_mode != IP2PROXY_FILE_IO) {
+		printf(DATABASE_IN_MEMORY);
+		return -1;
+	}
+
+	// The rows of both databases must have the same columns, patches rebuild the layout of 32-bit offsets
+	if (old_handler->large_format || new_handler->large_format || old_handler->database_type != new_handler->database_type || old_handler->database_column != new_handler->database_column || old_handler->database_column < 2 || old_handler->database_column > 33 || old_handler->ipv4_database_count == 0 || (old_handler->ipv6_database_count > 0) != (new_handler->ipv6_database_count > 0)) {
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memset(&writer, 0, sizeof(writer));
+
+	if (IP2Proxy_index_fingerprint(old_handler, &header.database_crc32c) == -1) {
+		return -1;
+	}
+
+	writer.handlers[0] = old_handler;
+	writer.handlers[1] = new_handler;
+	writer.country_column = IP2PROXY_COUNTRY_POSITION[old_handler->database_type] - 2;
+	writer.slot_count = 1024;
+
+	diff = (ip2proxy_diff *) malloc(sizeof(ip2proxy_diff));
+	writer.slots = (ip2proxy_patch_slot *) calloc(writer.slot_count, sizeof(ip2proxy_patch_slot));
+
+	// Written aside then renamed like a sidecar index file
+	if ((temporary = (char *) malloc(strlen(path) + 5)) != NULL) {
+		sprintf(temporary, "%s.tmp", path);
+	}
+
+	if (diff == NULL || writer.slots == NULL || temporary == NULL || (writer.file = fopen(temporary, "wb")) == NULL) {
+		free(diff);
+		free(writer.slots);
+		free(temporary);
+		return -1;
+	}
+
+	diff->pending = 0;
+	diff->changes = 0;
+	diff->report = IP2Proxy_patch_change;
+	diff->user_data = &writer;
+
+	// Room for the header, filled once the ranges are counted
+	if (fwrite(&header, sizeof(header), 1, writer.file) == 1
+		&& IP2Proxy_diff_rows(diff, old_handler, new_handler, 0, ALL) == 0
+		&& (old_handler->ipv6_database_count == 0 || IP2Proxy_diff_rows(diff, old_handler, new_handler, 1, ALL) == 0)
+		&& (writer.strings_size == 0 || fwrite(writer.strings, writer.strings_size, 1, writer.file) == 1)) {
+		memcpy(header.magic, IP2PROXY_PATCH_MAGIC, sizeof(header.magic));
+		header.version = IP2PROXY_PATCH_VERSION;
+		header.byte_order = 0x01020304;
+		header.payload_crc32c = IP2Proxy_crc32c(writer.crc, writer.strings, writer.strings_size);
+		header.ipv4_changes = writer.changes[0];
+		header.ipv6_changes = writer.changes[1];
+		header.strings_size = writer.strings_size;
+		header.database_type = new_handler->database_type;
+		header.database_column = new_handler->database_column;
+		header.database_year = new_handler->database_year;
+		header.database_month = new_handler->database_month;
+		header.database_day = new_handler->database_day;
+
+		// Applied once to a scratch file to record the CRC32C of the database it produces
+		if (fseek(writer.file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, writer.file) == 1 && fflush(writer.file) == 0
+			&& (image = tmpfile()) != NULL && IP2Proxy_patch_image(old_handler, temporary, image, &header.output_crc32c, &expected) != -1
+			&& fseek(writer.file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, writer.file) == 1) {
+			result = diff->changes;
+		}
+
+		if (image != NULL) {
+			fclose(image);
+		}
+	}
+
+	if (fclose(writer.file) != 0) {
+		result = -1;
+	}
+
+	if (result != -1 && rename(temporary, path) != 0) {
+		result = -1;
+	}
+
+	if (result == -1) {
+		remove(temporary);
+	}
+
+	free(diff);
+	free(writer.slots);
+	free(writer.strings);
+	free(temporary);
+
+	return result;
+}
+
+// Database image written by IP2Proxy_apply_patch, rows are counted and indexed by a first pass then written by a second one
+typedef struct ip2proxy_image {
+	ip2proxy_row_cursor cursor;
+	IP2Proxy *handler;
+	FILE *file; // NULL while counting
+	int ipv6;
+	uint32_t rows;
+	uint8_t *index; // low and high row of every 16 bits prefix as in a BIN database
+	uint8_t *starts; // 1 when a row starts within the prefix, 2 when one starts at its first address
+	uint32_t strings_start; // of the old database
+	uint32_t shift; // moves the strings of the old database to their new position
+	uint32_t patch_strings; // position of the strings of the patch
+	int failed;
+} ip2proxy_image;
+
+// Add a row starting at from, a bit of new_columns set when the column points into the strings of the patch
+static void IP2Proxy_image_row(ip2proxy_image *image, const uint8_t *from, const uint32_t *values, uint32_t new_columns, int last)
+{
+	uint32_t columns = image->handler->database_column - 1;
+	uint32_t key_size = image->ipv6 ? 16 : 4;
+	uint32_t prefix = image->ipv6 ? ((uint32_t) from[0] << 8) | from[1] : ((uint32_t) from[12] << 8) | from[13];
+	uint8_t row[16 + 256 * 4];
+	uint32_t value;
+	uint32_t i;
+
+	// The last row only marks the end of the address family and stays out of the index
+	if (image->index != NULL && !last) {
+		IP2Proxy_put32(image->index + prefix * 8 + 4, image->rows);
+		image->starts[prefix] |= 1;
+
+		for (i = 16 - key_size + 2; i < 16 && from[i] == 0; i++) {
+		}
+
+		if (i == 16) {
+			IP2Proxy_put32(image->index + prefix * 8, image->rows);
+			image->starts[prefix] |= 2;
+		}
+	}
+
+	image->rows++;
+
+	if (image->file == NULL) {
+		return;
+	}
+
+	for (i = 0; i < key_size; i++) {
+		row[i] = from[15 - i];
+	}
+
+	for (i = 0; i < columns; i++) {
+		if (new_columns & (1U << i)) {
+			value = image->patch_strings + values[i];
+		} else {
+			value = (values[i] >= image->strings_start) ? values[i] + image->shift : values[i];
+		}
+
+		IP2Proxy_put32(row + key_size + i * 4, value);
+	}
+
+	if (fwrite(row, key_size + columns * 4, 1, image->file) != 1) {
+		image->failed = 1;
+	}
+}
+
+// Fill the prefixes without rows of an index built by IP2Proxy_image_row
+static void IP2Proxy_image_index(ip2proxy_image *image)
+{
+	uint32_t high = 0;
+	uint32_t i;
+
+	for (i = 0; i < 65536; i++) {
+		if (!(image->starts[i] & 2)) {
+			IP2Proxy_put32(image->index + i * 8, high);
+		}
+
+		if (image->starts[i] & 1) {
+			high = IP2Proxy_get32(image->index + i * 8 + 4);
+		} else {
+			IP2Proxy_put32(image->index + i * 8 + 4, high);
+		}
+	}
+}
+
+// Add the rows of one address family, the ranges of the patch laid over the rows of the old database
+static void IP2Proxy_image_rows(ip2proxy_image *image, int ipv6, const uint8_t *entries, uint32_t count)
+{
+	IP2Proxy *handler = image->handler;
+	ip2proxy_row_cursor *cursor = &image->cursor;
+	uint32_t columns = handler->database_column - 1;
+	uint32_t entry_size = IP2PROXY_PATCH_ENTRY_SIZE(handler->database_column);
+	uint32_t key_size = ipv6 ? 16 : 4;
+	uint64_t base_address = ipv6 ? handler->ipv6_database_address : handler->ipv4_database_address;
+	uint32_t row_count = ipv6 ? handler->ipv6_database_count : handler->ipv4_database_count;
+	uint8_t buffer[256 * 4];
+	const uint8_t *data;
+	const uint8_t *entry;
+	uint8_t next[16]; // first address without a row yet
+	uint32_t values[256];
+	uint32_t new_columns;
+	uint32_t i;
+	uint32_t j;
+	int found;
+	int k;
+
+	image->ipv6 = ipv6;
+	image->rows = 0;
+
+	if (row_count == 0) {
+		return;
+	}
+
+	memset(next, 0, 16);
+	IP2Proxy_cursor_init(cursor, handler, ipv6, 0, 0);
+	found = IP2Proxy_cursor_read(cursor);
+
+	for (j = 0; j <= count; j++) {
+		entry = (j < count) ? entries + j * entry_size : NULL;
+
+		// Old rows up to the next range, a row overlapping a range is cut around it
+		while (found) {
+			if (memcmp(cursor->to, next, 16) < 0) {
+				cursor->row++;
+				found = IP2Proxy_cursor_read(cursor);
+				continue;
+			}
+
+			if (entry != NULL && memcmp(next, entry, 16) >= 0) {
+				break;
+			}
+
+			for (i = 0; i < columns; i++) {
+				values[i] = IP2Proxy_get32(cursor->data + key_size + i * 4);
+			}
+
+			IP2Proxy_image_row(image, next, values, 0, 0);
+
+			if (entry != NULL && memcmp(cursor->to, entry, 16) >= 0) {
+				break;
+			}
+
+			memcpy(next, cursor->to, 16);
+
+			for (k = 15; k >= 0 && ++next[k] == 0; k--) {
+			}
+
+			cursor->row++;
+			found = IP2Proxy_cursor_read(cursor);
+		}
+
+		if (entry == NULL) {
+			break;
+		}
+
+		memcpy(&new_columns, entry + 32, 4);
+		memcpy(values, entry + 36, columns * 4);
+		IP2Proxy_image_row(image, entry, values, new_columns, 0);
+		memcpy(next, entry + 16, 16);
+
+		for (k = 15; k >= 0 && ++next[k] == 0; k--) {
+		}
+	}
+
+	// The last row is kept as it is
+	IP2Proxy_row_key(handler, ipv6, row_count - 1, next);
+	data = IP2Proxy_fetch(handler, base_address + (uint64_t) (row_count - 1) * (handler->database_column * 4 + (ipv6 ? 12 : 0)) + key_size, columns * 4, buffer);
+
+	for (i = 0; i < columns; i++) {
+		values[i] = IP2Proxy_get32(data + i * 4);
+	}
+
+	IP2Proxy_image_row(image, next, values, 0, 1);
+}
+
+// Check the ranges of one address family of a patch, sorted, disjoint and pointing to strings of either file
+static int IP2Proxy_patch_valid(IP2Proxy *handler, int ipv6, const uint8_t *entries, uint32_t count, uint32_t strings_start, uint32_t database_size, uint32_t strings_size)
+{
+	uint32_t columns = handler->database_column - 1;
+	uint32_t entry_size = IP2PROXY_PATCH_ENTRY_SIZE(handler->database_column);
+	const uint8_t *entry;
+	uint32_t new_columns;
+	uint32_t value;
+	uint8_t last[16];
+	uint32_t i;
+	uint32_t j;
+
+	// Ranges end before the last row of the family
+	memset(last, 0xFF, 16);
+	memset(last, 0, ipv6 ? 0 : 12);
+	last[15] = 0xFE;
+
+	for (j = 0; j < count; j++) {
+		entry = entries + j * entry_size;
+
+		if (memcmp(entry, entry + 16, 16) > 0 || memcmp(entry + 16, last, 16) > 0 || (!ipv6 && memcmp(entry, last, 12) != 0)) {
+			return 0;
+		}
+
+		if (j > 0 && memcmp(entry, entry - entry_size + 16, 16) <= 0) {
+			return 0;
+		}
+
+		memcpy(&new_columns, entry + 32, 4);
+
+		for (i = 0; i < columns; i++) {
+			memcpy(&value, entry + 36 + i * 4, 4);
+
+			if ((new_columns & (1U << i)) ? value >= strings_size : (value < strings_start || value >= database_size)) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+// Copy bytes of the old database to the image
+static int IP2Proxy_image_copy(IP2Proxy *handler, FILE *file, uint32_t offset, uint32_t size)
+{
+	uint8_t buffer[65536];
+	uint32_t length;
+
+	while (size > 0) {
+		length = (size < sizeof(buffer)) ? size : (uint32_t) sizeof(buffer);
+
+		if (IP2Proxy_read_at(handler, (off_t) offset, buffer, length) != length || fwrite(buffer, length, 1, file) != 1) {
+			return -1;
+		}
+
+		offset += length;
+		size -= length;
+	}
+
+	return 0;
+}
+
+// Patched database being written by IP2Proxy_apply_patch
+typedef struct ip2proxy_patch_job {
+	const ip2proxy_patch_header *header;
+	const uint8_t *entries[2];
+	const uint8_t *strings;
+	uint32_t counts[2];
+	uint32_t strings_start; // of the old database
+	uint32_t database_size;
+	uint8_t *indexes[2];
+} ip2proxy_patch_job;
+
+// Count and index the rows, then write the header, index tables, rows and strings of the patched database
+static int32_t IP2Proxy_image_write(IP2Proxy *handler, ip2proxy_image *image, ip2proxy_patch_job *job, FILE *file)
+{
+	uint8_t database_header[64];
+	uint32_t rows[2];
+	uint32_t row_sizes[2];
+	uint32_t index_addresses[2];
+	uint32_t row_addresses[2];
+	uint64_t position;
+	uint64_t size;
+	int i;
+
+	row_sizes[0] = handler->database_column * 4;
+	row_sizes[1] = handler->database_column * 4 + 12;
+	image->handler = handler;
+	image->strings_start = job->strings_start;
+
+	for (i = 0; i < 2; i++) {
+		memset(image->starts, 0, 65536);
+		image->index = job->indexes[i];
+		IP2Proxy_image_rows(image, i, job->entries[i], job->counts[i]);
+		rows[i] = image->rows;
+
+		if (image->index != NULL) {
+			IP2Proxy_image_index(image);
+		}
+	}
+
+	index_addresses[0] = (job->indexes[0] != NULL) ? 65 : 0;
+	index_addresses[1] = (job->indexes[1] != NULL) ? 65 + ((job->indexes[0] != NULL) ? IP2PROXY_INDEX_TABLE_SIZE : 0) : 0;
+	row_addresses[0] = 65 + ((job->indexes[0] != NULL) ? IP2PROXY_INDEX_TABLE_SIZE : 0) + ((job->indexes[1] != NULL) ? IP2PROXY_INDEX_TABLE_SIZE : 0);
+	row_addresses[1] = row_addresses[0] + rows[0] * row_sizes[0];
+	position = (uint64_t) row_addresses[1] - 1 + (uint64_t) rows[1] * row_sizes[1];
+	size = position + (job->database_size - job->strings_start) + job->header->strings_size;
+
+	// String pointers of the BIN format are 32 bits
+	if (size > 0xFFFFFFFFU || IP2Proxy_read_at(handler, 0, database_header, 64) != 64) {
+		return -1;
+	}
+
+	image->shift = (uint32_t) position - job->strings_start;
+	image->patch_strings = (uint32_t) position + (job->database_size - job->strings_start);
+
+	database_header[2] = job->header->database_year;
+	database_header[3] = job->header->database_month;
+	database_header[4] = job->header->database_day;
+	IP2Proxy_put32(database_header + 5, rows[0]);
+	IP2Proxy_put32(database_header + 9, row_addresses[0]);
+	IP2Proxy_put32(database_header + 13, rows[1]);
+	IP2Proxy_put32(database_header + 17, (rows[1] > 0) ? row_addresses[1] : handler->ipv6_database_address);
+	IP2Proxy_put32(database_header + 21, index_addresses[0]);
+	IP2Proxy_put32(database_header + 25, index_addresses[1]);
+	IP2Proxy_put32(database_header + 31, (uint32_t) size);
+
+	if (fwrite(database_header, 64, 1, file) != 1 || (job->indexes[0] != NULL && fwrite(job->indexes[0], IP2PROXY_INDEX_TABLE_SIZE, 1, file) != 1) || (job->indexes[1] != NULL && fwrite(job->indexes[1], IP2PROXY_INDEX_TABLE_SIZE, 1, file) != 1)) {
+		return -1;
+	}
+
+	image->file = file;
+	image->index = NULL;
+
+	for (i = 0; i < 2; i++) {
+		IP2Proxy_image_rows(image, i, job->entries[i], job->counts[i]);
+	}
+
+	// Old strings are copied as they are, the new ones follow
+	if (image->failed || IP2Proxy_image_copy(handler, file, job->strings_start, job->database_size - job->strings_start) != 0 || (job->header->strings_size > 0 && fwrite(job->strings, job->header->strings_size, 1, file) != 1)) {
+		return -1;
+	}
+
+	return (int32_t) (job->counts[0] + job->counts[1]);
+}
+
+// Read a patch and check it was made for the database of a handler
+static uint8_t *IP2Proxy_read_patch(IP2Proxy *handler, const char *patch, ip2proxy_patch_job *job)
+{
+	ip2proxy_patch_header *header;
+	struct stat file_stat;
+	uint8_t *buffer = NULL;
+	uint32_t entry_size = IP2PROXY_PATCH_ENTRY_SIZE(handler->database_column);
+	uint32_t crc;
+	uint64_t size;
+	FILE *file;
+
+	if ((file = fopen(patch, "rb")) == NULL) {
+		return NULL;
+	}
+
+	if (fstat(fileno(file), &file_stat) == 0 && (uint64_t) file_stat.st_size >= sizeof(ip2proxy_patch_header) && (uint64_t) file_stat.st_size < 0xFFFFFFFFU
+		&& (buffer = (uint8_t *) malloc((size_t) file_stat.st_size)) != NULL && fread(buffer, (size_t) file_stat.st_size, 1, file) != 1) {
+		free(buffer);
+		buffer = NULL;
+	}
+
+	fclose(file);
+
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	header = (ip2proxy_patch_header *) buffer;
+	size = sizeof(ip2proxy_patch_header) + ((uint64_t) header->ipv4_changes + header->ipv6_changes) * entry_size + header->strings_size;
+
+	// Complete, intact and made for this database
+	if (memcmp(header->magic, IP2PROXY_PATCH_MAGIC, sizeof(header->magic)) != 0 || header->version != IP2PROXY_PATCH_VERSION || header->byte_order != 0x01020304
+		|| header->database_type != handler->database_type || header->database_column != handler->database_column
+		|| size != (uint64_t) file_stat.st_size || IP2Proxy_crc32c(0, buffer + sizeof(ip2proxy_patch_header), (size_t) size - sizeof(ip2proxy_patch_header)) != header->payload_crc32c
+		|| IP2Proxy_index_fingerprint(handler, &crc) == -1 || crc != header->database_crc32c) {
+		free(buffer);
+		return NULL;
+	}
+
+	job->header = header;
+	job->counts[0] = header->ipv4_changes;
+	job->counts[1] = header->ipv6_changes;
+	job->entries[0] = buffer + sizeof(ip2proxy_patch_header);
+	job->entries[1] = job->entries[0] + job->counts[0] * entry_size;
+	job->strings = job->entries[1] + job->counts[1] * entry_size;
+
+	return buffer;
+}
+
+// CRC32C of a stream from its start
+static int32_t IP2Proxy_stream_crc32c(FILE *file, uint32_t *crc)
+{
+	uint8_t buffer[65536];
+	size_t length;
+
+	*crc = 0;
+
+	if (fflush(file) != 0 || fseek(file, 0, SEEK_SET) != 0) {
+		return -1;
+	}
+
+	while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		*crc = IP2Proxy_crc32c(*crc, buffer, length);
+	}
+
+	return ferror(file) ? -1 : 0;
+}
+
+// Write the database of a handler with a patch applied to a stream, crc is the CRC32C of the stream and expected the one recorded in the patch
+static int32_t IP2Proxy_patch_image(IP2Proxy *handler, const char *patch, FILE *file, uint32_t *crc, uint32_t *expected)
+{
+	ip2proxy_patch_job job;
+	ip2proxy_image *image;
+	uint8_t *buffer;
+	uint32_t row_sizes[2];
+	uint32_t index_size;
+	uint64_t file_size;
+	int32_t result = -1;
+
+	if (handler->is_csv == 1 || handler->large_format || handler->database_column < 2 || handler->database_column > 33 || handler->ipv4_database_count == 0) {
+		return -1;
+	}
+
+	memset(&job, 0, sizeof(job));
+	row_sizes[0] = handler->database_column * 4;
+	row_sizes[1] = handler->database_column * 4 + 12;
+	index_size = ((handler->ipv4_index_base_address > 0) ? IP2PROXY_INDEX_TABLE_SIZE : 0) + ((handler->ipv6_index_base_address > 0) ? IP2PROXY_INDEX_TABLE_SIZE : 0);
+	job.strings_start = handler->ipv4_database_address - 1 + handler->ipv4_database_count * row_sizes[0];
+
+	if (handler->ipv6_database_count > 0) {
+		job.strings_start = handler->ipv6_database_address - 1 + handler->ipv6_database_count * row_sizes[1];
+	}
+
+	// Only the layout of the vendor files is rebuilt: header, index tables, IPv4 rows, IPv6 rows and strings
+	if (IP2Proxy_database_file_size(handler, &file_size) == -1 || file_size < job.strings_start || handler->ipv4_database_address != 65 + index_size
+		|| (handler->ipv6_database_count > 0 && handler->ipv6_database_address != handler->ipv4_database_address + handler->ipv4_database_count * row_sizes[0])) {
+		return -1;
+	}
+
+	job.database_size = (uint32_t) file_size;
+
+	if ((buffer = IP2Proxy_read_patch(handler, patch, &job)) == NULL) {
+		return -1;
+	}
+
+	if ((handler->ipv6_database_count == 0 && job.counts[1] > 0)
+		|| !IP2Proxy_patch_valid(handler, 0, job.entries[0], job.counts[0], job.strings_start, job.database_size, job.header->strings_size)
+		|| !IP2Proxy_patch_valid(handler, 1, job.entries[1], job.counts[1], job.strings_start, job.database_size, job.header->strings_size)) {
+		free(buffer);
+		return -1;
+	}
+
+	*expected = job.header->output_crc32c;
+	image = (ip2proxy_image *) calloc(1, sizeof(ip2proxy_image));
+
+	if (image != NULL) {
+		image->starts = (uint8_t *) malloc(65536);
+	}
+
+	if (handler->ipv4_index_base_address > 0) {
+		job.indexes[0] = (uint8_t *) malloc(IP2PROXY_INDEX_TABLE_SIZE);
+	}
+
+	if (handler->ipv6_index_base_address > 0) {
+		job.indexes[1] = (uint8_t *) malloc(IP2PROXY_INDEX_TABLE_SIZE);
+	}
+
+	if (image != NULL && image->starts != NULL && (handler->ipv4_index_base_address == 0 || job.indexes[0] != NULL) && (handler->ipv6_index_base_address == 0 || job.indexes[1] != NULL)) {
+		result = IP2Proxy_image_write(handler, image, &job, file);
+
+		// Read back, what reached the file is checked rather than what was meant to be written
+		if (result != -1 && IP2Proxy_stream_crc32c(file, crc) == -1) {
+			result = -1;
+		}
+	}
+
+	if (image != NULL) {
+		free(image->starts);
+	}
+
+	free(image);
+	free(job.indexes[0]);
+	free(job.indexes[1]);
+	free(buffer);
+
+	return result;
+}
+
+// Write the database of a handler with a patch applied to output, returns the number of ranges changed
+int32_t IP2Proxy_apply_patch(IP2Proxy *handler, const char *patch, const char *output)
+{
+	char *temporary;
+	uint32_t crc;
+	uint32_t expected;
+	FILE *file;
+	int32_t result = -1;
+
+	if (handler == NULL || patch == NULL || output == NULL || (temporary = (char *) malloc(strlen(output) + 5)) == NULL) {
+		return -1;
+	}
+
+	// Written aside then renamed, readers opening output get the old or the new database, never a mix
+	sprintf(temporary, "%s.tmp", output);
+
+	if ((file = fopen(temporary, "w+b")) != NULL) {
+		result = IP2Proxy_patch_image(handler, patch, file, &crc, &expected);
+
+		if (fclose(file) != 0) {
+			result = -1;
+		}
+
+		// Only the database the patch was made to produce replaces output
+		if (result != -1 && crc != expected) {
+			result = -1;
+		}
+
+		if (result != -1 && rename(temporary, output) != 0) {
+			result = -1;
+		}
+
+		if (result == -1) {
+			remove(temporary);
+		}
+	}
+
+	free(temporary);
+
+	return result;
+}
+
+// Write the frames of a compressed BIN file, the frames up to the first row hold the header and index tables and stay raw
+static int32_t IP2Proxy_frames_write(IP2Proxy *handler, uint32_t size, FILE *file)
+{
+	ip2proxy_frames_header header;
+	uint32_t frame_count = (size + IP2PROXY_FRAME_SIZE - 1) / IP2PROXY_FRAME_SIZE;
+	uint32_t raw_frames = (handler->ipv4_database_address - 1) / IP2PROXY_FRAME_SIZE;
+	uint32_t *offsets = (uint32_t *) malloc((frame_count + 1) * sizeof(uint32_t));
+	uint8_t *raw_buffer = (uint8_t *) malloc(IP2PROXY_FRAME_SIZE);
+	uint8_t *compressed = (uint8_t *) malloc(IP2PROXY_FRAME_SIZE);
+	uint64_t position = sizeof(header) + (uint64_t) (frame_count + 1) * sizeof(uint32_t);
+	uint32_t crc = 0;
+	uint32_t stored;
+	uint32_t raw;
+	uint32_t i;
+	int32_t result = -1;
+
+	if (offsets == NULL || raw_buffer == NULL || compressed == NULL || fseek(file, (long) position, SEEK_SET) != 0) {
+		free(offsets);
+		free(raw_buffer);
+		free(compressed);
+		return -1;
+	}
+
+	IP2Proxy_crc32c_init();
+
+	for (i = 0; i < frame_count; i++) {
+		raw = (i + 1 < frame_count) ? IP2PROXY_FRAME_SIZE : size - i * IP2PROXY_FRAME_SIZE;
+
+		if (IP2Proxy_read_at(handler, (off_t) i * IP2PROXY_FRAME_SIZE, raw_buffer, raw) != raw) {
+			break;
+		}
+
+		crc = IP2Proxy_crc32c(crc, raw_buffer, raw);
+
+		// A frame which does not shrink is stored raw
+		stored = (i >= raw_frames && raw > 1) ? IP2Proxy_lz4_compress(raw_buffer, raw, compressed, raw - 1) : 0;
+
+		if (position + ((stored > 0) ? stored : raw) > 0xFFFFFFFFU || fwrite((stored > 0) ? compressed : raw_buffer, (stored > 0) ? stored : raw, 1, file) != 1) {
+			break;
+		}
+
+		offsets[i] = (uint32_t) position;
+		position += (stored > 0) ? stored : raw;
+	}
+
+	offsets[frame_count] = (uint32_t) position;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IP2PROXY_FRAMES_MAGIC, sizeof(header.magic));
+	header.version = IP2PROXY_FRAMES_VERSION;
+	header.byte_order = 0x01020304;
+	header.frame_size = IP2PROXY_FRAME_SIZE;
+	header.frame_count = frame_count;
+	header.raw_size = size;
+	header.raw_crc32c = crc;
+
+	if (i == frame_count && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(offsets, (frame_count + 1) * sizeof(uint32_t), 1, file) == 1) {
+		result = 0;
+	}
+
+	free(offsets);
+	free(raw_buffer);
+	free(compressed);
+
+	return result;
+}
+
+// Write the BIN file of a handler as a compressed BIN file which IP2Proxy_open reads like the BIN file
+int32_t IP2Proxy_compress(IP2Proxy *handler, const char *output)
+{
+	uint64_t size;
+	char *temporary;
+	FILE *file;
+	int32_t result = -1;
+
+	if (handler == NULL || handler->is_csv == 1 || output == NULL || IP2Proxy_database_file_size(handler, &size) == -1 || size == 0 || size > 0xFFFFFFFFU) {
+		return -1;
+	}
+
+	if ((temporary = (char *) malloc(strlen(output) + 5)) == NULL) {
+		return -1;
+	}
+
+	// Written aside then renamed like a patched database
+	sprintf(temporary, "%s.tmp", output);
+
+	if ((file = fopen(temporary, "wb")) != NULL) {
+		result = IP2Proxy_frames_write(handler, (uint32_t) size, file);
+
+		if (fclose(file) != 0) {
+			result = -1;
+		}
+
+		if (result != -1 && rename(temporary, output) != 0) {
+			result = -1;
+		}
+
+		if (result == -1) {
+			remove(temporary);
+		}
+	}
+
+	free(temporary);
+
+	return result;
+}
+
+// Segments of one address family in which no layer of an overlay moves to another row
+typedef struct ip2proxy_overlay_index {
+	uint8_t *starts; // first address of every segment as a 16 bytes big endian key, the first one is 0
+	uint32_t *rows; // row of every layer in every segment
+	uint32_t count;
+} ip2proxy_overlay_index;
+
+typedef struct ip2proxy_overlay_layer {
+	IP2Proxy *handler;
+	uint32_t fields;
+	uint32_t flags;
+} ip2proxy_overlay_layer;
+
+// Databases stacked by priority, layer 0 first
+struct IP2ProxyOverlay {
+	uint32_t count;
+	uint32_t base; // lowest priority layer holding a database
+	ip2proxy_overlay_layer *layers;
+	ip2proxy_overlay_index indexes[2];
+};
+
+// Row of a layer without a database or outside its rows
+#define IP2PROXY_OVERLAY_NO_ROW 0xFFFFFFFFU
+
+static void IP2Proxy_overlay_free_index(ip2proxy_overlay_index *index)
+{
+	free(index->starts);
+	free(index->rows);
+}
+
+// Open an overlay of layers databases, every layer empty
+IP2ProxyOverlay *IP2Proxy_overlay_open(uint32_t layers)
+{
+	IP2ProxyOverlay *overlay;
+	int i;
+
+	if (layers == 0 || layers > IP2PROXY_OVERLAY_MAX_LAYERS) {
+		return NULL;
+	}
+
+	if ((overlay = (IP2ProxyOverlay *) calloc(1, sizeof(IP2ProxyOverlay))) == NULL) {
+		return NULL;
+	}
+
+	overlay->count = layers;
+	overlay->layers = (ip2proxy_overlay_layer *) calloc(layers, sizeof(ip2proxy_overlay_layer));
+
+	// One segment from address 0 in which no layer has a row
+	for (i = 0; i < 2; i++) {
+		overlay->indexes[i].starts = (uint8_t *) calloc(1, 16);
+		overlay->indexes[i].rows = (uint32_t *) malloc(layers * sizeof(uint32_t));
+		overlay->indexes[i].count = 1;
+
+		if (overlay->indexes[i].rows != NULL) {
+			memset(overlay->indexes[i].rows, 0xFF, layers * sizeof(uint32_t));
+		}
+	}
+
+	if (overlay->layers == NULL || overlay->indexes[0].starts == NULL || overlay->indexes[0].rows == NULL || overlay->indexes[1].starts == NULL || overlay->indexes[1].rows == NULL) {
+		IP2Proxy_overlay_close(overlay);
+		return NULL;
+	}
+
+	return overlay;
+}
+
+// Merge the segments of one address family with the rows of handler as layer, NULL to empty the layer.
+// The other layers keep the rows of the segments they are in, so their databases are not read.
+static int32_t IP2Proxy_overlay_merge(IP2ProxyOverlay *overlay, int ipv6, uint32_t layer, IP2Proxy *handler, ip2proxy_overlay_index *merged)
+{
+	ip2proxy_overlay_index *old = &overlay->indexes[ipv6];
+	ip2proxy_row_cursor *cursor = NULL;
+	uint32_t layers = overlay->count;
+	uint32_t rows[IP2PROXY_OVERLAY_MAX_LAYERS];
+	uint32_t capacity = old->count + 1;
+	uint32_t segment = 0;
+	uint32_t row;
+	uint8_t start[16];
+	uint8_t end[16];
+	const uint8_t *old_key;
+	const uint8_t *new_key;
+	int state = 2; // 0 while rows of handler are left, 1 when only the end of its last row is left
+	int order;
+	int i;
+
+	if (handler != NULL) {
+		if ((cursor = (ip2proxy_row_cursor *) malloc(sizeof(ip2proxy_row_cursor))) == NULL) {
+			return -1;
+		}
+
+		IP2Proxy_cursor_init(cursor, handler, ipv6, 0, 0);
+
+		if (IP2Proxy_cursor_readahead(cursor) != 0) {
+			free(cursor);
+			return -1;
+		}
+
+		capacity += cursor->count;
+		state = IP2Proxy_cursor_read(cursor) ? 0 : 2;
+	}
+
+	merged->starts = (uint8_t *) malloc((size_t) capacity * 16);
+	merged->rows = (uint32_t *) malloc((size_t) capacity * layers * sizeof(uint32_t));
+	merged->count = 0;
+
+	if (merged->starts == NULL || merged->rows == NULL) {
+		IP2Proxy_overlay_free_index(merged);
+
+		if (cursor != NULL) {
+			free(cursor->window);
+			free(cursor);
+		}
+
+		return -1;
+	}
+
+	rows[layer] = IP2PROXY_OVERLAY_NO_ROW;
+
+	// Both lists of bounds are sorted, take the lower one or both when they are the same address
+	while (segment < old->count || state != 2) {
+		old_key = (segment < old->count) ? old->starts + (size_t) segment * 16 : NULL;
+		new_key = (state == 0) ? cursor->from : (state == 1) ? end : NULL;
+		order = (old_key == NULL) ? 1 : (new_key == NULL) ? -1 : memcmp(old_key, new_key, 16);
+		memcpy(start, (order <= 0) ? old_key : new_key, 16);
+
+		if (order <= 0) {
+			row = rows[layer];
+			memcpy(rows, old->rows + (size_t) segment * layers, layers * sizeof(uint32_t));
+			rows[layer] = row;
+			segment++;
+		}
+
+		if (order >= 0 && state == 0) {
+			rows[layer] = cursor->row;
+			memcpy(end, cursor->to, 16);
+			cursor->row++;
+
+			// Past the last row the layer has none, unless it ends at the last address
+			if (!IP2Proxy_cursor_read(cursor)) {
+				for (i = 15; i >= 0 && ++end[i] == 0; i--) {
+				}
+
+				state = (i >= 0) ? 1 : 2;
+			}
+		} else if (order >= 0) {
+			rows[layer] = IP2PROXY_OVERLAY_NO_ROW;
+			state = 2;
+		}
+
+		// Bounds of the old rows of layer fall away with the segments they leave alike
+		if (merged->count == 0 || memcmp(merged->rows + (size_t) (merged->count - 1) * layers, rows, layers * sizeof(uint32_t)) != 0) {
+			memcpy(merged->starts + (size_t) merged->count * 16, start, 16);
+			memcpy(merged->rows + (size_t) merged->count * layers, rows, layers * sizeof(uint32_t));
+			merged->count++;
+		}
+	}
+
+	if (cursor != NULL) {
+		free(cursor->window);
+		free(cursor);
+	}
+
+	return 0;
+}
+
+// Put a database in a layer of the overlay, or empty the layer with a NULL handler
+int32_t IP2Proxy_overlay_set_layer(IP2ProxyOverlay *overlay, uint32_t layer, IP2Proxy *handler, uint32_t fields, uint32_t flags)
+{
+	ip2proxy_overlay_index merged[2];
+	uint32_t i;
+
+	if (overlay == NULL || layer >= overlay->count) {
+		return -1;
+	}
+
+	// Rows of every layer are read through its own file
+	if (handler != NULL && (handler->is_csv == 1 || lookup_mode != IP2PROXY_FILE_IO)) {
+		return -1;
+	}
+
+	if (IP2Proxy_overlay_merge(overlay, 0, layer, handler, &merged[0]) != 0) {
+		return -1;
+	}
+
+	if (IP2Proxy_overlay_merge(overlay, 1, layer, handler, &merged[1]) != 0) {
+		IP2Proxy_overlay_free_index(&merged[0]);
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		IP2Proxy_overlay_free_index(&overlay->indexes[i]);
+		overlay->indexes[i] = merged[i];
+	}
+
+	overlay->layers[layer].handler = handler;
+	overlay->layers[layer].fields = fields;
+	overlay->layers[layer].flags = flags;
+	overlay->base = 0;
+
+	for (i = 0; i < overlay->count; i++) {
+		if (overlay->layers[i].handler != NULL) {
+			overlay->base = i;
+		}
+	}
+
+	return 0;
+}
+
+// Merge the fields of the layers holding an address, each field from the first layer which lists the address and
+// overrides the field. The base layer answers the fields left whether it lists the address or not.
+int32_t IP2Proxy_overlay_lookup(IP2ProxyOverlay *overlay, const char *ip, size_t length, uint32_t mode, IP2ProxyView *view)
+{
+	static const IP2ProxyField not_supported = { NOT_SUPPORTED, sizeof(NOT_SUPPORTED) - 1 };
+	static const IP2ProxyField not_proxy = { "-", 1 };
+	ip2proxy_overlay_index *index;
+	ip2proxy_overlay_layer *layer;
+	IP2Proxy *handler;
+	IP2ProxyView layer_view;
+	IP2ProxyField *field;
+	const IP2ProxyField *source;
+	const uint32_t *rows;
+	const uint8_t *data;
+	uint8_t row_buffer[200];
+	uint8_t key[16];
+	uint32_t column_offset;
+	uint32_t missing = mode;
+	uint32_t taken;
+	uint32_t low;
+	uint32_t high;
+	uint32_t mid;
+	uint32_t i;
+	size_t j;
+	int version;
+	int ipv6;
+	int found = 0;
+
+	if (overlay == NULL || ip == NULL || view == NULL) {
+		return -1;
+	}
+
+	if ((version = IP2Proxy_lookup_key(ip, length, key)) == -1) {
+		IP2Proxy_bad_view(view, INVALID_IP_ADDRESS);
+		return -1;
+	}
+
+	ipv6 = (version == 6);
+	index = &overlay->indexes[ipv6];
+
+	// Last segment starting at or below the address, one search for every layer
+	low = 0;
+	high = index->count - 1;
+
+	while (low < high) {
+		mid = low + ((high - low + 1) >> 1);
+
+		if (memcmp(index->starts + (size_t) mid * 16, key, 16) <= 0) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	rows = index->rows + (size_t) low * overlay->count;
+	IP2Proxy_fill_view(view, &not_supported);
+	view->is_proxy = -1;
+
+	for (i = 0; i < overlay->count; i++) {
+		if (rows[i] == IP2PROXY_OVERLAY_NO_ROW) {
+			continue;
+		}
+
+		found = 1;
+		layer = &overlay->layers[i];
+		handler = layer->handler;
+		taken = missing & layer->fields;
+
+		if (taken == 0) {
+			continue;
+		}
+
+		column_offset = handler->database_column * 4 + (ipv6 ? 12 : 0);
+		data = IP2Proxy_fetch(handler, (ipv6 ? handler->ipv6_database_address : handler->ipv4_database_address) + (uint64_t) rows[i] * column_offset, column_offset, row_buffer);
+		IP2Proxy_get_kernel(handler)->read_view(handler, data + (ipv6 ? 16 : 4), taken | ISPROXY, NULL, &layer_view);
+
+		if (layer_view.is_proxy <= 0 && i != overlay->base) {
+			continue;
+		}
+
+		// Listed by an allowlist, the address is not a proxy
+		if ((layer->flags & IP2PROXY_OVERLAY_ALLOW) && layer_view.is_proxy > 0) {
+			IP2Proxy_fill_view(&layer_view, &not_proxy);
+			layer_view.is_proxy = 0;
+		}
+
+		if (taken & ISPROXY) {
+			view->is_proxy = layer_view.is_proxy;
+		}
+
+		for (j = 0; j < sizeof(IP2PROXY_VIEW_FIELDS) / sizeof(IP2PROXY_VIEW_FIELDS[0]); j++) {
+			if ((taken & IP2PROXY_VIEW_FIELDS[j].flag) == 0) {
+				continue;
+			}
+
+			source = IP2PROXY_VIEW_FIELD(&layer_view, j);
+			field = IP2PROXY_VIEW_FIELD(view, j);
+			*field = *source;
+
+			// Strings read into the buffer of the layer view are copied, the next layer reuses it
+			if ((uintptr_t) source->data >= (uintptr_t) layer_view.buffer && (uintptr_t) source->data < (uintptr_t) layer_view.buffer + sizeof(layer_view.buffer)) {
+				memcpy(view->buffer[j], source->data, source->length);
+				field->data = (const char *) view->buffer[j];
+			}
+		}
+
+		missing &= ~taken;
+	}
+
+	if (!found) {
+		// Layer i is the first holding IPv6 rows
+		for (i = 0; ipv6 && i < overlay->count && (overlay->layers[i].handler == NULL || overlay->layers[i].handler->ipv6_database_count == 0); i++) {
+		}
+
+		IP2Proxy_bad_view(view, (ipv6 && i == overlay->count) ? IPV6_ADDRESS_MISSING_IN_IPV4_BIN : NOT_SUPPORTED);
+		return -1;
+	}
+
+	return 0;
+}
+
+void IP2Proxy_overlay_close(IP2ProxyOverlay *overlay)
+{
+	if (overlay != NULL) {
+		IP2Proxy_overlay_free_index(&overlay->indexes[0]);
+		IP2Proxy_overlay_free_index(&overlay->indexes[1]);
+		free(overlay->layers);
+		free(overlay);
+	}
+}
+
+// Get the location data
+static IP2ProxyRecord *IP2Proxy_get_record(IP2Proxy *handler, char *ip, uint32_t mode)
+{
+	ip_container parsed_ip = IP2Proxy_parse_address(ip);
+	IP2ProxyRecord *record;
+	IP2ProxyView view;
+
+	if (IP2Proxy_negative_view(handler, &parsed_ip, mode, &view)) {
+		return IP2Proxy_view_to_record(&view);
+	}
+
+	if (parsed_ip.version == 4) {
+		record = IP2Proxy_get_ipv4_record(handler, mode, parsed_ip);
+
+		if (record == NULL) {
+			return IP2Proxy_bad_record(NOT_SUPPORTED);
+		}
+
+		return record;
+	}
+	if (parsed_ip.version == 6) {
+		if (handler->ipv6_database_count == 0) {
+			return IP2Proxy_bad_record(IPV6_ADDRESS_MISSING_IN_IPV4_BIN);
+		}
+
+		record = IP2Proxy_get_ipv6_record(handler, mode, parsed_ip);
+
+		if (record == NULL) {
+			return IP2Proxy_bad_record(NOT_SUPPORTED);
+		}
+
+		return record;
+	} else {
+		return IP2Proxy_bad_record(INVALID_IP_ADDRESS);
+	}
+}
+
+// Get IPv4 records from database
+static IP2ProxyRecord *IP2Proxy_get_ipv4_record(IP2Proxy *handler, uint32_t mode, ip_container parsed_ip)
+{
+	FILE *handle = handler->file;
+	uint32_t ip_number;
+	uint32_t ip_from;
+	uint32_t ip_to;
+	uint8_t full_row_buffer[200];
+	const uint8_t *row;
+
+	ip_number = parsed_ip.ipv4;
+
+	if (ip_number == (uint32_t) MAX_IPV4_RANGE) {
+		ip_number = ip_number - 1;
+	}
+
+	if (handler->is_csv == 1) {
+		char line[2048];
+		char *delimiter = ";";
+		char *token;
+		int is_found = 0;
+
+		IP2ProxyRecord *record = IP2Proxy_new_record();
+		record->is_proxy = "-1";
+		record->proxy_type = NOT_SUPPORTED;
+		record->region = NOT_SUPPORTED;
+		record->city = NOT_SUPPORTED;
+		record->isp = NOT_SUPPORTED;
+		record->domain = NOT_SUPPORTED;
+		record->usage_type = NOT_SUPPORTED;
+		record->asn = NOT_SUPPORTED;
+		record->as_ = NOT_SUPPORTED;
+		record->last_seen = NOT_SUPPORTED;
+		record->threat = NOT_SUPPORTED;
+		record->provider = NOT_SUPPORTED;
+		record->fraud_score = NOT_SUPPORTED;
+
+		while (fgets(line, 2048, handle) != NULL) {
+			IP2Proxy_replace(line, "\n", "");
+			IP2Proxy_replace(line, "\",\"", ";");
+			IP2Proxy_replace(line, "\"", "");
+
+			token = strtok(line, delimiter);
+
+			ip_from = atoi(token);
+
+			token = strtok(NULL, delimiter);
+
+			ip_to = atoi(token);
+
+			if (ip_number >= ip_from && ip_number <= ip_to) {
+				is_found = 1;
+				break;
+			}
+		}
+
+		if (is_found == 0) {
+			record->country_short = "-";
+			record->country_long = "-";
+			record->region = "-";
+			record->city = "-";
+			record->isp = "-";
+			record->is_proxy = "0";
+			record->proxy_type = "-";
+			record->domain = "-";
+			record->usage_type = "-";
+			record->asn = "-";
+			record->as_ = "-";
+			record->last_seen = "-";
+			record->threat = "-";
+			record->provider = "-";
+			record->fraud_score = "0";
+
+			return record;
+		}
+
+		switch (handler->database_type) {
+			case 1:
+				token = strtok(NULL, delimiter);
+				record->country_short = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->country_long = strdup(token);
+
+				if (strcmp(record->country_short, "-") == 0) {
+					record->is_proxy = "0";
+				} else {
+					record->is_proxy = "1";
+				}
+
+				return record;
+
+			case 2:
+				token = strtok(NULL, delimiter);
+				record->proxy_type = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->country_short = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->country_long = strdup(token);
+
+				if (strcmp(record->country_short, "-") == 0) {
+					record->is_proxy = "0";
+				} else if (strcmp(record->proxy_type, "DCH") == 0 || strcmp(record->proxy_type, "SES") == 0) {
+					record->is_proxy = "0";
+				} else {
+					record->is_proxy = "1";
+				}
+
+				return record;
+
+			case 3:
+				token = strtok(NULL, delimiter);
+				record->proxy_type = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->country_short = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->country_long = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->region = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->city = strdup(token);
+
+
+				if (strcmp(record->country_short, "-") == 0) {
+					record->is_proxy = "0";
+				} else if (strcmp(record->proxy_type, "DCH") == 0 || strcmp(record->proxy_type, "SES") == 0) {
+					record->is_proxy = "0";
+				} else {
+					record->is_proxy = "1";
+				}
+
+				return record;
+
+			case 4:
+				token = strtok(NULL, delimiter);
+				record->proxy_type = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->country_short = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->country_long = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->region = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->city = strdup(token);
+
+				token = strtok(NULL, delimiter);
+				record->isp = strdup(token);
+
+				if (strcmp(record->country_short, "-") == 0) {
+					record->is_proxy = "0";
+				} else if (strcmp(record->proxy_type, "DCH") == 0 || strcmp(record->proxy_type, "SES") == 0) {
+					record->is_proxy = "0";
+				} else {
+					record->is_proxy = "1";
+				}
+
+				return record;
+		}
+
+		return NULL;
+	}
+
+	row = IP2Proxy_get_kernel(handler)->find_ipv4_row(handler, ip_number, full_row_buffer);
+
+	if (row == NULL) {
+		return NULL;
+	}
+
+	return IP2Proxy_read_record(handler, row + 4, mode, NULL);
+}
+
+// Search the IPv4 row containing an IP number, returns the row starting with its IP from
+static IP2PROXY_INLINE const uint8_t *IP2Proxy_search_ipv4_row(IP2Proxy *handler, uint32_t ip_number, uint8_t *buffer, uint32_t database_column)
+{
+	uint64_t base_address = handler->ipv4_database_address;
+	uint64_t ipv4_index_base_address = handler->ipv4_index_base_address;
+
+	uint32_t low = 0;
+	uint32_t high = handler->ipv4_database_count;
+	uint32_t mid = 0;
+	uint32_t ip_from;
+	uint32_t ip_to;
+
+	uint32_t column_offset = database_column * 4;
+	uint64_t row_offset = 0;
+	const uint8_t *row;
+	uint32_t full_row_size;
+
+	if (handler->pinned_index != NULL) {
+		ip2proxy_pinned_index *pinned = (ip2proxy_pinned_index *) handler->pinned_index;
+
+		if (pinned->ipv4_index != NULL) {
+			low = pinned->ipv4_index[(ip_number >> 16) << 1];
+			high = pinned->ipv4_index[((ip_number >> 16) << 1) + 1];
+		}
+
+		IP2Proxy_pinned_narrow_ipv4(pinned, ip_number, &low, &high);
+	} else if (ipv4_index_base_address > 0) {
+		uint32_t number = (uint32_t) ip_number >> 16;
+		uint64_t indexpos = ipv4_index_base_address + (number << 3);
+
+		uint8_t indexbuffer[8];
+		const uint8_t *index = IP2Proxy_fetch(handler, indexpos, sizeof(indexbuffer), indexbuffer);
+		low = IP2Proxy_get32(index);
+		high = IP2Proxy_get32(index + 4);
+	}
+
+	full_row_size = column_offset + 4;
+
+	while (low <= high) {
+		mid = (uint32_t)((low + high) >> 1);
+		row_offset = base_address + (uint64_t) mid * column_offset;
+
+		row = IP2Proxy_fetch(handler, row_offset, full_row_size, buffer);
+
+		ip_from = IP2Proxy_get32(row);
+		ip_to = IP2Proxy_get32(row + column_offset);
+
+		if ((ip_number >= ip_from) && (ip_number < ip_to)) {
+			return row;
+		} else {
+			if (ip_number < ip_from) {
+				high = mid - 1;
+			} else {
+				low = mid + 1;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// Get IPv6 records from database
+static IP2ProxyRecord * IP2Proxy_get_ipv6_record(IP2Proxy *handler, uint32_t mode, ip_container parsed_ip)
+{
+	uint8_t full_row_buffer[200];
+	const uint8_t *row = IP2Proxy_get_kernel(handler)->find_ipv6_row(handler, &parsed_ip.ipv6, full_row_buffer);
+
+	if (row == NULL) {
+		return NULL;
+	}
+
+	return IP2Proxy_read_record(handler, row + 16, mode, NULL);
+}
+
+// Search the IPv6 row containing an IP number, returns the row starting with its IP from
+static IP2PROXY_INLINE const uint8_t *IP2Proxy_search_ipv6_row(IP2Proxy *handler, struct in6_addr *ip, uint8_t *buffer, uint32_t database_column)
+{
+	uint64_t base_address = handler->ipv6_database_address;
+	uint64_t ipv6_index_base_address = handler->ipv6_index_base_address;
+
+	uint32_t low = 0;
+	uint32_t high = handler->ipv6_database_count;
+	uint32_t mid = 0;
+
+	struct in6_addr ip_from;
+	struct in6_addr ip_to;
+	struct in6_addr ip_number;
+
+	uint32_t column_offset = database_column * 4 + 12;
+	uint64_t row_offset = 0;
+	const uint8_t *row;
+	uint32_t full_row_size;
+
+	ip_number = *ip;
+
+	if (!high) {
+		return NULL;
+	}
+
+	if (handler->pinned_index != NULL) {
+		ip2proxy_pinned_index *pinned = (ip2proxy_pinned_index *) handler->pinned_index;
+		uint32_t number = (ip_number.s6_addr[0] * 256) + ip_number.s6_addr[1];
+
+		if (pinned->ipv6_index != NULL) {
+			low = pinned->ipv6_index[number << 1];
+			high = pinned->ipv6_index[(number << 1) + 1];
+		}
+
+		IP2Proxy_pinned_narrow_ipv6(pinned, &ip_number, &low, &high);
+	} else if (ipv6_index_base_address > 0) {
+		uint32_t number = (ip_number.s6_addr[0] * 256) + ip_number.s6_addr[1];
+		uint64_t indexpos = ipv6_index_base_address + (number << 3);
+
+		uint8_t indexbuffer[8];
+		const uint8_t *index = IP2Proxy_fetch(handler, indexpos, sizeof(indexbuffer), indexbuffer);
+		low = IP2Proxy_get32(index);
+		high = IP2Proxy_get32(index + 4);
+	}
+
+	full_row_size = column_offset + 16;
+
+	while (low <= high) {
+		mid = (uint32_t)((low + high) >> 1);
+		row_offset = base_address + (uint64_t) mid * column_offset;
+
+		row = IP2Proxy_fetch(handler, row_offset, full_row_size, buffer);
+
+		ip_from = IP2Proxy_get128(row);
+		ip_to = IP2Proxy_get128(row + column_offset);
+
+		if ((IP2Proxy_ipv6_compare(&ip_number, &ip_from) >= 0) && (IP2Proxy_ipv6_compare(&ip_number, &ip_to) < 0)) {
+			return row;
+		} else {
+			if (IP2Proxy_ipv6_compare(&ip_number, &ip_from) < 0) {
+				high = mid - 1;
+			} else {
+				low = mid + 1;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static const uint8_t *IP2Proxy_find_ipv4_row_generic(IP2Proxy *handler, uint32_t ip_number, uint8_t *buffer)
+{
+	return IP2Proxy_search_ipv4_row(handler, ip_number, buffer, handler->database_column);
+}
+
+static const uint8_t *IP2Proxy_find_ipv6_row_generic(IP2Proxy *handler, struct in6_addr *ip, uint8_t *buffer)
+{
+	return IP2Proxy_search_ipv6_row(handler, ip, buffer, handler->database_column);
+}
+
+// Decode and search functions of every layout with its positions as constants
+#define IP2PROXY_DEFINE_KERNEL(type, columns, country, region, city, isp, proxy_type, domain, usage_type, asn, as, last_seen, threat, provider, fraud_score) \
+static void IP2Proxy_read_view_px##type(IP2Proxy *handler, const uint8_t *buffer, uint32_t mode, const ip2proxy_prefetch *prefetch, IP2ProxyView *view) \
+{ \
+	static const uint8_t position[IP2PROXY_FIELD_COUNT] = { country, region, city, isp, proxy_type, domain, usage_type, asn, as, last_seen, threat, provider, fraud_score }; \
+	IP2Proxy_decode_view(handler, buffer, mode, prefetch, view, position); \
+} \
+\
+static const uint8_t *IP2Proxy_find_ipv4_row_px##type(IP2Proxy *handler, uint32_t ip_number, uint8_t *buffer) \
+{ \
+	return IP2Proxy_search_ipv4_row(handler, ip_number, buffer, columns); \
+} \
+\
+static const uint8_t *IP2Proxy_find_ipv6_row_px##type(IP2Proxy *handler, struct in6_addr *ip, uint8_t *buffer) \
+{ \
+	return IP2Proxy_search_ipv6_row(handler, ip, buffer, columns); \
+}
+
+#define IP2PROXY_KERNEL_ENTRY(type, columns, country, region, city, isp, proxy_type, domain, usage_type, asn, as, last_seen, threat, provider, fraud_score) \
+	{ columns, IP2Proxy_read_view_px##type, IP2Proxy_find_ipv4_row_px##type, IP2Proxy_find_ipv6_row_px##type },
+
+IP2PROXY_LAYOUTS(IP2PROXY_DEFINE_KERNEL)
+
+// Generic kernel first, then PX1 to PX12
+static const ip2proxy_kernel IP2PROXY_KERNELS[13] = {
+	{ 0, IP2Proxy_read_view_generic, IP2Proxy_find_ipv4_row_generic, IP2Proxy_find_ipv6_row_generic },
+	IP2PROXY_LAYOUTS(IP2PROXY_KERNEL_ENTRY)
+};
+
+// Pick the kernel of the database type, unknown layouts use the position tables
+static const ip2proxy_kernel *IP2Proxy_select_kernel(IP2Proxy *handler)
+{
+	uint8_t dbtype = handler->database_type;
+
+	if (dbtype >= 1 && dbtype <= 12 && IP2PROXY_KERNELS[dbtype].database_column == handler->database_column) {
+		return &IP2PROXY_KERNELS[dbtype];
+	}
+
+	return &IP2PROXY_KERNELS[0];
+}
+
+static const ip2proxy_kernel *IP2Proxy_get_kernel(IP2Proxy *handler)
+{
+	return (handler->kernel != NULL) ? (const ip2proxy_kernel *) handler->kernel : &IP2PROXY_KERNELS[0];
+}
+
+// Initialize the record object
+static IP2ProxyRecord *IP2Proxy_new_record()
+{
+	IP2ProxyRecord *record = (IP2ProxyRecord *) calloc(1, sizeof(IP2ProxyRecord));
+	return record;
+}
+
+// Free the record object
+void IP2Proxy_free_record(IP2ProxyRecord *record)
+{
+
+	if (record == NULL) {
+		return;
+	}
+
+	if (record->country_short != NULL) {
+		free(record->country_short);
+	}
+
+	if (record->country_long != NULL) {
+		free(record->country_long);
+	}
+
+	if (record->region != NULL) {
+		free(record->region);
+	}
+
+	if (record->city != NULL) {
+		free(record->city);
+	}
+
+	if (record->isp != NULL) {
+		free(record->isp);
+	}
+
+	if (record->proxy_type != NULL) {
+		free(record->proxy_type);
+	}
+
+	if (record->domain != NULL) {
+		free(record->domain);
+	}
+
+	if (record->usage_type != NULL) {
+		free(record->usage_type);
+	}
+
+	if (record->asn != NULL) {
+		free(record->asn);
+	}
+
+	if (record->as_ != NULL) {
+		free(record->as_);
+	}
+
+	if (record->last_seen != NULL) {
+		free(record->last_seen);
+	}
+
+	if (record->threat != NULL) {
+		free(record->threat);
+	}
+
+	if (record->provider != NULL) {
+		free(record->provider);
+	}
+
+	if (record->fraud_score != NULL) {
+		free(record->fraud_score);
+	}
+
+	free(record);
+}
+
+// Set to use memory caching
+int32_t IP2Proxy_set_memory_cache(FILE *file)
+{
+	int64_t size;
+	lookup_mode = IP2PROXY_CACHE_MEMORY;
+
+	if (IP2Proxy_memory_size(file, &size) == -1) {
+		lookup_mode = IP2PROXY_FILE_IO;
+		return -1;
+	}
+
+	if ((memory_pointer = malloc(size + 1)) == NULL) {
+		lookup_mode = IP2PROXY_FILE_IO;
+		return -1;
+	}
+
+	if (IP2Proxy_load_database_into_memory(file, memory_frames, memory_pointer, size) == -1) {
+		lookup_mode = IP2PROXY_FILE_IO;
+		free(memory_pointer);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Set to use shared memory
+#ifndef WIN32
+int32_t IP2Proxy_set_shared_memory(FILE *file)
+{
+	int64_t size;
+	int32_t is_dababase_loaded = 1;
+	void *addr = (void*)MAP_ADDR;
+
+	lookup_mode = IP2PROXY_SHARED_MEMORY;
+
+	// New shared memory object is created
+	if ((shm_fd = shm_open(IP2PROXY_SHM, O_RDWR | O_CREAT | O_EXCL, 0777)) != -1) {
+		is_dababase_loaded = 0;
+	}
+
+	// Failed to create new shared memory object
+	else if ((shm_fd = shm_open(IP2PROXY_SHM, O_RDWR , 0777)) == -1) {
+		lookup_mode = IP2PROXY_FILE_IO;
+		return -1;
+	}
+
+	if (IP2Proxy_memory_size(file, &size) == -1) {
+		close(shm_fd);
+
+		if (is_dababase_loaded == 0) {
+			shm_unlink(IP2PROXY_SHM);
+		}
+
+		lookup_mode = IP2PROXY_FILE_IO;
+
+		return -1;
+	}
+
+	if (is_dababase_loaded == 0 && ftruncate(shm_fd, size + 1) == -1) {
+		close(shm_fd);
+		shm_unlink(IP2PROXY_SHM);
+		lookup_mode = IP2PROXY_FILE_IO;
+		return -1;
+	}
+
+	memory_pointer = mmap(addr, size + 1, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+
+	if (memory_pointer == (void *) -1) {
+		close(shm_fd);
+
+		if (is_dababase_loaded == 0) {
+			shm_unlink(IP2PROXY_SHM);
+		}
+
+		lookup_mode = IP2PROXY_FILE_IO;
+
+		return -1;
+	}
+
+	if (is_dababase_loaded == 0) {
+		if (IP2Proxy_load_database_into_memory(file, memory_frames, memory_pointer, size) == -1) {
+			munmap(memory_pointer, size);
+			close(shm_fd);
+			shm_unlink(IP2PROXY_SHM);
+			lookup_mode = IP2PROXY_FILE_IO;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+#else
+#ifdef WIN32
+int32_t IP2Proxy_set_shared_memory(FILE *file)
+{
+	int64_t size;
+	int32_t is_dababase_loaded = 1;
+
+	lookup_mode = IP2PROXY_SHARED_MEMORY;
+
+	if (IP2Proxy_memory_size(file, &size) == -1) {
+		lookup_mode = IP2PROXY_FILE_IO;
+		return -1;
+	}
+
+	shm_fd = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD) ((uint64_t) (size + 1) >> 32), (DWORD) (size + 1), TEXT(IP2PROXY_SHM));
+
+	if (shm_fd == NULL) {
+		lookup_mode = IP2PROXY_FILE_IO;
+		return -1;
+	}
+
+	is_dababase_loaded = (GetLastError() == ERROR_ALREADY_EXISTS);
+	memory_pointer = MapViewOfFile(shm_fd, FILE_MAP_WRITE, 0, 0, 0);
+
+	if (memory_pointer == NULL) {
+		UnmapViewOfFile(memory_pointer);
+		lookup_mode = IP2PROXY_FILE_IO;
+		return -1;
+	}
+
+	if (is_dababase_loaded == 0) {
+		if (IP2Proxy_load_database_into_memory(file, memory_frames, memory_pointer, size) == -1) {
+			UnmapViewOfFile(memory_pointer);
+			CloseHandle(shm_fd);
+			lookup_mode = IP2PROXY_FILE_IO;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+#endif
+#endif
+
+// A truncated or padded download does not match the size written in the header
+static int32_t IP2Proxy_check_database_size(IP2Proxy *handler)
+{
+	uint64_t size;
+
+	if (handler->database_size == 0) {
+		return 0;
+	}
+
+	if (IP2Proxy_database_file_size(handler, &size) == -1 || size != handler->database_size) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// Size of the BIN file of a handler, the size once decompressed for a compressed BIN file
+static int32_t IP2Proxy_database_file_size(IP2Proxy *handler, uint64_t *size)
+{
+	struct stat buffer;
+
+	if (handler->frames != NULL) {
+		*size = ((ip2proxy_frames *) handler->frames)->raw_size;
+		return 0;
+	}
+
+	if (fstat(fileno(handler->file), &buffer) == -1) {
+		return -1;
+	}
+
+	*size = (uint64_t) buffer.st_size;
+
+	return 0;
+}
+
+// Size of the BIN file loaded into memory, the size once decompressed for a compressed BIN file
+static int32_t IP2Proxy_memory_size(FILE *file, int64_t *size)
+{
+	struct stat buffer;
+
+	if (memory_frames != NULL) {
+		*size = memory_frames->raw_size;
+		return 0;
+	}
+
+	// A BIN file larger than the address space cannot be loaded
+	if (fstat(fileno(file), &buffer) == -1 || (uint64_t) buffer.st_size >= (uint64_t) SIZE_MAX) {
+		return -1;
+	}
+
+	*size = buffer.st_size;
+
+	return 0;
+}
+
+// Seconds from an arbitrary point, to time the loading
+static double IP2Proxy_now(void)
+{
+#ifndef WIN32
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+#else
+	return (double) GetTickCount64() / 1000.0;
+#endif
+}
+
+#define IP2PROXY_CRC32C_POLY 0x82F63B78
+
+static uint32_t crc32c_table[8][256];
+
+// Tables for the slicing-by-8 software CRC32C
+static void IP2Proxy_crc32c_init(void)
+{
+	uint32_t crc;
+	uint32_t i, j;
+
+	if (crc32c_table[0][1] != 0) {
+		return;
+	}
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+
+		for (j = 0; j < 8; j++) {
+			crc = (crc & 1) ? (crc >> 1) ^ IP2PROXY_CRC32C_POLY : crc >> 1;
+		}
+
+		crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[j - 1][i] & 0xFF];
+		}
+	}
+}
+
+static uint32_t IP2Proxy_crc32c_software(uint32_t crc, const uint8_t *data, size_t length)
+{
+	crc = ~crc;
+
+	while (length >= 8) {
+		crc ^= IP2Proxy_get32(data);
+		crc = crc32c_table[7][crc & 0xFF] ^ crc32c_table[6][(crc >> 8) & 0xFF] ^ crc32c_table[5][(crc >> 16) & 0xFF] ^ crc32c_table[4][crc >> 24]
+			^ crc32c_table[3][data[4]] ^ crc32c_table[2][data[5]] ^ crc32c_table[1][data[6]] ^ crc32c_table[0][data[7]];
+		data += 8;
+		length -= 8;
+	}
+
+	while (length-- > 0) {
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data++) & 0xFF];
+	}
+
+	return ~crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define IP2PROXY_CRC32C_HARDWARE
+
+// SSE 4.2 crc32 instruction, 8 bytes per cycle
+__attribute__((target("sse4.2"))) static uint32_t IP2Proxy_crc32c_hardware(uint32_t crc, const uint8_t *data, size_t length)
+{
+	uint64_t value = ~crc;
+	uint64_t word;
+
+	while (length >= 8) {
+		memcpy(&word, data, 8);
+		value = __builtin_ia32_crc32di(value, word);
+		data += 8;
+		length -= 8;
+	}
+
+	while (length-- > 0) {
+		value = __builtin_ia32_crc32qi((uint32_t) value, *data++);
+	}
+
+	return ~(uint32_t) value;
+}
+
+static int IP2Proxy_crc32c_has_hardware(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define IP2PROXY_CRC32C_HARDWARE
+#include <arm_acle.h>
+
+// ARMv8 crc32c instructions
+static uint32_t IP2Proxy_crc32c_hardware(uint32_t crc, const uint8_t *data, size_t length)
+{
+	uint64_t word;
+
+	crc = ~crc;
+
+	while (length >= 8) {
+		memcpy(&word, data, 8);
+		crc = __crc32cd(crc, word);
+		data += 8;
+		length -= 8;
+	}
+
+	while (length-- > 0) {
+		crc = __crc32cb(crc, *data++);
+	}
+
+	return ~crc;
+}
+
+static int IP2Proxy_crc32c_has_hardware(void)
+{
+	return 1;
+}
+#endif
+
+// CRC32C (Castagnoli) of a buffer, continuing from crc (0 to start)
+static uint32_t IP2Proxy_crc32c(uint32_t crc, const uint8_t *data, size_t length)
+{
+#ifdef IP2PROXY_CRC32C_HARDWARE
+	if (IP2Proxy_crc32c_has_hardware()) {
+		return IP2Proxy_crc32c_hardware(crc, data, length);
+	}
+#endif
+
+	IP2Proxy_crc32c_init();
+
+	return IP2Proxy_crc32c_software(crc, data, length);
+}
+
+static uint32_t IP2Proxy_gf2_times(const uint32_t *matrix, uint32_t vector)
+{
+	uint32_t sum = 0;
+
+	while (vector != 0) {
+		if (vector & 1) {
+			sum ^= *matrix;
+		}
+
+		vector >>= 1;
+		matrix++;
+	}
+
+	return sum;
+}
+
+static void IP2Proxy_gf2_square(uint32_t *square, const uint32_t *matrix)
+{
+	int n;
+
+	for (n = 0; n < 32; n++) {
+		square[n] = IP2Proxy_gf2_times(matrix, matrix[n]);
+	}
+}
+
+// CRC32C of two concatenated blocks from the CRC32C of each block, as crc32_combine of zlib
+static uint32_t IP2Proxy_crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t length2)
+{
+	uint32_t even[32];
+	uint32_t odd[32];
+	uint32_t row = 1;
+	int n;
+
+	if (length2 == 0) {
+		return crc1;
+	}
+
+	// Operator for one zero bit
+	odd[0] = IP2PROXY_CRC32C_POLY;
+
+	for (n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	IP2Proxy_gf2_square(even, odd);
+	IP2Proxy_gf2_square(odd, even);
+
+	// Apply length2 zero bytes to crc1
+	do {
+		IP2Proxy_gf2_square(even, odd);
+
+		if (length2 & 1) {
+			crc1 = IP2Proxy_gf2_times(even, crc1);
+		}
+
+		length2 >>= 1;
+
+		if (length2 == 0) {
+			break;
+		}
+
+		IP2Proxy_gf2_square(odd, even);
+
+		if (length2 & 1) {
+			crc1 = IP2Proxy_gf2_times(odd, crc1);
+		}
+
+		length2 >>= 1;
+	} while (length2 != 0);
+
+	return crc1 ^ crc2;
+}
+
+// Chunks of the BIN file read by one loader thread
+typedef struct ip2proxy_load_job {
+	FILE *file;
+	ip2proxy_frames *frames;
+	uint8_t *memory;
+	uint64_t size;
+	uint32_t chunks;
+	uint32_t first;
+	uint32_t step;
+	uint32_t *crcs;
+	int32_t result;
+} ip2proxy_load_job;
+
+// Read every step-th chunk and checksum it while it is still in cache
+static void *IP2Proxy_load_worker(void *arg)
+{
+	ip2proxy_load_job *job = (ip2proxy_load_job *) arg;
+	uint64_t offset;
+	uint32_t length;
+	uint32_t chunk;
+
+	for (chunk = job->first; chunk < job->chunks; chunk += job->step) {
+		offset = (uint64_t) chunk * IP2PROXY_LOAD_CHUNK;
+		length = (job->size - offset < IP2PROXY_LOAD_CHUNK) ? (uint32_t) (job->size - offset) : IP2PROXY_LOAD_CHUNK;
+
+		if (((job->frames != NULL) ? IP2Proxy_frames_read(job->frames, (off_t) offset, job->memory + offset, length) : IP2Proxy_pread(job->file, (off_t) offset, job->memory + offset, length)) != length) {
+			job->result = -1;
+			break;
+		}
+
+		job->crcs[chunk] = IP2Proxy_crc32c(0, job->memory + offset, length);
+	}
+
+	return NULL;
+}
+
+// Load BIN file into memory with parallel reads, checksum it and record the timing, frames are decompressed by the readers
+int32_t IP2Proxy_load_database_into_memory(FILE *file, ip2proxy_frames *frames, void *memory, int64_t size)
+{
+	ip2proxy_load_job jobs[IP2PROXY_LOAD_THREADS];
+	uint32_t chunks = (uint32_t) ((size + IP2PROXY_LOAD_CHUNK - 1) / IP2PROXY_LOAD_CHUNK);
+	uint32_t threads = 1;
+	uint32_t started = 1;
+	uint32_t *crcs;
+	uint32_t crc = 0;
+	uint64_t length;
+	double start = IP2Proxy_now();
+	int32_t result = 0;
+	uint32_t i;
+#ifndef WIN32
+	pthread_t workers[IP2PROXY_LOAD_THREADS];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	threads = (cpus > 1) ? (uint32_t) cpus : 1;
+	threads = (threads > IP2PROXY_LOAD_THREADS) ? IP2PROXY_LOAD_THREADS : threads;
+	threads = (threads > chunks) ? chunks : threads;
+	threads = (threads == 0) ? 1 : threads;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fileno(file), 0, (off_t) size, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fileno(file), 0, (off_t) size, POSIX_FADV_WILLNEED);
+#endif
+#endif
+
+	if ((crcs = (uint32_t *) calloc(chunks + 1, sizeof(uint32_t))) == NULL) {
+		return -1;
+	}
+
+	IP2Proxy_crc32c_init();
+
+	for (i = 0; i < threads; i++) {
+		jobs[i].file = file;
+		jobs[i].frames = frames;
+		jobs[i].memory = (uint8_t *) memory;
+		jobs[i].size = (uint64_t) size;
+		jobs[i].chunks = chunks;
+		jobs[i].first = i;
+		jobs[i].step = threads;
+		jobs[i].crcs = crcs;
+		jobs[i].result = 0;
+	}
+
+#ifndef WIN32
+	for (started = 1; started < threads; started++) {
+		if (pthread_create(&workers[started], NULL, IP2Proxy_load_worker, &jobs[started]) != 0) {
+			break;
+		}
+	}
+
+	// Jobs of the threads which could not start run here
+	IP2Proxy_load_worker(&jobs[0]);
+
+	for (i = started; i < threads; i++) {
+		IP2Proxy_load_worker(&jobs[i]);
+	}
+
+	for (i = 1; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+#else
+	IP2Proxy_load_worker(&jobs[0]);
+#endif
+
+	for (i = 0; i < threads; i++) {
+		if (jobs[i].result == -1) {
+			result = -1;
+		}
+	}
+
+	for (i = 0; i < chunks; i++) {
+		length = (i + 1 < chunks) ? IP2PROXY_LOAD_CHUNK : (uint64_t) size - (uint64_t) i * IP2PROXY_LOAD_CHUNK;
+		crc = IP2Proxy_crc32c_combine(crc, crcs[i], length);
+	}
+
+	free(crcs);
+
+	// A compressed BIN file records the checksum of its raw bytes
+	if (result == -1 || (frames != NULL && crc != frames->raw_crc32c)) {
+		return -1;
+	}
+
+	load_stats.size = (uint64_t) size;
+	load_stats.crc32c = crc;
+	load_stats.threads = started;
+	load_stats.seconds = IP2Proxy_now() - start;
+	load_stats.throughput = (load_stats.seconds > 0) ? (double) size / (1024.0 * 1024.0) / load_stats.seconds : 0;
+
+	return 0;
+}
+
+// Size, checksum and timing of the last load into memory
+int32_t IP2Proxy_get_load_stats(IP2Proxy *handler, IP2ProxyLoadStats *stats)
+{
+	if (handler == NULL || stats == NULL || load_stats.size == 0) {
+		return -1;
+	}
+
+	*stats = load_stats;
+
+	return 0;
+}
+
+// Close the memory
+int32_t IP2Proxy_close_memory(FILE *file)
+{
+	int64_t size;
+
+	if (lookup_mode == IP2PROXY_CACHE_MEMORY) {
+		if (memory_pointer != NULL) {
+			free(memory_pointer);
+		}
+	} else if (lookup_mode == IP2PROXY_SHARED_MEMORY) {
+		if (memory_pointer != NULL) {
+#ifndef	WIN32
+			if (IP2Proxy_memory_size(file, &size) == 0) {
+				munmap(memory_pointer, size);
+			}
+
+			close(shm_fd);
+#else
+#ifdef WIN32
+			UnmapViewOfFile(memory_pointer);
+			CloseHandle(shm_fd);
+#endif
+#endif
+		}
+	}
+
+	if (file != NULL) {
+		fclose(file);
+	}
+
+	lookup_mode = IP2PROXY_FILE_IO;
+	memory_frames = NULL;
+	return 0;
+}
+
+// Create page cache for File I/O mode
+static ip2proxy_page_cache *IP2Proxy_page_cache_new(FILE *file, ip2proxy_frames *frames, uint32_t pages)
+{
+	ip2proxy_page_cache *cache;
+	uint32_t buckets = 1;
+	uint32_t i;
+
+	if (file == NULL || pages == 0) {
+		return NULL;
+	}
+
+	// Keep hash chains short with at least two buckets per page
+	while (buckets < pages * 2) {
+		buckets <<= 1;
+	}
+
+	if ((cache = (ip2proxy_page_cache *) calloc(1, sizeof(ip2proxy_page_cache))) == NULL) {
+		return NULL;
+	}
+
+	cache->file = file;
+	cache->frames = frames;
+	cache->page_size = (frames != NULL) ? frames->frame_size : IP2PROXY_PAGE_SIZE;
+	cache->capacity = pages;
+	cache->bucket_mask = buckets - 1;
+	cache->head = -1;
+	cache->tail = -1;
+	cache->buckets = (int32_t *) malloc(buckets * sizeof(int32_t));
+	cache->pages = (ip2proxy_page *) calloc(pages, sizeof(ip2proxy_page));
+	cache->storage = (uint8_t *) malloc((size_t) pages * cache->page_size);
+
+	if (cache->buckets == NULL || cache->pages == NULL || cache->storage == NULL) {
+		IP2Proxy_page_cache_free(cache);
+		return NULL;
+	}
+
+	for (i = 0; i < buckets; i++) {
+		cache->buckets[i] = -1;
+	}
+
+	for (i = 0; i < pages; i++) {
+		cache->pages[i].data = cache->storage + (size_t) i * cache->page_size;
+	}
+
+	return cache;
+}
+
+// Free page cache
+static void IP2Proxy_page_cache_free(ip2proxy_page_cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+
+	free(cache->buckets);
+	free(cache->pages);
+	free(cache->storage);
+	free(cache);
+}
+
+// Unlink a page from the LRU list
+static void IP2Proxy_page_cache_unlink(ip2proxy_page_cache *cache, int32_t slot)
+{
+	ip2proxy_page *page = &cache->pages[slot];
+
+	if (page->prev != -1) {
+		cache->pages[page->prev].next = page->next;
+	} else {
+		cache->head = page->next;
+	}
+
+	if (page->next != -1) {
+		cache->pages[page->next].prev = page->prev;
+	} else {
+		cache->tail = page->prev;
+	}
+}
+
+// Put a page in front of the LRU list
+static void IP2Proxy_page_cache_push(ip2proxy_page_cache *cache, int32_t slot)
+{
+	ip2proxy_page *page = &cache->pages[slot];
+
+	page->prev = -1;
+	page->next = cache->head;
+
+	if (cache->head != -1) {
+		cache->pages[cache->head].prev = slot;
+	}
+
+	cache->head = slot;
+
+	if (cache->tail == -1) {
+		cache->tail = slot;
+	}
+}
+
+// Remove a page from its hash chain
+static void IP2Proxy_page_cache_unhash(ip2proxy_page_cache *cache, int32_t slot)
+{
+	int32_t *link = &cache->buckets[cache->pages[slot].number & cache->bucket_mask];
+
+	while (*link != -1) {
+		if (*link == slot) {
+			*link = cache->pages[slot].chain;
+			return;
+		}
+
+		link = &cache->pages[*link].chain;
+	}
+}
+
+// Read bytes at a zero based file offset without moving the file position
+static uint32_t IP2Proxy_pread(FILE *file, off_t offset, uint8_t *buffer, uint32_t size)
+{
+	uint32_t length = 0;
+
+#ifndef WIN32
+	ssize_t n;
+
+	while (length < size) {
+		n = pread(fileno(file), buffer + length, size - length, offset + length);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+
+		length += (uint32_t) n;
+	}
+#else
+	if (fseek(file, (long) offset, SEEK_SET) == 0) {
+		length = (uint32_t) fread(buffer, 1, size, file);
+	}
+#endif
+
+	return length;
+}
+
+// Hash of the next 4 bytes for the LZ4 match finder
+static uint32_t IP2Proxy_lz4_hash(const uint8_t *data)
+{
+	uint32_t value;
+
+	memcpy(&value, data, 4);
+
+	return (value * 2654435761U) >> (32 - IP2PROXY_LZ4_HASH_BITS);
+}
+
+// Write the extra bytes of a literal or match length of 15 or more
+static uint32_t IP2Proxy_lz4_put_length(uint8_t *destination, uint32_t out, uint32_t length)
+{
+	if (length < 15) {
+		return out;
+	}
+
+	for (length -= 15; length >= 255; length -= 255) {
+		destination[out++] = 255;
+	}
+
+	destination[out++] = (uint8_t) length;
+
+	return out;
+}
+
+// Compress a block in the LZ4 block format, 0 when it does not fit into capacity
+static uint32_t IP2Proxy_lz4_compress(const uint8_t *source, uint32_t size, uint8_t *destination, uint32_t capacity)
+{
+	uint32_t table[1 << IP2PROXY_LZ4_HASH_BITS];
+	uint32_t limit = (size > 12) ? size - 12 : 0;
+	uint32_t position = 0;
+	uint32_t anchor = 0;
+	uint32_t out = 0;
+	uint32_t candidate;
+	uint32_t literals;
+	uint32_t length;
+	uint32_t h;
+
+	memset(table, 0, sizeof(table));
+
+	// A match ends at least 5 bytes before the end and starts at least 12 bytes before it
+	while (position < limit) {
+		h = IP2Proxy_lz4_hash(source + position);
+		candidate = table[h];
+		table[h] = position;
+
+		if (candidate >= position || position - candidate > 65535 || memcmp(source + candidate, source + position, 4) != 0) {
+			position++;
+			continue;
+		}
+
+		length = 4;
+
+		while (position + length < size - 5 && source[candidate + length] == source[position + length]) {
+			length++;
+		}
+
+		literals = position - anchor;
+
+		if (out + 1 + literals / 255 + 1 + literals + 2 + (length - 4) / 255 + 1 > capacity) {
+			return 0;
+		}
+
+		destination[out++] = (uint8_t) (((literals < 15) ? literals : 15) << 4 | ((length - 4 < 15) ? length - 4 : 15));
+
+		out = IP2Proxy_lz4_put_length(destination, out, literals);
+
+		memcpy(destination + out, source + anchor, literals);
+		out += literals;
+		destination[out++] = (uint8_t) (position - candidate);
+		destination[out++] = (uint8_t) ((position - candidate) >> 8);
+
+		out = IP2Proxy_lz4_put_length(destination, out, length - 4);
+
+		position += length;
+		anchor = position;
+	}
+
+	// Last sequence holds only literals
+	literals = size - anchor;
+
+	if (out + 1 + literals / 255 + 1 + literals > capacity) {
+		return 0;
+	}
+
+	destination[out++] = (uint8_t) (((literals < 15) ? literals : 15) << 4);
+
+	out = IP2Proxy_lz4_put_length(destination, out, literals);
+
+	memcpy(destination + out, source + anchor, literals);
+
+	return out + literals;
+}
+
+// Decompress a block in the LZ4 block format, 0 on a corrupt block
+static uint32_t IP2Proxy_lz4_decompress(const uint8_t *source, uint32_t size, uint8_t *destination, uint32_t capacity)
+{
+	uint32_t in = 0;
+	uint32_t out = 0;
+	uint32_t offset;
+	uint32_t length;
+	uint8_t token;
+	uint8_t byte;
+
+	while (in < size) {
+		token = source[in++];
+		length = token >> 4;
+
+		if (length == 15) {
+			do {
+				if (in >= size) {
+					return 0;
+				}
+
+				byte = source[in++];
+				length += byte;
+			} while (byte == 255);
+		}
+
+		if (length > size - in || length > capacity - out) {
+			return 0;
+		}
+
+		memcpy(destination + out, source + in, length);
+		in += length;
+		out += length;
+
+		if (in == size) {
+			break;
+		}
+
+		if (size - in < 2) {
+			return 0;
+		}
+
+		offset = (uint32_t) source[in] | ((uint32_t) source[in + 1] << 8);
+		in += 2;
+		length = (token & 15) + 4;
+
+		if ((token & 15) == 15) {
+			do {
+				if (in >= size) {
+					return 0;
+				}
+
+				byte = source[in++];
+				length += byte;
+			} while (byte == 255);
+		}
+
+		if (offset == 0 || offset > out || length > capacity - out) {
+			return 0;
+		}
+
+		// Overlapping matches repeat the bytes just written
+		if (offset >= length) {
+			memcpy(destination + out, destination + out - offset, length);
+			out += length;
+		} else {
+			while (length-- > 0) {
+				destination[out] = destination[out - offset];
+				out++;
+			}
+		}
+	}
+
+	return out;
+}
+
+// Open the frames of a compressed BIN file, NULL for a plain BIN file
+static ip2proxy_frames *IP2Proxy_frames_open(FILE *file)
+{
+	ip2proxy_frames_header header;
+	ip2proxy_frames *frames;
+	struct stat file_stat;
+	uint64_t size;
+	uint32_t i;
+
+	if (IP2Proxy_pread(file, 0, (uint8_t *) &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, IP2PROXY_FRAMES_MAGIC, sizeof(header.magic)) != 0) {
+		return NULL;
+	}
+
+	// Only the frame size IP2Proxy_compress writes, the count must match the raw size without overflow
+	if (header.version != IP2PROXY_FRAMES_VERSION || header.byte_order != 0x01020304 || header.frame_size != IP2PROXY_FRAME_SIZE
+		|| header.frame_count != (uint32_t) (((uint64_t) header.raw_size + header.frame_size - 1) / header.frame_size)) {
+		return NULL;
+	}
+
+	size = ((uint64_t) header.frame_count + 1) * sizeof(uint32_t);
+
+	// A damaged header must not announce more offsets than the file holds
+	if (fstat(fileno(file), &file_stat) == -1 || (uint64_t) file_stat.st_size < sizeof(header) + size) {
+		return NULL;
+	}
+
+	if ((frames = (ip2proxy_frames *) calloc(1, sizeof(ip2proxy_frames))) == NULL) {
+		return NULL;
+	}
+
+	if ((frames->offsets = (uint32_t *) malloc((size_t) size)) == NULL || IP2Proxy_pread(file, sizeof(header), (uint8_t *) frames->offsets, (uint32_t) size) != size) {
+		IP2Proxy_frames_free(frames);
+		return NULL;
+	}
+
+	// Frames follow the offsets in order and none is longer than its raw bytes
+	for (i = 0; i < header.frame_count; i++) {
+		if (frames->offsets[i] < sizeof(header) + size || frames->offsets[i + 1] < frames->offsets[i] || frames->offsets[i + 1] - frames->offsets[i] > header.frame_size || frames->offsets[i + 1] > (uint64_t) file_stat.st_size) {
+			IP2Proxy_frames_free(frames);
+			return NULL;
+		}
+	}
+
+	frames->file = file;
+	frames->frame_size = header.frame_size;
+	frames->frame_count = header.frame_count;
+	frames->raw_size = header.raw_size;
+	frames->raw_crc32c = header.raw_crc32c;
+
+	return frames;
+}
+
+// Free the frames, the file belongs to the handler
+static void IP2Proxy_frames_free(ip2proxy_frames *frames)
+{
+	if (frames == NULL) {
+		return;
+	}
+
+	free(frames->offsets);
+	free(frames);
+}
+
+// Read and decompress a frame, returns its raw length or 0 on error
+static uint32_t IP2Proxy_frames_load(ip2proxy_frames *frames, uint32_t number, uint8_t *data)
+{
+	uint32_t raw = (number + 1 < frames->frame_count) ? frames->frame_size : frames->raw_size - number * frames->frame_size;
+	uint32_t stored = frames->offsets[number + 1] - frames->offsets[number];
+	uint8_t *compressed;
+	uint32_t length = 0;
+
+	if (stored == raw) {
+		return (IP2Proxy_pread(frames->file, (off_t) frames->offsets[number], data, raw) == raw) ? raw : 0;
+	}
+
+	// Scratch space per call keeps concurrent readers of the frames apart
+	if ((compressed = (uint8_t *) malloc(stored)) == NULL) {
+		return 0;
+	}
+
+	if (IP2Proxy_pread(frames->file, (off_t) frames->offsets[number], compressed, stored) == stored) {
+		length = IP2Proxy_lz4_decompress(compressed, stored, data, raw);
+	}
+
+	free(compressed);
+
+	return (length == raw) ? raw : 0;
+}
+
+// Read bytes at a zero based offset of the BIN file held in the frames
+static uint32_t IP2Proxy_frames_read(ip2proxy_frames *frames, off_t offset, uint8_t *buffer, uint32_t size)
+{
+	uint8_t *scratch = NULL;
+	uint32_t copied = 0;
+	uint32_t number;
+	uint32_t start;
+	uint32_t count;
+	uint32_t raw;
+
+	while (copied < size && offset < (off_t) frames->raw_size) {
+		number = (uint32_t) (offset / frames->frame_size);
+		start = (uint32_t) (offset % frames->frame_size);
+		raw = (number + 1 < frames->frame_count) ? frames->frame_size : frames->raw_size - number * frames->frame_size;
+		count = (size - copied < raw - start) ? size - copied : raw - start;
+
+		// Whole frames are decompressed straight into the buffer
+		if (start == 0 && count == raw) {
+			if (IP2Proxy_frames_load(frames, number, buffer + copied) != raw) {
+				break;
+			}
+		} else {
+			if (scratch == NULL && (scratch = (uint8_t *) malloc(frames->frame_size)) == NULL) {
+				break;
+			}
+
+			if (IP2Proxy_frames_load(frames, number, scratch) != raw) {
+				break;
+			}
+
+			memcpy(buffer + copied, scratch + start, count);
+		}
+
+		copied += count;
+		offset += count;
+	}
+
+	free(scratch);
+
+	return copied;
+}
+
+// Read bytes at a zero based offset of the BIN file of a handler, compressed or not
+static uint32_t IP2Proxy_read_at(IP2Proxy *handler, off_t offset, uint8_t *buffer, uint32_t size)
+{
+	if (handler->frames != NULL) {
+		return IP2Proxy_frames_read((ip2proxy_frames *) handler->frames, offset, buffer, size);
+	}
+
+	return IP2Proxy_pread(handler->file, offset, buffer, size);
+}
+
+// Read a page from the BIN file, a page is a frame of a compressed BIN file
+static uint32_t IP2Proxy_page_cache_load(ip2proxy_page_cache *cache, uint32_t number, uint8_t *data)
+{
+	if (cache->frames != NULL) {
+		return (number < cache->frames->frame_count) ? IP2Proxy_frames_load(cache->frames, number, data) : 0;
+	}
+
+	return IP2Proxy_pread(cache->file, (off_t) number * cache->page_size, data, cache->page_size);
+}
+
+// Get a page from cache, load it from file on miss
+static ip2proxy_page *IP2Proxy_page_cache_get(ip2proxy_page_cache *cache, uint32_t number)
+{
+	int32_t slot = cache->buckets[number & cache->bucket_mask];
+
+	while (slot != -1) {
+		if (cache->pages[slot].number == number) {
+			if (cache->head != slot) {
+				IP2Proxy_page_cache_unlink(cache, slot);
+				IP2Proxy_page_cache_push(cache, slot);
+			}
+
+			return &cache->pages[slot];
+		}
+
+		slot = cache->pages[slot].chain;
+	}
+
+	// Use a free slot, otherwise evict the least recently used page
+	if (cache->used < cache->capacity) {
+		slot = (int32_t) cache->used++;
+	} else {
+		slot = cache->tail;
+		IP2Proxy_page_cache_unlink(cache, slot);
+		IP2Proxy_page_cache_unhash(cache, slot);
+	}
+
+	cache->pages[slot].number = number;
+	cache->pages[slot].length = IP2Proxy_page_cache_load(cache, number, cache->pages[slot].data);
+	cache->pages[slot].chain = cache->buckets[number & cache->bucket_mask];
+	cache->buckets[number & cache->bucket_mask] = slot;
+	IP2Proxy_page_cache_push(cache, slot);
+
+	return &cache->pages[slot];
+}
+
+// Copy bytes at a zero based file offset out of the page cache
+static uint32_t IP2Proxy_page_cache_read(ip2proxy_page_cache *cache, uint64_t offset, uint8_t *buffer, uint32_t length)
+{
+	uint32_t copied = 0;
+
+	while (copied < length) {
+		ip2proxy_page *page = IP2Proxy_page_cache_get(cache, (uint32_t) (offset / cache->page_size));
+		uint32_t start = (uint32_t) (offset % cache->page_size);
+		uint32_t count = length - copied;
+
+		if (start >= page->length) {
+			break;
+		}
+
+		if (count > page->length - start) {
+			count = page->length - start;
+		}
+
+		memcpy(buffer + copied, page->data + start, count);
+		copied += count;
+		offset += count;
+	}
+
+	return copied;
+}
+
+// Load an IPv4 or IPv6 index table of 65536 low and high row pairs
+static uint32_t *IP2Proxy_pinned_load_index(IP2Proxy *handler, uint64_t position)
+{
+	uint32_t size = 65536 * 2 * sizeof(uint32_t);
+	uint32_t *index = (uint32_t *) malloc(size);
+	uint32_t i;
+
+	if (index == NULL) {
+		return NULL;
+	}
+
+	if (IP2Proxy_read_at(handler, (off_t) position - 1, (uint8_t *) index, size) != size) {
+		free(index);
+		return NULL;
+	}
+
+	// Decode in place, each entry is only read before it is written
+	for (i = 0; i < 65536 * 2; i++) {
+		index[i] = IP2Proxy_get32((uint8_t *) &index[i]);
+	}
+
+	return index;
+}
+
+// Scan the rows in large sequential reads and keep the first key of every n-th row
+static int32_t IP2Proxy_pinned_load_samples(IP2Proxy *handler, uint32_t interval, uint64_t base_address, uint32_t count, uint32_t column_offset, uint32_t *ipv4_samples, struct in6_addr *ipv6_samples)
+{
+	uint32_t rows_per_chunk = interval * ((1 << 20) / (interval * column_offset) + 1);
+	uint8_t *buffer = (uint8_t *) malloc((size_t) rows_per_chunk * column_offset);
+	uint32_t key_size = (ipv4_samples != NULL) ? 4 : 16;
+	uint32_t row;
+	uint32_t rows;
+	uint32_t i;
+
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	for (row = 0; row < count; row += rows) {
+		rows = (count - row < rows_per_chunk) ? count - row : rows_per_chunk;
+
+		if (IP2Proxy_read_at(handler, (off_t) base_address - 1 + (off_t) row * column_offset, buffer, rows * column_offset) < ((rows - 1) / interval * interval) * column_offset + key_size) {
+			free(buffer);
+			return -1;
+		}
+
+		for (i = 0; i < rows; i += interval) {
+			if (ipv4_samples != NULL) {
+				ipv4_samples[(row + i) / interval] = IP2Proxy_get32(buffer + i * column_offset);
+			} else {
+				ipv6_samples[(row + i) / interval] = IP2Proxy_get128(buffer + i * column_offset);
+			}
+		}
+	}
+
+	free(buffer);
+	return 0;
+}
+
+// Build the pinned index of a BIN database
+static ip2proxy_pinned_index *IP2Proxy_pinned_index_new(IP2Proxy *handler, uint32_t interval)
+{
+	ip2proxy_pinned_index *pinned = (ip2proxy_pinned_index *) calloc(1, sizeof(ip2proxy_pinned_index));
+
+	if (pinned == NULL) {
+		return NULL;
+	}
+
+	pinned->interval = interval;
+	pinned->ipv4_sample_count = (handler->ipv4_database_count + interval - 1) / interval;
+	pinned->ipv6_sample_count = (handler->ipv6_database_count + interval - 1) / interval;
+
+	if (handler->ipv4_index_base_address > 0 && (pinned->ipv4_index = IP2Proxy_pinned_load_index(handler, handler->ipv4_index_base_address)) == NULL) {
+		IP2Proxy_pinned_index_free(pinned);
+		return NULL;
+	}
+
+	if (handler->ipv6_index_base_address > 0 && (pinned->ipv6_index = IP2Proxy_pinned_load_index(handler, handler->ipv6_index_base_address)) == NULL) {
+		IP2Proxy_pinned_index_free(pinned);
+		return NULL;
+	}
+
+	if (pinned->ipv4_sample_count > 0) {
+		if ((pinned->ipv4_samples = (uint32_t *) malloc(pinned->ipv4_sample_count * sizeof(uint32_t))) == NULL
+			|| IP2Proxy_pinned_load_samples(handler, interval, handler->ipv4_database_address, handler->ipv4_database_count, handler->database_column * 4, pinned->ipv4_samples, NULL) == -1) {
+			IP2Proxy_pinned_index_free(pinned);
+			return NULL;
+		}
+	}
+
+	if (pinned->ipv6_sample_count > 0) {
+		if ((pinned->ipv6_samples = (struct in6_addr *) malloc(pinned->ipv6_sample_count * sizeof(struct in6_addr))) == NULL
+			|| IP2Proxy_pinned_load_samples(handler, interval, handler->ipv6_database_address, handler->ipv6_database_count, handler->database_column * 4 + 12, NULL, pinned->ipv6_samples) == -1) {
+			IP2Proxy_pinned_index_free(pinned);
+			return NULL;
+		}
+	}
+
+	return pinned;
+}
+
+// Free the pinned index
+static void IP2Proxy_pinned_index_free(ip2proxy_pinned_index *pinned)
+{
+	if (pinned == NULL) {
+		return;
+	}
+
+	// Arrays of a sidecar index file point into its mapping
+	if (pinned->mapping != NULL) {
+#ifndef WIN32
+		munmap(pinned->mapping, pinned->mapping_size);
+#else
+		free(pinned->mapping);
+#endif
+		free(pinned);
+		return;
+	}
+
+	free(pinned->ipv4_index);
+	free(pinned->ipv6_index);
+	free(pinned->ipv4_samples);
+	free(pinned->ipv6_samples);
+	free(pinned);
+}
+
+// CRC32C of the BIN header and index tables, binds a sidecar index file to its BIN database
+static int32_t IP2Proxy_index_fingerprint(IP2Proxy *handler, uint32_t *crc)
+{
+	uint8_t *buffer = (uint8_t *) malloc(IP2PROXY_INDEX_TABLE_SIZE);
+	uint64_t positions[2];
+	uint32_t i;
+
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	if (IP2Proxy_read_at(handler, 0, buffer, 64) != 64) {
+		free(buffer);
+		return -1;
+	}
+
+	*crc = IP2Proxy_crc32c(0, buffer, 64);
+
+	positions[0] = handler->ipv4_index_base_address;
+	positions[1] = handler->ipv6_index_base_address;
+
+	for (i = 0; i < 2; i++) {
+		if (positions[i] == 0) {
+			continue;
+		}
+
+		if (IP2Proxy_read_at(handler, (off_t) positions[i] - 1, buffer, IP2PROXY_INDEX_TABLE_SIZE) != IP2PROXY_INDEX_TABLE_SIZE) {
+			free(buffer);
+			return -1;
+		}
+
+		*crc = IP2Proxy_crc32c(*crc, buffer, IP2PROXY_INDEX_TABLE_SIZE);
+	}
+
+	free(buffer);
+	return 0;
+}
+
+// Fill the header of a sidecar index file for the BIN database of a handler
+static void IP2Proxy_index_header_init(IP2Proxy *handler, ip2proxy_pinned_index *pinned, ip2proxy_index_header *header)
+{
+	memset(header, 0, sizeof(ip2proxy_index_header));
+	memcpy(header->magic, IP2PROXY_INDEX_MAGIC, sizeof(header->magic));
+	header->version = IP2PROXY_INDEX_VERSION;
+	header->byte_order = 0x01020304;
+	header->interval = pinned->interval;
+	header->database_size = (uint32_t) handler->database_size; // the fingerprint covers the high bits in the header
+	header->database_type = handler->database_type;
+	header->database_column = handler->database_column;
+	header->database_year = handler->database_year;
+	header->database_month = handler->database_month;
+	header->database_day = handler->database_day;
+	header->ipv4_database_count = handler->ipv4_database_count;
+	header->ipv6_database_count = handler->ipv6_database_count;
+	header->ipv4_sample_count = pinned->ipv4_sample_count;
+	header->ipv6_sample_count = pinned->ipv6_sample_count;
+	header->flags = ((pinned->ipv4_index != NULL) ? IP2PROXY_INDEX_IPV4 : 0) | ((pinned->ipv6_index != NULL) ? IP2PROXY_INDEX_IPV6 : 0);
+}
+
+// Write the pinned index of a BIN database to a sidecar index file
+int32_t IP2Proxy_save_index(IP2Proxy *handler, const char *path, uint32_t interval)
+{
+	ip2proxy_pinned_index *pinned;
+	ip2proxy_index_header header;
+	char *temporary;
+	FILE *file;
+	int32_t result = -1;
+
+	if (handler == NULL || path == NULL || handler->is_csv == 1 || interval == 0) {
+		return -1;
+	}
+
+	if ((pinned = IP2Proxy_pinned_index_new(handler, interval)) == NULL) {
+		return -1;
+	}
+
+	IP2Proxy_index_header_init(handler, pinned, &header);
+
+	if (IP2Proxy_index_fingerprint(handler, &header.database_crc32c) == -1) {
+		IP2Proxy_pinned_index_free(pinned);
+		return -1;
+	}
+
+	if (pinned->ipv4_index != NULL) {
+		header.payload_crc32c = IP2Proxy_crc32c(header.payload_crc32c, (uint8_t *) pinned->ipv4_index, IP2PROXY_INDEX_TABLE_SIZE);
+	}
+	if (pinned->ipv6_index != NULL) {
+		header.payload_crc32c = IP2Proxy_crc32c(header.payload_crc32c, (uint8_t *) pinned->ipv6_index, IP2PROXY_INDEX_TABLE_SIZE);
+	}
+	header.payload_crc32c = IP2Proxy_crc32c(header.payload_crc32c, (uint8_t *) pinned->ipv4_samples, pinned->ipv4_sample_count * sizeof(uint32_t));
+	header.payload_crc32c = IP2Proxy_crc32c(header.payload_crc32c, (uint8_t *) pinned->ipv6_samples, pinned->ipv6_sample_count * sizeof(struct in6_addr));
+
+	// Written aside then renamed, processes starting meanwhile never see a partial file
+	if ((temporary = (char *) malloc(strlen(path) + 5)) == NULL) {
+		IP2Proxy_pinned_index_free(pinned);
+		return -1;
+	}
+
+	sprintf(temporary, "%s.tmp", path);
+
+	if ((file = fopen(temporary, "wb")) != NULL) {
+		if (fwrite(&header, sizeof(header), 1, file) == 1
+			&& (pinned->ipv4_index == NULL || fwrite(pinned->ipv4_index, IP2PROXY_INDEX_TABLE_SIZE, 1, file) == 1)
+			&& (pinned->ipv6_index == NULL || fwrite(pinned->ipv6_index, IP2PROXY_INDEX_TABLE_SIZE, 1, file) == 1)
+			&& fwrite(pinned->ipv4_samples, sizeof(uint32_t), pinned->ipv4_sample_count, file) == pinned->ipv4_sample_count
+			&& fwrite(pinned->ipv6_samples, sizeof(struct in6_addr), pinned->ipv6_sample_count, file) == pinned->ipv6_sample_count) {
+			result = 0;
+		}
+
+		if (fclose(file) != 0) {
+			result = -1;
+		}
+
+		if (result == 0 && rename(temporary, path) != 0) {
+			result = -1;
+		}
+
+		if (result == -1) {
+			remove(temporary);
+		}
+	}
+
+	free(temporary);
+	IP2Proxy_pinned_index_free(pinned);
+
+	return result;
+}
+
+// Compare the row keys sampled in a sidecar index file with the rows of the BIN database
+static int32_t IP2Proxy_index_check_samples(IP2Proxy *handler, ip2proxy_pinned_index *pinned)
+{
+	uint32_t *ipv4_samples = NULL;
+	struct in6_addr *ipv6_samples = NULL;
+	int32_t result = 0;
+
+	if (pinned->ipv4_sample_count > 0) {
+		if ((ipv4_samples = (uint32_t *) malloc(pinned->ipv4_sample_count * sizeof(uint32_t))) == NULL
+			|| IP2Proxy_pinned_load_samples(handler, pinned->interval, handler->ipv4_database_address, handler->ipv4_database_count, handler->database_column * 4, ipv4_samples, NULL) == -1
+			|| memcmp(ipv4_samples, pinned->ipv4_samples, pinned->ipv4_sample_count * sizeof(uint32_t)) != 0) {
+			result = -1;
+		}
+	}
+
+	if (result == 0 && pinned->ipv6_sample_count > 0) {
+		if ((ipv6_samples = (struct in6_addr *) malloc(pinned->ipv6_sample_count * sizeof(struct in6_addr))) == NULL
+			|| IP2Proxy_pinned_load_samples(handler, pinned->interval, handler->ipv6_database_address, handler->ipv6_database_count, handler->database_column * 4 + 12, NULL, ipv6_samples) == -1
+			|| memcmp(ipv6_samples, pinned->ipv6_samples, pinned->ipv6_sample_count * sizeof(struct in6_addr)) != 0) {
+			result = -1;
+		}
+	}
+
+	free(ipv4_samples);
+	free(ipv6_samples);
+
+	return result;
+}
+
+// Check a mapped sidecar index file against the BIN database and point the pinned index into it
+static int32_t IP2Proxy_index_attach(IP2Proxy *handler, ip2proxy_pinned_index *pinned)
+{
+	ip2proxy_index_header *header = (ip2proxy_index_header *) pinned->mapping;
+	ip2proxy_index_header expected;
+	uint8_t *data = (uint8_t *) pinned->mapping + sizeof(ip2proxy_index_header);
+	size_t payload = pinned->mapping_size - sizeof(ip2proxy_index_header);
+
+	pinned->interval = header->interval;
+	pinned->ipv4_sample_count = header->ipv4_sample_count;
+	pinned->ipv6_sample_count = header->ipv6_sample_count;
+
+	if (pinned->interval == 0) {
+		return -1;
+	}
+
+	// Same version, same BIN database, same sampling
+	IP2Proxy_index_header_init(handler, pinned, &expected);
+	expected.flags = ((handler->ipv4_index_base_address > 0) ? IP2PROXY_INDEX_IPV4 : 0) | ((handler->ipv6_index_base_address > 0) ? IP2PROXY_INDEX_IPV6 : 0);
+	expected.ipv4_sample_count = (handler->ipv4_database_count + pinned->interval - 1) / pinned->interval;
+	expected.ipv6_sample_count = (handler->ipv6_database_count + pinned->interval - 1) / pinned->interval;
+	expected.payload_crc32c = header->payload_crc32c;
+
+	if (IP2Proxy_index_fingerprint(handler, &expected.database_crc32c) == -1 || memcmp(header, &expected, sizeof(ip2proxy_index_header)) != 0) {
+		return -1;
+	}
+
+	if (payload != ((header->flags & IP2PROXY_INDEX_IPV4) ? IP2PROXY_INDEX_TABLE_SIZE : 0) + ((header->flags & IP2PROXY_INDEX_IPV6) ? IP2PROXY_INDEX_TABLE_SIZE : 0)
+		+ (size_t) header->ipv4_sample_count * sizeof(uint32_t) + (size_t) header->ipv6_sample_count * sizeof(struct in6_addr)) {
+		return -1;
+	}
+
+	// A damaged sidecar would return wrong records
+	if (IP2Proxy_crc32c(0, data, payload) != header->payload_crc32c) {
+		return -1;
+	}
+
+	if (header->flags & IP2PROXY_INDEX_IPV4) {
+		pinned->ipv4_index = (uint32_t *) data;
+		data += IP2PROXY_INDEX_TABLE_SIZE;
+	}
+
+	if (header->flags & IP2PROXY_INDEX_IPV6) {
+		pinned->ipv6_index = (uint32_t *) data;
+		data += IP2PROXY_INDEX_TABLE_SIZE;
+	}
+
+	pinned->ipv4_samples = (uint32_t *) data;
+	data += (size_t) header->ipv4_sample_count * sizeof(uint32_t);
+	pinned->ipv6_samples = (struct in6_addr *) data;
+
+	// The fingerprint does not cover the rows, a DB rebuilt with the same header and index tables is caught here
+	return IP2Proxy_index_check_samples(handler, pinned);
+}
+
+// Map a sidecar index file and use it as pinned index, the plain search is kept when it is missing or stale
+int32_t IP2Proxy_load_index(IP2Proxy *handler, const char *path)
+{
+	ip2proxy_pinned_index *pinned;
+	struct stat buffer;
+	uint8_t *data;
+	size_t size;
+	int fd;
+
+	if (handler == NULL || path == NULL || handler->is_csv == 1) {
+		return -1;
+	}
+
+	// Database is already in memory
+	if (lookup_mode != IP2PROXY_FILE_IO) {
+		return -1;
+	}
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		return -1;
+	}
+
+	if (fstat(fd, &buffer) == -1 || (size_t) buffer.st_size < sizeof(ip2proxy_index_header)) {
+		close(fd);
+		return -1;
+	}
+
+	size = (size_t) buffer.st_size;
+
+#ifndef WIN32
+	data = (uint8_t *) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (data == (uint8_t *) MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+#else
+	if ((data = (uint8_t *) malloc(size)) == NULL || read(fd, data, (unsigned int) size) != (int) size) {
+		free(data);
+		close(fd);
+		return -1;
+	}
+#endif
+
+	close(fd);
+
+	if ((pinned = (ip2proxy_pinned_index *) calloc(1, sizeof(ip2proxy_pinned_index))) == NULL) {
+#ifndef WIN32
+		munmap(data, size);
+#else
+		free(data);
+#endif
+		return -1;
+	}
+
+	pinned->mapping = data;
+	pinned->mapping_size = size;
+
+	if (IP2Proxy_index_attach(handler, pinned) == -1) {
+		IP2Proxy_pinned_index_free(pinned);
+		return -1;
+	}
+
+	IP2Proxy_pinned_index_free(handler->pinned_index);
+	handler->pinned_index = pinned;
+
+	return 0;
+}
+
+// Narrow the IPv4 search to the rows between two sampled keys
+static void IP2Proxy_pinned_narrow_ipv4(ip2proxy_pinned_index *pinned, uint32_t ip_number, uint32_t *low, uint32_t *high)
+{
+	uint32_t interval = pinned->interval;
+	uint32_t first = *low / interval;
+	uint32_t last = *high / interval;
+	uint32_t mid;
+
+	if (pinned->ipv4_sample_count == 0) {
+		return;
+	}
+
+	if (last >= pinned->ipv4_sample_count) {
+		last = pinned->ipv4_sample_count - 1;
+	}
+
+	if (first > last) {
+		return;
+	}
+
+	// Find the last sampled row starting at or below the IP number
+	while (first < last) {
+		mid = (first + last + 1) >> 1;
+
+		if (pinned->ipv4_samples[mid] <= ip_number) {
+			first = mid;
+		} else {
+			last = mid - 1;
+		}
+	}
+
+	if (first * interval > *low) {
+		*low = first * interval;
+	}
+
+	if (first * interval + interval - 1 < *high) {
+		*high = first * interval + interval - 1;
+	}
+}
+
+// Narrow the IPv6 search to the rows between two sampled keys
+static void IP2Proxy_pinned_narrow_ipv6(ip2proxy_pinned_index *pinned, struct in6_addr *ip_number, uint32_t *low, uint32_t *high)
+{
+	uint32_t interval = pinned->interval;
+	uint32_t first = *low / interval;
+	uint32_t last = *high / interval;
+	uint32_t mid;
+
+	if (pinned->ipv6_sample_count == 0) {
+		return;
+	}
+
+	if (last >= pinned->ipv6_sample_count) {
+		last = pinned->ipv6_sample_count - 1;
+	}
+
+	if (first > last) {
+		return;
+	}
+
+	// Find the last sampled row starting at or below the IP number
+	while (first < last) {
+		mid = (first + last + 1) >> 1;
+
+		if (IP2Proxy_ipv6_compare(&pinned->ipv6_samples[mid], ip_number) <= 0) {
+			first = mid;
+		} else {
+			last = mid - 1;
+		}
+	}
+
+	if (first * interval > *low) {
+		*low = first * interval;
+	}
+
+	if (first * interval + interval - 1 < *high) {
+		*high = first * interval + interval - 1;
+	}
+}
+
+// Get bytes at a database position, pointing into memory when the database is loaded
+static const uint8_t *IP2Proxy_fetch(IP2Proxy *handler, uint64_t position, uint32_t length, uint8_t *buffer)
+{
+	uint32_t copied;
+
+	if (lookup_mode != IP2PROXY_FILE_IO) {
+		return (uint8_t *) memory_pointer + position - 1;
+	}
+
+	if (handler->page_cache != NULL) {
+		copied = IP2Proxy_page_cache_read((ip2proxy_page_cache *) handler->page_cache, position - 1, buffer, length);
+	} else {
+		copied = IP2Proxy_read_at(handler, (off_t) position - 1, buffer, length);
+	}
+
+	if (copied < length) {
+		memset(buffer + copied, 0, length - copied);
+	}
+
+	return buffer;
+}
+
+// Decode a little endian 32-bit value
+static uint32_t IP2Proxy_get32(const uint8_t *buffer)
+{
+	return ((uint32_t) buffer[3] << 24) | ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[1] << 8) | (uint32_t) buffer[0];
+}
+
+// Decode a big endian 32-bit value
+static uint32_t IP2Proxy_get32_be(const uint8_t *buffer)
+{
+	return ((uint32_t) buffer[0] << 24) | ((uint32_t) buffer[1] << 16) | ((uint32_t) buffer[2] << 8) | (uint32_t) buffer[3];
+}
+
+// Decode a little endian 128-bit IPv6 address
+static struct in6_addr IP2Proxy_get128(const uint8_t *buffer)
+{
+	int i;
+	struct in6_addr addr6;
+
+	for (i = 0; i < 16; i++) {
+		addr6.s6_addr[i] = buffer[15 - i];
+	}
+
+	return addr6;
+}
+
+#ifndef	WIN32
+// Remove shared memory object
+void IP2Proxy_delete_shared_memory()
+{
+	shm_unlink(IP2PROXY_SHM);
+}
+#else
+#ifdef WIN32
+void IP2Proxy_delete_shared_memory()
+{
+}
+#endif
+#endif
+
+#ifndef WIN32
+enum {
+	IP2PROXY_ASYNC_INDEX,
+	IP2PROXY_ASYNC_SEARCH,
+	IP2PROXY_ASYNC_STRINGS
+};
+
+typedef struct ip2proxy_async_lookup ip2proxy_async_lookup;
+
+// One positioned read issued by a lookup
+typedef struct ip2proxy_async_read {
+	struct ip2proxy_async_read *next;
+	ip2proxy_async_lookup *lookup;
+	off_t offset;
+	uint32_t length;
+	int32_t result;
+	uint8_t *buffer;
+	struct iovec iov;
+} ip2proxy_async_read;
+
+// Lookup in flight, advanced by the completion of its reads
+struct ip2proxy_async_lookup {
+	ip2proxy_async_lookup *next;
+	IP2Proxy_async_callback callback;
+	void *user_data;
+	IP2ProxyRecord *record;
+	ip_container ip;
+	uint32_t mode;
+	uint32_t state;
+	uint32_t low;
+	uint32_t high;
+	uint32_t pending;
+	uint8_t index[8];
+	uint8_t row[200];
+	ip2proxy_async_read reads[16];
+	ip2proxy_prefetch strings;
+};
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#define IP2PROXY_IO_URING
+
+// Submission and completion rings shared with the kernel
+typedef struct ip2proxy_uring {
+	int32_t fd;
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t in_flight;
+	uint32_t to_submit;
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+} ip2proxy_uring;
+#endif
+
+struct IP2ProxyAsync {
+	IP2Proxy *handler;
+	int32_t notify_fd[2];
+	uint32_t in_flight;
+	ip2proxy_async_lookup *lookups;
+	ip2proxy_async_lookup *free_list;
+	ip2proxy_async_lookup *done_head;
+	ip2proxy_async_lookup *done_tail;
+	ip2proxy_async_read *backlog_head;
+	ip2proxy_async_read *backlog_tail;
+#ifdef IP2PROXY_IO_URING
+	ip2proxy_uring ring;
+#endif
+	pthread_t *threads;
+	uint32_t thread_count;
+	int32_t stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	ip2proxy_async_read *queue_head;
+	ip2proxy_async_read *queue_tail;
+	ip2proxy_async_read *completed;
+};
+
+static void IP2Proxy_async_step(IP2ProxyAsync *async, ip2proxy_async_lookup *lookup);
+
+// Collect the string fields a record decode will read
+static void IP2Proxy_prefetch_positions(IP2Proxy *handler, const uint8_t *buffer, uint32_t mode, ip2proxy_prefetch *prefetch)
+{
+	uint8_t dbtype = handler->database_type;
+	uint8_t *positions[] = { IP2PROXY_COUNTRY_POSITION, IP2PROXY_PROXY_TYPE_POSITION, IP2PROXY_REGION_POSITION, IP2PROXY_CITY_POSITION, IP2PROXY_ISP_POSITION, IP2PROXY_DOMAIN_POSITION, IP2PROXY_USAGE_TYPE_POSITION, IP2PROXY_ASN_POSITION, IP2PROXY_AS_POSITION, IP2PROXY_LAST_SEEN_POSITION, IP2PROXY_THREAT_POSITION, IP2PROXY_PROVIDER_POSITION, IP2PROXY_FRAUD_SCORE_POSITION, IP2PROXY_COUNTRY_POSITION };
+	uint32_t masks[] = { ISPROXY | COUNTRYSHORT, ISPROXY | PROXYTYPE, REGION, CITY, ISP, DOMAINNAME, USAGETYPE, ASN, AS, LASTSEEN, THREAT, PROVIDER, FRAUDSCORE, COUNTRYLONG };
+	uint32_t position;
+	uint32_t i, j;
+
+	prefetch->count = 0;
+
+	for (i = 0; i < sizeof(masks) / sizeof(masks[0]); i++) {
+		if ((mode & masks[i]) == 0 || positions[i][dbtype] == 0) {
+			continue;
+		}
+
+		position = IP2Proxy_get32(buffer + 4 * (positions[i][dbtype] - 2));
+
+		// Country name follows the 2 characters country code
+		if (masks[i] == COUNTRYLONG) {
+			position += 3;
+		}
+
+		for (j = 0; j < prefetch->count; j++) {
+			if (prefetch->position[j] == position) {
+				break;
+			}
+		}
+
+		if (j == prefetch->count) {
+			prefetch->position[prefetch->count++] = position;
+		}
+	}
+}
+
+// Wake up the event loop waiting on the notification descriptor
+static void IP2Proxy_async_notify(IP2ProxyAsync *async)
+{
+	uint64_t value = 1;
+
+	if (write(async->notify_fd[1], &value, sizeof(value)) < 0) {
+		// Descriptor is already readable
+	}
+}
+
+#ifdef IP2PROXY_IO_URING
+// Map the rings of a new io_uring instance
+static int32_t IP2Proxy_uring_open(ip2proxy_uring *ring, uint32_t entries, int32_t event_fd)
+{
+	struct io_uring_params params;
+	uint8_t *sq;
+	uint8_t *cq;
+
+	memset(&params, 0, sizeof(params));
+
+	if ((ring->fd = (int32_t) syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+		ring->fd = -1;
+		return -1;
+	}
+
+	ring->sq_entries = params.sq_entries;
+	ring->cq_entries = params.cq_entries;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size) {
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+
+		ring->cq_ring_size = 0;
+	}
+#endif
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = ring->sq_ring;
+
+	if (ring->sq_ring != MAP_FAILED && ring->cq_ring_size > 0) {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	}
+
+	ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || (void *) ring->sqes == MAP_FAILED
+		|| syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) {
+		if (ring->sq_ring != MAP_FAILED) {
+			munmap(ring->sq_ring, ring->sq_ring_size);
+		}
+
+		if (ring->cq_ring_size > 0 && ring->cq_ring != MAP_FAILED) {
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		}
+
+		if ((void *) ring->sqes != MAP_FAILED) {
+			munmap(ring->sqes, ring->sqes_size);
+		}
+
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+
+	sq = (uint8_t *) ring->sq_ring;
+	cq = (uint8_t *) ring->cq_ring;
+	ring->sq_head = (uint32_t *) (sq + params.sq_off.head);
+	ring->sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+	ring->sq_mask = (uint32_t *) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (uint32_t *) (sq + params.sq_off.array);
+	ring->cq_head = (uint32_t *) (cq + params.cq_off.head);
+	ring->cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+	ring->cq_mask = (uint32_t *) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	return 0;
+}
+
+// Unmap the rings and close the io_uring instance
+static void IP2Proxy_uring_close(ip2proxy_uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+
+	if (ring->cq_ring_size > 0) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+// Put a read into the submission ring, 0 when the ring is full
+static int32_t IP2Proxy_uring_queue(ip2proxy_uring *ring, FILE *file, ip2proxy_async_read *request)
+{
+	uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	uint32_t tail = *ring->sq_tail;
+	uint32_t index;
+	struct io_uring_sqe *sqe;
+
+	// Never have more reads in flight than completion entries
+	if (tail - head >= ring->sq_entries || ring->in_flight >= ring->cq_entries) {
+		return 0;
+	}
+
+	index = tail & *ring->sq_mask;
+	sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+
+	request->iov.iov_base = request->buffer;
+	request->iov.iov_len = request->length;
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fileno(file);
+	sqe->off = (uint64_t) request->offset;
+	sqe->addr = (uint64_t) (uintptr_t) &request->iov;
+	sqe->len = 1;
+	sqe->user_data = (uint64_t) (uintptr_t) request;
+
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+	ring->in_flight++;
+
+	return 1;
+}
+
+// Hand the queued reads over to the kernel
+static void IP2Proxy_uring_submit(ip2proxy_uring *ring)
+{
+	long submitted;
+
+	while (ring->to_submit > 0) {
+		submitted = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 0, 0, NULL, 0);
+
+		if (submitted < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			break;
+		}
+
+		ring->to_submit -= (uint32_t) submitted;
+	}
+}
+#endif
+
+// Issue a read, it completes later through IP2Proxy_async_poll
+static void IP2Proxy_async_queue_read(IP2ProxyAsync *async, ip2proxy_async_lookup *lookup, off_t offset, uint32_t length, uint8_t *buffer)
+{
+	ip2proxy_async_read *request = &lookup->reads[lookup->pending++];
+
+	request->next = NULL;
+	request->lookup = lookup;
+	request->offset = offset;
+	request->length = length;
+	request->buffer = buffer;
+	request->result = 0;
+
+#ifdef IP2PROXY_IO_URING
+	if (async->ring.fd != -1) {
+		if (async->backlog_head != NULL || !IP2Proxy_uring_queue(&async->ring, async->handler->file, request)) {
+			if (async->backlog_tail != NULL) {
+				async->backlog_tail->next = request;
+			} else {
+				async->backlog_head = request;
+			}
+
+			async->backlog_tail = request;
+		}
+
+		return;
+	}
+#endif
+
+	pthread_mutex_lock(&async->lock);
+
+	if (async->queue_tail != NULL) {
+		async->queue_tail->next = request;
+	} else {
+		async->queue_head = request;
+	}
+
+	async->queue_tail = request;
+	pthread_cond_signal(&async->cond);
+	pthread_mutex_unlock(&async->lock);
+}
+
+// Move reads waiting for ring space into the ring and submit them
+static void IP2Proxy_async_flush(IP2ProxyAsync *async)
+{
+#ifdef IP2PROXY_IO_URING
+	if (async->ring.fd != -1) {
+		while (async->backlog_head != NULL && IP2Proxy_uring_queue(&async->ring, async->handler->file, async->backlog_head)) {
+			async->backlog_head = async->backlog_head->next;
+		}
+
+		if (async->backlog_head == NULL) {
+			async->backlog_tail = NULL;
+		}
+
+		IP2Proxy_uring_submit(&async->ring);
+	}
+#endif
+}
+
+// Thread pool worker serving reads when io_uring is not available
+static void *IP2Proxy_async_worker(void *arg)
+{
+	IP2ProxyAsync *async = (IP2ProxyAsync *) arg;
+	ip2proxy_async_read *request;
+
+	pthread_mutex_lock(&async->lock);
+
+	for (;;) {
+		while (async->stop == 0 && async->queue_head == NULL) {
+			pthread_cond_wait(&async->cond, &async->lock);
+		}
+
+		if (async->queue_head == NULL) {
+			break;
+		}
+
+		request = async->queue_head;
+		async->queue_head = request->next;
+
+		if (async->queue_head == NULL) {
+			async->queue_tail = NULL;
+		}
+
+		pthread_mutex_unlock(&async->lock);
+
+		request->result = (int32_t) IP2Proxy_read_at(async->handler, request->offset, request->buffer, request->length);
+
+		pthread_mutex_lock(&async->lock);
+		request->next = async->completed;
+		async->completed = request;
+		IP2Proxy_async_notify(async);
+	}
+
+	pthread_mutex_unlock(&async->lock);
+
+	return NULL;
+}
+
+// Queue a finished lookup for delivery
+static void IP2Proxy_async_finish(IP2ProxyAsync *async, ip2proxy_async_lookup *lookup, IP2ProxyRecord *record)
+{
+	lookup->record = record;
+	lookup->next = NULL;
+
+	if (async->done_tail != NULL) {
+		async->done_tail->next = lookup;
+	} else {
+		async->done_head = lookup;
+	}
+
+	async->done_tail = lookup;
+}
+
+// Read the next row of the binary search
+static void IP2Proxy_async_probe(IP2ProxyAsync *async, ip2proxy_async_lookup *lookup)
+{
+	IP2Proxy *handler = async->handler;
+	uint32_t ipv6 = (lookup->ip.version == 6);
+	uint32_t column_offset = handler->database_column * 4 + (ipv6 ? 12 : 0);
+	uint64_t base_address = ipv6 ? handler->ipv6_database_address : handler->ipv4_database_address;
+	uint32_t mid;
+
+	if (lookup->low > lookup->high) {
+		IP2Proxy_async_finish(async, lookup, IP2Proxy_bad_record(NOT_SUPPORTED));
+		return;
+	}
+
+	mid = (lookup->low + lookup->high) >> 1;
+	lookup->state = IP2PROXY_ASYNC_SEARCH;
+	IP2Proxy_async_queue_read(async, lookup, (off_t) base_address - 1 + (off_t) mid * column_offset, column_offset + (ipv6 ? 16 : 4), lookup->row);
+}
+
+// Advance a lookup once all of its reads are done
+static void IP2Proxy_async_step(IP2ProxyAsync *async, ip2proxy_async_lookup *lookup)
+{
+	IP2Proxy *handler = async->handler;
+	uint32_t ipv6 = (lookup->ip.version == 6);
+	uint32_t key_size = ipv6 ? 16 : 4;
+	uint32_t column_offset = handler->database_column * 4 + (ipv6 ? 12 : 0);
+	uint32_t mid = (lookup->low + lookup->high) >> 1;
+	int32_t below;
+	int32_t above;
+	uint32_t i;
+
+	switch (lookup->state) {
+		case IP2PROXY_ASYNC_INDEX:
+			lookup->low = IP2Proxy_get32(lookup->index);
+			lookup->high = IP2Proxy_get32(lookup->index + 4);
+			IP2Proxy_async_probe(async, lookup);
+			return;
+
+		case IP2PROXY_ASYNC_SEARCH:
+			if (ipv6) {
+				struct in6_addr ip_from = IP2Proxy_get128(lookup->row);
+				struct in6_addr ip_to = IP2Proxy_get128(lookup->row + column_offset);
+
+				below = IP2Proxy_ipv6_compare(&lookup->ip.ipv6, &ip_from) < 0;
+				above = IP2Proxy_ipv6_compare(&lookup->ip.ipv6, &ip_to) >= 0;
+			} else {
+				below = lookup->ip.ipv4 < IP2Proxy_get32(lookup->row);
+				above = lookup->ip.ipv4 >= IP2Proxy_get32(lookup->row + column_offset);
+			}
+
+			if (below) {
+				lookup->high = mid - 1;
+				IP2Proxy_async_probe(async, lookup);
+			} else if (above) {
+				lookup->low = mid + 1;
+				IP2Proxy_async_probe(async, lookup);
+			} else {
+				// Row found, read all of its string fields at once
+				lookup->state = IP2PROXY_ASYNC_STRINGS;
+				IP2Proxy_prefetch_positions(handler, lookup->row + key_size, lookup->mode, &lookup->strings);
+
+				for (i = 0; i < lookup->strings.count; i++) {
+					IP2Proxy_async_queue_read(async, lookup, (off_t) (handler->strings_base + lookup->strings.position[i]), sizeof(lookup->strings.data[i]), lookup->strings.data[i]);
+				}
+
+				if (lookup->pending == 0) {
+					IP2Proxy_async_finish(async, lookup, IP2Proxy_read_record(handler, lookup->row + key_size, lookup->mode, &lookup->strings));
+				}
+			}
+			return;
+
+		case IP2PROXY_ASYNC_STRINGS:
+			IP2Proxy_async_finish(async, lookup, IP2Proxy_read_record(handler, lookup->row + key_size, lookup->mode, &lookup->strings));
+			return;
+	}
+}
+
+// A read completed, advance its lookup when it was the last one outstanding
+static void IP2Proxy_async_complete(IP2ProxyAsync *async, ip2proxy_async_read *request)
+{
+	ip2proxy_async_lookup *lookup = request->lookup;
+	uint32_t length = (request->result > 0) ? (uint32_t) request->result : 0;
+
+	if (length < request->length) {
+		memset(request->buffer + length, 0, request->length - length);
+	}
+
+	if (--lookup->pending == 0) {
+		IP2Proxy_async_step(async, lookup);
+	}
+}
+
+// Process the reads completed by the kernel or the thread pool
+static void IP2Proxy_async_reap(IP2ProxyAsync *async)
+{
+	ip2proxy_async_read *request;
+	ip2proxy_async_read *next;
+
+#ifdef IP2PROXY_IO_URING
+	if (async->ring.fd != -1) {
+		ip2proxy_uring *ring = &async->ring;
+		uint32_t head = *ring->cq_head;
+		uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		struct io_uring_cqe *cqe;
+
+		while (head != tail) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			request = (ip2proxy_async_read *) (uintptr_t) cqe->user_data;
+			request->result = cqe->res;
+			ring->in_flight--;
+			head++;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+			IP2Proxy_async_complete(async, request);
+			tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		}
+
+		IP2Proxy_async_flush(async);
+		return;
+	}
+#endif
+
+	pthread_mutex_lock(&async->lock);
+	request = async->completed;
+	async->completed = NULL;
+	pthread_mutex_unlock(&async->lock);
+
+	while (request != NULL) {
+		next = request->next;
+		IP2Proxy_async_complete(async, request);
+		request = next;
+	}
+}
+
+// Create an asynchronous lookup context, io_uring is used unless the thread pool is requested
+IP2ProxyAsync *IP2Proxy_async_open(IP2Proxy *handler, uint32_t max_lookups, uint32_t flags)
+{
+	IP2ProxyAsync *async;
+	uint32_t i;
+
+	if (handler == NULL || max_lookups == 0) {
+		return NULL;
+	}
+
+	if ((async = (IP2ProxyAsync *) calloc(1, sizeof(IP2ProxyAsync))) == NULL) {
+		return NULL;
+	}
+
+	async->handler = handler;
+#ifdef IP2PROXY_IO_URING
+	async->ring.fd = -1;
+#endif
+
+	if ((async->lookups = (ip2proxy_async_lookup *) calloc(max_lookups, sizeof(ip2proxy_async_lookup))) == NULL) {
+		free(async);
+		return NULL;
+	}
+
+	for (i = 0; i < max_lookups; i++) {
+		async->lookups[i].next = async->free_list;
+		async->free_list = &async->lookups[i];
+	}
+
+#ifdef HAVE_SYS_EVENTFD_H
+	async->notify_fd[0] = async->notify_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (async->notify_fd[0] == -1) {
+#else
+	if (pipe(async->notify_fd) == -1 || fcntl(async->notify_fd[0], F_SETFL, O_NONBLOCK) == -1 || fcntl(async->notify_fd[1], F_SETFL, O_NONBLOCK) == -1) {
+#endif
+		free(async->lookups);
+		free(async);
+		return NULL;
+	}
+
+#ifdef IP2PROXY_IO_URING
+	// Frames of a compressed BIN file are decompressed by the thread pool
+	if ((flags & IP2PROXY_ASYNC_THREAD_POOL) == 0 && lookup_mode == IP2PROXY_FILE_IO && handler->is_csv == 0 && handler->frames == NULL) {
+		uint32_t entries = 1;
+
+		while (entries < max_lookups * 16 && entries < 4096) {
+			entries <<= 1;
+		}
+
+		if (IP2Proxy_uring_open(&async->ring, entries, async->notify_fd[0]) == 0) {
+			return async;
+		}
+	}
+#endif
+
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->cond, NULL);
+
+	if ((async->threads = (pthread_t *) calloc(IP2PROXY_ASYNC_THREADS, sizeof(pthread_t))) == NULL) {
+		IP2Proxy_async_close(async);
+		return NULL;
+	}
+
+	for (i = 0; i < IP2PROXY_ASYNC_THREADS; i++) {
+		if (pthread_create(&async->threads[i], NULL, IP2Proxy_async_worker, async) != 0) {
+			break;
+		}
+
+		async->thread_count++;
+	}
+
+	if (async->thread_count == 0) {
+		IP2Proxy_async_close(async);
+		return NULL;
+	}
+
+	return async;
+}
+
+// Start a lookup, the callback is invoked from IP2Proxy_async_poll once it completes
+int32_t IP2Proxy_async_submit(IP2ProxyAsync *async, const char *ip, uint32_t mode, IP2Proxy_async_callback callback, void *user_data)
+{
+	IP2Proxy *handler;
+	ip2proxy_async_lookup *lookup;
+
+	if (async == NULL || ip == NULL || async->free_list == NULL) {
+		return -1;
+	}
+
+	handler = async->handler;
+	lookup = async->free_list;
+	async->free_list = lookup->next;
+	async->in_flight++;
+
+	lookup->callback = callback;
+	lookup->user_data = user_data;
+	lookup->record = NULL;
+	lookup->mode = mode;
+	lookup->pending = 0;
+	lookup->strings.count = 0;
+	lookup->ip = IP2Proxy_parse_address(ip);
+
+	// Nothing to read from the file, answer right away
+	if (handler->is_csv == 1 || lookup_mode != IP2PROXY_FILE_IO || (lookup->ip.version != 4 && lookup->ip.version != 6) || (lookup->ip.version == 6 && handler->ipv6_database_count == 0)) {
+		IP2Proxy_async_finish(async, lookup, IP2Proxy_get_record(handler, (char *) ip, mode));
+		IP2Proxy_async_notify(async);
+		return 0;
+	}
+
+	if (lookup->ip.version == 4) {
+		if (lookup->ip.ipv4 == (uint32_t) MAX_IPV4_RANGE) {
+			lookup->ip.ipv4--;
+		}
+
+		lookup->low = 0;
+		lookup->high = handler->ipv4_database_count;
+
+		if (handler->pinned_index != NULL) {
+			ip2proxy_pinned_index *pinned = (ip2proxy_pinned_index *) handler->pinned_index;
+
+			if (pinned->ipv4_index != NULL) {
+				lookup->low = pinned->ipv4_index[(lookup->ip.ipv4 >> 16) << 1];
+				lookup->high = pinned->ipv4_index[((lookup->ip.ipv4 >> 16) << 1) + 1];
+			}
+
+			IP2Proxy_pinned_narrow_ipv4(pinned, lookup->ip.ipv4, &lookup->low, &lookup->high);
+		} else if (handler->ipv4_index_base_address > 0) {
+			lookup->state = IP2PROXY_ASYNC_INDEX;
+			IP2Proxy_async_queue_read(async, lookup, (off_t) handler->ipv4_index_base_address - 1 + ((lookup->ip.ipv4 >> 16) << 3), sizeof(lookup->index), lookup->index);
+			IP2Proxy_async_flush(async);
+			return 0;
+		}
+	} else {
+		uint32_t number = (lookup->ip.ipv6.s6_addr[0] * 256) + lookup->ip.ipv6.s6_addr[1];
+
+		lookup->low = 0;
+		lookup->high = handler->ipv6_database_count;
+
+		if (handler->pinned_index != NULL) {
+			ip2proxy_pinned_index *pinned = (ip2proxy_pinned_index *) handler->pinned_index;
+
+			if (pinned->ipv6_index != NULL) {
+				lookup->low = pinned->ipv6_index[number << 1];
+				lookup->high = pinned->ipv6_index[(number << 1) + 1];
+			}
+
+			IP2Proxy_pinned_narrow_ipv6(pinned, &lookup->ip.ipv6, &lookup->low, &lookup->high);
+		} else if (handler->ipv6_index_base_address > 0) {
+			lookup->state = IP2PROXY_ASYNC_INDEX;
+			IP2Proxy_async_queue_read(async, lookup, (off_t) handler->ipv6_index_base_address - 1 + (number << 3), sizeof(lookup->index), lookup->index);
+			IP2Proxy_async_flush(async);
+			return 0;
+		}
+	}
+
+	IP2Proxy_async_probe(async, lookup);
+
+	if (lookup->pending == 0) {
+		IP2Proxy_async_notify(async);
+	}
+
+	IP2Proxy_async_flush(async);
+
+	return 0;
+}
+
+// Descriptor which becomes readable when IP2Proxy_async_poll has work to do
+int32_t IP2Proxy_async_fd(IP2ProxyAsync *async)
+{
+	if (async == NULL) {
+		return -1;
+	}
+
+	return async->notify_fd[0];
+}
+
+// Number of lookups submitted and not delivered yet
+uint32_t IP2Proxy_async_pending(IP2ProxyAsync *async)
+{
+	if (async == NULL) {
+		return 0;
+	}
+
+	return async->in_flight;
+}
+
+// Name of the I/O backend in use
+const char *IP2Proxy_async_backend(IP2ProxyAsync *async)
+{
+#ifdef IP2PROXY_IO_URING
+	if (async != NULL && async->ring.fd != -1) {
+		return "io_uring";
+	}
+#endif
+
+	return "threads";
+}
+
+// Advance lookups and run the callbacks of completed ones, wait up to timeout milliseconds (-1 until one completes)
+int32_t IP2Proxy_async_poll(IP2ProxyAsync *async, int32_t timeout)
+{
+	int32_t completed = 0;
+	uint8_t drain[64];
+	struct pollfd pfd;
+	ip2proxy_async_lookup *lookup;
+
+	if (async == NULL) {
+		return -1;
+	}
+
+	for (;;) {
+		if (async->done_head == NULL && async->in_flight > 0 && timeout != 0) {
+			pfd.fd = async->notify_fd[0];
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			poll(&pfd, 1, timeout);
+		}
+
+		while (read(async->notify_fd[0], drain, sizeof(drain)) > 0) {
+		}
+
+		IP2Proxy_async_reap(async);
+
+		while (async->done_head != NULL) {
+			lookup = async->done_head;
+			async->done_head = lookup->next;
+
+			if (async->done_head == NULL) {
+				async->done_tail = NULL;
+			}
+
+			async->in_flight--;
+			completed++;
+
+			if (lookup->callback != NULL) {
+				lookup->callback(lookup->record, lookup->user_data);
+			} else {
+				IP2Proxy_free_record(lookup->record);
+			}
+
+			lookup->next = async->free_list;
+			async->free_list = lookup;
+		}
+
+		if (completed > 0 || timeout >= 0 || async->in_flight == 0) {
+			return completed;
+		}
+	}
+}
+
+// Wait for the outstanding lookups and release the asynchronous lookup context
+void IP2Proxy_async_close(IP2ProxyAsync *async)
+{
+	uint32_t i;
+
+	if (async == NULL) {
+		return;
+	}
+
+	while (async->in_flight > 0 && (async->thread_count > 0
+#ifdef IP2PROXY_IO_URING
+		|| async->ring.fd != -1
+#endif
+		)) {
+		IP2Proxy_async_poll(async, -1);
+	}
+
+#ifdef IP2PROXY_IO_URING
+	if (async->ring.fd != -1) {
+		IP2Proxy_uring_close(&async->ring);
+	}
+#endif
+
+	if (async->threads != NULL) {
+		pthread_mutex_lock(&async->lock);
+		async->stop = 1;
+		pthread_cond_broadcast(&async->cond);
+		pthread_mutex_unlock(&async->lock);
+
+		for (i = 0; i < async->thread_count; i++) {
+			pthread_join(async->threads[i], NULL);
+		}
+
+		free(async->threads);
+		pthread_mutex_destroy(&async->lock);
+		pthread_cond_destroy(&async->cond);
+	}
+
+	close(async->notify_fd[0]);
+
+	if (async->notify_fd[1] != async->notify_fd[0]) {
+		close(async->notify_fd[1]);
+	}
+
+	free(async->lookups);
+	free(async);
+}
+#else
+#ifdef WIN32
+IP2ProxyAsync *IP2Proxy_async_open(IP2Proxy *handler, uint32_t max_lookups, uint32_t flags)
+{
+	return NULL;
+}
+
+int32_t IP2Proxy_async_submit(IP2ProxyAsync *async, const char *ip, uint32_t mode, IP2Proxy_async_callback callback, void *user_data)
+{
+	return -1;
+}
+
+int32_t IP2Proxy_async_fd(IP2ProxyAsync *async)
+{
+	return -1;
+}
+
+uint32_t IP2Proxy_async_pending(IP2ProxyAsync *async)
+{
+	return 0;
+}
+
+const char *IP2Proxy_async_backend(IP2ProxyAsync *async)
+{
+	return "none";
+}
+
+int32_t IP2Proxy_async_poll(IP2ProxyAsync *async, int32_t timeout)
+{
+	return -1;
+}
+
+void IP2Proxy_async_close(IP2ProxyAsync *async)
+{
+}
+#endif
+#endif
+
+#if !defined(WIN32) && defined(HAVE_LINUX_FUTEX_H) && defined(SYS_futex)
+#define IP2PROXY_RING_MAGIC 0x47525850
+#define IP2PROXY_RING_VERSION 2
+#define IP2PROXY_RING_SPINS 4096
+#define IP2PROXY_RING_SILENCE 1.0 // seconds without a heartbeat before a client gives up on the lookup thread
+#define IP2PROXY_RING_MAX_SLOTS 65536
+
+// Request and result of one lookup, the sequence tells which of them the slot holds
+typedef struct {
+	uint32_t sequence; // position when free, position + 1 with a request, position + 2 with a result
+	uint32_t waiters;
+	uint32_t mode;
+	uint32_t version; // 4 or 6
+	uint8_t address[16];
+	int32_t status; // value returned by the lookup
+	int32_t is_proxy;
+	uint8_t reserved[24];
+	uint8_t fields[14][256]; // every string field of the view as a length and the characters
+} ip2proxy_ring_slot;
+
+// Start of the shared memory segment, the positions are on their own cache lines
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t stop;
+	uint8_t reserved1[48];
+	uint32_t tail; // next position taken by a client
+	uint8_t reserved2[60];
+	uint32_t head; // next position answered by the lookup thread
+	uint32_t heartbeat; // counts the wake-ups of the lookup thread, stays still once its process is gone
+	uint8_t reserved3[56];
+} ip2proxy_ring_header;
+
+struct IP2ProxyRing {
+	IP2Proxy *handler;
+	ip2proxy_ring_header *header;
+	ip2proxy_ring_slot *slots;
+	size_t size;
+	char *name;
+	int32_t owner;
+	uint32_t spins;
+	pthread_t thread;
+};
+
+static void IP2Proxy_ring_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+// Spin, then sleep until the word holds the value, -1 once the ring stops or its lookup thread is gone
+static int32_t IP2Proxy_ring_wait(IP2ProxyRing *ring, uint32_t *word, uint32_t value, uint32_t *waiters)
+{
+	struct timespec timeout = { 0, 100000000 };
+	uint32_t current;
+	uint32_t spins = 0;
+	uint32_t heartbeat = 0;
+	uint32_t beat;
+	double heard = 0;
+
+	while ((current = __atomic_load_n(word, __ATOMIC_ACQUIRE)) != value) {
+		if (__atomic_load_n(&ring->header->stop, __ATOMIC_RELAXED)) {
+			return -1;
+		}
 
-		uint8_t indexbuffer[8];
-		if (lookup_mode == IP2PROXY_FILE_IO) {
-			fseek(handle, indexpos - 1, 0);
-			fread(indexbuffer, sizeof(indexbuffer), 1, handle);
+		if (spins++ < ring->spins) {
+			IP2Proxy_ring_pause();
+			continue;
 		}
-		mem_offset = indexpos;
-		low = IP2Proxy_read32_row((uint8_t*)indexbuffer, 0, mem_offset);
-		high = IP2Proxy_read32_row((uint8_t*)indexbuffer, 4, mem_offset);
-	}
 
-	full_row_size = column_offset + 16;
-	row_size = column_offset - 16;
+		// The timeout bounds the wait for a stop which raced with going to sleep
+		__atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
 
-	while (low <= high) {
-		mid = (uint32_t)((low + high) >> 1);
-		row_offset = base_address + (mid * column_offset);
+		if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == current) {
+			syscall(SYS_futex, word, FUTEX_WAIT, current, &timeout, NULL, 0);
+		}
 
-		if (lookup_mode == IP2PROXY_FILE_IO) {
-			fseek(handle, row_offset - 1, 0);
-			fread(&full_row_buffer, full_row_size, 1, handle);
+		__atomic_fetch_sub(waiters, 1, __ATOMIC_SEQ_CST);
+
+		if (ring->owner) {
+			__atomic_fetch_add(&ring->header->heartbeat, 1, __ATOMIC_RELAXED);
+			continue;
 		}
-		mem_offset = row_offset;
 
-		ip_from = IP2Proxy_read128_row((uint8_t *)full_row_buffer, 0, mem_offset);
-		ip_to = IP2Proxy_read128_row((uint8_t *)full_row_buffer, column_offset, mem_offset);
+		// A crashed or killed server never sets the stop flag, only its heartbeat tells it is still there
+		beat = __atomic_load_n(&ring->header->heartbeat, __ATOMIC_RELAXED);
 
-		if ((IP2Proxy_ipv6_compare(&ip_number, &ip_from) >= 0) && (IP2Proxy_ipv6_compare(&ip_number, &ip_to) < 0)) {
-			if (lookup_mode == IP2PROXY_FILE_IO) {
-				memcpy(&row_buffer, ((uint8_t*)full_row_buffer) + 16, row_size); // extract actual row data
-			}
-			return IP2Proxy_read_record(handler, (uint8_t *)row_buffer, mode, mem_offset + 16);
-		} else {
-			if (IP2Proxy_ipv6_compare(&ip_number, &ip_from) < 0) {
-				high = mid - 1;
-			} else {
-				low = mid + 1;
-			}
+		if (heard == 0 || beat != heartbeat) {
+			heartbeat = beat;
+			heard = IP2Proxy_now();
+		} else if (IP2Proxy_now() - heard > IP2PROXY_RING_SILENCE) {
+			return -1;
 		}
 	}
 
-	return NULL;
+	return 0;
 }
 
-// Initialize the record object
-static IP2ProxyRecord *IP2Proxy_new_record()
+// Publish a new value of the word and wake whoever sleeps on it
+static void IP2Proxy_ring_post(uint32_t *word, uint32_t value, uint32_t *waiters)
 {
-	IP2ProxyRecord *record = (IP2ProxyRecord *) calloc(1, sizeof(IP2ProxyRecord));
-	return record;
+	__atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) != 0) {
+		syscall(SYS_futex, word, FUTEX_WAKE, 0x7FFFFFFF, NULL, NULL, 0);
+	}
 }
 
-// Free the record object
-void IP2Proxy_free_record(IP2ProxyRecord *record)
+// Lookup thread, answers the slots in the order the clients took them
+static void *IP2Proxy_ring_worker(void *arg)
 {
-
-	if (record == NULL) {
-		return;
+	IP2ProxyRing *ring = (IP2ProxyRing *) arg;
+	ip2proxy_ring_header *header = ring->header;
+	uint32_t mask = header->slot_count - 1;
+	uint32_t head = header->head;
+	ip2proxy_ring_slot *slot = &ring->slots[head & mask];
+	IP2ProxyView *view = (IP2ProxyView *) malloc(sizeof(IP2ProxyView));
+	const IP2ProxyField *field;
+	ip_container parsed_ip;
+	size_t i;
+
+	if (view == NULL) {
+		return NULL;
 	}
 
-	if (record->country_short != NULL) {
-		free(record->country_short);
-	}
+	// No timeout, a client which took a slot and died before posting its request stops the ring until it is closed
+	while (IP2Proxy_ring_wait(ring, &slot->sequence, head + 1, &slot->waiters) == 0) {
+		memset(&parsed_ip, 0, sizeof(parsed_ip));
+		parsed_ip.version = slot->version;
 
-	if (record->country_long != NULL) {
-		free(record->country_long);
-	}
+		if (parsed_ip.version == 4) {
+			parsed_ip.ipv4 = IP2Proxy_get32_be(slot->address + 12);
+		} else {
+			memcpy(parsed_ip.ipv6.s6_addr, slot->address, 16);
+		}
 
-	if (record->region != NULL) {
-		free(record->region);
-	}
+		slot->status = IP2Proxy_get_parsed_view(ring->handler, parsed_ip, slot->mode, view);
+		slot->is_proxy = view->is_proxy;
 
-	if (record->city != NULL) {
-		free(record->city);
-	}
+		for (i = 0; i < sizeof(IP2PROXY_VIEW_FIELDS) / sizeof(IP2PROXY_VIEW_FIELDS[0]); i++) {
+			field = IP2PROXY_VIEW_FIELD(view, i);
+			slot->fields[i][0] = (uint8_t) ((field->length > 255) ? 255 : field->length);
+			memcpy(slot->fields[i] + 1, field->data, slot->fields[i][0]);
+		}
 
-	if (record->isp != NULL) {
-		free(record->isp);
+		IP2Proxy_ring_post(&slot->sequence, head + 2, &slot->waiters);
+		head++;
+		__atomic_store_n(&header->head, head, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&header->heartbeat, 1, __ATOMIC_RELAXED);
+		slot = &ring->slots[head & mask];
 	}
 
-	if (record->proxy_type != NULL) {
-		free(record->proxy_type);
-	}
+	free(view);
 
-	if (record->domain != NULL) {
-		free(record->domain);
-	}
+	return NULL;
+}
 
-	if (record->usage_type != NULL) {
-		free(record->usage_type);
-	}
+// Map a ring segment, the size is checked against the header when size is 0
+static IP2ProxyRing *IP2Proxy_ring_map(const char *name, int fd, size_t size)
+{
+	IP2ProxyRing *ring;
+	void *memory;
+	struct stat buffer;
 
-	if (record->asn != NULL) {
-		free(record->asn);
-	}
+	if (size == 0) {
+		if (fstat(fd, &buffer) == -1 || (size_t) buffer.st_size < sizeof(ip2proxy_ring_header)) {
+			return NULL;
+		}
 
-	if (record->as_ != NULL) {
-		free(record->as_);
+		size = (size_t) buffer.st_size;
 	}
 
-	if (record->last_seen != NULL) {
-		free(record->last_seen);
+	if ((memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		return NULL;
 	}
 
-	if (record->threat != NULL) {
-		free(record->threat);
+	if ((ring = (IP2ProxyRing *) calloc(1, sizeof(IP2ProxyRing))) == NULL || (ring->name = strdup(name)) == NULL) {
+		free(ring);
+		munmap(memory, size);
+		return NULL;
 	}
 
-	if (record->provider != NULL) {
-		free(record->provider);
-	}
+	ring->header = (ip2proxy_ring_header *) memory;
+	ring->slots = (ip2proxy_ring_slot *) ((uint8_t *) memory + sizeof(ip2proxy_ring_header));
+	ring->size = size;
 
-	if (record->fraud_score != NULL) {
-		free(record->fraud_score);
-	}
+	// Spinning only helps while the other side runs on another CPU
+	ring->spins = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? IP2PROXY_RING_SPINS : 0;
 
-	free(record);
+	return ring;
 }
 
-// Set to use memory caching
-int32_t IP2Proxy_set_memory_cache(FILE *file)
+// Create a ring in shared memory and start a thread answering its lookups from the handler
+IP2ProxyRing *IP2Proxy_ring_create(IP2Proxy *handler, const char *name, uint32_t slot_count)
 {
-	struct stat buffer;
-	lookup_mode = IP2PROXY_CACHE_MEMORY;
-
-	if (fstat(fileno(file), &buffer) == -1) {
-		lookup_mode = IP2PROXY_FILE_IO;
-		return -1;
-	}
+	IP2ProxyRing *ring;
+	size_t size;
+	uint32_t count = 1;
+	uint32_t i;
+	int fd;
 
-	if ((memory_pointer = malloc(buffer.st_size + 1)) == NULL) {
-		lookup_mode = IP2PROXY_FILE_IO;
-		return -1;
+	if (handler == NULL || name == NULL || handler->is_csv) {
+		return NULL;
 	}
 
-	if (IP2Proxy_load_database_into_memory(file, memory_pointer, buffer.st_size) == -1) {
-		lookup_mode = IP2PROXY_FILE_IO;
-		free(memory_pointer);
-		return -1;
+	// Positions wrap around at 2^32, a power of 2 keeps the slot of a position stable
+	while (count < slot_count && count < IP2PROXY_RING_MAX_SLOTS) {
+		count <<= 1;
 	}
 
-	return 0;
-}
-
-// Set to use shared memory
-#ifndef WIN32
-int32_t IP2Proxy_set_shared_memory(FILE *file)
-{
-	struct stat buffer;
-	int32_t is_dababase_loaded = 1;
-	void *addr = (void*)MAP_ADDR;
-
-	lookup_mode = IP2PROXY_SHARED_MEMORY;
+	size = sizeof(ip2proxy_ring_header) + (size_t) count * sizeof(ip2proxy_ring_slot);
 
-	// New shared memory object is created
-	if ((shm_fd = shm_open(IP2PROXY_SHM, O_RDWR | O_CREAT | O_EXCL, 0777)) != -1) {
-		is_dababase_loaded = 0;
+	// An existing object is not taken over, it may belong to another user or a running ring
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) == -1) {
+		return NULL;
 	}
 
-	// Failed to create new shared memory object
-	else if ((shm_fd = shm_open(IP2PROXY_SHM, O_RDWR , 0777)) == -1) {
-		lookup_mode = IP2PROXY_FILE_IO;
-		return -1;
+	if (ftruncate(fd, (off_t) size) == -1 || (ring = IP2Proxy_ring_map(name, fd, size)) == NULL) {
+		close(fd);
+		shm_unlink(name);
+		return NULL;
 	}
 
-	if (fstat(fileno(file), &buffer) == -1) {
-		close(shm_fd);
-
-		if (is_dababase_loaded == 0) {
-			shm_unlink(IP2PROXY_SHM);
-		}
+	close(fd);
 
-		lookup_mode = IP2PROXY_FILE_IO;
+	ring->handler = handler;
+	ring->owner = 1;
+	ring->header->version = IP2PROXY_RING_VERSION;
+	ring->header->slot_count = count;
 
-		return -1;
+	for (i = 0; i < count; i++) {
+		ring->slots[i].sequence = i;
 	}
 
-	if (is_dababase_loaded == 0 && ftruncate(shm_fd, buffer.st_size + 1) == -1) {
-		close(shm_fd);
-		shm_unlink(IP2PROXY_SHM);
-		lookup_mode = IP2PROXY_FILE_IO;
-		return -1;
+	if (pthread_create(&ring->thread, NULL, IP2Proxy_ring_worker, ring) != 0) {
+		munmap(ring->header, ring->size);
+		shm_unlink(name);
+		free(ring->name);
+		free(ring);
+		return NULL;
 	}
 
-	memory_pointer = mmap(addr, buffer.st_size + 1, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	// Clients only use the ring once the magic is set
+	__atomic_store_n(&ring->header->magic, IP2PROXY_RING_MAGIC, __ATOMIC_RELEASE);
 
-	if (memory_pointer == (void *) -1) {
-		close(shm_fd);
+	return ring;
+}
 
-		if (is_dababase_loaded == 0) {
-			shm_unlink(IP2PROXY_SHM);
-		}
+// Attach to a ring created by another process
+IP2ProxyRing *IP2Proxy_ring_open(const char *name)
+{
+	IP2ProxyRing *ring;
+	ip2proxy_ring_header *header;
+	int fd;
 
-		lookup_mode = IP2PROXY_FILE_IO;
+	if (name == NULL || (fd = shm_open(name, O_RDWR, 0600)) == -1) {
+		return NULL;
+	}
 
-		return -1;
+	ring = IP2Proxy_ring_map(name, fd, 0);
+	close(fd);
+
+	if (ring == NULL) {
+		return NULL;
 	}
 
-	if (is_dababase_loaded == 0) {
-		if (IP2Proxy_load_database_into_memory(file, memory_pointer, buffer.st_size) == -1) {
-			munmap(memory_pointer, buffer.st_size);
-			close(shm_fd);
-			shm_unlink(IP2PROXY_SHM);
-			lookup_mode = IP2PROXY_FILE_IO;
-			return -1;
-		}
+	header = ring->header;
+
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != IP2PROXY_RING_MAGIC || header->version != IP2PROXY_RING_VERSION || header->slot_count == 0 || (header->slot_count & (header->slot_count - 1)) != 0
+		|| ring->size < sizeof(ip2proxy_ring_header) + (size_t) header->slot_count * sizeof(ip2proxy_ring_slot)) {
+		munmap(ring->header, ring->size);
+		free(ring->name);
+		free(ring);
+		return NULL;
 	}
 
-	return 0;
+	return ring;
 }
-#else
-#ifdef WIN32
-int32_t IP2Proxy_set_shared_memory(FILE *file)
-{
-	struct stat buffer;
-	int32_t is_dababase_loaded = 1;
-
-	lookup_mode = IP2PROXY_SHARED_MEMORY;
 
-	if (fstat(fileno(file), &buffer) == -1) {
-		lookup_mode = IP2PROXY_FILE_IO;
+// Look up an IP address through the ring, the fields point into the buffer of the view
+int32_t IP2Proxy_ring_lookup(IP2ProxyRing *ring, const char *ip, uint32_t mode, IP2ProxyView *view)
+{
+	ip2proxy_ring_header *header;
+	ip2proxy_ring_slot *slot;
+	ip_container parsed_ip;
+	IP2ProxyField *field;
+	uint32_t position;
+	int32_t status;
+	size_t i;
+
+	if (ring == NULL || ip == NULL || view == NULL) {
 		return -1;
 	}
 
-	shm_fd = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, buffer.st_size + 1, TEXT(IP2PROXY_SHM));
+	// Invalid addresses are answered without a round trip
+	parsed_ip = IP2Proxy_parse_address_n(ip, strlen(ip));
 
-	if (shm_fd == NULL) {
-		lookup_mode = IP2PROXY_FILE_IO;
+	if (parsed_ip.version != 4 && parsed_ip.version != 6) {
+		IP2Proxy_bad_view(view, INVALID_IP_ADDRESS);
 		return -1;
 	}
 
-	is_dababase_loaded = (GetLastError() == ERROR_ALREADY_EXISTS);
-	memory_pointer = MapViewOfFile(shm_fd, FILE_MAP_WRITE, 0, 0, 0);
+	header = ring->header;
+	position = __atomic_fetch_add(&header->tail, 1, __ATOMIC_RELAXED);
+	slot = &ring->slots[position & (header->slot_count - 1)];
 
-	if (memory_pointer == NULL) {
-		UnmapViewOfFile(memory_pointer);
-		lookup_mode = IP2PROXY_FILE_IO;
+	// Wait for the client one lap ahead to collect its result
+	if (IP2Proxy_ring_wait(ring, &slot->sequence, position, &slot->waiters) != 0) {
+		IP2Proxy_bad_view(view, NOT_SUPPORTED);
 		return -1;
 	}
 
-	if (is_dababase_loaded == 0) {
-		if (IP2Proxy_load_database_into_memory(file, memory_pointer, buffer.st_size) == -1) {
-			UnmapViewOfFile(memory_pointer);
-			CloseHandle(shm_fd);
-			lookup_mode = IP2PROXY_FILE_IO;
-			return -1;
-		}
-	}
+	slot->mode = mode;
+	slot->version = parsed_ip.version;
 
-	return 0;
-}
-#endif
-#endif
+	if (parsed_ip.version == 4) {
+		memset(slot->address, 0, 12);
+		slot->address[12] = (uint8_t) (parsed_ip.ipv4 >> 24);
+		slot->address[13] = (uint8_t) (parsed_ip.ipv4 >> 16);
+		slot->address[14] = (uint8_t) (parsed_ip.ipv4 >> 8);
+		slot->address[15] = (uint8_t) parsed_ip.ipv4;
+	} else {
+		memcpy(slot->address, parsed_ip.ipv6.s6_addr, 16);
+	}
 
-// Load BIN file into memory
-int32_t IP2Proxy_load_database_into_memory(FILE *file, void *memory, int64_t size)
-{
-	fseek(file, 0, SEEK_SET);
+	IP2Proxy_ring_post(&slot->sequence, position + 1, &slot->waiters);
 
-	if (fread(memory, size, 1, file) != 1) {
+	if (IP2Proxy_ring_wait(ring, &slot->sequence, position + 2, &slot->waiters) != 0) {
+		IP2Proxy_bad_view(view, NOT_SUPPORTED);
 		return -1;
 	}
 
-	return 0;
-}
+	view->is_proxy = slot->is_proxy;
 
-// Close the memory
-int32_t IP2Proxy_close_memory(FILE *file)
-{
-	struct stat buffer;
+	for (i = 0; i < sizeof(IP2PROXY_VIEW_FIELDS) / sizeof(IP2PROXY_VIEW_FIELDS[0]); i++) {
+		field = IP2PROXY_VIEW_FIELD(view, i);
+		memcpy(view->buffer[i], slot->fields[i], 1 + slot->fields[i][0]);
+		field->data = (const char *) view->buffer[i] + 1;
+		field->length = view->buffer[i][0];
+	}
 
-	if (lookup_mode == IP2PROXY_CACHE_MEMORY) {
-		if (memory_pointer != NULL) {
-			free(memory_pointer);
-		}
-	} else if (lookup_mode == IP2PROXY_SHARED_MEMORY) {
-		if (memory_pointer != NULL) {
-#ifndef	WIN32
-			if (fstat(fileno(file), &buffer) == 0) {
-				munmap(memory_pointer, buffer.st_size);
-			}
+	status = slot->status;
+	IP2Proxy_ring_post(&slot->sequence, position + header->slot_count, &slot->waiters);
 
-			close(shm_fd);
-#else
-#ifdef WIN32
-			UnmapViewOfFile(memory_pointer);
-			CloseHandle(shm_fd);
-#endif
-#endif
-		}
+	return status;
+}
+
+// Detach from a ring, the creator also stops the lookup thread and removes the segment
+void IP2Proxy_ring_close(IP2ProxyRing *ring)
+{
+	if (ring == NULL) {
+		return;
 	}
 
-	if (file != NULL) {
-		fclose(file);
+	if (ring->owner) {
+		__atomic_store_n(&ring->header->stop, 1, __ATOMIC_SEQ_CST);
+		pthread_join(ring->thread, NULL);
+		shm_unlink(ring->name);
 	}
 
-	lookup_mode = IP2PROXY_FILE_IO;
-	return 0;
+	munmap(ring->header, ring->size);
+	free(ring->name);
+	free(ring);
 }
-
-#ifndef	WIN32
-// Remove shared memory object
-void IP2Proxy_delete_shared_memory()
+#else
+IP2ProxyRing *IP2Proxy_ring_create(IP2Proxy *handler, const char *name, uint32_t slot_count)
 {
-	shm_unlink(IP2PROXY_SHM);
+	return NULL;
 }
-#else
-#ifdef WIN32
-void IP2Proxy_delete_shared_memory()
+
+IP2ProxyRing *IP2Proxy_ring_open(const char *name)
 {
+	return NULL;
 }
-#endif
-#endif
 
-// Check if address is IPv4
-static int IP2Proxy_is_ipv4(char *ip)
+int32_t IP2Proxy_ring_lookup(IP2ProxyRing *ring, const char *ip, uint32_t mode, IP2ProxyView *view)
 {
-	struct sockaddr_in sa;
-	return inet_pton(AF_INET, ip, &sa.sin_addr);
+	return -1;
 }
 
-// Check if address is IPv6
-static int IP2Proxy_is_ipv6(char *ip)
+void IP2Proxy_ring_close(IP2ProxyRing *ring)
 {
-	struct in6_addr result;
-	return inet_pton(AF_INET6, ip, &result);
 }
+#endif
 
 // Get API version numeric
 unsigned long int IP2Proxy_version_number(void)
@@ -1314,7 +7195,7 @@ struct in6_addr IP2Proxy_read128_row(uint8_t* buffer, uint32_t position, uint32_
 	return addr6;
 }
 
-struct in6_addr IP2Proxy_read_ipv6_address(FILE *handle, uint32_t position)
+struct in6_addr IP2Proxy_read_ipv6_address(FILE *handle, uint64_t position)
 {
 	int i, j;
 	struct in6_addr addr6;
@@ -1326,41 +7207,25 @@ struct in6_addr IP2Proxy_read_ipv6_address(FILE *handle, uint32_t position)
 	return addr6;
 }
 
-uint32_t IP2Proxy_read32(FILE *handle, uint32_t position)
+uint32_t IP2Proxy_read32(FILE *handle, uint64_t position)
 {
 	uint8_t byte1 = 0;
 	uint8_t byte2 = 0;
 	uint8_t byte3 = 0;
 	uint8_t byte4 = 0;
 	uint8_t *cache_shm = memory_pointer;
-	size_t temp;
+	uint8_t bytes[4];
 
 	// Read from file
 	if (lookup_mode == IP2PROXY_FILE_IO && handle != NULL) {
-		fseek(handle, position - 1, SEEK_SET);
-		temp = fread(&byte1, 1, 1, handle);
-
-		if (temp == 0) {
-			return 0;
-		}
-
-		temp = fread(&byte2, 1, 1, handle);
-
-		if (temp == 0) {
-			return 0;
-		}
-
-		temp = fread(&byte3, 1, 1, handle);
-
-		if (temp == 0) {
+		if (IP2Proxy_pread(handle, (off_t) position - 1, bytes, 4) != 4) {
 			return 0;
 		}
 
-		temp = fread(&byte4, 1, 1, handle);
-
-		if (temp == 0) {
-			return 0;
-		}
+		byte1 = bytes[0];
+		byte2 = bytes[1];
+		byte3 = bytes[2];
+		byte4 = bytes[3];
 	} else {
 		byte1 = cache_shm[position - 1];
 		byte2 = cache_shm[position];
@@ -1392,17 +7257,13 @@ uint32_t IP2Proxy_read32_row(uint8_t* buffer, uint32_t position, uint32_t mem_of
 	}
 }
 
-uint8_t IP2Proxy_read8(FILE *handle, uint32_t position)
+uint8_t IP2Proxy_read8(FILE *handle, uint64_t position)
 {
 	uint8_t ret = 0;
 	uint8_t *cache_shm = memory_pointer;
-	size_t temp;
 
 	if (lookup_mode == IP2PROXY_FILE_IO && handle != NULL) {
-		fseek(handle, position - 1, SEEK_SET);
-		temp = fread(&ret, 1, 1, handle);
-
-		if (temp == 0) {
+		if (IP2Proxy_pread(handle, (off_t) position - 1, &ret, 1) != 1) {
 			return 0;
 		}
 	} else {
@@ -1423,7 +7284,7 @@ uint8_t IP2Proxy_read8_row(uint8_t* buffer, uint32_t position, uint32_t mem_offs
 	}
 }
 
-char *IP2Proxy_read_string(FILE *handle, uint32_t position)
+char *IP2Proxy_read_string(FILE *handle, uint64_t position)
 {
 	uint8_t data[255];
 	uint8_t size = 0;
@@ -1431,8 +7292,8 @@ char *IP2Proxy_read_string(FILE *handle, uint32_t position)
 	uint8_t *cache_shm = memory_pointer;
 
 	if (lookup_mode == IP2PROXY_FILE_IO && handle != NULL) {
-		fseek(handle, position, 0);
-		fread(&data, 255, 1, handle); // max size of string field + 1 byte for length
+		memset(data, 0, sizeof(data));
+		IP2Proxy_pread(handle, (off_t) position, data, 255); // max size of string field + 1 byte for length
 		size = data[0];
 		str = (char *)malloc(size+1);
 		memcpy(str, ((uint8_t*)data) + 1, size);
@@ -1446,42 +7307,25 @@ char *IP2Proxy_read_string(FILE *handle, uint32_t position)
 	return str;
 }
 
-float IP2Proxy_read_float(FILE *handle, uint32_t position)
+float IP2Proxy_read_float(FILE *handle, uint64_t position)
 {
 	float ret = 0.0;
 	uint8_t *cache_shm = memory_pointer;
-	size_t temp;
 
 #if defined(_SUN_) || defined(__powerpc__) || defined(__ppc__) || defined(__ppc64__) || defined(__powerpc64__)
 	char *p = (char *) &ret;
+	uint8_t bytes[4];
 
 	// for SUN SPARC, have to reverse the byte order
 	if (lookup_mode == IP2PROXY_FILE_IO && handle != NULL) {
-		fseek(handle, position - 1, SEEK_SET);
-
-		temp = fread(p + 3, 1, 1, handle);
-
-		if (temp == 0) {
-			return 0.0;
-		}
-
-		temp = fread(p + 2, 1, 1, handle);
-
-		if (temp == 0) {
+		if (IP2Proxy_pread(handle, (off_t) position - 1, bytes, 4) != 4) {
 			return 0.0;
 		}
 
-		temp = fread(p + 1, 1, 1, handle);
-
-		if (temp == 0) {
-			return 0.0;
-		}
-
-		temp = fread(p, 1, 1, handle);
-
-		if (temp == 0) {
-			return 0.0;
-		}
+		*(p+3) = bytes[0];
+		*(p+2) = bytes[1];
+		*(p+1) = bytes[2];
+		*(p) = bytes[3];
 	} else {
 		*(p+3) = cache_shm[position - 1];
 		*(p+2) = cache_shm[position];
@@ -1490,10 +7334,7 @@ float IP2Proxy_read_float(FILE *handle, uint32_t position)
 	}
 #else
 	if (lookup_mode == IP2PROXY_FILE_IO && handle != NULL) {
-		fseek(handle, position - 1, SEEK_SET);
-		temp = fread(&ret, 4, 1, handle);
-
-		if (temp == 0) {
+		if (IP2Proxy_pread(handle, (off_t) position - 1, (uint8_t *) &ret, 4) != 4) {
 			return 0.0;
 		}
 	} else {
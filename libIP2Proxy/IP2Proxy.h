@@ -78,21 +78,42 @@ extern "C" {
 #define AS				0x00400
 #define LASTSEEN		0x00800
 #define THREAT			0x01000
-#define PROVIDER		0x01200
-#define FRAUDSCORE		0x01300
-#define ALL				COUNTRYSHORT | COUNTRYLONG | REGION | CITY | ISP | ISPROXY | PROXYTYPE | DOMAINNAME | USAGETYPE | ASN | AS | LASTSEEN | THREAT | PROVIDER | FRAUDSCORE
+#define PROVIDER		0x02000
+#define FRAUDSCORE		0x04000
+#define ALL				(COUNTRYSHORT | COUNTRYLONG | REGION | CITY | ISP | ISPROXY | PROXYTYPE | DOMAINNAME | USAGETYPE | ASN | AS | LASTSEEN | THREAT | PROVIDER | FRAUDSCORE)
 
 #define INVALID_IP_ADDRESS					"INVALID IP ADDRESS"
 #define IPV6_ADDRESS_MISSING_IN_IPV4_BIN	"IPV6 ADDRESS MISSING IN IPV4 BIN"
 #define NOT_SUPPORTED						"NOT SUPPORTED"
+#define DATABASE_IN_MEMORY					"IP2Proxy library error: two databases are compared in IP2PROXY_FILE_IO mode only, a database is loaded into memory.\n"
 #define INVALID_BIN_DATABASE				"Incorrect IP2Proxy BIN file format. Please make sure that you are using the latest IP2Proxy BIN file."
 #define IP2PROXY_SHM						"/IP2Proxy_Shm"
 #define MAP_ADDR							4194500608
 
+#define IP2PROXY_PAGE_SIZE					4096
+#define IP2PROXY_PAGE_CACHE_DEFAULT			64
+#define IP2PROXY_FRAME_SIZE					65536
+#define IP2PROXY_FRAME_CACHE_DEFAULT		32
+#define IP2PROXY_PINNED_INDEX_INTERVAL		64
+#define IP2PROXY_ASYNC_THREADS				4
+#define IP2PROXY_ASYNC_THREAD_POOL			0x0001
+#define IP2PROXY_LOAD_THREADS				8
+#define IP2PROXY_LOAD_CHUNK					(4 * 1024 * 1024)
+#define IP2PROXY_PREFIX_MAGIC				"IP2PXLPM"
+#define IP2PROXY_OVERLAY_MAX_LAYERS			16
+#define IP2PROXY_OVERLAY_ALLOW				0x0001
+
 enum IP2Proxy_lookup_mode {
 	IP2PROXY_FILE_IO,
 	IP2PROXY_CACHE_MEMORY,
-	IP2PROXY_SHARED_MEMORY
+	IP2PROXY_SHARED_MEMORY,
+	IP2PROXY_HYBRID_MEMORY
+};
+
+enum IP2Proxy_export_format {
+	IP2PROXY_EXPORT_NFTABLES,
+	IP2PROXY_EXPORT_IPSET,
+	IP2PROXY_EXPORT_BINARY
 };
 
 typedef struct {
@@ -105,13 +126,20 @@ typedef struct {
 	uint8_t database_year;
 	uint8_t product_code;
 	uint8_t license_code;
+	uint8_t large_format;
 	uint32_t ipv4_database_count;
-	uint32_t ipv4_database_address;
-	uint32_t ipv4_index_base_address;
+	uint64_t ipv4_database_address;
+	uint64_t ipv4_index_base_address;
 	uint32_t ipv6_database_count;
-	uint32_t ipv6_database_address;
-	uint32_t ipv6_index_base_address;
-	uint32_t database_size;
+	uint64_t ipv6_database_address;
+	uint64_t ipv6_index_base_address;
+	uint64_t database_size;
+	uint64_t strings_base;
+	void *page_cache;
+	void *pinned_index;
+	const void *kernel;
+	void *negative_filter;
+	void *frames;
 } IP2Proxy;
 
 typedef struct {
@@ -132,6 +160,94 @@ typedef struct {
 	char *fraud_score;
 } IP2ProxyRecord;
 
+/* String field of a view, not null terminated */
+typedef struct {
+	const char *data;
+	uint32_t length;
+} IP2ProxyField;
+
+/* Record decoded without allocation, fields point into the database in memory or into buffer */
+typedef struct {
+	int32_t is_proxy;
+	IP2ProxyField country_short;
+	IP2ProxyField country_long;
+	IP2ProxyField region;
+	IP2ProxyField city;
+	IP2ProxyField isp;
+	IP2ProxyField proxy_type;
+	IP2ProxyField domain;
+	IP2ProxyField usage_type;
+	IP2ProxyField asn;
+	IP2ProxyField as_;
+	IP2ProxyField last_seen;
+	IP2ProxyField threat;
+	IP2ProxyField provider;
+	IP2ProxyField fraud_score;
+	uint8_t buffer[14][256];
+} IP2ProxyView;
+
+/* Last load of a BIN file into memory */
+typedef struct {
+	uint64_t size;
+	uint32_t crc32c;
+	uint32_t threads;
+	double seconds;
+	double throughput; /* MB per second */
+} IP2ProxyLoadStats;
+
+/* Use of the negative lookup filter */
+typedef struct {
+	uint64_t lookups; /* lookups which checked the filter */
+	uint64_t skipped; /* lookups answered as not a proxy without a search */
+	uint32_t ipv4_buckets; /* /24 IPv4 networks holding a proxy */
+	uint32_t ipv6_buckets; /* /24 IPv6 prefixes holding a proxy */
+	uint64_t ipv6_lookups; /* share of the IPv6 addresses in lookups */
+	uint64_t ipv6_skipped; /* share of the IPv6 addresses in skipped */
+	uint32_t ipv6_networks; /* bits set by the /48 IPv6 networks holding a proxy, hashed */
+} IP2ProxyFilterStats;
+
+/* Called for every database segment of a range query, return non zero to stop */
+typedef int32_t (*IP2Proxy_range_callback)(const char *from, const char *to, const IP2ProxyView *view, void *user_data);
+
+/* Proxies exported by IP2Proxy_export_cidr, NULL lists and a 0 score match every proxy */
+typedef struct {
+	const char *proxy_type; /* comma separated values such as "VPN,TOR" */
+	const char *usage_type; /* comma separated values such as "DCH,CDN" */
+	const char *threat; /* comma separated values such as "SPAM,BOTNET" */
+	int32_t fraud_score; /* minimum fraud score */
+} IP2ProxyExportFilter;
+
+/*
+ * Header of the binary prefix list of IP2Proxy_export_cidr, in host byte order. It is followed by
+ * ipv4_count entries of a uint32_t prefix length and 4 address bytes, then by ipv6_count entries
+ * of a uint32_t prefix length and 16 address bytes, the layout of a BPF LPM trie key.
+ */
+typedef struct {
+	char magic[8];
+	uint32_t byte_order; /* 0x01020304 */
+	uint32_t ipv4_count;
+	uint32_t ipv6_count;
+	uint32_t reserved;
+} IP2ProxyPrefixHeader;
+
+/* Called for every address range whose fields differ between two databases, return non zero to stop */
+typedef int32_t (*IP2Proxy_diff_callback)(const char *from, const char *to, const IP2ProxyView *old_view, const IP2ProxyView *new_view, void *user_data);
+
+typedef struct IP2ProxyAsync IP2ProxyAsync;
+typedef void (*IP2Proxy_async_callback)(IP2ProxyRecord *record, void *user_data);
+
+/* Lookups from other processes through a request ring in shared memory */
+typedef struct IP2ProxyRing IP2ProxyRing;
+
+/* Lookups of sorted addresses walking the rows of the database */
+typedef struct IP2ProxyJoin IP2ProxyJoin;
+
+/* Rows of the database in ascending order, for exports and analytics */
+typedef struct IP2ProxyCursor IP2ProxyCursor;
+
+/* Lookups through databases stacked by priority, each field from the first layer listing the address */
+typedef struct IP2ProxyOverlay IP2ProxyOverlay;
+
 /* Public functions */
 unsigned long int IP2Proxy_version_number(void);
 char *IP2Proxy_version_string(void);
@@ -142,6 +258,13 @@ char *IP2Proxy_get_package_version(IP2Proxy *handler);
 
 int IP2Proxy_open_mem(IP2Proxy *handler, enum IP2Proxy_lookup_mode);
 int IP2Proxy_set_lookup_mode(IP2Proxy *handler, enum IP2Proxy_lookup_mode);
+int32_t IP2Proxy_set_page_cache(IP2Proxy *handler, uint32_t pages);
+int32_t IP2Proxy_set_pinned_index(IP2Proxy *handler, uint32_t interval);
+int32_t IP2Proxy_get_load_stats(IP2Proxy *handler, IP2ProxyLoadStats *stats);
+int32_t IP2Proxy_save_index(IP2Proxy *handler, const char *path, uint32_t interval);
+int32_t IP2Proxy_load_index(IP2Proxy *handler, const char *path);
+int32_t IP2Proxy_set_negative_filter(IP2Proxy *handler, int32_t enable);
+int32_t IP2Proxy_get_filter_stats(IP2Proxy *handler, IP2ProxyFilterStats *stats);
 
 IP2Proxy *IP2Proxy_open(char *db);
 IP2Proxy *IP2Proxy_open_csv(char *csv);
@@ -162,21 +285,53 @@ IP2ProxyRecord *IP2Proxy_get_usage_type(IP2Proxy *handler, char *ip);
 IP2ProxyRecord *IP2Proxy_is_proxy(IP2Proxy *handler, char *ip);
 IP2ProxyRecord *IP2Proxy_get_provider(IP2Proxy *handler, char *ip);
 IP2ProxyRecord *IP2Proxy_get_fraud_score(IP2Proxy *handler, char *ip);
+int32_t IP2Proxy_get_view(IP2Proxy *handler, const char *ip, uint32_t mode, IP2ProxyView *view);
+int32_t IP2Proxy_get_view_n(IP2Proxy *handler, const char *ip, size_t length, uint32_t mode, IP2ProxyView *view);
+int32_t IP2Proxy_query_range(IP2Proxy *handler, const char *start, const char *end, uint32_t mode, IP2Proxy_range_callback callback, void *user_data);
+int32_t IP2Proxy_query_cidr(IP2Proxy *handler, const char *cidr, uint32_t mode, IP2Proxy_range_callback callback, void *user_data);
+int32_t IP2Proxy_diff(IP2Proxy *old_handler, IP2Proxy *new_handler, uint32_t mode, IP2Proxy_diff_callback callback, void *user_data);
+int32_t IP2Proxy_make_patch(IP2Proxy *old_handler, IP2Proxy *new_handler, const char *path);
+int32_t IP2Proxy_apply_patch(IP2Proxy *handler, const char *patch, const char *output);
+int32_t IP2Proxy_compress(IP2Proxy *handler, const char *output);
+int32_t IP2Proxy_export_cidr(IP2Proxy *handler, const IP2ProxyExportFilter *filter, enum IP2Proxy_export_format format, const char *name, FILE *output);
 
 uint32_t IP2Proxy_close(IP2Proxy *handler);
 void IP2Proxy_free_record(IP2ProxyRecord *record);
 
+IP2ProxyAsync *IP2Proxy_async_open(IP2Proxy *handler, uint32_t max_lookups, uint32_t flags);
+int32_t IP2Proxy_async_submit(IP2ProxyAsync *async, const char *ip, uint32_t mode, IP2Proxy_async_callback callback, void *user_data);
+int32_t IP2Proxy_async_poll(IP2ProxyAsync *async, int32_t timeout);
+int32_t IP2Proxy_async_fd(IP2ProxyAsync *async);
+uint32_t IP2Proxy_async_pending(IP2ProxyAsync *async);
+const char *IP2Proxy_async_backend(IP2ProxyAsync *async);
+void IP2Proxy_async_close(IP2ProxyAsync *async);
+
+IP2ProxyRing *IP2Proxy_ring_create(IP2Proxy *handler, const char *name, uint32_t slots);
+IP2ProxyRing *IP2Proxy_ring_open(const char *name);
+int32_t IP2Proxy_ring_lookup(IP2ProxyRing *ring, const char *ip, uint32_t mode, IP2ProxyView *view);
+void IP2Proxy_ring_close(IP2ProxyRing *ring);
+IP2ProxyJoin *IP2Proxy_join_open(IP2Proxy *handler, uint32_t mode);
+int32_t IP2Proxy_join_lookup(IP2ProxyJoin *join, const char *ip, size_t length, const IP2ProxyView **view);
+void IP2Proxy_join_close(IP2ProxyJoin *join);
+IP2ProxyCursor *IP2Proxy_cursor_open(IP2Proxy *handler, int32_t ipv6, uint32_t mode, uint32_t part, uint32_t parts);
+int32_t IP2Proxy_cursor_next(IP2ProxyCursor *cursor, const uint8_t **from, const uint8_t **to, const IP2ProxyView **view);
+void IP2Proxy_cursor_close(IP2ProxyCursor *cursor);
+IP2ProxyOverlay *IP2Proxy_overlay_open(uint32_t layers);
+int32_t IP2Proxy_overlay_set_layer(IP2ProxyOverlay *overlay, uint32_t layer, IP2Proxy *handler, uint32_t fields, uint32_t flags);
+int32_t IP2Proxy_overlay_lookup(IP2ProxyOverlay *overlay, const char *ip, size_t length, uint32_t mode, IP2ProxyView *view);
+void IP2Proxy_overlay_close(IP2ProxyOverlay *overlay);
+
 /* Private functions */
-char *IP2Proxy_read_string(FILE *handle, uint32_t position);
-float IP2Proxy_read_float(FILE *handle, uint32_t position);
+char *IP2Proxy_read_string(FILE *handle, uint64_t position);
+float IP2Proxy_read_float(FILE *handle, uint64_t position);
 float IP2Proxy_read_float_row(uint8_t* buffer, uint32_t position, uint32_t mem_offset);
 int32_t IP2Proxy_set_memory_cache(FILE *filehandle);
 int32_t IP2Proxy_set_shared_memory(FILE *filehandle);
-struct in6_addr IP2Proxy_read_ipv6_address(FILE *handle, uint32_t position);
+struct in6_addr IP2Proxy_read_ipv6_address(FILE *handle, uint64_t position);
 struct in6_addr IP2Proxy_read128_row(uint8_t* buffer, uint32_t position, uint32_t mem_offset);
-uint32_t IP2Proxy_read32(FILE *handle, uint32_t position);
+uint32_t IP2Proxy_read32(FILE *handle, uint64_t position);
 uint32_t IP2Proxy_read32_row(uint8_t* buffer, uint32_t position, uint32_t mem_offset);
-uint8_t IP2Proxy_read8(FILE *handle, uint32_t position);
+uint8_t IP2Proxy_read8(FILE *handle, uint64_t position);
 uint8_t IP2Proxy_read8_row(uint8_t* buffer, uint32_t position, uint32_t mem_offset);
 int32_t IP2Proxy_close_memory(FILE *file);
 void IP2Proxy_delete_shm();
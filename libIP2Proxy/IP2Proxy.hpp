@@ -0,0 +1,319 @@
+/*
+ * IP2Proxy C library is distributed under MIT license
+ * Copyright (c) 2013-2026 IP2Location.com. support at ip2location dot com
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT license
+ */
+
+#ifndef HAVE_IP2PROXY_HPP
+#define HAVE_IP2PROXY_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if defined(__has_include)
+#if __has_include(<span>) && __cplusplus >= 202002L
+#include <span>
+#endif
+#endif
+
+#include "IP2Proxy.h"
+
+namespace ip2proxy {
+
+/* Field masks, combine them with | to select the fields a lookup decodes */
+namespace field {
+	inline constexpr uint32_t country_short = COUNTRYSHORT;
+	inline constexpr uint32_t country_long = COUNTRYLONG;
+	inline constexpr uint32_t region = REGION;
+	inline constexpr uint32_t city = CITY;
+	inline constexpr uint32_t isp = ISP;
+	inline constexpr uint32_t is_proxy = ISPROXY;
+	inline constexpr uint32_t proxy_type = PROXYTYPE;
+	inline constexpr uint32_t domain = DOMAINNAME;
+	inline constexpr uint32_t usage_type = USAGETYPE;
+	inline constexpr uint32_t asn = ASN;
+	inline constexpr uint32_t as = AS;
+	inline constexpr uint32_t last_seen = LASTSEEN;
+	inline constexpr uint32_t threat = THREAT;
+	inline constexpr uint32_t provider = PROVIDER;
+	inline constexpr uint32_t fraud_score = FRAUDSCORE;
+	inline constexpr uint32_t all = ALL;
+}
+
+enum class lookup_mode {
+	file_io = IP2PROXY_FILE_IO,
+	cache_memory = IP2PROXY_CACHE_MEMORY,
+	shared_memory = IP2PROXY_SHARED_MEMORY,
+	hybrid_memory = IP2PROXY_HYBRID_MEMORY
+};
+
+/* Closes the database when the last owner goes away */
+struct handle_deleter {
+	void operator()(IP2Proxy *handler) const noexcept
+	{
+		IP2Proxy_close(handler);
+	}
+};
+
+using handle = std::unique_ptr<IP2Proxy, handle_deleter>;
+
+/*
+ * Result of a lookup. Strings are views into the database in memory modes,
+ * or into the result itself in File I/O mode. They stay valid as long as the
+ * result and the database which was loaded into memory are alive, whichever
+ * database the lookup went through, as a process keeps only one database in
+ * memory. Reading a field which is not part of Fields does not compile.
+ */
+template <uint32_t Fields = field::all>
+class result {
+public:
+	result() : view_(new IP2ProxyView()), found_(false)
+	{
+	}
+
+	result(std::unique_ptr<IP2ProxyView> view, bool found) noexcept : view_(std::move(view)), found_(found)
+	{
+	}
+
+	result(const result &) = delete;
+	result &operator=(const result &) = delete;
+	result(result &&) noexcept = default;
+	result &operator=(result &&) noexcept = default;
+
+	explicit operator bool() const noexcept
+	{
+		return found_;
+	}
+
+	/* -1 on errors, 0 not a proxy, 1 a proxy, 2 a data center, search engine or AI crawler */
+	int is_proxy() const noexcept
+	{
+		static_assert((Fields & field::is_proxy) != 0, "is_proxy is not selected");
+		return view_->is_proxy;
+	}
+
+	std::string_view country_short() const noexcept
+	{
+		static_assert((Fields & field::country_short) != 0, "country_short is not selected");
+		return get(view_->country_short);
+	}
+
+	std::string_view country_long() const noexcept
+	{
+		static_assert((Fields & field::country_long) != 0, "country_long is not selected");
+		return get(view_->country_long);
+	}
+
+	std::string_view region() const noexcept
+	{
+		static_assert((Fields & field::region) != 0, "region is not selected");
+		return get(view_->region);
+	}
+
+	std::string_view city() const noexcept
+	{
+		static_assert((Fields & field::city) != 0, "city is not selected");
+		return get(view_->city);
+	}
+
+	std::string_view isp() const noexcept
+	{
+		static_assert((Fields & field::isp) != 0, "isp is not selected");
+		return get(view_->isp);
+	}
+
+	std::string_view proxy_type() const noexcept
+	{
+		static_assert((Fields & field::proxy_type) != 0, "proxy_type is not selected");
+		return get(view_->proxy_type);
+	}
+
+	std::string_view domain() const noexcept
+	{
+		static_assert((Fields & field::domain) != 0, "domain is not selected");
+		return get(view_->domain);
+	}
+
+	std::string_view usage_type() const noexcept
+	{
+		static_assert((Fields & field::usage_type) != 0, "usage_type is not selected");
+		return get(view_->usage_type);
+	}
+
+	std::string_view asn() const noexcept
+	{
+		static_assert((Fields & field::asn) != 0, "asn is not selected");
+		return get(view_->asn);
+	}
+
+	std::string_view as() const noexcept
+	{
+		static_assert((Fields & field::as) != 0, "as is not selected");
+		return get(view_->as_);
+	}
+
+	std::string_view last_seen() const noexcept
+	{
+		static_assert((Fields & field::last_seen) != 0, "last_seen is not selected");
+		return get(view_->last_seen);
+	}
+
+	std::string_view threat() const noexcept
+	{
+		static_assert((Fields & field::threat) != 0, "threat is not selected");
+		return get(view_->threat);
+	}
+
+	std::string_view provider() const noexcept
+	{
+		static_assert((Fields & field::provider) != 0, "provider is not selected");
+		return get(view_->provider);
+	}
+
+	std::string_view fraud_score() const noexcept
+	{
+		static_assert((Fields & field::fraud_score) != 0, "fraud_score is not selected");
+		return get(view_->fraud_score);
+	}
+
+private:
+	friend class database;
+
+	static std::string_view get(const IP2ProxyField &value) noexcept
+	{
+		return std::string_view(value.data, value.length);
+	}
+
+	// Kept on the heap so the views survive a move
+	std::unique_ptr<IP2ProxyView> view_;
+	bool found_;
+};
+
+class database {
+public:
+	explicit database(const std::string &path, lookup_mode mode = lookup_mode::file_io)
+		: handle_(IP2Proxy_open(const_cast<char *>(path.c_str())))
+	{
+		if (!handle_) {
+			throw std::runtime_error("IP2Proxy: unable to open " + path);
+		}
+
+		if (mode != lookup_mode::file_io && IP2Proxy_set_lookup_mode(handle_.get(), static_cast<enum IP2Proxy_lookup_mode>(mode)) != 0) {
+			throw std::runtime_error("IP2Proxy: unable to load " + path + " into memory");
+		}
+	}
+
+	database(const database &) = delete;
+	database &operator=(const database &) = delete;
+	database(database &&) noexcept = default;
+	database &operator=(database &&) noexcept = default;
+
+	template <uint32_t Fields = field::all>
+	result<Fields> lookup(std::string_view ip) const
+	{
+		std::unique_ptr<IP2ProxyView> view(new IP2ProxyView());
+		bool found = IP2Proxy_get_view_n(handle_.get(), ip.data(), ip.size(), Fields, view.get()) == 0;
+
+		return result<Fields>(std::move(view), found);
+	}
+
+#ifdef __cpp_lib_span
+	/* Look up every address of ips into the result at the same index */
+	template <uint32_t Fields = field::all>
+	void lookup(std::span<const std::string_view> ips, std::span<result<Fields>> results) const
+	{
+		if (results.size() < ips.size()) {
+			throw std::length_error("IP2Proxy: not enough room for the results");
+		}
+
+		for (std::size_t i = 0; i < ips.size(); i++) {
+			results[i] = lookup<Fields>(ips[i]);
+		}
+	}
+#endif
+
+	/*
+	 * Call f(from, to, result) for every segment of the database overlapping
+	 * the network, the result is only valid during the call. Return false
+	 * from f to stop. Returns the number of segments.
+	 */
+	template <uint32_t Fields = field::all>
+	int query_cidr(const std::string &cidr, const std::function<bool(std::string_view, std::string_view, const result<Fields> &)> &f) const
+	{
+		struct context {
+			const std::function<bool(std::string_view, std::string_view, const result<Fields> &)> &f;
+			result<Fields> current;
+		} ctx{f, result<Fields>()};
+
+		int32_t rows = IP2Proxy_query_cidr(handle_.get(), cidr.c_str(), Fields, [](const char *from, const char *to, const IP2ProxyView *view, void *user_data) -> int32_t {
+			context *c = static_cast<context *>(user_data);
+
+			*c->current.view_ = *view;
+			return c->f(from, to, c->current) ? 0 : 1;
+		}, &ctx);
+
+		if (rows < 0) {
+			throw std::invalid_argument("IP2Proxy: invalid network " + cidr);
+		}
+
+		return rows;
+	}
+
+	void set_page_cache(uint32_t pages)
+	{
+		if (IP2Proxy_set_page_cache(handle_.get(), pages) != 0) {
+			throw std::runtime_error("IP2Proxy: unable to resize the page cache");
+		}
+	}
+
+	void set_pinned_index(uint32_t interval)
+	{
+		if (IP2Proxy_set_pinned_index(handle_.get(), interval) != 0) {
+			throw std::runtime_error("IP2Proxy: unable to pin the index");
+		}
+	}
+
+	/* Database package, 1 for PX1 up to 12 for PX12 */
+	int package() const noexcept
+	{
+		return handle_->database_type;
+	}
+
+	/* Write the sidecar index file of the database */
+	void save_index(const std::string &path, uint32_t interval = IP2PROXY_PINNED_INDEX_INTERVAL)
+	{
+		if (IP2Proxy_save_index(handle_.get(), path.c_str(), interval) != 0) {
+			throw std::runtime_error("IP2Proxy: unable to write " + path);
+		}
+	}
+
+	/* Use a sidecar index file, false when it is missing or stale and the plain search is kept */
+	bool load_index(const std::string &path) noexcept
+	{
+		return IP2Proxy_load_index(handle_.get(), path.c_str()) == 0;
+	}
+
+	std::string database_version() const
+	{
+		return IP2Proxy_get_database_version(handle_.get());
+	}
+
+	IP2Proxy *native_handle() const noexcept
+	{
+		return handle_.get();
+	}
+
+private:
+	handle handle_;
+};
+
+}
+
+#endif
@@ -0,0 +1,168 @@
+#include <IP2Proxy.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+Time lookups of pseudo random IPv4 addresses with the decoder specialized for the
+database type and with the generic one, then ISPROXY lookups with the negative
+lookup filter, then ISPROXY lookups through a shared memory ring answered by
+another thread.
+
+Usage: bench-IP2Proxy [database] [lookups]
+*/
+
+#define ADDRESSES 65536
+#define ROUNDS 5
+
+static char addresses[ADDRESSES][16];
+
+/* Best time of ROUNDS runs */
+static double bench(IP2Proxy *handler, uint32_t mode, long lookups, unsigned long *checksum)
+{
+	IP2ProxyView view;
+	double best = 0;
+	clock_t start;
+	long i;
+	int round;
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = clock();
+
+		for (i = 0; i < lookups; i++) {
+			IP2Proxy_get_view(handler, addresses[i % ADDRESSES], mode, &view);
+			*checksum += view.country_short.length + view.provider.length + (unsigned long) (view.is_proxy + 1);
+		}
+
+		if (round == 0 || (double) (clock() - start) / CLOCKS_PER_SEC < best) {
+			best = (double) (clock() - start) / CLOCKS_PER_SEC;
+		}
+	}
+
+	return best;
+}
+
+/* Elapsed time, the lookup thread of the ring runs on another CPU */
+static double now(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+}
+
+static double bench_ring(IP2ProxyRing *ring, uint32_t mode, long lookups, unsigned long *checksum)
+{
+	IP2ProxyView view;
+	double start = now();
+	long i;
+
+	for (i = 0; i < lookups; i++) {
+		IP2Proxy_ring_lookup(ring, addresses[i % ADDRESSES], mode, &view);
+		*checksum += view.country_short.length + view.provider.length + (unsigned long) (view.is_proxy + 1);
+	}
+
+	return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = (argc > 1) ? argv[1] : "../data/SAMPLE.BIN";
+	long lookups = (argc > 2) ? atol(argv[2]) : 1000000;
+	const void *kernel;
+	unsigned long specialized_sum = 0;
+	unsigned long generic_sum = 0;
+	double specialized;
+	double generic;
+	unsigned long search_sum = 0;
+	unsigned long filtered_sum = 0;
+	double search;
+	double filtered;
+	IP2ProxyFilterStats stats;
+	IP2ProxyRing *server;
+	IP2ProxyRing *client;
+	unsigned long direct_sum = 0;
+	unsigned long ring_sum = 0;
+	double direct;
+	double ring = 0;
+	uint32_t modes[2];
+	const char *names[2];
+	uint32_t seed = 2463534242U;
+	int i;
+
+	IP2Proxy *IP2ProxyObj = IP2Proxy_open((char *) path);
+
+	if (IP2ProxyObj == NULL) {
+		printf("Please install the database in correct path.\n");
+		return -1;
+	}
+
+	if (IP2Proxy_set_lookup_mode(IP2ProxyObj, IP2PROXY_CACHE_MEMORY) == -1) {
+		fprintf(stderr, "Call to IP2Proxy_set_lookup_mode failed\n");
+		return -1;
+	}
+
+	for (i = 0; i < ADDRESSES; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		sprintf(addresses[i], "%u.%u.%u.%u", (unsigned) (seed >> 24), (unsigned) ((seed >> 16) & 255), (unsigned) ((seed >> 8) & 255), (unsigned) (seed & 255));
+	}
+
+	modes[0] = ALL;
+	names[0] = "ALL";
+	modes[1] = ISPROXY;
+	names[1] = "ISPROXY";
+
+	kernel = IP2ProxyObj->kernel;
+
+	printf("Database: %s (PX%d), %ld lookups\n", path, IP2ProxyObj->database_type, lookups);
+
+	for (i = 0; i < 2; i++) {
+		IP2ProxyObj->kernel = NULL;
+		generic = bench(IP2ProxyObj, modes[i], lookups, &generic_sum);
+
+		IP2ProxyObj->kernel = kernel;
+		specialized = bench(IP2ProxyObj, modes[i], lookups, &specialized_sum);
+
+		printf("%-8s generic %.3fs  specialized %.3fs  %.2fx\n", names[i], generic, specialized, (specialized > 0) ? generic / specialized : 0.0);
+	}
+
+	search = bench(IP2ProxyObj, ISPROXY, lookups, &search_sum);
+
+	if (IP2Proxy_set_negative_filter(IP2ProxyObj, 1) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_set_negative_filter failed\n");
+		return -1;
+	}
+
+	filtered = bench(IP2ProxyObj, ISPROXY, lookups, &filtered_sum);
+	IP2Proxy_get_filter_stats(IP2ProxyObj, &stats);
+
+	printf("%-8s search %.3fs  filter %.3fs  %.2fx, %.1f%% of the lookups skipped the search\n", "ISPROXY", search, filtered, (filtered > 0) ? search / filtered : 0.0, (stats.lookups > 0) ? 100.0 * (double) stats.skipped / (double) stats.lookups : 0.0);
+
+	IP2Proxy_set_negative_filter(IP2ProxyObj, 0);
+	server = IP2Proxy_ring_create(IP2ProxyObj, "/ip2proxy-bench", 256);
+	client = IP2Proxy_ring_open("/ip2proxy-bench");
+	direct = now();
+	bench(IP2ProxyObj, ISPROXY, lookups, &direct_sum);
+	direct = (now() - direct) / ROUNDS;
+
+	if (server != NULL && client != NULL) {
+		ring = bench_ring(client, ISPROXY, lookups, &ring_sum);
+		printf("%-8s in process %.3fs  ring %.3fs  %.0f ns more per lookup\n", "ISPROXY", direct, ring, (ring - direct) * 1e9 / (double) lookups);
+	} else {
+		printf("%-8s shared memory ring not available\n", "ISPROXY");
+	}
+
+	IP2Proxy_ring_close(client);
+	IP2Proxy_ring_close(server);
+	IP2Proxy_close(IP2ProxyObj);
+
+	if (generic_sum != specialized_sum || filtered_sum != search_sum || (ring_sum != 0 && ring_sum * ROUNDS != direct_sum)) {
+		fprintf(stderr, "Lookups differ\n");
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,321 @@
+#include <IP2Proxy.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ip2proxyd.h"
+
+/*
+Load generator for ip2proxyd. Every connection runs on its own thread and keeps
+a number of requests in flight, each one a batch of pseudo random IPv4
+addresses. With a database, every result is checked against a local lookup.
+
+Usage: load-ip2proxyd [-s socket] [-c connections] [-n seconds] [-b batch]
+                      [-p pipeline] [-m mode] [-d database]
+*/
+
+#define ADDRESSES 65536
+
+static char addresses[ADDRESSES][16];
+
+static const char *socket_path = IP2PROXYD_SOCKET;
+static int seconds = 5;
+static int batch = 64;
+static int pipeline = 8;
+static uint32_t mode = ALL;
+static IP2Proxy *database = NULL;
+
+typedef struct {
+	pthread_t thread;
+	uint32_t next;
+	unsigned long frames;
+	unsigned long lookups;
+	unsigned long errors;
+	uint8_t *request;
+	uint8_t *response;
+} client;
+
+static double now(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+}
+
+static void put32(uint8_t *buffer, uint32_t value)
+{
+	buffer[0] = (uint8_t) value;
+	buffer[1] = (uint8_t) (value >> 8);
+	buffer[2] = (uint8_t) (value >> 16);
+	buffer[3] = (uint8_t) (value >> 24);
+}
+
+static uint32_t get32(const uint8_t *buffer)
+{
+	return ((uint32_t) buffer[3] << 24) | ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[1] << 8) | (uint32_t) buffer[0];
+}
+
+static int transfer(int fd, uint8_t *buffer, size_t size, int sending)
+{
+	ssize_t done;
+
+	while (size > 0) {
+		done = sending ? send(fd, buffer, size, MSG_NOSIGNAL) : recv(fd, buffer, size, 0);
+
+		if (done <= 0) {
+			if (done < 0 && errno == EINTR) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		buffer += done;
+		size -= (size_t) done;
+	}
+
+	return 0;
+}
+
+/* Request id is the index of the first address of the batch */
+static int send_request(client *self, int fd)
+{
+	size_t size = IP2PROXYD_HEADER_SIZE;
+	size_t length;
+	int i;
+
+	put32(self->request + 4, self->next);
+	put32(self->request + 8, mode);
+	self->request[12] = (uint8_t) batch;
+	self->request[13] = (uint8_t) (batch >> 8);
+	self->request[14] = IP2PROXYD_VERSION;
+	self->request[15] = 0;
+
+	for (i = 0; i < batch; i++) {
+		length = strlen(addresses[(self->next + i) % ADDRESSES]);
+		self->request[size] = (uint8_t) length;
+		memcpy(self->request + size + 1, addresses[(self->next + i) % ADDRESSES], length);
+		size += 1 + length;
+	}
+
+	put32(self->request, (uint32_t) size - 4);
+	self->next = (self->next + (uint32_t) batch) % ADDRESSES;
+
+	return transfer(fd, self->request, size, 1);
+}
+
+/* Compare a response with local lookups of the same addresses */
+static void verify(client *self, const uint8_t *response, uint32_t length)
+{
+	static const uint32_t masks[] = { COUNTRYSHORT, COUNTRYLONG, REGION, CITY, ISP, PROXYTYPE, DOMAINNAME, USAGETYPE, ASN, AS, LASTSEEN, THREAT, PROVIDER, FRAUDSCORE };
+	IP2ProxyView view;
+	IP2ProxyField *fields[14];
+	uint32_t id = get32(response);
+	uint32_t count = (uint32_t) response[8] | ((uint32_t) response[9] << 8);
+	const uint8_t *result = response + 12;
+	const uint8_t *end = response + length;
+	uint32_t i;
+	int j;
+
+	fields[0] = &view.country_short;
+	fields[1] = &view.country_long;
+	fields[2] = &view.region;
+	fields[3] = &view.city;
+	fields[4] = &view.isp;
+	fields[5] = &view.proxy_type;
+	fields[6] = &view.domain;
+	fields[7] = &view.usage_type;
+	fields[8] = &view.asn;
+	fields[9] = &view.as_;
+	fields[10] = &view.last_seen;
+	fields[11] = &view.threat;
+	fields[12] = &view.provider;
+	fields[13] = &view.fraud_score;
+
+	if (count != (uint32_t) batch || response[10] != IP2PROXYD_OK) {
+		self->errors++;
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		IP2Proxy_get_view(database, addresses[(id + i) % ADDRESSES], mode, &view);
+
+		if (result >= end || (int8_t) result[0] != view.is_proxy) {
+			self->errors++;
+			return;
+		}
+
+		result++;
+
+		for (j = 0; j < 14; j++) {
+			if ((mode & masks[j]) == 0) {
+				continue;
+			}
+
+			if (result >= end || result[0] != (fields[j]->length > 255 ? 255 : fields[j]->length) || memcmp(result + 1, fields[j]->data, result[0]) != 0) {
+				self->errors++;
+				return;
+			}
+
+			result += 1 + result[0];
+		}
+	}
+}
+
+static int receive_response(client *self, int fd)
+{
+	uint8_t prefix[4];
+	uint32_t length;
+
+	if (transfer(fd, prefix, 4, 0) != 0) {
+		return -1;
+	}
+
+	length = get32(prefix);
+
+	if (length < IP2PROXYD_HEADER_SIZE - 4 || transfer(fd, self->response, length, 0) != 0) {
+		return -1;
+	}
+
+	self->frames++;
+	self->lookups += (uint32_t) self->response[8] | ((uint32_t) self->response[9] << 8);
+
+	if (database != NULL) {
+		verify(self, self->response, length);
+	}
+
+	return 0;
+}
+
+static void *run(void *argument)
+{
+	client *self = (client *) argument;
+	struct sockaddr_un address;
+	double deadline = now() + seconds;
+	int in_flight = 0;
+	int fd;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+		fprintf(stderr, "Failed to connect to %s\n", socket_path);
+		self->errors++;
+		return NULL;
+	}
+
+	/* Keep the pipeline full until the deadline, then drain it */
+	while (in_flight < pipeline && send_request(self, fd) == 0) {
+		in_flight++;
+	}
+
+	while (in_flight > 0 && receive_response(self, fd) == 0) {
+		in_flight--;
+
+		if (now() < deadline && send_request(self, fd) == 0) {
+			in_flight++;
+		}
+	}
+
+	if (in_flight > 0) {
+		self->errors++;
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int connections = 1;
+	const char *path = NULL;
+	unsigned long frames = 0;
+	unsigned long lookups = 0;
+	unsigned long errors = 0;
+	uint32_t seed = 2463534242U;
+	client *clients;
+	double start;
+	double elapsed;
+	int i;
+
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "-s") == 0) {
+			socket_path = argv[i + 1];
+		} else if (strcmp(argv[i], "-c") == 0) {
+			connections = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-n") == 0) {
+			seconds = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-b") == 0) {
+			batch = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-p") == 0) {
+			pipeline = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-m") == 0) {
+			mode = (uint32_t) strtoul(argv[i + 1], NULL, 0);
+		} else if (strcmp(argv[i], "-d") == 0) {
+			path = argv[i + 1];
+		}
+	}
+
+	if (connections < 1 || batch < 1 || batch > IP2PROXYD_MAX_BATCH || pipeline < 1) {
+		fprintf(stderr, "Invalid connections, batch or pipeline\n");
+		return -1;
+	}
+
+	/* Checks run from every thread, so they do not share a file position */
+	if (path != NULL && ((database = IP2Proxy_open((char *) path)) == NULL || IP2Proxy_set_lookup_mode(database, IP2PROXY_CACHE_MEMORY) != 0)) {
+		fprintf(stderr, "Failed to open BIN database %s\n", path);
+		return -1;
+	}
+
+	for (i = 0; i < ADDRESSES; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		sprintf(addresses[i], "%u.%u.%u.%u", (seed >> 24) & 255, (seed >> 16) & 255, (seed >> 8) & 255, seed & 255);
+	}
+
+	clients = (client *) calloc((size_t) connections, sizeof(client));
+
+	for (i = 0; i < connections; i++) {
+		clients[i].next = (uint32_t) (i * 4099) % ADDRESSES;
+		clients[i].request = (uint8_t *) malloc(IP2PROXYD_MAX_FRAME);
+		clients[i].response = (uint8_t *) malloc(IP2PROXYD_HEADER_SIZE + (size_t) IP2PROXYD_MAX_BATCH * 14 * 256 + IP2PROXYD_MAX_BATCH);
+	}
+
+	start = now();
+
+	for (i = 0; i < connections; i++) {
+		pthread_create(&clients[i].thread, NULL, run, &clients[i]);
+	}
+
+	for (i = 0; i < connections; i++) {
+		pthread_join(clients[i].thread, NULL);
+		frames += clients[i].frames;
+		lookups += clients[i].lookups;
+		errors += clients[i].errors;
+		free(clients[i].request);
+		free(clients[i].response);
+	}
+
+	elapsed = now() - start;
+
+	printf("Connections %d, batch %d, pipeline %d, mode 0x%X\n", connections, batch, pipeline, mode);
+	printf("%lu requests, %lu lookups in %.2f s\n", frames, lookups, elapsed);
+	printf("%.0f requests/s, %.0f lookups/s\n", frames / elapsed, lookups / elapsed);
+
+	if (database != NULL) {
+		printf("%lu mismatched responses\n", errors);
+		IP2Proxy_close(database);
+	}
+
+	free(clients);
+
+	return (errors == 0) ? 0 : -1;
+}
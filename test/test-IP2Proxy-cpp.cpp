@@ -0,0 +1,101 @@
+#include <IP2Proxy.hpp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+int main()
+{
+	try {
+		ip2proxy::database db("../data/SAMPLE.BIN");
+		IP2Proxy *handler = db.native_handle();
+		IP2ProxyRecord *record = IP2Proxy_get_all(handler, const_cast<char *>("1.10.245.156"));
+
+		auto all = db.lookup("1.10.245.156");
+		auto some = db.lookup<ip2proxy::field::is_proxy | ip2proxy::field::country_short | ip2proxy::field::provider>("1.10.245.156");
+		auto moved = std::move(some);
+		auto invalid = db.lookup<ip2proxy::field::country_short>("not an address");
+		std::string_view line = "1.10.245.156 - - [19/Oct/2026:10:00:00 +0000] \"GET / HTTP/1.1\" 200";
+		auto slice = db.lookup<ip2proxy::field::country_short>(line.substr(0, line.find(' ')));
+		auto mapped = db.lookup<ip2proxy::field::country_short>("::ffff:1.10.245.156");
+
+		std::fprintf(stdout, "Database Version: %s\n", db.database_version().c_str());
+		std::fprintf(stdout, "Country Code: %.*s\n", (int) all.country_short().size(), all.country_short().data());
+		std::fprintf(stdout, "Provider: %.*s\n", (int) moved.provider().size(), moved.provider().data());
+
+		if (!all || !moved || invalid) {
+			std::fprintf(stderr, "Unexpected lookup status\n");
+			return -1;
+		}
+
+		if (all.country_short() != record->country_short || all.country_long() != record->country_long || all.region() != record->region
+			|| all.city() != record->city || all.isp() != record->isp || all.proxy_type() != record->proxy_type
+			|| all.domain() != record->domain || all.usage_type() != record->usage_type || all.asn() != record->asn
+			|| all.as() != record->as_ || all.last_seen() != record->last_seen || all.threat() != record->threat
+			|| all.provider() != record->provider || all.fraud_score() != record->fraud_score
+			|| std::to_string(all.is_proxy()) != record->is_proxy) {
+			std::fprintf(stderr, "View does not match the record\n");
+			return -1;
+		}
+
+		if (slice.country_short() != "TH" || mapped.country_short() != "TH") {
+			std::fprintf(stderr, "Address slice or IPv4-mapped address not parsed\n");
+			return -1;
+		}
+
+		if (moved.country_short() != "TH" || moved.provider() != record->provider || moved.is_proxy() != all.is_proxy()) {
+			std::fprintf(stderr, "Moved result does not match the record\n");
+			return -1;
+		}
+
+		int thai = 0;
+		int segments = db.query_cidr<ip2proxy::field::country_short>("1.10.245.0/24", [&](std::string_view, std::string_view, const auto &segment) {
+			thai += segment.country_short() == "TH";
+			return true;
+		});
+
+		if (segments < 1 || thai < 1) {
+			std::fprintf(stderr, "Network query returned no segment in Thailand\n");
+			return -1;
+		}
+
+		IP2Proxy_free_record(record);
+	} catch (const std::exception &e) {
+		std::fprintf(stderr, "%s\n", e.what());
+		return -1;
+	}
+
+	/* Closing another database must not release the one in memory */
+	try {
+		ip2proxy::database in_memory("../data/SAMPLE.BIN", ip2proxy::lookup_mode::cache_memory);
+		auto before = in_memory.lookup<ip2proxy::field::country_short>("1.10.245.156");
+
+		{
+			ip2proxy::database other("../data/SAMPLE.BIN");
+		}
+
+		try {
+			ip2proxy::database second("../data/SAMPLE.BIN", ip2proxy::lookup_mode::cache_memory);
+			std::fprintf(stderr, "Second database loaded into memory\n");
+			return -1;
+		} catch (const std::runtime_error &) {
+		}
+
+		auto after = in_memory.lookup<ip2proxy::field::country_short>("1.10.245.156");
+
+		if (before.country_short() != "TH" || after.country_short() != "TH") {
+			std::fprintf(stderr, "Database in memory released by another database\n");
+			return -1;
+		}
+	} catch (const std::exception &e) {
+		std::fprintf(stderr, "%s\n", e.what());
+		return -1;
+	}
+
+	try {
+		ip2proxy::database missing("../data/MISSING.BIN");
+		return -1;
+	} catch (const std::runtime_error &) {
+	}
+
+	return 0;
+}
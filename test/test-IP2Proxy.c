@@ -1,9 +1,260 @@
+#ifdef __linux__
+#define _POSIX_C_SOURCE 200112L
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #include <IP2Proxy.h>
 #include <string.h>
 
+/* Addresses looked up again under every cache and index setting */
+static const char *CHECKED_ADDRESSES[] = { "1.10.245.156", "1.15.232.62", "13.214.43.36", "176.116.186.226", "23.83.130.186", "0.0.0.0", "255.255.255.254", "2001:470:19fc::", "2001:470:5088::1", "2a01:4f8::1" };
+#define CHECKED_COUNT (sizeof(CHECKED_ADDRESSES) / sizeof(CHECKED_ADDRESSES[0]))
+
+/* 0 when the handler returns the reference records for the checked addresses */
+static int check_lookups(IP2Proxy *handler, IP2ProxyRecord **reference)
+{
+	IP2ProxyRecord *record;
+	size_t i;
+	int differ = 0;
+
+	for (i = 0; i < CHECKED_COUNT && !differ; i++) {
+		record = IP2Proxy_get_all(handler, (char *) CHECKED_ADDRESSES[i]);
+
+		differ = strcmp(record->country_short, reference[i]->country_short) != 0 || strcmp(record->country_long, reference[i]->country_long) != 0
+			|| strcmp(record->region, reference[i]->region) != 0 || strcmp(record->city, reference[i]->city) != 0 || strcmp(record->isp, reference[i]->isp) != 0
+			|| strcmp(record->is_proxy, reference[i]->is_proxy) != 0 || strcmp(record->proxy_type, reference[i]->proxy_type) != 0
+			|| strcmp(record->domain, reference[i]->domain) != 0 || strcmp(record->usage_type, reference[i]->usage_type) != 0
+			|| strcmp(record->asn, reference[i]->asn) != 0 || strcmp(record->as_, reference[i]->as_) != 0 || strcmp(record->last_seen, reference[i]->last_seen) != 0
+			|| strcmp(record->threat, reference[i]->threat) != 0 || strcmp(record->provider, reference[i]->provider) != 0 || strcmp(record->fraud_score, reference[i]->fraud_score) != 0;
+
+		IP2Proxy_free_record(record);
+	}
+
+	return differ ? -1 : 0;
+}
+
+static void async_callback(IP2ProxyRecord *record, void *user_data)
+{
+	*(IP2ProxyRecord **) user_data = record;
+}
+
+static int32_t diff_callback(const char *from, const char *to, const IP2ProxyView *old_view, const IP2ProxyView *new_view, void *user_data)
+{
+	(*(int *) user_data)++;
+
+	return 0;
+}
+
+/* Copy a BIN file to the large format, with gap bytes between the index tables and the rows */
+static int write_large_copy(const char *from, const char *to, uint32_t gap)
+{
+	FILE *input = fopen(from, "rb");
+	FILE *output = fopen(to, "wb");
+	uint8_t header[64];
+	uint8_t buffer[4096];
+	uint32_t addresses[3];
+	uint32_t tables;
+	size_t length;
+	int offsets[3] = { 9, 17, 31 };
+	int i;
+	int j;
+
+	if (input == NULL || output == NULL || fread(header, sizeof(header), 1, input) != 1) {
+		return -1;
+	}
+
+	/* Rows move by gap, the string pointers keep their value as offsets from gap */
+	for (i = 0; i < 3; i++) {
+		addresses[i] = (uint32_t) header[offsets[i]] | ((uint32_t) header[offsets[i] + 1] << 8) | ((uint32_t) header[offsets[i] + 2] << 16) | ((uint32_t) header[offsets[i] + 3] << 24);
+
+		for (j = 0; j < 4; j++) {
+			header[offsets[i] + j] = (uint8_t) ((addresses[i] + gap) >> (j * 8));
+		}
+	}
+
+	tables = addresses[0] - 1 - sizeof(header);
+	memset(header + 35, 0, sizeof(header) - 35);
+	header[35] = 1;
+
+	for (j = 0; j < 4; j++) {
+		header[56 + j] = (uint8_t) (gap >> (j * 8));
+	}
+
+	fwrite(header, sizeof(header), 1, output);
+
+	while (tables > 0 && (length = fread(buffer, 1, (tables < sizeof(buffer)) ? tables : sizeof(buffer), input)) > 0) {
+		fwrite(buffer, 1, length, output);
+		tables -= (uint32_t) length;
+	}
+
+	memset(buffer, 0, sizeof(buffer));
+
+	for (i = 0; (uint32_t) i < gap; i += (int) length) {
+		length = (gap - (uint32_t) i < sizeof(buffer)) ? gap - (uint32_t) i : sizeof(buffer);
+		fwrite(buffer, 1, length, output);
+	}
+
+	while ((length = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+		fwrite(buffer, 1, length, output);
+	}
+
+	fclose(input);
+
+	return (fclose(output) == 0) ? 0 : -1;
+}
+
+/* Header of a compressed BIN file with the frames given, followed by zeros up to size bytes */
+static int write_damaged_frames(const char *to, uint32_t frame_size, uint32_t frame_count, uint32_t raw_size, size_t size)
+{
+	FILE *output = fopen(to, "wb");
+	uint32_t words[6];
+	uint8_t zero = 0;
+	size_t length = 8 + sizeof(words);
+
+	if (output == NULL) {
+		return -1;
+	}
+
+	words[0] = 1;
+	words[1] = 0x01020304;
+	words[2] = frame_size;
+	words[3] = frame_count;
+	words[4] = raw_size;
+	words[5] = 0;
+
+	fwrite("IP2PXLZ4", 8, 1, output);
+	fwrite(words, sizeof(words), 1, output);
+
+	for (; length < size; length++) {
+		fwrite(&zero, 1, 1, output);
+	}
+
+	return (fclose(output) == 0) ? 0 : -1;
+}
+
+/* Position of bytes in a file, -1 if they are missing */
+static long find_bytes(const char *path, const char *bytes, size_t length)
+{
+	FILE *input = fopen(path, "rb");
+	uint8_t *buffer;
+	long size;
+	long i;
+
+	if (input == NULL || fseek(input, 0, SEEK_END) != 0 || (size = ftell(input)) < (long) length || fseek(input, 0, SEEK_SET) != 0 || (buffer = (uint8_t *) malloc((size_t) size)) == NULL) {
+		return -1;
+	}
+
+	if (fread(buffer, (size_t) size, 1, input) != 1) {
+		size = 0;
+	}
+
+	fclose(input);
+
+	for (i = 0; i + (long) length <= size && memcmp(buffer + i, bytes, length) != 0; i++) {
+	}
+
+	free(buffer);
+
+	return (i + (long) length <= size) ? i : -1;
+}
+
+/* Copy a file with the bits of mask flipped in one byte, as a DB rebuilt with new rows */
+static int write_changed_copy(const char *from, const char *to, long offset, uint8_t mask)
+{
+	FILE *input = fopen(from, "rb");
+	FILE *output = fopen(to, "wb");
+	uint8_t buffer[4096];
+	size_t length;
+	long position = 0;
+
+	if (input == NULL || output == NULL) {
+		return -1;
+	}
+
+	while ((length = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+		if (offset >= position && offset < position + (long) length) {
+			buffer[offset - position] ^= mask;
+		}
+
+		fwrite(buffer, 1, length, output);
+		position += (long) length;
+	}
+
+	fclose(input);
+
+	if (offset >= position) {
+		fclose(output);
+		return -1;
+	}
+
+	return (fclose(output) == 0) ? 0 : -1;
+}
+
+static int32_t range_callback(const char *from, const char *to, const IP2ProxyView *view, void *user_data)
+{
+	if (view->country_short.length == 2 && strncmp(view->country_short.data, "TH", 2) == 0) {
+		(*(int *) user_data)++;
+	}
+
+	return 0;
+}
+
 int main ()
 {
 	IP2ProxyRecord *record = NULL;
+	IP2ProxyRecord *async_record = NULL;
+	IP2ProxyRecord *indexed_record = NULL;
+	IP2ProxyRecord *reference[CHECKED_COUNT];
+	IP2Proxy *cached = NULL;
+	uint32_t pages[3] = { 1, 0, IP2PROXY_PAGE_CACHE_DEFAULT };
+	uint32_t intervals[4] = { 1, 7, IP2PROXY_PINNED_INDEX_INTERVAL, 0 };
+	IP2Proxy *hybrid = NULL;
+	IP2ProxyLoadStats load_stats;
+	FILE *database_file = NULL;
+	long database_size = 0;
+	size_t n;
+	IP2ProxyAsync *async = NULL;
+	int range_matches = 0;
+	int32_t range_rows;
+	IP2ProxyExportFilter filter = { "VPN", NULL, NULL, 0 };
+	FILE *export_file = NULL;
+	IP2ProxyRecord *filtered_record = NULL;
+	IP2ProxyFilterStats filter_stats;
+	IP2Proxy *same = NULL;
+	int diff_changes = 0;
+	IP2Proxy *patched = NULL;
+	IP2Proxy *compressed = NULL;
+	IP2Proxy *large = NULL;
+	IP2Proxy *in_memory = NULL;
+	IP2Proxy *stale = NULL;
+	long stale_key;
+	IP2Proxy *changed = NULL;
+	IP2Proxy *updated = NULL;
+	IP2ProxyRecord *updated_record = NULL;
+	long changed_string;
+	int32_t changed_ranges;
+	IP2ProxyOverlay *overlay = NULL;
+	IP2ProxyView overlay_view;
+	IP2ProxyRing *ring_server = NULL;
+	IP2ProxyRing *ring_client = NULL;
+	IP2ProxyView ring_view;
+#ifdef __linux__
+	int ring_pipe[2];
+	char ring_ready;
+	pid_t ring_pid;
+#endif
+	IP2ProxyJoin *join = NULL;
+	const IP2ProxyView *join_view = NULL;
+	IP2ProxyCursor *cursor = NULL;
+	const uint8_t *row_from = NULL;
+	const uint8_t *row_to = NULL;
+	uint8_t next_from[16];
+	uint32_t cursor_rows = 0;
+	uint32_t part;
+	int k;
 
 	/*
 	Lookup by CSV file (Slower)
@@ -56,9 +307,468 @@ int main ()
 	fprintf(stdout, "Provider: %s\n", record->provider);
 	fprintf(stdout, "Fraud Score: %s\n", record->fraud_score);
 
-	IP2Proxy_close(IP2ProxyObj);
 	IP2Proxy_free_record(record);
 
+	/*
+	Non-blocking lookup, the result must match the blocking one
+	*/
+	record = IP2Proxy_get_all(IP2ProxyObj, "1.10.245.156");
+	async = IP2Proxy_async_open(IP2ProxyObj, 8, 0);
+
+	if (async == NULL || IP2Proxy_async_submit(async, "1.10.245.156", ALL, async_callback, &async_record) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_async_submit failed\n");
+		return -1;
+	}
+
+	while (async_record == NULL) {
+		IP2Proxy_async_poll(async, -1);
+	}
+
+	IP2Proxy_async_close(async);
+
+	if (strcmp(record->country_short, "TH") != 0 || strcmp(async_record->country_short, record->country_short) != 0 || strcmp(async_record->provider, record->provider) != 0 || strcmp(async_record->is_proxy, record->is_proxy) != 0) {
+		fprintf(stderr, "Asynchronous lookup returned a different record\n");
+		return -1;
+	}
+
+	/*
+	Page cache of 1 page and of the default size, the records must be those read without cache
+	*/
+	cached = IP2Proxy_open("../data/SAMPLE.BIN");
+
+	if (cached == NULL || IP2Proxy_set_page_cache(cached, 0) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_set_page_cache failed\n");
+		return -1;
+	}
+
+	for (n = 0; n < CHECKED_COUNT; n++) {
+		reference[n] = IP2Proxy_get_all(cached, (char *) CHECKED_ADDRESSES[n]);
+	}
+
+	for (n = 0; n < 3; n++) {
+		if (IP2Proxy_set_page_cache(cached, pages[n]) != 0 || check_lookups(cached, reference) != 0) {
+			fprintf(stderr, "Lookup with a page cache of %u pages returned a different record\n", pages[n]);
+			return -1;
+		}
+	}
+
+	/*
+	Pinned index of every row, every 7th row and the default interval, then none
+	*/
+	for (n = 0; n < 4; n++) {
+		if (IP2Proxy_set_pinned_index(cached, intervals[n]) != 0 || check_lookups(cached, reference) != 0) {
+			fprintf(stderr, "Lookup with a pinned index of interval %u returned a different record\n", intervals[n]);
+			return -1;
+		}
+	}
+
+	/*
+	Hybrid mode keeps memory per handler, two handlers can use it
+	*/
+	hybrid = IP2Proxy_open("../data/SAMPLE.BIN");
+
+	if (hybrid == NULL || IP2Proxy_set_lookup_mode(cached, IP2PROXY_HYBRID_MEMORY) != 0 || IP2Proxy_set_lookup_mode(hybrid, IP2PROXY_HYBRID_MEMORY) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_set_lookup_mode failed in hybrid mode\n");
+		return -1;
+	}
+
+	if (check_lookups(cached, reference) != 0 || check_lookups(hybrid, reference) != 0) {
+		fprintf(stderr, "Lookup in hybrid mode returned a different record\n");
+		return -1;
+	}
+
+	IP2Proxy_close(hybrid);
+	IP2Proxy_close(cached);
+
+	/*
+	Sidecar index file, the result must not change
+	*/
+	if (IP2Proxy_save_index(IP2ProxyObj, "SAMPLE.IDX", 16) != 0 || IP2Proxy_load_index(IP2ProxyObj, "SAMPLE.IDX") != 0) {
+		fprintf(stderr, "Call to IP2Proxy_save_index or IP2Proxy_load_index failed\n");
+		return -1;
+	}
+
+	remove("SAMPLE.IDX");
+	indexed_record = IP2Proxy_get_all(IP2ProxyObj, "1.10.245.156");
+
+	if (strcmp(indexed_record->country_short, record->country_short) != 0 || strcmp(indexed_record->provider, record->provider) != 0 || strcmp(indexed_record->is_proxy, record->is_proxy) != 0) {
+		fprintf(stderr, "Lookup with the sidecar index returned a different record\n");
+		return -1;
+	}
+
+	/*
+	Sidecar index file of a DB with the same header and index tables but another sampled row key
+	*/
+	stale_key = (long) IP2ProxyObj->ipv4_database_address - 1 + 16 * IP2ProxyObj->database_column * 4;
+
+	if (write_changed_copy("../data/SAMPLE.BIN", "STALE.BIN", stale_key, 0xFF) != 0 || (stale = IP2Proxy_open("STALE.BIN")) == NULL || IP2Proxy_save_index(stale, "STALE.IDX", 16) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_save_index failed\n");
+		return -1;
+	}
+
+	if (IP2Proxy_load_index(IP2ProxyObj, "STALE.IDX") != -1) {
+		fprintf(stderr, "Stale sidecar index file was accepted\n");
+		return -1;
+	}
+
+	IP2Proxy_close(stale);
+	remove("STALE.IDX");
+	remove("STALE.BIN");
+
+	/*
+	Every segment of a CIDR block, the block of the record above is in Thailand
+	*/
+	range_rows = IP2Proxy_query_cidr(IP2ProxyObj, "1.10.245.156/32", COUNTRYSHORT, range_callback, &range_matches);
+
+	if (range_rows != 1 || range_matches != 1 || IP2Proxy_query_range(IP2ProxyObj, "1.10.245.156", "::1", ALL, range_callback, &range_matches) != -1) {
+		fprintf(stderr, "Call to IP2Proxy_query_cidr or IP2Proxy_query_range failed\n");
+		return -1;
+	}
+
+	/*
+	The last row of an address family only marks its end, blocks up to the top address end in the segment before it
+	*/
+	if (IP2Proxy_query_range(IP2ProxyObj, "255.255.255.0", "255.255.255.255", COUNTRYSHORT, range_callback, &range_matches) != 1
+		|| IP2Proxy_query_range(IP2ProxyObj, "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ff00", "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", COUNTRYSHORT, range_callback, &range_matches) != 1
+		|| IP2Proxy_query_cidr(IP2ProxyObj, "255.255.255.0/24", COUNTRYSHORT, range_callback, &range_matches) != 1
+		|| IP2Proxy_query_cidr(IP2ProxyObj, "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ff00/120", COUNTRYSHORT, range_callback, &range_matches) != 1) {
+		fprintf(stderr, "Call to IP2Proxy_query_range or IP2Proxy_query_cidr returned the last row of an address family\n");
+		return -1;
+	}
+
+	/*
+	Export of the VPN proxies as ipset restore input
+	*/
+	export_file = tmpfile();
+
+	if (export_file == NULL || IP2Proxy_export_cidr(IP2ProxyObj, &filter, IP2PROXY_EXPORT_IPSET, "vpn", export_file) <= 0) {
+		fprintf(stderr, "Call to IP2Proxy_export_cidr failed\n");
+		return -1;
+	}
+
+	fclose(export_file);
+
+	/*
+	Negative lookup filter, a proxy still goes through the search
+	*/
+	if (IP2Proxy_set_negative_filter(IP2ProxyObj, 1) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_set_negative_filter failed\n");
+		return -1;
+	}
+
+	filtered_record = IP2Proxy_is_proxy(IP2ProxyObj, "1.10.245.156");
+
+	if (strcmp(filtered_record->is_proxy, record->is_proxy) != 0 || IP2Proxy_get_filter_stats(IP2ProxyObj, &filter_stats) != 0 || filter_stats.skipped != 0) {
+		fprintf(stderr, "Lookup with the negative filter returned a different record\n");
+		return -1;
+	}
+
+	IP2Proxy_free_record(filtered_record);
+	filtered_record = IP2Proxy_is_proxy(IP2ProxyObj, "1.2.3.4");
+
+	if (strcmp(filtered_record->is_proxy, "0") != 0 || IP2Proxy_get_filter_stats(IP2ProxyObj, &filter_stats) != 0 || filter_stats.lookups != 2 || filter_stats.skipped != 1) {
+		fprintf(stderr, "Negative filter did not answer a network without proxies\n");
+		return -1;
+	}
+
+	IP2Proxy_free_record(filtered_record);
+
+	/* The /24 IPv6 prefix of 2001:470:19fc::/47 holds proxies, the /48 networks of the address below do not */
+	filtered_record = IP2Proxy_is_proxy(IP2ProxyObj, "2001:470:19fc::1");
+
+	if (strcmp(filtered_record->is_proxy, "2") != 0 || IP2Proxy_get_filter_stats(IP2ProxyObj, &filter_stats) != 0 || filter_stats.ipv6_lookups != 1 || filter_stats.ipv6_skipped != 0) {
+		fprintf(stderr, "Lookup of an IPv6 proxy with the negative filter returned a different record\n");
+		return -1;
+	}
+
+	IP2Proxy_free_record(filtered_record);
+	filtered_record = IP2Proxy_is_proxy(IP2ProxyObj, "2001:470:1000::1");
+
+	if (strcmp(filtered_record->is_proxy, "0") != 0 || IP2Proxy_get_filter_stats(IP2ProxyObj, &filter_stats) != 0 || filter_stats.ipv6_lookups != 2 || filter_stats.ipv6_skipped != 1 || filter_stats.skipped != 2) {
+		fprintf(stderr, "Negative filter did not answer a /48 IPv6 network without proxies\n");
+		return -1;
+	}
+
+	IP2Proxy_free_record(filtered_record);
+
+	/*
+	Nothing changed between two copies of the same database
+	*/
+	same = IP2Proxy_open("../data/SAMPLE.BIN");
+
+	if (same == NULL || IP2Proxy_diff(IP2ProxyObj, same, ALL, diff_callback, &diff_changes) != 0 || diff_changes != 0) {
+		fprintf(stderr, "Call to IP2Proxy_diff failed\n");
+		return -1;
+	}
+
+	/*
+	An empty patch rebuilds the same database
+	*/
+	if (IP2Proxy_make_patch(IP2ProxyObj, same, "SAMPLE.PAT") != 0 || IP2Proxy_apply_patch(IP2ProxyObj, "SAMPLE.PAT", "PATCHED.BIN") != 0 || (patched = IP2Proxy_open("PATCHED.BIN")) == NULL) {
+		fprintf(stderr, "Call to IP2Proxy_make_patch or IP2Proxy_apply_patch failed\n");
+		return -1;
+	}
+
+	if (IP2Proxy_diff(patched, same, ALL, diff_callback, &diff_changes) != 0 || diff_changes != 0 || patched->ipv4_database_count != same->ipv4_database_count) {
+		fprintf(stderr, "Patched database differs\n");
+		return -1;
+	}
+
+	/*
+	A patch of a DB with another country name, the patched DB must return it
+	*/
+	changed_string = find_bytes("../data/SAMPLE.BIN", "\002TH\010Thailand", 12);
+
+	if (changed_string == -1 || write_changed_copy("../data/SAMPLE.BIN", "CHANGED.BIN", changed_string + 4, 'T' ^ 'X') != 0 || (changed = IP2Proxy_open("CHANGED.BIN")) == NULL) {
+		fprintf(stderr, "Unable to write a changed database\n");
+		return -1;
+	}
+
+	changed_ranges = IP2Proxy_make_patch(same, changed, "CHANGED.PAT");
+
+	if (changed_ranges <= 0 || IP2Proxy_apply_patch(same, "CHANGED.PAT", "UPDATED.BIN") != changed_ranges || (updated = IP2Proxy_open("UPDATED.BIN")) == NULL) {
+		fprintf(stderr, "Call to IP2Proxy_make_patch or IP2Proxy_apply_patch failed with a changed database\n");
+		return -1;
+	}
+
+	updated_record = IP2Proxy_get_all(updated, "1.10.245.156");
+
+	if (IP2Proxy_diff(updated, changed, ALL, diff_callback, &diff_changes) != 0 || diff_changes != 0 || strcmp(updated_record->country_long, "Xhailand") != 0 || strcmp(updated_record->provider, record->provider) != 0) {
+		fprintf(stderr, "Database patched with changes differs\n");
+		return -1;
+	}
+
+	/* A patch recording another output is refused, output is left as it was */
+	if (write_changed_copy("CHANGED.PAT", "DAMAGED.PAT", 24, 0xFF) != 0 || IP2Proxy_apply_patch(same, "DAMAGED.PAT", "UPDATED.BIN") != -1 || IP2Proxy_diff(updated, changed, ALL, diff_callback, &diff_changes) != 0 || diff_changes != 0) {
+		fprintf(stderr, "Call to IP2Proxy_apply_patch did not check the patched database\n");
+		return -1;
+	}
+
+	IP2Proxy_free_record(updated_record);
+	IP2Proxy_close(updated);
+	IP2Proxy_close(changed);
+	remove("DAMAGED.PAT");
+	remove("CHANGED.PAT");
+	remove("UPDATED.BIN");
+	remove("CHANGED.BIN");
+
+	/*
+	Merge join of ascending addresses, the last one must match the lookup above
+	*/
+	join = IP2Proxy_join_open(IP2ProxyObj, ALL);
+
+	if (join == NULL || IP2Proxy_join_lookup(join, "1.10.245.155", 12, &join_view) != 0 || IP2Proxy_join_lookup(join, "1.10.245.156", 12, &join_view) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_join_open or IP2Proxy_join_lookup failed\n");
+		return -1;
+	}
+
+	if (join_view->is_proxy != atoi(record->is_proxy) || join_view->country_short.length != 2 || strncmp(join_view->country_short.data, record->country_short, 2) != 0 || join_view->provider.length != strlen(record->provider) || strncmp(join_view->provider.data, record->provider, join_view->provider.length) != 0) {
+		fprintf(stderr, "Merge join returned a different record\n");
+		return -1;
+	}
+
+	IP2Proxy_join_close(join);
+
+	/*
+	Rows of two slices of the IPv4 rows, every row starts right after the previous one ends
+	*/
+	memset(next_from, 0, sizeof(next_from));
+
+	for (part = 0; part < 2; part++) {
+		if ((cursor = IP2Proxy_cursor_open(IP2ProxyObj, 0, ISPROXY, part, 2)) == NULL) {
+			fprintf(stderr, "Call to IP2Proxy_cursor_open failed\n");
+			return -1;
+		}
+
+		while (IP2Proxy_cursor_next(cursor, &row_from, &row_to, &join_view) == 1) {
+			if (memcmp(row_from, next_from, 16) != 0 || join_view->is_proxy < 0) {
+				fprintf(stderr, "Cursor returned a row out of order\n");
+				return -1;
+			}
+
+			memcpy(next_from, row_to, 16);
+
+			for (k = 15; k >= 0 && ++next_from[k] == 0; k--) {
+			}
+
+			cursor_rows++;
+		}
+
+		IP2Proxy_cursor_close(cursor);
+	}
+
+	if (cursor_rows != IP2ProxyObj->ipv4_database_count - 1) {
+		fprintf(stderr, "Cursor returned %u of %u rows\n", cursor_rows, IP2ProxyObj->ipv4_database_count - 1);
+		return -1;
+	}
+
+	/*
+	A compressed copy reads the same as the database
+	*/
+	if (IP2Proxy_compress(IP2ProxyObj, "SAMPLE.LZ4") != 0 || (compressed = IP2Proxy_open("SAMPLE.LZ4")) == NULL) {
+		fprintf(stderr, "Call to IP2Proxy_compress failed\n");
+		return -1;
+	}
+
+	if (compressed->frames == NULL || IP2Proxy_diff(compressed, same, ALL, diff_callback, &diff_changes) != 0 || diff_changes != 0) {
+		fprintf(stderr, "Compressed database differs\n");
+		return -1;
+	}
+
+	/*
+	Damaged frame headers, 2^32 - 1 frames of 1 byte and more frame offsets than the file holds
+	*/
+	if (write_damaged_frames("DAMAGED.LZ4", 1, 0xFFFFFFFF, 0xFFFFFFFF, 104) != 0 || IP2Proxy_open("DAMAGED.LZ4") != NULL
+		|| write_damaged_frames("DAMAGED.LZ4", 65536, 65536, 0xFFFFFFFF, 104) != 0 || IP2Proxy_open("DAMAGED.LZ4") != NULL) {
+		fprintf(stderr, "Compressed database with a damaged header was opened\n");
+		return -1;
+	}
+
+	remove("DAMAGED.LZ4");
+
+	/*
+	A copy in the large format, rows and strings past the 32-bit offsets of the classic header
+	*/
+	if (write_large_copy("../data/SAMPLE.BIN", "LARGE.BIN", 4096) != 0 || (large = IP2Proxy_open("LARGE.BIN")) == NULL) {
+		fprintf(stderr, "Failed to open a large format copy\n");
+		return -1;
+	}
+
+	if (large->large_format != 1 || large->strings_base != 4096 || IP2Proxy_diff(large, same, ALL, diff_callback, &diff_changes) != 0 || diff_changes != 0) {
+		fprintf(stderr, "Large format database differs\n");
+		return -1;
+	}
+
+	/*
+	An allowlist layer over the database, then the same layer reloaded as a plain layer
+	*/
+	overlay = IP2Proxy_overlay_open(2);
+
+	if (overlay == NULL || IP2Proxy_overlay_set_layer(overlay, 1, same, ALL, 0) != 0 || IP2Proxy_overlay_set_layer(overlay, 0, large, ISPROXY | PROXYTYPE, IP2PROXY_OVERLAY_ALLOW) != 0 || IP2Proxy_overlay_lookup(overlay, "1.10.245.156", 12, ALL, &overlay_view) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_overlay_set_layer or IP2Proxy_overlay_lookup failed\n");
+		return -1;
+	}
+
+	if (overlay_view.is_proxy != 0 || overlay_view.proxy_type.length != 1 || overlay_view.country_short.length != 2 || strncmp(overlay_view.country_short.data, record->country_short, 2) != 0) {
+		fprintf(stderr, "Allowlist layer did not override the database\n");
+		return -1;
+	}
+
+	if (IP2Proxy_overlay_set_layer(overlay, 0, compressed, ALL, 0) != 0 || IP2Proxy_overlay_lookup(overlay, "1.10.245.156", 12, ALL, &overlay_view) != 0
+		|| overlay_view.is_proxy != atoi(record->is_proxy) || overlay_view.provider.length != strlen(record->provider) || strncmp(overlay_view.provider.data, record->provider, overlay_view.provider.length) != 0) {
+		fprintf(stderr, "Reloaded overlay layer returned a different record\n");
+		return -1;
+	}
+
+	IP2Proxy_overlay_close(overlay);
+
+#ifdef __linux__
+	/*
+	Lookup through a shared memory ring answered by another thread
+	*/
+	ring_server = IP2Proxy_ring_create(IP2ProxyObj, "/IP2Proxy_Test_Ring", 4);
+	ring_client = IP2Proxy_ring_open("/IP2Proxy_Test_Ring");
+
+	if (ring_server == NULL || ring_client == NULL || IP2Proxy_ring_create(IP2ProxyObj, "/IP2Proxy_Test_Ring", 4) != NULL || IP2Proxy_ring_lookup(ring_client, "1.10.245.156", ALL, &ring_view) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_ring_create or IP2Proxy_ring_lookup failed\n");
+		return -1;
+	}
+
+	if (ring_view.country_short.length != 2 || strncmp(ring_view.country_short.data, record->country_short, 2) != 0 || ring_view.provider.length != strlen(record->provider) || strncmp(ring_view.provider.data, record->provider, ring_view.provider.length) != 0) {
+		fprintf(stderr, "Lookup through the ring returned a different record\n");
+		return -1;
+	}
+
+	IP2Proxy_ring_close(ring_client);
+	IP2Proxy_ring_close(ring_server);
+
+	/* A client gives up on a ring whose server was killed without closing it */
+	if (pipe(ring_pipe) != 0 || (ring_pid = fork()) == -1) {
+		fprintf(stderr, "Call to fork failed\n");
+		return -1;
+	}
+
+	if (ring_pid == 0) {
+		ring_ready = (IP2Proxy_ring_create(IP2ProxyObj, "/IP2Proxy_Test_Dead_Ring", 4) != NULL) ? 1 : 0;
+
+		if (write(ring_pipe[1], &ring_ready, 1) != 1 || !ring_ready) {
+			_exit(1);
+		}
+
+		for (;;) {
+			pause();
+		}
+	}
+
+	if (read(ring_pipe[0], &ring_ready, 1) != 1 || !ring_ready || (ring_client = IP2Proxy_ring_open("/IP2Proxy_Test_Dead_Ring")) == NULL || IP2Proxy_ring_lookup(ring_client, "1.10.245.156", ALL, &ring_view) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_ring_lookup failed before the server was killed\n");
+		return -1;
+	}
+
+	kill(ring_pid, SIGKILL);
+	waitpid(ring_pid, NULL, 0);
+	close(ring_pipe[0]);
+	close(ring_pipe[1]);
+
+	if (IP2Proxy_ring_lookup(ring_client, "1.10.245.156", ALL, &ring_view) != -1) {
+		fprintf(stderr, "Call to IP2Proxy_ring_lookup did not fail after the server was killed\n");
+		return -1;
+	}
+
+	IP2Proxy_ring_close(ring_client);
+	shm_unlink("/IP2Proxy_Test_Dead_Ring");
+#endif
+
+	/*
+	Two databases are not compared while one of them is in memory
+	*/
+	in_memory = IP2Proxy_open("../data/SAMPLE.BIN");
+
+	/* Nothing was loaded into memory yet */
+	if (in_memory == NULL || IP2Proxy_get_load_stats(in_memory, &load_stats) != -1) {
+		fprintf(stderr, "Call to IP2Proxy_get_load_stats did not fail before a load\n");
+		return -1;
+	}
+
+	if (IP2Proxy_set_lookup_mode(in_memory, IP2PROXY_CACHE_MEMORY) != 0) {
+		fprintf(stderr, "Call to IP2Proxy_set_lookup_mode failed\n");
+		return -1;
+	}
+
+	if ((database_file = fopen("../data/SAMPLE.BIN", "rb")) != NULL) {
+		database_size = (fseek(database_file, 0, SEEK_END) == 0) ? ftell(database_file) : 0;
+		fclose(database_file);
+	}
+
+	if (IP2Proxy_get_load_stats(in_memory, &load_stats) != 0 || load_stats.size != (uint64_t) database_size || load_stats.crc32c == 0 || load_stats.threads == 0) {
+		fprintf(stderr, "Call to IP2Proxy_get_load_stats returned wrong statistics\n");
+		return -1;
+	}
+
+	if (IP2Proxy_diff(in_memory, same, ALL, diff_callback, &diff_changes) != -1 || IP2Proxy_make_patch(same, in_memory, "SAMPLE.PAT") != -1) {
+		fprintf(stderr, "Call to IP2Proxy_diff or IP2Proxy_make_patch did not fail with a database in memory\n");
+		return -1;
+	}
+
+	IP2Proxy_close(in_memory);
+
+	IP2Proxy_close(large);
+	remove("LARGE.BIN");
+	IP2Proxy_close(compressed);
+	remove("SAMPLE.LZ4");
+	IP2Proxy_close(patched);
+	remove("SAMPLE.PAT");
+	remove("PATCHED.BIN");
+	IP2Proxy_close(same);
+	IP2Proxy_free_record(indexed_record);
+
+	for (n = 0; n < CHECKED_COUNT; n++) {
+		IP2Proxy_free_record(reference[n]);
+	}
+	IP2Proxy_free_record(async_record);
+	IP2Proxy_free_record(record);
+	IP2Proxy_close(IP2ProxyObj);
+
 	return 0;
 }
 
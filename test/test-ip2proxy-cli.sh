@@ -0,0 +1,42 @@
+#!/bin/sh
+# Values holding quotes and ampersands, as written by --diff and --group-by in CSV and XML
+
+DATA="${srcdir:-.}/data/SAMPLE.BIN"
+IP2PROXY=./ip2proxy
+CHANGED=QUOTED.BIN
+INPUT=QUOTED.TXT
+OUTPUT=QUOTED.OUT
+
+trap 'rm -f "$CHANGED" "$INPUT" "$OUTPUT"' EXIT
+
+fail()
+{
+	echo "$1" >&2
+	cat "$OUTPUT" >&2
+	exit 1
+}
+
+# A copy of the BIN file with a quote in an ISP name, "AT&T Enterprises LLC" becomes "AT&T "nterprises LLC"
+offset=$(LC_ALL=C grep -obUa 'AT&T Enterprises LLC' "$DATA" | head -n 1 | cut -d: -f1)
+
+if [ -z "$offset" ]; then
+	echo "No ISP name to change in $DATA" >&2
+	exit 1
+fi
+
+cp "$DATA" "$CHANGED" && printf '"' | dd of="$CHANGED" bs=1 seek=$((offset + 5)) conv=notrunc 2> /dev/null || exit 1
+echo 23.113.49.109 > "$INPUT"
+
+"$IP2PROXY" -d "$DATA" --diff "$CHANGED" -f CSV > "$OUTPUT" 2> /dev/null
+grep -F -q '"23.113.49.109","23.113.49.109","isp","AT&T Enterprises LLC","AT&T ""nterprises LLC"' "$OUTPUT" || fail "Quote not doubled by --diff in CSV"
+
+"$IP2PROXY" -d "$DATA" --diff "$CHANGED" -f XML > "$OUTPUT" 2> /dev/null
+grep -F -q '<old>AT&amp;T Enterprises LLC</old><new>AT&amp;T "nterprises LLC</new>' "$OUTPUT" || fail "Ampersand not escaped by --diff in XML"
+
+"$IP2PROXY" -d "$CHANGED" -i "$INPUT" -f CSV --group-by isp > "$OUTPUT"
+grep -F -q '"AT&T ""nterprises LLC","1"' "$OUTPUT" || fail "Quote not doubled by --group-by in CSV"
+
+"$IP2PROXY" -d "$CHANGED" -i "$INPUT" -f XML --group-by isp > "$OUTPUT"
+grep -F -q '<isp>AT&amp;T "nterprises LLC</isp>' "$OUTPUT" || fail "Ampersand not escaped by --group-by in XML"
+
+exit 0